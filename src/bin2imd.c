@@ -35,7 +35,7 @@
 #define MAX_FILENAME 260
 #define MAX_HEADER_LINE 256
 #define MAX_COMMENT_SIZE 65536
-#define MAX_FORMAT_LINE 256
+#define MAX_FORMAT_LINE 4096
 #define MAX_TRACK_DATA_BUFFER (LIBIMD_MAX_SECTORS_PER_TRACK * LIBIMD_MAX_SECTOR_SIZE)
 #define MAX_TRACKS 256 /* Define MAX_TRACKS */
 
@@ -204,9 +204,13 @@ int parse_format_option(Options* opts, SideFormat format_defs[], const char* con
     /* skip dash */
     if(*g_current_arg_ptr == '-')
         g_current_arg_ptr++;
-    while (name_len < 3 && *g_current_arg_ptr && isalpha((unsigned char)*g_current_arg_ptr)) {
+    while (name_len < 2 && *g_current_arg_ptr && isalpha((unsigned char)*g_current_arg_ptr)) {
         opt_name[name_len++] = (char)toupper((unsigned char)*g_current_arg_ptr++); /* FIX C4244: Cast int to char */
     }
+    /* Optional side digit (SS0, SM1, ...), or a third letter to reject below */
+    if (name_len == 2 && *g_current_arg_ptr && isalnum((unsigned char)*g_current_arg_ptr)) {
+        opt_name[name_len++] = (char)toupper((unsigned char)*g_current_arg_ptr++);
+    }
     if (name_len < 2) return 0; /* Not a valid option name */
 
     /* Check for side specifier (0 or 1) */
@@ -322,6 +326,8 @@ void print_usage(const char* prog_name) {
     fprintf(stderr, "  (Options in option-file override command line for specific tracks).\n");
     fprintf(stderr, "\nOption File (.B2I) Format:\n");
     fprintf(stderr, "  <track_num> [options...]\n");
+    fprintf(stderr, "  <first>-<last> [options...]  (range: options apply to each track's own side;\n");
+    fprintf(stderr, "                                 DM0=/DM1= etc. restrict the line to one side)\n");
     fprintf(stderr, "  Example: 0 DM=5 SS=512 SM=1,2,3\n");
     fprintf(stderr, "           40 DM=3 SS=1024 SM=0,1\n");
     fprintf(stderr, "  (Lines starting with ';' or blank are ignored).\n");
@@ -381,7 +387,7 @@ void parse_args(int argc, char* argv[], Options* opts) {
                 opts->fill_byte = (uint8_t)f;
                 opts->fill_specified = 1;
             }
-            else if (opt_char == 'C' && value) { /* Comment */
+            else if (opt_char == 'C' && value && arg[2] == '=') { /* Comment (-CM=/-CM0= are cylinder maps) */
                 if (*value == '@') {
                     opts->comment_file = value + 1;
                     opts->comment_text = NULL;
@@ -456,6 +462,22 @@ void validate_side_format(const SideFormat* side, int side_num, const Options* o
     g_current_context = NULL; /* Clear local context */
 }
 
+/* Returns a bitmask of the sides (bit 0/1) addressed by the options in a format line */
+/* Options without a side digit address both sides */
+int format_line_side_mask(const char* p) {
+    int mask = 0;
+    while (*p) {
+        while (*p && isspace((unsigned char)*p)) p++;
+        if (!*p) break;
+        if (*p == '-') p++;
+        while (*p && isalpha((unsigned char)*p)) p++;
+        if (*p == '0' || *p == '1') mask |= 1 << (*p - '0');
+        else mask |= 3;
+        while (*p && !isspace((unsigned char)*p)) p++;
+    }
+    return mask ? mask : 3;
+}
+
 /* Reads the format file and applies overrides */
 int read_format_file(Options* opts, SideFormat track_formats[][2], uint32_t max_cylinders) {
     FILE* ffmt = NULL;
@@ -491,6 +513,39 @@ int read_format_file(Options* opts, SideFormat track_formats[][2], uint32_t max_
         }
         track_num = (uint32_t)track_num_ul;
 
+        /* Track range "<first>-<last>": options apply to each track's own side */
+        if (*g_current_arg_ptr == '-' && isdigit((unsigned char)g_current_arg_ptr[1])) {
+            unsigned long last_track_ul;
+            g_current_arg_ptr++;
+            if (!parse_num_arg(&last_track_ul, 10, track_num_ul, max_track_num)) {
+                imd_report(IMD_REPORT_LEVEL_WARNING, "Format file line %d: Invalid track range", line_num);
+                continue;
+            }
+            char* options_start = g_current_arg_ptr;
+            int side_mask = format_line_side_mask(options_start);
+            for (uint32_t t = track_num; t <= (uint32_t)last_track_ul; ++t) {
+                uint32_t cyl = t / (opts->two_sides + 1);
+                uint8_t head = (uint8_t)(t % (opts->two_sides + 1)); /* Cast result */
+                SideFormat line_formats[2];
+                if (!(side_mask & (1 << head))) continue;
+
+                memcpy(line_formats, track_formats[cyl], sizeof(line_formats));
+                memcpy(&line_formats[head], &opts->defaults[head], sizeof(SideFormat));
+                g_current_arg_ptr = options_start;
+                while (skip_whitespace()) {
+                    char context[30];
+                    snprintf(context, sizeof(context), "Format File Line %d", line_num);
+                    if (!parse_format_option(opts, line_formats, context)) {
+                        if (t == track_num) imd_report(IMD_REPORT_LEVEL_WARNING, "Format file line %d: Invalid option near '%s'", line_num, g_current_arg_ptr);
+                        break; /* Stop parsing this line */
+                    }
+                }
+                memcpy(&track_formats[cyl][head], &line_formats[head], sizeof(SideFormat));
+                validate_side_format(&track_formats[cyl][head], head, opts);
+            }
+            continue;
+        }
+
         /* Initialize track format from defaults */
         uint32_t cyl = track_num / (opts->two_sides + 1);
         uint8_t head = (uint8_t)(track_num % (opts->two_sides + 1)); /* Cast result */
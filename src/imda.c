@@ -11,61 +11,1786 @@
  *
  */
 
+ /* Define _DEFAULT_SOURCE to enable POSIX features (dirent, pthreads) for corpus mode */
+#define _DEFAULT_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <errno.h>
 #include <ctype.h>
+#include <math.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+#include "libimd.h" /* Use our IMD library (includes defines) */
+#include "libimd_utils.h" /* For common utilities */
+
+ /* Define version strings - replace with actual build system values if available */
+#ifndef CMAKE_VERSION_STR
+#define CMAKE_VERSION_STR "0.1.0" /* Placeholder version */
+#endif
+#ifndef GIT_VERSION_STR
+#define GIT_VERSION_STR "dev" /* Placeholder git revision */
+#endif
+
+/* --- Constants --- */
+#define MAX_FILENAME 260
+/* MAX_HEADER_LINE is defined in libimd.h */
+
+/* Track capacity model constants */
+#define US_PER_MINUTE 60000000UL
+#define NUM_SECTOR_SIZE_CODES 7  /* 128 .. 8192 bytes */
+
+/* Corpus mode constants */
+#define MAX_CORPUS_JOBS 64
+#define DEFAULT_CORPUS_JOBS 4
+#define MAX_CORPUS_PATH 4096
+#define HISTOGRAM_BAR_WIDTH 40
+#define MAX_RECOMMENDATIONS 8
+
+/* Mixed-rate images: contiguous runs of tracks in one mode */
+#define MAX_DATA_ZONES 16
+
+/* Format fingerprint */
+#define MAX_FORMAT_SIGNATURES 16    /* Capacity of the corpus histogram, >= table size */
+#define FINGERPRINT_CPM_TRACKS 6    /* Tracks (after track 0) searched for a CP/M directory */
+#define FINGERPRINT_DETAIL 160
+#define SIG_ENC_ANY 0
+#define SIG_ENC_FM  1
+#define SIG_ENC_MFM 2
+
+/* Rotational latency simulation */
+#define SIM_CYLINDERS 4             /* Cylinders read per candidate layout */
+#define SIM_MAX_SECTORS 64          /* Exhaustive search limit (sectors per track) */
+#define SIM_TOP_RESULTS 5
+#define SIM_DEFAULT_RPM 300
+#define SIM_DEFAULT_HOST_US 1000
+#define SIM_DEFAULT_STEP_MS 6
+
+/* Content analysis cylinder map characters */
+#define CONTENT_MAP_DATA        '#'
+#define CONTENT_MAP_BLANK       '.'
+#define CONTENT_MAP_ERRORS      'e'
+#define CONTENT_MAP_UNAVAILABLE '-'
+#define CONTENT_MAP_MISSING     ' '
+
+/* bin2imd format plan: longest option string of one line (three 255-entry maps) */
+#define B2I_MAX_OPTIONS 4096
+#define B2I_MAX_CYLINDERS 255          /* Largest value bin2imd accepts for -N=<cyls> */
+
+/* Drive descriptor flags (conceptual, based on original IMDA.C - specific to this tool) */
+/* These represent potential output drive types */
+#define DRIVE_TYPE_D35_DD  0x00 /* 3.5" DD 80-track */
+#define DRIVE_TYPE_D35_HD  0x01 /* 3.5" HD 80-track */
+#define DRIVE_TYPE_D525_DD_40 0x02 /* 5.25" DD 40-track */
+#define DRIVE_TYPE_D525_DD_80 0x03 /* 5.25" DD 80-track (QD) */
+#define DRIVE_TYPE_D525_HD 0x04 /* 5.25" HD 80-track */
+#define DRIVE_TYPE_D8    0x05 /* 8"    SS/DS 77-track */
+#define DRIVE_TYPE_MASK  0x07
+
+/* Option flags (conceptual - specific to this tool) */
+#define OPTION_DSTEP 0x10 /* Double-stepping needed */
+#define OPTION_T32   0x20 /* Translate 300->250 kbps */
+#define OPTION_T23   0x40 /* Translate 250->300 kbps */
+
+/* Note flags (conceptual - specific to this tool) */
+#define NOTE_40TRACK   0x0100 /* Fits on 40 tracks */
+#define NOTE_77TRACK   0x0200 /* Likely 77 track drive (8") */
+#define NOTE_360RPM    0x0400 /* Fits on 360 RPM drive (relevant for 500kbps) */
+
+/*
+ * Recorded track layout per encoding (IBM 3740 FM / IBM System 34 MFM).
+ * Gap 3 uses the uPD765 read/write GPL values: the smallest gap that still
+ * leaves room for the write splice, i.e. the tightest layout a drive accepts.
+ */
+typedef struct {
+    const char* name;
+    uint8_t bits_per_byte;          /* Bit cells per data byte at the nominal data rate */
+    uint16_t track_preamble;        /* Gap 4a + sync + index AM + gap 1 */
+    uint16_t sector_overhead;       /* Sync + ID AM + ID + CRC + gap 2 + sync + data AM + data CRC */
+    uint8_t min_gap3[NUM_SECTOR_SIZE_CODES]; /* Per sector size code */
+} TrackLayout;
+
+static const TrackLayout TRACK_LAYOUT_FM = {
+    "FM", 16,
+    40 + 6 + 1 + 26,                /* 0xFF x40, 0x00 x6, FC, 0xFF x26 */
+    6 + 1 + 4 + 2 + 11 + 6 + 1 + 2,
+    { 7, 14, 27, 71, 200, 200, 200 }
+};
+
+static const TrackLayout TRACK_LAYOUT_MFM = {
+    "MFM", 8,
+    80 + 12 + 4 + 50,               /* 0x4E x80, 0x00 x12, C2 C2 C2 FC, 0x4E x50 */
+    12 + 4 + 4 + 2 + 22 + 12 + 4 + 2,
+    { 10, 14, 27, 53, 153, 200, 200 }
+};
+
+/* Spindle speed of each DRIVE_TYPE_* */
+static const uint16_t DRIVE_RPM[DRIVE_TYPE_MASK + 1] = {
+    300,    /* DRIVE_TYPE_D35_DD */
+    300,    /* DRIVE_TYPE_D35_HD */
+    300,    /* DRIVE_TYPE_D525_DD_40 */
+    300,    /* DRIVE_TYPE_D525_DD_80 */
+    360,    /* DRIVE_TYPE_D525_HD */
+    360,    /* DRIVE_TYPE_D8 */
+    300, 300
+};
+
+/* Low spindle speed of dual-speed drives, 0 if single-speed. A 5.25" HD drive drops
+ * to 300 RPM for double-density rates, e.g. writing a 300 kbps image with T300=250. */
+static const uint16_t DRIVE_LOW_RPM[DRIVE_TYPE_MASK + 1] = {
+    0,      /* DRIVE_TYPE_D35_DD */
+    0,      /* DRIVE_TYPE_D35_HD */
+    0,      /* DRIVE_TYPE_D525_DD_40 */
+    0,      /* DRIVE_TYPE_D525_DD_80 */
+    300,    /* DRIVE_TYPE_D525_HD */
+    0,      /* DRIVE_TYPE_D8 */
+    0, 0
+};
+
+/* The track needing the most time on the disk, as computed by the capacity model */
+typedef struct {
+    uint32_t bytes;                 /* Recorded bytes with minimum gaps */
+    uint32_t time_us;               /* At the image's own data rate */
+    uint32_t rate_kbps;
+    const TrackLayout* layout;
+    uint8_t cyl, head, num_sectors;
+    uint32_t sector_size;
+} TrackFit;
+
+/* Contiguous run of tracks (in file order) recorded in the same mode */
+typedef struct {
+    uint8_t mode;                   /* IMD mode of the first track */
+    uint8_t modes_used;             /* Same bits as ImageSummary; >1 bit only if MAX_DATA_ZONES overflowed */
+    uint8_t mixed;                  /* Other modes merged in after MAX_DATA_ZONES was reached */
+    uint8_t first_cyl, first_head;
+    uint8_t last_cyl, last_head;
+    uint32_t track_count;
+    TrackFit max_fit;
+} DataZone;
+
+/* Header-only analysis of one image */
+typedef struct {
+    uint8_t max_cyl;
+    uint8_t max_head;
+    uint8_t modes_used;             /* Bitmask: bit 0=500k, bit 1=300k, bit 2=250k */
+    uint32_t track_count;
+    TrackFit max_fit;
+    uint32_t size_code_tracks[NUM_SECTOR_SIZE_CODES]; /* Tracks per sector size code */
+    uint32_t sector_count_tracks[256];                /* Tracks per sectors-per-track value */
+    DataZone zones[MAX_DATA_ZONES];
+    int zone_count;
+} ImageSummary;
+
+/* Where a track record starts, recorded during the header pass */
+typedef struct {
+    long offset;                    /* File position of the track record */
+    uint8_t cyl, head, mode, num_sectors;
+    uint32_t sector_size;
+    uint8_t first_sector;           /* Lowest sector ID on the track */
+    uint8_t first_sector_slot;      /* Its position in the sector map (slots after the index) */
+} TrackIndexEntry;
+
+typedef struct {
+    TrackIndexEntry* entries;
+    size_t count;
+    size_t capacity;
+} TrackIndex;
+
+/* Loads tracks on demand for the signature probes, keeping the last one */
+typedef struct {
+    FILE* fimd;
+    const TrackIndex* index;
+    ImdTrackInfo track;
+    long loaded_offset;             /* Offset of the track in 'track', -1 if none */
+    uint32_t tracks_loaded;
+} FingerprintReader;
+
+/* One entry of the compiled signature table */
+typedef struct {
+    const char* name;               /* Short label (corpus histogram) */
+    const char* system;
+    uint8_t encoding;               /* SIG_ENC_* */
+    uint8_t num_sectors;            /* 0 = any */
+    uint16_t sector_size;           /* 0 = any */
+    int16_t first_sector;           /* Lowest sector ID, -1 = any */
+    uint8_t cylinders;              /* 0 = any */
+    int (*probe)(FingerprintReader* reader, char* detail, size_t detail_size); /* NULL = geometry only */
+} FormatSignature;
+
+/* Target drive and host timing for the latency simulation */
+typedef struct {
+    int num_sectors;
+    int heads;
+    uint32_t revolution_us;
+    uint32_t pitch_us;              /* Sectors are assumed evenly spread over the revolution */
+    uint32_t sector_us;             /* ID field through data CRC */
+    uint32_t host_us;               /* Host processing between sector reads */
+    uint32_t step_us;               /* Step plus settle to the next cylinder */
+    uint32_t head_switch_us;
+} SimParams;
+
+typedef struct {
+    int interleave;
+    int head_skew, cyl_skew;        /* Slots each logical track is rotated against the previous one */
+    uint64_t elapsed_us;
+} SimResult;
+
+/* Content statistics of one decoded track */
+typedef struct {
+    uint8_t num_sectors;
+    double uniform_ratio;           /* Uniform sectors / sectors with data */
+    double entropy;                 /* Shannon entropy of the data bytes, bits per byte */
+    double fill_share;              /* Bytes equal to 0xE5 or 0x00 / data bytes */
+    double unusable_share;          /* Unavailable or error sectors / all sectors */
+    char map_char;                  /* CONTENT_MAP_* classification */
+} TrackContent;
+
+/* Corpus mode: image paths to analyze */
+typedef struct {
+    char** paths;
+    size_t count;
+    size_t capacity;
+} PathList;
+
+/* Corpus mode: aggregate histograms (counts of images) */
+typedef struct {
+    uint32_t images;
+    uint32_t failed;
+    uint32_t rate[5];               /* 250k, 300k, 500k, mixed, none */
+    uint32_t cylinders[257];        /* Indexed by cylinder count */
+    uint32_t sides[2];              /* Single / double sided */
+    uint32_t sector_size[NUM_SECTOR_SIZE_CODES];
+    uint32_t sector_count[256];
+    uint32_t drive[DRIVE_TYPE_MASK + 2]; /* By DRIVE_TYPE_*, last = no single drive fits */
+    uint32_t classified;
+    uint32_t format[MAX_FORMAT_SIGNATURES + 1]; /* By FORMAT_SIGNATURES index, last = unidentified */
+} CorpusHistograms;
+
+/* Format-defining fields of one track, as bin2imd options describe them */
+typedef struct {
+    uint8_t cyl, head, mode;
+    uint8_t sector_size_code;
+    uint32_t sector_size;
+    uint8_t num_sectors;
+    uint8_t has_cmap, has_hmap;
+    uint8_t smap[LIBIMD_MAX_SECTORS_PER_TRACK];
+    uint8_t cmap[LIBIMD_MAX_SECTORS_PER_TRACK];
+    uint8_t hmap[LIBIMD_MAX_SECTORS_PER_TRACK];
+} TrackFormat;
+
+/* Consecutive cylinders on one side (or both) sharing the same deviation from the default */
+typedef struct {
+    int head;
+    int first_cyl, last_cyl;
+    int first_track;                /* bin2imd track number of the first track, for ordering */
+    int format_index;
+    int both_sides;                 /* 1 = merged with the identical run on side 1, -1 = absorbed */
+} B2iRun;
+
+/* One distinct track format and the number of tracks using it (default-format vote) */
+typedef struct {
+    int format_index;
+    size_t votes;
+} B2iFormatVote;
+
+/* --- Global State --- */
+int quiet_mode = 0;
+
+/* --- Helper Functions --- */
+
+/* removed local error_exit */
+
+/**
+ * @brief Returns the nominal data rate of an IMD mode in kbps.
+ */
+uint32_t mode_rate_kbps(uint8_t mode) {
+    switch (mode % 3) {
+    case 0:  return 500;
+    case 1:  return 300;
+    default: return 250;
+    }
+}
+
+/**
+ * @brief Returns the recorded layout (FM or MFM) of an IMD mode.
+ */
+const TrackLayout* mode_layout(uint8_t mode) {
+    return (mode > 2) ? &TRACK_LAYOUT_MFM : &TRACK_LAYOUT_FM;
+}
+
+/**
+ * @brief Returns the bytes a track occupies on the disk with minimum gaps.
+ */
+uint32_t track_required_bytes(const ImdTrackInfo* track) {
+    const TrackLayout* layout = mode_layout(track->mode);
+    uint8_t gap3 = layout->min_gap3[track->sector_size_code < NUM_SECTOR_SIZE_CODES ? track->sector_size_code : NUM_SECTOR_SIZE_CODES - 1];
+    return layout->track_preamble + (uint32_t)track->num_sectors * (layout->sector_overhead + track->sector_size + gap3);
+}
+
+/**
+ * @brief Converts recorded bytes to microseconds when written at rate_kbps.
+ */
+uint32_t bytes_to_us(uint32_t bytes, const TrackLayout* layout, uint32_t rate_kbps) {
+    return (uint32_t)(((uint64_t)bytes * layout->bits_per_byte * 1000u) / rate_kbps);
+}
+
+/**
+ * @brief Returns the duration of one revolution in microseconds.
+ */
+uint32_t revolution_us(uint32_t rpm) {
+    return (uint32_t)(US_PER_MINUTE / rpm);
+}
+
+/**
+ * @brief Returns the unformatted capacity of one revolution in bytes.
+ */
+uint32_t revolution_bytes(const TrackLayout* layout, uint32_t rate_kbps, uint32_t rpm) {
+    return (uint32_t)(((uint64_t)rate_kbps * 1000u * 60u) / ((uint64_t)layout->bits_per_byte * rpm));
+}
+
+/**
+ * @brief Returns the rate a track of rate_kbps is written at with the T300=250 / T250=300 options in flags.
+ */
+uint32_t translated_rate_kbps(uint32_t flags, uint32_t rate_kbps) {
+    if ((flags & OPTION_T32) && rate_kbps == 300) return 250;
+    if ((flags & OPTION_T23) && rate_kbps == 250) return 300;
+    return rate_kbps;
+}
+
+/* --- Track Header Analysis --- */
+
+/**
+ * @brief Keeps the track needing the most time on the disk in *fit.
+ */
+static void track_fit_update(TrackFit* fit, const ImdTrackInfo* track, uint32_t track_bytes, uint32_t track_us) {
+    if (track_us <= fit->time_us) return;
+    fit->bytes = track_bytes;
+    fit->time_us = track_us;
+    fit->rate_kbps = mode_rate_kbps(track->mode);
+    fit->layout = mode_layout(track->mode);
+    fit->cyl = track->cyl;
+    fit->head = track->head;
+    fit->num_sectors = track->num_sectors;
+    fit->sector_size = track->sector_size;
+}
+
+/**
+ * @brief Walks the track headers (no sector data) from the current file position and
+ *        accumulates geometry, data rates, the tightest track and format histograms.
+ *        If index is not NULL, the file position and format of every track are recorded in it.
+ * @return 0 on success, -1 on a track header read error (summary->track_count is the failing index).
+ */
+int analyze_track_headers(FILE* fimd, ImageSummary* summary, TrackIndex* index) {
+    ImdTrackInfo track_info;
+    memset(summary, 0, sizeof(*summary));
+
+    while (1) {
+        long track_pos = ftell(fimd);
+        /* Use imd_read_track_header to only read header info, not data */
+        int load_status = imd_read_track_header(fimd, &track_info);
+        if (load_status == 0) break; /* EOF */
+        if (load_status < 0) return -1;
+        summary->track_count++;
+
+        if (index) {
+            if (index->count == index->capacity) {
+                size_t new_capacity = index->capacity ? index->capacity * 2 : 160;
+                TrackIndexEntry* grown = (TrackIndexEntry*)realloc(index->entries, new_capacity * sizeof(TrackIndexEntry));
+                if (!grown) return -1;
+                index->entries = grown;
+                index->capacity = new_capacity;
+            }
+            TrackIndexEntry* entry = &index->entries[index->count++];
+            entry->offset = track_pos;
+            entry->cyl = track_info.cyl;
+            entry->head = track_info.head;
+            entry->mode = track_info.mode;
+            entry->num_sectors = track_info.num_sectors;
+            entry->sector_size = track_info.sector_size;
+            entry->first_sector = track_info.num_sectors ? 0xFF : 0;
+            entry->first_sector_slot = 0;
+            for (uint8_t i = 0; i < track_info.num_sectors; ++i) {
+                if (track_info.smap[i] < entry->first_sector) {
+                    entry->first_sector = track_info.smap[i];
+                    entry->first_sector_slot = i;
+                }
+            }
+        }
+
+        if (track_info.cyl > summary->max_cyl) summary->max_cyl = track_info.cyl;
+        if (track_info.head > summary->max_head) summary->max_head = track_info.head;
+
+        /* Track modes used */
+        uint8_t mode_bit = 0;
+        switch (track_info.mode % 3) { /* Logic relies on mode numbering pattern */
+        case 0: mode_bit = 1; break; /* 500 kbps */
+        case 1: mode_bit = 2; break; /* 300 kbps */
+        case 2: mode_bit = 4; break; /* 250 kbps */
+        }
+        summary->modes_used |= mode_bit;
+
+        /* Zones: a new one starts whenever the mode (rate or FM/MFM) changes */
+        DataZone* zone = summary->zone_count ? &summary->zones[summary->zone_count - 1] : NULL;
+        if (!zone || (zone->mode != track_info.mode && summary->zone_count < MAX_DATA_ZONES)) {
+            zone = &summary->zones[summary->zone_count++];
+            memset(zone, 0, sizeof(*zone));
+            zone->mode = track_info.mode;
+            zone->first_cyl = track_info.cyl;
+            zone->first_head = track_info.head;
+        }
+        if (zone->mode != track_info.mode) zone->mixed = 1;
+        zone->modes_used |= mode_bit;
+        zone->last_cyl = track_info.cyl;
+        zone->last_head = track_info.head;
+        zone->track_count++;
+
+        summary->sector_count_tracks[track_info.num_sectors]++;
+
+        /* Exact track size from the layout tables; keep the track needing the most time */
+        if (track_info.num_sectors > 0) {
+            uint32_t track_bytes = track_required_bytes(&track_info);
+            uint32_t rate = mode_rate_kbps(track_info.mode);
+            uint32_t track_us = bytes_to_us(track_bytes, mode_layout(track_info.mode), rate);
+
+            if (track_info.sector_size_code < NUM_SECTOR_SIZE_CODES) summary->size_code_tracks[track_info.sector_size_code]++;
+            track_fit_update(&summary->max_fit, &track_info, track_bytes, track_us);
+            track_fit_update(&zone->max_fit, &track_info, track_bytes, track_us);
+        }
+        /* No need to free track data as imd_read_track_header doesn't load it */
+    }
+    return 0;
+}
+
+/**
+ * @brief Returns the spindle speed the drive described by flags writes the track in fit at:
+ *        its normal speed, or the low speed of a dual-speed drive when the track only fits
+ *        there and is written at a double-density rate.
+ */
+uint32_t drive_rpm(uint32_t flags, const TrackFit* fit) {
+    uint32_t rpm = DRIVE_RPM[flags & DRIVE_TYPE_MASK];
+    uint32_t low_rpm = DRIVE_LOW_RPM[flags & DRIVE_TYPE_MASK];
+    uint32_t rate = translated_rate_kbps(flags, fit->rate_kbps);
+    if (low_rpm == 0 || rate > 300 || fit->bytes <= revolution_bytes(fit->layout, rate, rpm)) return rpm;
+    return low_rpm;
+}
+
+/**
+ * @brief Returns 1 if the tightest track fits one revolution of the drive described by flags.
+ */
+int drive_fits(uint32_t flags, const TrackFit* fit) {
+    uint32_t rate = translated_rate_kbps(flags, fit->rate_kbps);
+    if (fit->bytes == 0) return 1;
+    return fit->bytes <= revolution_bytes(fit->layout, rate, drive_rpm(flags, fit));
+}
+
+/**
+ * @brief Returns the spare bytes of one revolution for the track in fit on the drive described by flags.
+ */
+long drive_margin_bytes(uint32_t flags, const TrackFit* fit) {
+    uint32_t rpm = drive_rpm(flags, fit);
+    return (long)revolution_bytes(fit->layout, translated_rate_kbps(flags, fit->rate_kbps), rpm) - (long)fit->bytes;
+}
+
+/**
+ * @brief Lists the drive types / options able to recreate a single-rate image, most suitable first.
+ *        Drives whose revolution cannot hold the image's largest track are left out.
+ * @return Number of entries written to flags_out (at most MAX_RECOMMENDATIONS), or -1 if the
+ *         image does not use exactly one data rate.
+ */
+int recommend_drives(const ImageSummary* summary, uint32_t* flags_out) {
+    uint32_t drive_flags = 0;
+    int count = 0, kept = 0;
+    uint8_t max_cyl = summary->max_cyl;
+
+    if (summary->modes_used != 1 && summary->modes_used != 2 && summary->modes_used != 4) return -1;
+
+    /* Determine base options */
+    if (max_cyl < 40) drive_flags |= OPTION_DSTEP; /* Needs double step if less than 40 */
+    else if (max_cyl == 39) drive_flags |= NOTE_40TRACK; /* Specific note for exactly 40 tracks */
+
+    if (max_cyl == 76) drive_flags |= NOTE_77TRACK; /* Specific note for 77 tracks (8") */
+
+    switch (summary->modes_used) {
+    case 1: /* 500 kbps only */
+        if (summary->max_fit.time_us <= revolution_us(360)) { /* Largest track fits one 360 RPM revolution */
+            drive_flags |= NOTE_360RPM;
+        }
+        flags_out[count++] = DRIVE_TYPE_D35_HD | drive_flags;
+        flags_out[count++] = DRIVE_TYPE_D525_HD | drive_flags;
+        if (max_cyl <= 76) { /* Check if it fits 8" drive */
+            flags_out[count++] = DRIVE_TYPE_D8 | drive_flags;
+        }
+        break;
+
+    case 2: /* 300 kbps only */
+        /* 300kbps implies a 5.25" HD drive running at low speed (needs T32) OR a 3.5" drive */
+        flags_out[count++] = DRIVE_TYPE_D525_HD | OPTION_T32 | drive_flags;
+        flags_out[count++] = DRIVE_TYPE_D35_DD | drive_flags;
+        flags_out[count++] = DRIVE_TYPE_D35_HD | drive_flags;
+        /* Original IMDA also listed D525_DD_80 + T32, seems less common */
+        flags_out[count++] = DRIVE_TYPE_D525_DD_80 | OPTION_T32 | drive_flags;
+        /* Original IMDA also listed D525_DD_40 + T32, only if 40 tracks */
+        if (drive_flags & NOTE_40TRACK) {
+            flags_out[count++] = DRIVE_TYPE_D525_DD_40 | OPTION_T32 | drive_flags;
+        }
+        break;
+
+    case 4: /* 250 kbps only */
+        /* 250kbps implies standard DD drives (3.5" or 5.25") OR 5.25" HD needing T23 */
+        if (drive_flags & NOTE_40TRACK) { /* Only show 40 track drive if image fits */
+            flags_out[count++] = DRIVE_TYPE_D525_DD_40 | drive_flags;
+        }
+        flags_out[count++] = DRIVE_TYPE_D525_DD_80 | drive_flags;
+        flags_out[count++] = DRIVE_TYPE_D525_HD | OPTION_T23 | drive_flags;
+        flags_out[count++] = DRIVE_TYPE_D35_DD | drive_flags;
+        flags_out[count++] = DRIVE_TYPE_D35_HD | drive_flags;
+        break;
+    }
+
+    for (int i = 0; i < count; ++i) {
+        if (drive_fits(flags_out[i], &summary->max_fit)) flags_out[kept++] = flags_out[i];
+    }
+    return kept;
+}
+
+/**
+ * @brief Returns the short name of a DRIVE_TYPE_* value.
+ */
+const char* drive_type_name(uint32_t drive_type) {
+    switch (drive_type & DRIVE_TYPE_MASK) {
+    case DRIVE_TYPE_D35_DD:     return "3.5\" DD 80-track";
+    case DRIVE_TYPE_D35_HD:     return "3.5\" HD 80-track";
+    case DRIVE_TYPE_D525_DD_40: return "5.25\" DD 40-track";
+    case DRIVE_TYPE_D525_DD_80: return "5.25\" QD 80-track";
+    case DRIVE_TYPE_D525_HD:    return "5.25\" HD 80-track";
+    case DRIVE_TYPE_D8:         return "8\"    SS/DS 77-track";
+    default:                    return "Unknown Drive Type";
+    }
+}
+
+/* --- Mixed Recording Modes (per-zone recommendations) --- */
+
+/**
+ * @brief Builds the summary recommend_drives() needs for one zone. Geometry stays that of
+ *        the whole image, since every zone is written with the same drive.
+ */
+void zone_summary(const ImageSummary* summary, const DataZone* zone, ImageSummary* out) {
+    memset(out, 0, sizeof(*out));
+    out->max_cyl = summary->max_cyl;
+    out->max_head = summary->max_head;
+    out->modes_used = zone->modes_used;
+    out->track_count = zone->track_count;
+    out->max_fit = zone->max_fit;
+}
+
+/**
+ * @brief Finds the one drive type able to write every zone, combining the translation
+ *        options each zone needs on it. Among drives that fit, the one needing the fewest
+ *        translations wins, ties going to the earliest suggestion for the first zone.
+ * @param tightest If not NULL, receives the zone fit with the least spare room on that drive.
+ * @return 1 if a drive was found (flags in *flags_out), 0 otherwise.
+ */
+int best_single_drive(const ImageSummary* summary, uint32_t* flags_out, const TrackFit** tightest) {
+    uint32_t zone_recs[MAX_DATA_ZONES][MAX_RECOMMENDATIONS];
+    int zone_rec_count[MAX_DATA_ZONES];
+    ImageSummary sub;
+    int best_translations = 3, found = 0;
+
+    if (summary->zone_count == 0) return 0;
+    for (int z = 0; z < summary->zone_count; ++z) {
+        zone_summary(summary, &summary->zones[z], &sub);
+        zone_rec_count[z] = recommend_drives(&sub, zone_recs[z]);
+        if (zone_rec_count[z] <= 0) return 0;
+    }
+
+    for (int c = 0; c < zone_rec_count[0]; ++c) {
+        uint32_t drive = zone_recs[0][c] & DRIVE_TYPE_MASK;
+        uint32_t flags = 0;
+        const TrackFit* least = NULL;
+        long least_margin = 0;
+        int ok = 1;
+
+        for (int z = 0; z < summary->zone_count && ok; ++z) {
+            const TrackFit* fit = &summary->zones[z].max_fit;
+            ok = 0;
+            for (int i = 0; i < zone_rec_count[z]; ++i) {
+                if ((zone_recs[z][i] & DRIVE_TYPE_MASK) != drive || !drive_fits(zone_recs[z][i], fit)) continue;
+                flags |= zone_recs[z][i];
+                ok = 1;
+                break;
+            }
+        }
+        if (!ok) continue;
+
+        int translations = ((flags & OPTION_T32) != 0) + ((flags & OPTION_T23) != 0);
+        if (found && translations >= best_translations) continue;
+        for (int z = 0; z < summary->zone_count; ++z) {
+            long margin = drive_margin_bytes(flags, &summary->zones[z].max_fit);
+            if (!least || margin < least_margin) { least = &summary->zones[z].max_fit; least_margin = margin; }
+        }
+        *flags_out = flags;
+        if (tightest) *tightest = least;
+        best_translations = translations;
+        found = 1;
+    }
+    return found;
+}
+
+/* --- Format Fingerprint (--identify) --- */
+
+/**
+ * @brief Returns the index entry of a track, or NULL if the image does not contain it.
+ */
+const TrackIndexEntry* track_index_find(const TrackIndex* index, uint8_t cyl, uint8_t head) {
+    for (size_t i = 0; i < index->count; ++i) {
+        if (index->entries[i].cyl == cyl && index->entries[i].head == head) return &index->entries[i];
+    }
+    return NULL;
+}
+
+/**
+ * @brief Returns the data of one sector, loading its track through the index if needed.
+ *        The pointer stays valid until the next call. NULL if the sector has no data.
+ */
+const uint8_t* fingerprint_sector(FingerprintReader* reader, const TrackIndexEntry* entry, uint8_t sector_id) {
+    if (!entry) return NULL;
+    if (reader->loaded_offset != entry->offset) {
+        if (reader->loaded_offset >= 0) imd_free_track_data(&reader->track);
+        reader->loaded_offset = -1;
+        if (fseek(reader->fimd, entry->offset, SEEK_SET) != 0) return NULL;
+        if (imd_load_track(reader->fimd, &reader->track, LIBIMD_FILL_BYTE_DEFAULT) <= 0) {
+            imd_free_track_data(&reader->track);
+            return NULL;
+        }
+        reader->loaded_offset = entry->offset;
+        reader->tracks_loaded++;
+    }
+    for (uint8_t i = 0; i < reader->track.num_sectors; ++i) {
+        if (reader->track.smap[i] != sector_id) continue;
+        if (!IMD_SDR_HAS_DATA(reader->track.sflag[i])) return NULL;
+        return reader->track.data + (size_t)i * reader->track.sector_size;
+    }
+    return NULL;
+}
+
+static uint16_t read_le16(const uint8_t* p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+/* Copies up to n bytes of a name field, replacing unprintable bytes, stopping at 'end' */
+static void copy_label(char* out, const uint8_t* in, size_t n, uint8_t end) {
+    size_t i;
+    for (i = 0; i < n && in[i] != end; ++i) out[i] = (in[i] >= 0x20 && in[i] < 0x7F) ? (char)in[i] : '.';
+    while (i > 0 && out[i - 1] == ' ') i--;
+    out[i] = '\0';
+}
+
+static int is_power_of_two(uint32_t v) {
+    return v != 0 && (v & (v - 1)) == 0;
+}
+
+/* IBM PC: a DOS 2.0+ BIOS Parameter Block in the boot sector, or a DOS 1.x FAT media byte */
+static int probe_fat12(FingerprintReader* reader, char* detail, size_t detail_size) {
+    const TrackIndexEntry* boot = track_index_find(reader->index, 0, 0);
+    const uint8_t* s = boot ? fingerprint_sector(reader, boot, boot->first_sector) : NULL;
+    char oem[9];
+    uint8_t fill;
+
+    if (s && (s[0] == 0xEB || s[0] == 0xE9)) {
+        uint16_t bytes_per_sector = read_le16(s + 11);
+        uint16_t reserved = read_le16(s + 14);
+        if (bytes_per_sector >= 128 && bytes_per_sector <= 4096 && is_power_of_two(bytes_per_sector) &&
+            is_power_of_two(s[13]) && reserved >= 1 && (s[16] == 1 || s[16] == 2) &&
+            read_le16(s + 17) != 0 && s[21] >= 0xF0 && read_le16(s + 22) != 0) {
+            copy_label(oem, s + 3, 8, 0);
+            snprintf(detail, detail_size, "BPB: OEM '%s', %u sectors of %u bytes, %u/track, %u head(s), media 0x%02X",
+                oem, read_le16(s + 19), bytes_per_sector, read_le16(s + 24), read_le16(s + 26), s[21]);
+            return 1;
+        }
+    }
+
+    /* DOS 1.x: no BPB; the FAT in the second sector starts with the media byte and FF FF */
+    if (!boot || boot->sector_size != 512 || (boot->num_sectors != 8 && boot->num_sectors != 9)) return 0;
+    s = fingerprint_sector(reader, boot, (uint8_t)(boot->first_sector + 1));
+    if (s && s[0] >= 0xFC && s[1] == 0xFF && s[2] == 0xFF && !imd_is_uniform(s, 512, &fill)) {
+        snprintf(detail, detail_size, "no BPB (DOS 1.x), FAT media byte 0x%02X", s[0]);
+        return 1;
+    }
+    return 0;
+}
+
+/* Commodore 1581: header block (logical track 40 sector 0) holds 28 03 44 and the disk name */
+static int probe_cbm1581(FingerprintReader* reader, char* detail, size_t detail_size) {
+    char name[17];
+    for (uint8_t head = 0; head < 2; ++head) {
+        const TrackIndexEntry* entry = track_index_find(reader->index, 39, head);
+        const uint8_t* s = entry ? fingerprint_sector(reader, entry, 1) : NULL;
+        if (!s || s[0] != 0x28 || s[1] != 0x03 || s[2] != 0x44) continue;
+        copy_label(name, s + 4, 16, 0xA0);
+        snprintf(detail, detail_size, "header at Cyl 39 Head %u, disk name '%s'", head, name);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Returns the number of used CP/M directory entries in a sector, or 0 if any
+ * entry is not a plausible directory entry (or all are free).
+ */
+static int cpm_directory_entries(const uint8_t* s, uint32_t size) {
+    int used = 0;
+    for (uint32_t off = 0; off + 32 <= size; off += 32) {
+        const uint8_t* e = s + off;
+        if (e[0] == 0xE5) continue;                         /* Free entry */
+        if (e[0] == 0x21) continue;                         /* CP/M 3 date stamps */
+        if (e[0] > 0x20) return 0;                          /* User 0-15, 0x10-0x1F (P2DOS), 0x20 label */
+        if ((e[1] & 0x7F) == ' ') return 0;
+        for (int i = 1; i <= 11; ++i) {
+            uint8_t c = (uint8_t)(e[i] & 0x7F);             /* High bits are attributes */
+            if (c < 0x20 || c == 0x7F || c == '.' || c == '*' || c == '?') return 0;
+        }
+        if (e[0] != 0x20 && (e[12] > 31 || e[14] > 63 || e[15] > 0x80)) return 0;
+        used++;
+    }
+    return used;
+}
+
+/* CP/M: the first sector of one of the first data tracks is a directory */
+static int probe_cpm_directory(FingerprintReader* reader, char* detail, size_t detail_size) {
+    for (size_t i = 1; i < reader->index->count && i <= FINGERPRINT_CPM_TRACKS; ++i) {
+        const TrackIndexEntry* entry = &reader->index->entries[i];
+        const uint8_t* s = fingerprint_sector(reader, entry, entry->first_sector);
+        int used = s ? cpm_directory_entries(s, entry->sector_size) : 0;
+        if (used == 0) continue;
+        snprintf(detail, detail_size, "directory at Cyl %u Head %u (%u reserved track(s) before it), %d entr%s in its first sector",
+            entry->cyl, entry->head, (unsigned)i, used, used == 1 ? "y" : "ies");
+        return 1;
+    }
+    return 0;
+}
+
+/* Apple II DOS 3.3: the VTOC (track 17 sector 0) describes a 35 x 16 x 256 disk */
+static int probe_apple_dos33(FingerprintReader* reader, char* detail, size_t detail_size) {
+    const TrackIndexEntry* entry = track_index_find(reader->index, 17, 0);
+    const uint8_t* s = entry ? fingerprint_sector(reader, entry, 0) : NULL;
+    if (!s || s[0x01] >= 35 || s[0x02] >= 16 || s[0x27] != 122 ||
+        s[0x34] != 35 || s[0x35] != 16 || read_le16(s + 0x36) != 256) return 0;
+    snprintf(detail, detail_size, "VTOC at track 17: DOS release %u, volume %u, catalog at track %u sector %u",
+        s[0x03], s[0x06], s[0x01], s[0x02]);
+    return 1;
+}
+
+/*
+ * Signatures in the order they are tried; the first match wins. Geometry is
+ * compared against the first data track (Cyl 1 Head 0), sector content is read
+ * only by the probe of a signature whose geometry matched. Entries without a
+ * probe are reported as "geometry consistent with", never as identified.
+ */
+static const FormatSignature FORMAT_SIGNATURES[] = {
+    /* name                   system                                          enc          secs size first cyls probe */
+    { "IBM PC (FAT12)",       "IBM PC / MS-DOS FAT12",                        SIG_ENC_ANY,  0,    0,  -1,   0, probe_fat12 },
+    { "Commodore 1581",       "Commodore 1581 (CBM DOS 3.5\")",               SIG_ENC_MFM, 10,  512,   1,  80, probe_cbm1581 },
+    { "CP/M",                 "CP/M (directory found)",                       SIG_ENC_ANY,  0,    0,  -1,   0, probe_cpm_directory },
+    { "IBM 3740 8\" SSSD",    "IBM 3740 8\" single density (CP/M 8\" SSSD)",  SIG_ENC_FM,  26,  128,   1,  77, NULL },
+    { "IBM System 34 8\" DD", "IBM System 34 8\" double density",             SIG_ENC_MFM, 26,  256,   1,  77, NULL },
+    { "Apple II DOS 3.3",     "Apple II DOS 3.3 (VTOC found)",                SIG_ENC_ANY, 16,  256,   0,  35, probe_apple_dos33 },
+    { "Apple II 16-sector",   "Apple II style 16 x 256, sectors 0-15",        SIG_ENC_ANY, 16,  256,   0,  35, NULL },
+    { "North Star DD",        "North Star (hard-sectored) double density",    SIG_ENC_MFM, 10,  512,   0,  35, NULL },
+    { "10x256 FM hard-sect.", "North Star SD / Heath H-17 / TRS-80 Model I, 10 x 256 FM", SIG_ENC_FM, 10, 256, 0, 0, NULL },
+};
+#define NUM_FORMAT_SIGNATURES (sizeof(FORMAT_SIGNATURES) / sizeof(FORMAT_SIGNATURES[0]))
+
+/**
+ * @brief Tries the signature table against an indexed image, reading only the few
+ *        sectors a probe asks for, and stops at the first match.
+ * @return Index into FORMAT_SIGNATURES, or -1 if nothing matched.
+ */
+int classify_image(FILE* fimd, const TrackIndex* index, const ImageSummary* summary,
+    char* detail, size_t detail_size, uint32_t* tracks_loaded) {
+    FingerprintReader reader;
+    const TrackIndexEntry* ref;
+    int match = -1;
+
+    detail[0] = '\0';
+    if (tracks_loaded) *tracks_loaded = 0;
+    if (index->count == 0) return -1;
+    ref = track_index_find(index, 1, 0);
+    if (!ref) ref = &index->entries[0];
+
+    memset(&reader, 0, sizeof(reader));
+    reader.fimd = fimd;
+    reader.index = index;
+    reader.loaded_offset = -1;
+
+    for (size_t i = 0; i < NUM_FORMAT_SIGNATURES && match < 0; ++i) {
+        const FormatSignature* sig = &FORMAT_SIGNATURES[i];
+        if (sig->encoding == SIG_ENC_FM && ref->mode > 2) continue;
+        if (sig->encoding == SIG_ENC_MFM && ref->mode <= 2) continue;
+        if (sig->num_sectors && ref->num_sectors != sig->num_sectors) continue;
+        if (sig->sector_size && ref->sector_size != sig->sector_size) continue;
+        if (sig->first_sector >= 0 && ref->first_sector != sig->first_sector) continue;
+        if (sig->cylinders && summary->max_cyl + 1 != sig->cylinders) continue;
+        if (!sig->probe || sig->probe(&reader, detail, detail_size)) match = (int)i;
+    }
+
+    if (reader.loaded_offset >= 0) imd_free_track_data(&reader.track);
+    if (tracks_loaded) *tracks_loaded = reader.tracks_loaded;
+    return match;
+}
+
+void track_index_free(TrackIndex* index) {
+    free(index->entries);
+    memset(index, 0, sizeof(*index));
+}
+
+/* --- Corpus Mode --- */
+
+/**
+ * @brief Appends a copy of path to the list, growing it as needed. Returns 0 on success.
+ */
+int path_list_add(PathList* list, const char* path) {
+    if (list->count == list->capacity) {
+        size_t new_capacity = list->capacity ? list->capacity * 2 : 256;
+        char** grown = (char**)realloc(list->paths, new_capacity * sizeof(char*));
+        if (!grown) return -1;
+        list->paths = grown;
+        list->capacity = new_capacity;
+    }
+    size_t len = strlen(path);
+    list->paths[list->count] = (char*)malloc(len + 1);
+    if (!list->paths[list->count]) return -1;
+    memcpy(list->paths[list->count], path, len + 1);
+    list->count++;
+    return 0;
+}
+
+void path_list_free(PathList* list) {
+    for (size_t i = 0; i < list->count; ++i) free(list->paths[i]);
+    free(list->paths);
+    memset(list, 0, sizeof(*list));
+}
+
+/**
+ * @brief Returns 1 if name ends in ".imd" (any case).
+ */
+int has_imd_extension(const char* name) {
+    size_t len = strlen(name);
+    return len >= 4 && name[len - 4] == '.' &&
+        tolower((unsigned char)name[len - 3]) == 'i' &&
+        tolower((unsigned char)name[len - 2]) == 'm' &&
+        tolower((unsigned char)name[len - 1]) == 'd';
+}
+
+/**
+ * @brief Builds dir/name into path. Returns 0, or -1 (with a message) if it does not fit.
+ */
+int join_corpus_path(char* path, size_t path_size, const char* dir, const char* name) {
+#ifdef _WIN32
+    int len = snprintf(path, path_size, "%s\\%s", dir, name);
+#else
+    int len = snprintf(path, path_size, "%s/%s", dir, name);
+#endif
+    if (len < 0 || (size_t)len >= path_size) {
+        fprintf(stderr, "Error: Path too long below '%s': '%s'\n", dir, name);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Recursively adds every .imd file below dir to the list. Symbolic links to
+ *        directories are not followed, so a link loop cannot repeat images.
+ */
+int collect_directory(PathList* list, const char* dir) {
+    char path[MAX_CORPUS_PATH];
+#ifdef _WIN32
+    WIN32_FIND_DATAA find_data;
+    HANDLE find;
+    if (join_corpus_path(path, sizeof(path), dir, "*") != 0) return -1;
+    find = FindFirstFileA(path, &find_data);
+    if (find == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "Warning: Cannot read directory '%s'\n", dir);
+        return 0;
+    }
+    do {
+        if (strcmp(find_data.cFileName, ".") == 0 || strcmp(find_data.cFileName, "..") == 0) continue;
+        if (join_corpus_path(path, sizeof(path), dir, find_data.cFileName) != 0) { FindClose(find); return -1; }
+        if (find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            if (find_data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) continue; /* Junction or directory link */
+            if (collect_directory(list, path) != 0) { FindClose(find); return -1; }
+        }
+        else if (has_imd_extension(find_data.cFileName)) {
+            if (path_list_add(list, path) != 0) { FindClose(find); return -1; }
+        }
+    } while (FindNextFileA(find, &find_data));
+    FindClose(find);
+#else
+    DIR* d = opendir(dir);
+    struct dirent* entry;
+    struct stat st;
+    if (!d) {
+        fprintf(stderr, "Warning: Cannot read directory '%s': %s\n", dir, strerror(errno));
+        return 0;
+    }
+    while ((entry = readdir(d)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        if (join_corpus_path(path, sizeof(path), dir, entry->d_name) != 0) { closedir(d); return -1; }
+        if (lstat(path, &st) != 0) continue;
+        /* Linked images are taken; linked directories are skipped */
+        if (S_ISLNK(st.st_mode) && (stat(path, &st) != 0 || S_ISDIR(st.st_mode))) continue;
+        if (S_ISDIR(st.st_mode)) {
+            if (collect_directory(list, path) != 0) { closedir(d); return -1; }
+        }
+        else if (S_ISREG(st.st_mode) && has_imd_extension(entry->d_name)) {
+            if (path_list_add(list, path) != 0) { closedir(d); return -1; }
+        }
+    }
+    closedir(d);
+#endif
+    return 0;
+}
+
+/**
+ * @brief Adds the paths listed in a manifest (one per line; blank lines and '#' comments ignored).
+ */
+int collect_manifest(PathList* list, const char* manifest) {
+    char line[MAX_CORPUS_PATH];
+    FILE* f = fopen(manifest, "r");
+    if (!f) {
+        fprintf(stderr, "Error: Cannot open manifest '%s': %s\n", manifest, strerror(errno));
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        size_t len = strlen(line);
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) line[--len] = '\0';
+        if (len == 0 || line[0] == '#') continue;
+        if (path_list_add(list, line) != 0) { fclose(f); return -1; }
+    }
+    fclose(f);
+    return 0;
+}
+
+/**
+ * @brief Adds a corpus argument: "@file" is a manifest, a directory is searched recursively,
+ *        anything else is taken as an image path.
+ */
+int collect_corpus_arg(PathList* list, const char* arg) {
+    if (arg[0] == '@') return collect_manifest(list, arg + 1);
+#ifdef _WIN32
+    DWORD attrs = GetFileAttributesA(arg);
+    if (attrs != INVALID_FILE_ATTRIBUTES && (attrs & FILE_ATTRIBUTE_DIRECTORY)) return collect_directory(list, arg);
+#else
+    struct stat st;
+    if (stat(arg, &st) == 0 && S_ISDIR(st.st_mode)) return collect_directory(list, arg);
+#endif
+    return path_list_add(list, arg);
+}
+
+/**
+ * @brief Analyzes one image without printing anything. Returns 0 on success, -1 on error.
+ */
+int analyze_image_file(const char* path, ImageSummary* summary, int* format_id) {
+    char header_line[LIBIMD_MAX_HEADER_LINE];
+    char detail[FINGERPRINT_DETAIL];
+    TrackIndex index;
+    int status = -1;
+    FILE* fimd = fopen(path, "rb");
+    if (!fimd) return -1;
+    memset(&index, 0, sizeof(index));
+    if (imd_read_file_header(fimd, NULL, header_line, sizeof(header_line)) == 0 &&
+        imd_skip_comment_block(fimd) == 0) {
+        status = analyze_track_headers(fimd, summary, format_id ? &index : NULL);
+        if (status == 0 && format_id) *format_id = classify_image(fimd, &index, summary, detail, sizeof(detail), NULL);
+    }
+    track_index_free(&index);
+    fclose(fimd);
+    return status;
+}
+
+/**
+ * @brief Adds one analyzed image to a set of histograms.
+ */
+void corpus_add_image(CorpusHistograms* hist, const ImageSummary* summary, const int* format_id) {
+    uint32_t recommendations[MAX_RECOMMENDATIONS];
+    int best_size = 0;
+    int best_count = 0;
+    int n;
+
+    hist->images++;
+    if (format_id) {
+        hist->classified++;
+        hist->format[*format_id >= 0 ? *format_id : MAX_FORMAT_SIGNATURES]++;
+    }
+    switch (summary->modes_used) {
+    case 4:  hist->rate[0]++; break;
+    case 2:  hist->rate[1]++; break;
+    case 1:  hist->rate[2]++; break;
+    case 0:  hist->rate[4]++; break;
+    default: hist->rate[3]++; break;
+    }
+    if (summary->track_count == 0) return;
+
+    hist->cylinders[summary->max_cyl + 1]++;
+    hist->sides[summary->max_head > 0 ? 1 : 0]++;
+
+    /* Sector size and count: the image's most common track format */
+    for (int i = 1; i < NUM_SECTOR_SIZE_CODES; ++i) {
+        if (summary->size_code_tracks[i] > summary->size_code_tracks[best_size]) best_size = i;
+    }
+    for (int i = 1; i < 256; ++i) {
+        if (summary->sector_count_tracks[i] > summary->sector_count_tracks[best_count]) best_count = i;
+    }
+    hist->sector_size[best_size]++;
+    hist->sector_count[best_count]++;
+
+    /* Recommended drive: the first suggestion (only drives the tightest track fits are suggested) */
+    n = recommend_drives(summary, recommendations);
+    if ((n < 0 && best_single_drive(summary, &recommendations[0], NULL)) || n > 0) {
+        hist->drive[recommendations[0] & DRIVE_TYPE_MASK]++;
+        return;
+    }
+    hist->drive[DRIVE_TYPE_MASK + 1]++;
+}
+
+void corpus_merge(CorpusHistograms* dst, const CorpusHistograms* src) {
+    dst->images += src->images;
+    dst->failed += src->failed;
+    for (int i = 0; i < 5; ++i) dst->rate[i] += src->rate[i];
+    for (int i = 0; i < 257; ++i) dst->cylinders[i] += src->cylinders[i];
+    for (int i = 0; i < 2; ++i) dst->sides[i] += src->sides[i];
+    for (int i = 0; i < NUM_SECTOR_SIZE_CODES; ++i) dst->sector_size[i] += src->sector_size[i];
+    for (int i = 0; i < 256; ++i) dst->sector_count[i] += src->sector_count[i];
+    for (int i = 0; i < DRIVE_TYPE_MASK + 2; ++i) dst->drive[i] += src->drive[i];
+    dst->classified += src->classified;
+    for (int i = 0; i < MAX_FORMAT_SIGNATURES + 1; ++i) dst->format[i] += src->format[i];
+}
+
+/* Shared work counter for the corpus worker pool */
+static const PathList* g_corpus_paths;
+static size_t g_corpus_next;
+static int g_corpus_identify;       /* Set before the workers start */
+#ifdef _WIN32
+static CRITICAL_SECTION g_corpus_lock;
+#else
+static pthread_mutex_t g_corpus_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static int corpus_next_index(size_t* index) {
+    int have;
+#ifdef _WIN32
+    EnterCriticalSection(&g_corpus_lock);
+#else
+    pthread_mutex_lock(&g_corpus_lock);
+#endif
+    have = (g_corpus_next < g_corpus_paths->count);
+    if (have) *index = g_corpus_next++;
+#ifdef _WIN32
+    LeaveCriticalSection(&g_corpus_lock);
+#else
+    pthread_mutex_unlock(&g_corpus_lock);
+#endif
+    return have;
+}
+
+/* Each worker fills its own histograms; they are merged after the pool is joined. */
+#ifdef _WIN32
+static DWORD WINAPI corpus_worker(LPVOID arg)
+#else
+static void* corpus_worker(void* arg)
+#endif
+{
+    CorpusHistograms* hist = (CorpusHistograms*)arg;
+    ImageSummary summary;
+    size_t index;
+    int format_id;
+    while (corpus_next_index(&index)) {
+        int* format_out = g_corpus_identify ? &format_id : NULL;
+        if (analyze_image_file(g_corpus_paths->paths[index], &summary, format_out) == 0) corpus_add_image(hist, &summary, format_out);
+        else hist->failed++;
+    }
+#ifdef _WIN32
+    return 0;
+#else
+    return NULL;
+#endif
+}
+
+/**
+ * @brief Prints one histogram row with a proportional bar.
+ */
+void print_histogram_row(const char* label, uint32_t count, uint32_t total) {
+    int bar = total ? (int)(((uint64_t)count * HISTOGRAM_BAR_WIDTH + total / 2) / total) : 0;
+    printf("  %-22s %8u %6.1f%% ", label, count, total ? 100.0 * count / total : 0.0);
+    for (int i = 0; i < bar; ++i) putchar('#');
+    printf("\n");
+}
+
+void print_corpus_report(const CorpusHistograms* hist) {
+    static const char* const rate_labels[5] = { "250kbps", "300kbps", "500kbps", "Mixed", "None" };
+    char label[32];
+    size_t size_count = 0;
+    const uint32_t* sizes = imd_get_sector_size_lookup(&size_count);
+    uint32_t with_tracks = 0;
+
+    for (int i = 0; i < 2; ++i) with_tracks += hist->sides[i];
+
+    printf("\nCorpus Summary: %u image(s) analyzed, %u failed\n", hist->images, hist->failed);
+
+    printf("\nData Rate (images):\n");
+    for (int i = 0; i < 5; ++i) if (hist->rate[i]) print_histogram_row(rate_labels[i], hist->rate[i], hist->images);
+
+    printf("\nCylinders (images):\n");
+    for (int i = 1; i < 257; ++i) {
+        if (!hist->cylinders[i]) continue;
+        snprintf(label, sizeof(label), "%d", i);
+        print_histogram_row(label, hist->cylinders[i], with_tracks);
+    }
+
+    printf("\nSides (images):\n");
+    if (hist->sides[0]) print_histogram_row("1", hist->sides[0], with_tracks);
+    if (hist->sides[1]) print_histogram_row("2", hist->sides[1], with_tracks);
+
+    printf("\nSector Size (most common per image):\n");
+    for (int i = 0; i < NUM_SECTOR_SIZE_CODES; ++i) {
+        if (!hist->sector_size[i]) continue;
+        snprintf(label, sizeof(label), "%u", (sizes && (size_t)i < size_count) ? sizes[i] : (128u << i));
+        print_histogram_row(label, hist->sector_size[i], with_tracks);
+    }
+
+    printf("\nSectors per Track (most common per image):\n");
+    for (int i = 0; i < 256; ++i) {
+        if (!hist->sector_count[i]) continue;
+        snprintf(label, sizeof(label), "%d", i);
+        print_histogram_row(label, hist->sector_count[i], with_tracks);
+    }
+
+    printf("\nRecommended Drive (images):\n");
+    for (int i = 0; i <= DRIVE_TYPE_D8; ++i) {
+        if (hist->drive[i]) print_histogram_row(drive_type_name((uint32_t)i), hist->drive[i], with_tracks);
+    }
+    if (hist->drive[DRIVE_TYPE_MASK + 1]) print_histogram_row("(no single drive)", hist->drive[DRIVE_TYPE_MASK + 1], with_tracks);
+
+    if (hist->classified) {
+        printf("\nIdentified Format (images):\n");
+        for (size_t i = 0; i < NUM_FORMAT_SIGNATURES; ++i) {
+            if (hist->format[i] && FORMAT_SIGNATURES[i].probe) print_histogram_row(FORMAT_SIGNATURES[i].name, hist->format[i], hist->classified);
+        }
+        if (hist->format[MAX_FORMAT_SIGNATURES]) print_histogram_row("(unidentified)", hist->format[MAX_FORMAT_SIGNATURES], hist->classified);
+        for (size_t i = 0, heading = 0; i < NUM_FORMAT_SIGNATURES; ++i) {
+            if (!hist->format[i] || FORMAT_SIGNATURES[i].probe) continue;
+            if (!heading++) printf("\nGeometry Consistent With (images, sector content not checked):\n");
+            print_histogram_row(FORMAT_SIGNATURES[i].name, hist->format[i], hist->classified);
+        }
+    }
+}
+
+/**
+ * @brief Analyzes every image named by args on a pool of worker threads and prints histograms.
+ */
+int run_corpus(char** args, int arg_count, int jobs, int identify) {
+    PathList paths;
+    CorpusHistograms* per_worker = NULL;
+    CorpusHistograms total;
+    int started = 0;
+    int result = EXIT_FAILURE;
+#ifdef _WIN32
+    HANDLE threads[MAX_CORPUS_JOBS];
+#else
+    pthread_t threads[MAX_CORPUS_JOBS];
+#endif
+
+    memset(&paths, 0, sizeof(paths));
+    memset(&total, 0, sizeof(total));
+    for (int i = 0; i < arg_count; ++i) {
+        if (collect_corpus_arg(&paths, args[i]) != 0) goto cleanup;
+    }
+    if (!quiet_mode) printf("Corpus: %lu image(s), %d worker(s)\n", (unsigned long)paths.count, jobs);
+    if (paths.count == 0) { result = EXIT_SUCCESS; goto cleanup; }
+
+    per_worker = (CorpusHistograms*)calloc((size_t)jobs, sizeof(CorpusHistograms));
+    if (!per_worker) {
+        fprintf(stderr, "Error: Memory allocation failed for corpus histograms.\n");
+        goto cleanup;
+    }
+
+    g_corpus_paths = &paths;
+    g_corpus_next = 0;
+    g_corpus_identify = identify;
+#ifdef _WIN32
+    InitializeCriticalSection(&g_corpus_lock);
+#endif
+    for (started = 0; started < jobs; ++started) {
+#ifdef _WIN32
+        threads[started] = CreateThread(NULL, 0, corpus_worker, &per_worker[started], 0, NULL);
+        if (!threads[started]) break;
+#else
+        if (pthread_create(&threads[started], NULL, corpus_worker, &per_worker[started]) != 0) break;
+#endif
+    }
+    if (started == 0) corpus_worker(&per_worker[0]); /* No threads available: run inline */
+    for (int i = 0; i < started; ++i) {
+#ifdef _WIN32
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+#else
+        pthread_join(threads[i], NULL);
+#endif
+    }
+#ifdef _WIN32
+    DeleteCriticalSection(&g_corpus_lock);
+#endif
+
+    for (int i = 0; i < jobs; ++i) corpus_merge(&total, &per_worker[i]);
+    print_corpus_report(&total);
+    result = EXIT_SUCCESS;
+
+cleanup:
+    free(per_worker);
+    path_list_free(&paths);
+    return result;
+}
+
+/* --- Content Analysis (--content) --- */
+
+/**
+ * @brief Adds a buffer to a 256-bin byte histogram.
+ *        Four interleaved sub-histograms avoid the store-to-load stall of
+ *        incrementing the same counter for runs of equal bytes (fill patterns).
+ */
+void byte_histogram_add(uint32_t* hist, const uint8_t* data, size_t size) {
+    uint32_t bank[4][256];
+    size_t i = 0;
+    memset(bank, 0, sizeof(bank));
+    for (; i + 4 <= size; i += 4) {
+        bank[0][data[i]]++;
+        bank[1][data[i + 1]]++;
+        bank[2][data[i + 2]]++;
+        bank[3][data[i + 3]]++;
+    }
+    for (; i < size; ++i) bank[0][data[i]]++;
+    for (int b = 0; b < 256; ++b) hist[b] += bank[0][b] + bank[1][b] + bank[2][b] + bank[3][b];
+}
+
+/**
+ * @brief Returns the Shannon entropy (bits per byte) of a byte histogram.
+ */
+double byte_histogram_entropy(const uint32_t* hist, uint64_t total) {
+    double entropy = 0.0;
+    if (total == 0) return 0.0;
+    for (int b = 0; b < 256; ++b) {
+        if (hist[b] == 0) continue;
+        double p = (double)hist[b] / (double)total;
+        entropy -= p * log2(p);
+    }
+    return entropy;
+}
+
+/**
+ * @brief Decodes one loaded track and computes its content statistics.
+ */
+void analyze_track_content(const ImdTrackInfo* track, TrackContent* content) {
+    uint32_t hist[256];
+    uint64_t data_bytes = 0;
+    uint32_t data_sectors = 0, uniform = 0, uniform_fill = 0, unusable = 0;
 
-#include "libimd.h" /* Use our IMD library (includes defines) */
-#include "libimd_utils.h" /* For common utilities */
+    memset(hist, 0, sizeof(hist));
+    memset(content, 0, sizeof(*content));
+    for (uint8_t i = 0; i < track->num_sectors; ++i) {
+        uint8_t flag = track->sflag[i];
+        uint8_t fill;
+        if (!IMD_SDR_HAS_DATA(flag) || IMD_SDR_HAS_ERR(flag)) unusable++;
+        if (!IMD_SDR_HAS_DATA(flag)) continue;
 
- /* Define version strings - replace with actual build system values if available */
-#ifndef CMAKE_VERSION_STR
-#define CMAKE_VERSION_STR "0.1.0" /* Placeholder version */
-#endif
-#ifndef GIT_VERSION_STR
-#define GIT_VERSION_STR "dev" /* Placeholder git revision */
-#endif
+        const uint8_t* data = track->data + (size_t)i * track->sector_size;
+        data_sectors++;
+        if (imd_is_uniform(data, track->sector_size, &fill)) {
+            uniform++;
+            if (fill == LIBIMD_FILL_BYTE_DEFAULT || fill == 0x00) uniform_fill++;
+        }
+        byte_histogram_add(hist, data, track->sector_size);
+        data_bytes += track->sector_size;
+    }
 
-/* --- Constants --- */
-#define MAX_FILENAME 260
-/* MAX_HEADER_LINE is defined in libimd.h */
+    content->num_sectors = track->num_sectors;
+    content->uniform_ratio = data_sectors ? (double)uniform / data_sectors : 0.0;
+    content->entropy = byte_histogram_entropy(hist, data_bytes);
+    content->fill_share = data_bytes ? (double)(hist[LIBIMD_FILL_BYTE_DEFAULT] + hist[0x00]) / (double)data_bytes : 0.0;
+    content->unusable_share = track->num_sectors ? (double)unusable / track->num_sectors : 0.0;
 
-/* Analysis Constants (based on original IMDA.C - specific to this tool) */
-#define BYTES_PER_SEC_500K 62500 /* 500,000 / 8 */
-#define BYTES_PER_SEC_300K 37500 /* 300,000 / 8 */
-#define BYTES_PER_SEC_250K 31250 /* 250,000 / 8 */
-#define SECTOR_OVERHEAD_GUESS 85
-#define CYLINDER_OVERHEAD_GUESS 85
+    if (data_sectors == 0) content->map_char = CONTENT_MAP_UNAVAILABLE;
+    else if (uniform_fill == data_sectors && unusable == 0) content->map_char = CONTENT_MAP_BLANK;
+    else if (unusable > 0) content->map_char = CONTENT_MAP_ERRORS;
+    else content->map_char = CONTENT_MAP_DATA;
+}
 
-/* Drive descriptor flags (conceptual, based on original IMDA.C - specific to this tool) */
-/* These represent potential output drive types */
-#define DRIVE_TYPE_D35_DD  0x00 /* 3.5" DD 80-track */
-#define DRIVE_TYPE_D35_HD  0x01 /* 3.5" HD 80-track */
-#define DRIVE_TYPE_D525_DD_40 0x02 /* 5.25" DD 40-track */
-#define DRIVE_TYPE_D525_DD_80 0x03 /* 5.25" DD 80-track (QD) */
-#define DRIVE_TYPE_D525_HD 0x04 /* 5.25" HD 80-track */
-#define DRIVE_TYPE_D8    0x05 /* 8"    SS/DS 77-track */
-#define DRIVE_TYPE_MASK  0x07
+/**
+ * @brief Decodes every track from tracks_pos onward and prints per-track content
+ *        statistics followed by a cylinder map of blank tracks.
+ * @return 0 on success, -1 on a track read error.
+ */
+int analyze_content(FILE* fimd, long tracks_pos, const ImageSummary* summary) {
+    char map[2][257];
+    ImdTrackInfo track = { 0 };
+    TrackContent content;
+    uint32_t blank_tracks = 0, tracks = 0;
+    int ncyl = summary->max_cyl + 1;
+    int nheads = summary->max_head > 0 ? 2 : 1;
 
-/* Option flags (conceptual - specific to this tool) */
-#define OPTION_DSTEP 0x10 /* Double-stepping needed */
-#define OPTION_T32   0x20 /* Translate 300->250 kbps */
-#define OPTION_T23   0x40 /* Translate 250->300 kbps */
+    if (fseek(fimd, tracks_pos, SEEK_SET) != 0) return -1;
+    memset(map, CONTENT_MAP_MISSING, sizeof(map));
 
-/* Note flags (conceptual - specific to this tool) */
-#define NOTE_40TRACK   0x0100 /* Fits on 40 tracks */
-#define NOTE_77TRACK   0x0200 /* Likely 77 track drive (8") */
-#define NOTE_360RPM    0x0400 /* Fits on 360 RPM drive (relevant for 500kbps) */
+    printf("\nContent Analysis:\n");
+    printf("  Cyl Hd Secs Uniform Entropy  Fill%% Unavail/Err%%  Class\n");
+    for (;;) {
+        int status = imd_load_track(fimd, &track, LIBIMD_FILL_BYTE_DEFAULT);
+        if (status == 0) break;
+        if (status < 0) {
+            imd_free_track_data(&track);
+            fprintf(stderr, "Error decoding track data for track index %u.\n", tracks);
+            return -1;
+        }
+        analyze_track_content(&track, &content);
+        imd_free_track_data(&track);
+        tracks++;
 
-/* --- Global State --- */
-int quiet_mode = 0;
+        if (track.head < 2) map[track.head][track.cyl] = content.map_char;
+        if (content.map_char == CONTENT_MAP_BLANK) blank_tracks++;
 
-/* --- Helper Functions --- */
+        printf("  %3u %2u %4u %6.0f%% %7.2f %5.1f%% %12.1f%%  %s\n",
+            track.cyl, track.head, content.num_sectors, content.uniform_ratio * 100.0, content.entropy,
+            content.fill_share * 100.0, content.unusable_share * 100.0,
+            content.map_char == CONTENT_MAP_BLANK ? "blank" :
+            content.map_char == CONTENT_MAP_UNAVAILABLE ? "unavailable" :
+            content.map_char == CONTENT_MAP_ERRORS ? "errors" : "data");
+    }
 
-/* removed local error_exit */
+    printf("\nCylinder Map ('%c' data, '%c' blank/formatted-only, '%c' errors, '%c' unavailable):\n",
+        CONTENT_MAP_DATA, CONTENT_MAP_BLANK, CONTENT_MAP_ERRORS, CONTENT_MAP_UNAVAILABLE);
+    printf("          ");
+    for (int c = 0; c < ncyl; ++c) putchar(c % 10 == 0 ? (char)('0' + (c / 10) % 10) : ' ');
+    printf("\n          ");
+    for (int c = 0; c < ncyl; ++c) putchar((char)('0' + c % 10));
+    printf("\n");
+    for (int h = 0; h < nheads; ++h) {
+        map[h][ncyl] = '\0';
+        printf("  Head %d: %s\n", h, map[h]);
+    }
+    printf("  Blank tracks: %u of %u (need not be written to physical media)\n", blank_tracks, tracks);
+    return 0;
+}
+
+/* --- bin2imd Format Plan (--emit-b2i) --- */
+
+/**
+ * @brief Copies the format-defining fields of a track header.
+ */
+void track_format_from_header(const ImdTrackInfo* track, TrackFormat* format) {
+    memset(format, 0, sizeof(*format));
+    format->cyl = track->cyl;
+    format->head = track->head;
+    format->mode = track->mode;
+    format->sector_size_code = track->sector_size_code;
+    format->sector_size = track->sector_size;
+    format->num_sectors = track->num_sectors;
+    format->has_cmap = (track->hflag & IMD_HFLAG_CMAP_PRES) != 0;
+    format->has_hmap = (track->hflag & IMD_HFLAG_HMAP_PRES) != 0;
+    memcpy(format->smap, track->smap, track->num_sectors);
+    if (format->has_cmap) memcpy(format->cmap, track->cmap, track->num_sectors);
+    if (format->has_hmap) memcpy(format->hmap, track->hmap, track->num_sectors);
+}
+
+/**
+ * @brief Returns 1 if two tracks would be described by identical bin2imd options.
+ */
+int track_format_equal(const TrackFormat* a, const TrackFormat* b) {
+    return a->mode == b->mode && a->sector_size_code == b->sector_size_code &&
+        a->num_sectors == b->num_sectors && memcmp(a->smap, b->smap, a->num_sectors) == 0 &&
+        a->has_cmap == b->has_cmap && (!a->has_cmap || memcmp(a->cmap, b->cmap, a->num_sectors) == 0) &&
+        a->has_hmap == b->has_hmap && (!a->has_hmap || memcmp(a->hmap, b->hmap, a->num_sectors) == 0);
+}
+
+/**
+ * @brief Appends " NAME<side>=v1,v2,..." to out.
+ */
+void append_map_option(char* out, size_t out_size, const char* name, const char* side, const uint8_t* map, uint8_t count) {
+    size_t len = strlen(out);
+    len += (size_t)snprintf(out + len, len < out_size ? out_size - len : 0, " %s%s=", name, side);
+    for (uint8_t i = 0; i < count && len < out_size; ++i) {
+        len += (size_t)snprintf(out + len, out_size - len, "%s%u", i ? "," : "", map[i]);
+    }
+}
+
+/**
+ * @brief Builds the bin2imd options that turn the side default into this track's format.
+ *        bin2imd starts every listed track from the side default, so only differences are
+ *        written; a changed sector count also restates CM/HM so the maps stay the same length,
+ *        and a track without maps restates them when the default has them.
+ */
+void build_track_override(const TrackFormat* track, const TrackFormat* def, const char* side, char* out, size_t out_size) {
+    int count_changed = track->num_sectors != def->num_sectors;
+    size_t len;
+    out[0] = '\0';
+    if (track->mode != def->mode) {
+        len = strlen(out);
+        snprintf(out + len, out_size - len, " DM%s=%u", side, track->mode);
+    }
+    if (track->sector_size_code != def->sector_size_code) {
+        len = strlen(out);
+        snprintf(out + len, out_size - len, " SS%s=%u", side, (unsigned)track->sector_size);
+    }
+    if (count_changed || memcmp(track->smap, def->smap, track->num_sectors) != 0) {
+        append_map_option(out, out_size, "SM", side, track->smap, track->num_sectors);
+    }
+    if (track->has_cmap ? (count_changed || !def->has_cmap || memcmp(track->cmap, def->cmap, track->num_sectors) != 0)
+        : def->has_cmap) {
+        /* Without a map of its own the track's sectors carry its physical cylinder */
+        uint8_t cmap[LIBIMD_MAX_SECTORS_PER_TRACK];
+        if (!track->has_cmap) memset(cmap, track->cyl, sizeof(cmap));
+        append_map_option(out, out_size, "CM", side, track->has_cmap ? track->cmap : cmap, track->num_sectors);
+    }
+    if (track->has_hmap ? (count_changed || !def->has_hmap || memcmp(track->hmap, def->hmap, track->num_sectors) != 0)
+        : def->has_hmap) {
+        uint8_t hmap[LIBIMD_MAX_SECTORS_PER_TRACK];
+        if (!track->has_hmap) memset(hmap, track->head, sizeof(hmap));
+        append_map_option(out, out_size, "HM", side, track->has_hmap ? track->hmap : hmap, track->num_sectors);
+    }
+}
+
+static int compare_b2i_runs(const void* a, const void* b) {
+    const B2iRun* ra = (const B2iRun*)a;
+    const B2iRun* rb = (const B2iRun*)b;
+    if (ra->first_track != rb->first_track) return (ra->first_track < rb->first_track) ? -1 : 1;
+    return 0;
+}
+
+/**
+ * @brief Reads all track headers and writes a bin2imd option file that recreates the
+ *        image layout: defaults per side from the most common format, plus only the tracks
+ *        that deviate, with identical consecutive overrides collapsed into track ranges.
+ * @return 0 on success, -1 on error.
+ */
+int emit_b2i(FILE* fimd, const char* input_filename, FILE* out) {
+    TrackFormat* formats = NULL;
+    B2iRun* runs = NULL;
+    B2iFormatVote* distinct = NULL;          /* Distinct formats on one side and their track counts */
+    int* index_by_track = NULL;              /* [cyl * 2 + head] -> formats index, -1 if absent */
+    size_t count = 0, capacity = 0, run_count = 0;
+    TrackFormat defaults[2];
+    int have_default[2] = { 0, 0 };
+    int max_cyl = 0, sides = 1;
+    int result = -1;
+    ImdTrackInfo track_info;
+    char override_a[B2I_MAX_OPTIONS], override_b[B2I_MAX_OPTIONS];
+
+    /* Single header-only pass: remember each track's format */
+    for (;;) {
+        int status = imd_read_track_header(fimd, &track_info);
+        if (status == 0) break;
+        if (status < 0) {
+            fprintf(stderr, "Error reading track header for track index %lu.\n", (unsigned long)count);
+            goto cleanup;
+        }
+        if (track_info.head > 1) continue;
+        if (count == capacity) {
+            size_t new_capacity = capacity ? capacity * 2 : 160;
+            TrackFormat* grown = (TrackFormat*)realloc(formats, new_capacity * sizeof(TrackFormat));
+            if (!grown) { fprintf(stderr, "Error: Memory allocation failed for track formats.\n"); goto cleanup; }
+            formats = grown;
+            capacity = new_capacity;
+        }
+        track_format_from_header(&track_info, &formats[count++]);
+        if (track_info.cyl > max_cyl) max_cyl = track_info.cyl;
+        if (track_info.head > 0) sides = 2;
+    }
+    if (count == 0) {
+        fprintf(stderr, "Error: Image contains no tracks.\n");
+        goto cleanup;
+    }
+    if (max_cyl + 1 > B2I_MAX_CYLINDERS) {
+        fprintf(stderr, "Error: Image uses cylinder %d; bin2imd -N accepts at most %d cylinders (0-%d).\n",
+            max_cyl, B2I_MAX_CYLINDERS, B2I_MAX_CYLINDERS - 1);
+        goto cleanup;
+    }
+
+    index_by_track = (int*)malloc((size_t)(max_cyl + 1) * 2 * sizeof(int));
+    runs = (B2iRun*)malloc(count * sizeof(B2iRun));
+    distinct = (B2iFormatVote*)malloc(count * sizeof(B2iFormatVote));
+    if (!index_by_track || !runs || !distinct) { fprintf(stderr, "Error: Memory allocation failed for track formats.\n"); goto cleanup; }
+    for (int i = 0; i < (max_cyl + 1) * 2; ++i) index_by_track[i] = -1;
+    for (size_t i = 0; i < count; ++i) index_by_track[formats[i].cyl * 2 + formats[i].head] = (int)i;
+
+    /* Default per side: the most common format on that side, counted into a table of distinct formats */
+    for (int h = 0; h < sides; ++h) {
+        size_t distinct_count = 0, best = 0;
+        for (size_t i = 0; i < count; ++i) {
+            size_t d;
+            if (formats[i].head != h) continue;
+            for (d = 0; d < distinct_count && !track_format_equal(&formats[i], &formats[distinct[d].format_index]); ++d);
+            if (d == distinct_count) {
+                distinct[distinct_count].format_index = (int)i;
+                distinct[distinct_count++].votes = 0;
+            }
+            distinct[d].votes++;
+        }
+        for (size_t d = 1; d < distinct_count; ++d) {
+            if (distinct[d].votes > distinct[best].votes) best = d;
+        }
+        if (distinct_count > 0) { defaults[h] = formats[distinct[best].format_index]; have_default[h] = 1; }
+    }
+    if (sides == 2 && !have_default[0]) { defaults[0] = defaults[1]; have_default[0] = 1; }
+
+    /* Runs of consecutive cylinders on one side with the same override */
+    for (int h = 0; h < sides; ++h) {
+        for (int c = 0; c <= max_cyl; ) {
+            int idx = index_by_track[c * 2 + h];
+            if (idx < 0 || track_format_equal(&formats[idx], &defaults[h])) { c++; continue; }
+            build_track_override(&formats[idx], &defaults[h], "", override_a, sizeof(override_a));
+            int last = c;
+            while (last + 1 <= max_cyl) {
+                int next = index_by_track[(last + 1) * 2 + h];
+                if (next < 0) break;
+                build_track_override(&formats[next], &defaults[h], "", override_b, sizeof(override_b));
+                if (strcmp(override_a, override_b) != 0) break;
+                last++;
+            }
+            runs[run_count].head = h;
+            runs[run_count].first_cyl = c;
+            runs[run_count].last_cyl = last;
+            runs[run_count].format_index = idx;
+            runs[run_count].first_track = c * sides + h;
+            runs[run_count].both_sides = 0;
+            run_count++;
+            c = last + 1;
+        }
+    }
+
+    /* Merge side 0 and side 1 runs that cover the same cylinders with the same override */
+    if (sides == 2) {
+        for (size_t i = 0; i < run_count; ++i) {
+            if (runs[i].head != 0 || runs[i].both_sides < 0) continue;
+            build_track_override(&formats[runs[i].format_index], &defaults[0], "", override_a, sizeof(override_a));
+            for (size_t j = 0; j < run_count; ++j) {
+                if (runs[j].head != 1 || runs[j].both_sides < 0 ||
+                    runs[j].first_cyl != runs[i].first_cyl || runs[j].last_cyl != runs[i].last_cyl) continue;
+                build_track_override(&formats[runs[j].format_index], &defaults[1], "", override_b, sizeof(override_b));
+                if (strcmp(override_a, override_b) == 0) {
+                    runs[i].both_sides = 1;
+                    runs[j].both_sides = -1; /* Absorbed */
+                }
+                break;
+            }
+        }
+    }
+    qsort(runs, run_count, sizeof(B2iRun), compare_b2i_runs);
+
+    /* --- Write the option file --- */
+    fprintf(out, "; bin2imd format plan for '%s'\n", imd_get_basename(input_filename));
+    fprintf(out, "; Generated by imda %s [%s] --emit-b2i\n", CMAKE_VERSION_STR, GIT_VERSION_STR);
+    fprintf(out, "; Use with:\n;   bin2imd <image.bin> <image.imd> <this.b2i> -N=%d -%d", max_cyl + 1, sides);
+    for (int h = 0; h < sides; ++h) {
+        char side[2] = { (char)('0' + h), '\0' };
+        TrackFormat none;
+        memset(&none, 0, sizeof(none));
+        none.mode = 0xFF;                   /* Force every field out */
+        none.sector_size_code = 0xFF;
+        none.num_sectors = 0;
+        build_track_override(&defaults[h], &none, side, override_a, sizeof(override_a));
+        /* Command-line format options take a leading '-' */
+        for (char* p = override_a; *p; ++p) {
+            if (*p == ' ') fputs(" -", out);
+            else fputc(*p, out);
+        }
+    }
+    fprintf(out, "\n");
+    for (int c = 0; c <= max_cyl; ++c) {
+        for (int h = 0; h < sides; ++h) {
+            if (index_by_track[c * 2 + h] < 0) fprintf(out, "; Note: Cyl %d Head %d is absent from the image (bin2imd will write it)\n", c, h);
+        }
+    }
+
+    for (size_t i = 0; i < run_count; ++i) {
+        const B2iRun* run = &runs[i];
+        const TrackFormat* format = &formats[run->format_index];
+        char side[2] = { (char)('0' + run->head), '\0' };
+        int first, last;
+        if (run->both_sides < 0) continue;
+
+        if (run->both_sides || sides == 1) {
+            first = run->first_cyl * sides;
+            last = run->last_cyl * sides + sides - 1;
+            build_track_override(format, &defaults[run->head], "", override_a, sizeof(override_a));
+        }
+        else {
+            first = run->first_cyl * sides + run->head;
+            last = run->last_cyl * sides + run->head;
+            build_track_override(format, &defaults[run->head], side, override_a, sizeof(override_a));
+        }
+        if (first == last) fprintf(out, "%d%s\n", first, override_a);
+        else fprintf(out, "%d-%d%s\n", first, last, override_a);
+    }
+    result = 0;
+
+cleanup:
+    free(distinct);
+    free(runs);
+    free(index_by_track);
+    free(formats);
+    return result;
+}
+
+/* --- Rotational Latency Simulation (--simulate) --- */
+
+/**
+ * @brief Places logical sectors 0..n-1 on physical slots with an N:1 interleave,
+ *        moving to the next free slot on a collision.
+ */
+void interleave_slots(int num_sectors, int interleave, uint8_t* slot_of_logical) {
+    uint8_t used[LIBIMD_MAX_SECTORS_PER_TRACK];
+    int pos = 0;
+    memset(used, 0, sizeof(used));
+    for (int k = 0; k < num_sectors; ++k) {
+        while (used[pos]) pos = (pos + 1) % num_sectors;
+        slot_of_logical[k] = (uint8_t)pos;
+        used[pos] = 1;
+        pos = (pos + interleave) % num_sectors;
+    }
+}
+
+/**
+ * @brief Simulates reading SIM_CYLINDERS cylinders sector by sector in logical order.
+ *        Each logical track is rotated against the previous one by head_skew slots after a
+ *        head switch or cyl_skew slots after a step. Returns the elapsed time in microseconds.
+ */
+uint64_t simulate_sequential_read(const SimParams* sim, int interleave, int head_skew, int cyl_skew) {
+    uint8_t slot_of_logical[LIBIMD_MAX_SECTORS_PER_TRACK];
+    uint64_t now = 0;
+    int rotation = 0;                       /* Slot of the first logical sector of the current track */
+
+    interleave_slots(sim->num_sectors, interleave, slot_of_logical);
+    for (int c = 0; c < SIM_CYLINDERS; ++c) {
+        for (int h = 0; h < sim->heads; ++h) {
+            if (c > 0 || h > 0) {
+                if (h > 0) { rotation += head_skew; now += sim->head_switch_us; }
+                else { rotation += cyl_skew; now += sim->step_us; }
+                rotation %= sim->num_sectors;
+            }
+            for (int k = 0; k < sim->num_sectors; ++k) {
+                /* Wait for the sector's ID field to reach the head, read it, then let the host process it */
+                uint64_t start = ((slot_of_logical[k] + rotation) % sim->num_sectors) * (uint64_t)sim->pitch_us;
+                uint64_t angle = now % sim->revolution_us;
+                now += (start >= angle) ? start - angle : sim->revolution_us - angle + start;
+                now += sim->sector_us + sim->host_us;
+            }
+        }
+    }
+    return now;
+}
+
+/* Slot of the first logical sector of a track relative to the index, from its sector map */
+static int track_first_slot(const TrackIndex* index, uint8_t cyl, uint8_t head) {
+    const TrackIndexEntry* entry = track_index_find(index, cyl, head);
+    return entry ? entry->first_sector_slot : -1;
+}
+
+/**
+ * @brief Simulates sequential reads of the image's format on the target drive for every
+ *        interleave and skew candidate and prints the fastest layouts with the imdu settings.
+ * @return 0 on success, -1 if the image format cannot be simulated.
+ */
+int simulate_latency(FILE* fimd, const TrackIndex* index, const ImageSummary* summary, const char* input_filename,
+    uint32_t rpm, uint32_t host_us, uint32_t step_us) {
+    const TrackIndexEntry* ref = track_index_find(index, 1, 0);
+    const TrackLayout* layout;
+    ImdTrackInfo ref_track;
+    SimParams sim;
+    SimResult best[SIM_TOP_RESULTS];
+    SimResult best_unskewed = { 1, 0, 0, UINT64_MAX };
+    int best_count = 0;
+    int as_read_il = 1, as_read_head_skew = 0, as_read_cyl_skew = 0;
+
+    if (!ref && index->count > 0) ref = &index->entries[0];
+    if (!ref || ref->num_sectors < 1 || ref->num_sectors > SIM_MAX_SECTORS) {
+        fprintf(stderr, "Error: Cannot simulate: no suitable track (1-%d sectors) found.\n", SIM_MAX_SECTORS);
+        return -1;
+    }
+    layout = mode_layout(ref->mode);
+
+    memset(&sim, 0, sizeof(sim));
+    sim.num_sectors = ref->num_sectors;
+    sim.heads = summary->max_head > 0 ? 2 : 1;
+    sim.revolution_us = revolution_us(rpm);
+    sim.pitch_us = sim.revolution_us / sim.num_sectors;
+    sim.sector_us = bytes_to_us(layout->sector_overhead + ref->sector_size, layout, mode_rate_kbps(ref->mode));
+    sim.host_us = host_us;
+    sim.step_us = step_us;
+    sim.head_switch_us = 0;             /* Head select is electronic */
+
+    /* The layout the image was read with */
+    if (fseek(fimd, ref->offset, SEEK_SET) == 0 && imd_read_track_header(fimd, &ref_track) > 0) {
+        as_read_il = imd_calculate_best_interleave(&ref_track);
+        if (as_read_il < 1 || as_read_il >= sim.num_sectors) as_read_il = 1;
+    }
+    {
+        int s10 = track_first_slot(index, 1, 0), s11 = track_first_slot(index, 1, 1), s20 = track_first_slot(index, 2, 0);
+        int prev = (sim.heads == 2) ? s11 : s10;
+        if (sim.heads == 2 && s10 >= 0 && s11 >= 0) as_read_head_skew = (s11 - s10 + sim.num_sectors) % sim.num_sectors;
+        if (prev >= 0 && s20 >= 0) as_read_cyl_skew = (s20 - prev + sim.num_sectors) % sim.num_sectors;
+    }
+    uint64_t as_read_us = simulate_sequential_read(&sim, as_read_il, as_read_head_skew, as_read_cyl_skew);
+
+    /* Exhaustive search, keeping the fastest few (ties: smaller interleave, then smaller skews) */
+    for (int il = 1; il < (sim.num_sectors > 1 ? sim.num_sectors : 2); ++il) {
+        for (int hs = 0; hs < (sim.heads == 2 ? sim.num_sectors : 1); ++hs) {
+            for (int cs = 0; cs < sim.num_sectors; ++cs) {
+                SimResult r = { il, hs, cs, simulate_sequential_read(&sim, il, hs, cs) };
+                int pos = best_count;
+                if (hs == 0 && cs == 0 && r.elapsed_us < best_unskewed.elapsed_us) best_unskewed = r;
+                while (pos > 0 && r.elapsed_us < best[pos - 1].elapsed_us) pos--;
+                if (pos >= SIM_TOP_RESULTS) continue;
+                if (best_count < SIM_TOP_RESULTS) best_count++;
+                memmove(&best[pos + 1], &best[pos], (size_t)(best_count - 1 - pos) * sizeof(SimResult));
+                best[pos] = r;
+            }
+        }
+    }
+
+    printf("\nRotational Latency Simulation (sequential read of %d cylinder(s)):\n", SIM_CYLINDERS);
+    printf("  Track Format : %d x %u %s at %u kbps, %d head(s)\n", sim.num_sectors, (unsigned)ref->sector_size,
+        layout->name, mode_rate_kbps(ref->mode), sim.heads);
+    printf("  Drive        : %u RPM (revolution %u us, sector pitch %u us, sector read %u us)\n",
+        rpm, sim.revolution_us, sim.pitch_us, sim.sector_us);
+    printf("  Host         : %u us per sector, step %u us\n", sim.host_us, sim.step_us);
+    printf("  As Read      : interleave %d:1, head skew %d, cylinder skew %d -> %.1f ms per cylinder\n",
+        as_read_il, as_read_head_skew, as_read_cyl_skew, as_read_us / 1000.0 / SIM_CYLINDERS);
+
+    printf("\n  Interleave  Head Skew  Cyl Skew  ms/Cylinder  vs As Read\n");
+    for (int i = 0; i < best_count; ++i) {
+        printf("  %8d:1 %10d %9d %12.1f %10.2fx\n", best[i].interleave,
+            best[i].head_skew, best[i].cyl_skew, best[i].elapsed_us / 1000.0 / SIM_CYLINDERS,
+            best[i].elapsed_us ? (double)as_read_us / (double)best[i].elapsed_us : 0.0);
+    }
+
+    printf("\n  Recommended  : interleave %d:1, head skew %d, cylinder skew %d\n",
+        best[0].interleave, best[0].head_skew, best[0].cyl_skew);
+    if (best[0].head_skew || best[0].cyl_skew) {
+        /* imdu -IL lays out every track the same way from the index: no skew */
+        printf("  imdu         : imdu %s <output.imd> -IL=%d   (%.1f ms per cylinder without skew)\n",
+            imd_get_basename(input_filename), best_unskewed.interleave, best_unskewed.elapsed_us / 1000.0 / SIM_CYLINDERS);
+        printf("                 imdu has no skew option; the skew applies when the target disk is formatted.\n");
+    }
+    else {
+        printf("  imdu         : imdu %s <output.imd> -IL=%d\n", imd_get_basename(input_filename), best[0].interleave);
+    }
+    return 0;
+}
 
 /**
  * @brief Prints usage information.
@@ -77,27 +1802,38 @@ void print_usage(const char* prog_name) {
     fprintf(stderr, "Copyright (C) 2025 - Howard M. Harte - https://github.com/hharte/imd-utils\n\n");
     fprintf(stderr, "The original MS-DOS version is available from http://dunfield.classiccmp.org/img/\n\n");
 
-    fprintf(stderr, "Usage: %s <image.imd> [-Q]\n\n", base_prog_name);
+    fprintf(stderr, "Usage: %s <image.imd> [-Q] [--content] [--identify] [--simulate ...]\n", base_prog_name);
+    fprintf(stderr, "       %s <image.imd> --emit-b2i > <plan.b2i>\n", base_prog_name);
+    fprintf(stderr, "       %s --corpus <dir|@manifest|image.imd> ... [--jobs N] [--identify] [-Q]\n\n", base_prog_name);
     fprintf(stderr, "Analyzes an IMD file and recommends drive types/options for recreation.\n\n");
     fprintf(stderr, "Options:\n");
-    fprintf(stderr, "  -Q      : Quiet mode (suppress summary and comment display).\n");
-    fprintf(stderr, "  --help  : Display this help message and exit.\n");
+    fprintf(stderr, "  -Q       : Quiet mode (suppress summary and comment display).\n");
+    fprintf(stderr, "  --content: Also decode sector data: per-track uniform-sector ratio, entropy,\n");
+    fprintf(stderr, "             fill-byte (0xE5/0x00) and unavailable/error share, and a cylinder\n");
+    fprintf(stderr, "             map flagging blank (formatted-only) tracks.\n");
+    fprintf(stderr, "  --identify: Identify the system/filesystem (FAT12 BPB, CP/M directory,\n");
+    fprintf(stderr, "             Commodore 1581, Apple DOS 3.3 VTOC) from a few sectors; other\n");
+    fprintf(stderr, "             Apple/North Star/Heath/8\" layouts are reported as matching geometry\n");
+    fprintf(stderr, "             only. With --corpus, adds a histogram of identified formats.\n");
+    fprintf(stderr, "  --simulate: Simulate sequential reads on the target machine for every interleave\n");
+    fprintf(stderr, "             and head/cylinder skew and print the fastest layouts and imdu -IL\n");
+    fprintf(stderr, "             setting. Target: --rpm N (default %d), --host-us N per-sector host\n", SIM_DEFAULT_RPM);
+    fprintf(stderr, "             processing (default %d), --step-ms N step+settle (default %d).\n", SIM_DEFAULT_HOST_US, SIM_DEFAULT_STEP_MS);
+    fprintf(stderr, "  --emit-b2i: Write a bin2imd option file (.B2I) to stdout that recreates this\n");
+    fprintf(stderr, "             image's layout: per-side defaults from the most common format plus\n");
+    fprintf(stderr, "             overrides for deviating tracks, collapsed into track ranges.\n");
+    fprintf(stderr, "  --corpus : Analyze many images (directories are searched recursively for\n");
+    fprintf(stderr, "             *.imd, @file lists one path per line) and print histograms of\n");
+    fprintf(stderr, "             data rate, cylinders, sides, sector size/count and recommended drive.\n");
+    fprintf(stderr, "  --jobs N : Corpus worker threads (1-%d, default %d).\n", MAX_CORPUS_JOBS, DEFAULT_CORPUS_JOBS);
+    fprintf(stderr, "  --help   : Display this help message and exit.\n");
 }
 
 /**
  * @brief Prints drive recommendation based on flags.
  */
-void print_drive_recommendation(uint32_t flags, uint8_t* notes_printed, int* note_idx) {
-    printf("\n");
-    switch (flags & DRIVE_TYPE_MASK) {
-    case DRIVE_TYPE_D35_DD:     printf(" 3.5\" DD 80-track"); break;
-    case DRIVE_TYPE_D35_HD:     printf(" 3.5\" HD 80-track"); break;
-    case DRIVE_TYPE_D525_DD_40: printf(" 5.25\" DD 40-track"); break;
-    case DRIVE_TYPE_D525_DD_80: printf(" 5.25\" QD 80-track"); break;
-    case DRIVE_TYPE_D525_HD:    printf(" 5.25\" HD 80-track"); break;
-    case DRIVE_TYPE_D8:         printf(" 8\"    SS/DS 77-track"); break;
-    default:                    printf(" Unknown Drive Type"); break;
-    }
+void print_drive_recommendation(uint32_t flags, const TrackFit* fit, uint8_t* notes_printed, int* note_idx) {
+    printf("\n %s", drive_type_name(flags));
 
     /* Print associated notes */
     if (flags & (NOTE_40TRACK | NOTE_77TRACK | NOTE_360RPM)) {
@@ -128,6 +1864,57 @@ void print_drive_recommendation(uint32_t flags, uint8_t* notes_printed, int* not
     if (flags & OPTION_T23) { printf("%sT250=300", first_opt ? "" : ", "); first_opt = 0; }
     if (first_opt) { printf("(none)"); }
     printf("\n");
+
+    /* Print the capacity margin of the largest track on this drive */
+    if (fit->bytes > 0) {
+        uint32_t rpm = drive_rpm(flags, fit);
+        uint32_t rate = translated_rate_kbps(flags, fit->rate_kbps);
+        uint32_t capacity = revolution_bytes(fit->layout, rate, rpm);
+        long margin_bytes = (long)capacity - (long)fit->bytes;
+        long margin_us = (long)revolution_us(rpm) - (long)bytes_to_us(fit->bytes, fit->layout, rate);
+        printf("   Track Fit  : %u of %u bytes at %u kbps / %u RPM%s, ", fit->bytes, capacity, rate, rpm,
+            rpm != DRIVE_RPM[flags & DRIVE_TYPE_MASK] ? " (low speed)" : "");
+        if (margin_bytes >= 0) printf("margin %ld bytes (%ld us)\n", margin_bytes, margin_us);
+        else printf("OVERFLOW by %ld bytes (%ld us) - will not fit\n", -margin_bytes, -margin_us);
+    }
+}
+
+/**
+ * @brief Prints the zones of an image mixing data rates or FM/MFM, the drive choices for each zone and
+ *        the best single drive able to write all of them.
+ */
+void print_zone_recommendations(const ImageSummary* summary, uint8_t* notes_printed, int* note_idx) {
+    uint32_t recommendations[MAX_RECOMMENDATIONS];
+    ImageSummary sub;
+    uint32_t best_flags = 0;
+    const TrackFit* tightest = NULL;
+
+    printf("\nRecording Mode Zones:\n");
+    for (int z = 0; z < summary->zone_count; ++z) {
+        const DataZone* zone = &summary->zones[z];
+        printf("  Zone %d: Cyl %2u Head %u - Cyl %2u Head %u  %4u track(s)  %u kbps %s%s\n", z + 1,
+            zone->first_cyl, zone->first_head, zone->last_cyl, zone->last_head, zone->track_count,
+            mode_rate_kbps(zone->mode), mode_layout(zone->mode)->name,
+            zone->mixed ? " (and others: zone limit reached)" : "");
+    }
+
+    for (int z = 0; z < summary->zone_count; ++z) {
+        zone_summary(summary, &summary->zones[z], &sub);
+        printf("\nZone %d Drive Types / IMD Options:\n", z + 1);
+        int n = recommend_drives(&sub, recommendations);
+        if (n <= 0) printf("\n (none: the largest track does not fit one revolution of any drive)\n");
+        for (int i = 0; i < n; ++i) {
+            print_drive_recommendation(recommendations[i], &summary->zones[z].max_fit, notes_printed, note_idx);
+        }
+    }
+
+    printf("\nBest Single Drive for All Zones:\n");
+    if (best_single_drive(summary, &best_flags, &tightest)) {
+        print_drive_recommendation(best_flags, tightest, notes_printed, note_idx);
+    }
+    else {
+        printf("\n No single drive type and translation setting can write every zone.\n");
+    }
 }
 
 
@@ -137,13 +1924,30 @@ int main(int argc, char* argv[]) {
     const char* input_filename = NULL;
     FILE* fimd = NULL;
     char header_line[LIBIMD_MAX_HEADER_LINE]; /* Use define from libimd.h */
-    ImdTrackInfo track_info;
+    ImageSummary summary;
+    int corpus_mode = 0;
+    int content_mode = 0;
+    int emit_b2i_mode = 0;
+    int identify_mode = 0;
+    int simulate_mode = 0;
+    uint32_t sim_rpm = SIM_DEFAULT_RPM;
+    uint32_t sim_host_us = SIM_DEFAULT_HOST_US;
+    uint32_t sim_step_ms = SIM_DEFAULT_STEP_MS;
+    TrackIndex track_index;
+    int corpus_jobs = DEFAULT_CORPUS_JOBS;
+    char** corpus_args = NULL;
+    int corpus_arg_count = 0;
     /* Initialize to prevent uninitialized use */
     /* Initialize to prevent uninitialized use */
     /* Initialize to prevent uninitialized use */
     int result = EXIT_FAILURE;
 
+    memset(&track_index, 0, sizeof(track_index));
+
     /* --- Argument Parsing --- */
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--corpus") == 0) corpus_mode = 1; /* Decides how file arguments are taken */
+    }
     for (int i = 1; i < argc; ++i) {
         if (strcmp(argv[i], "-Q") == 0) {
             quiet_mode = 1;
@@ -152,9 +1956,47 @@ int main(int argc, char* argv[]) {
             print_usage(argv[0]);
             return EXIT_SUCCESS;
         }
+        else if (strcmp(argv[i], "--content") == 0) {
+            content_mode = 1;
+        }
+        else if (strcmp(argv[i], "--simulate") == 0) {
+            simulate_mode = 1;
+        }
+        else if (strcmp(argv[i], "--rpm") == 0 || strcmp(argv[i], "--host-us") == 0 || strcmp(argv[i], "--step-ms") == 0) {
+            char* endptr = NULL;
+            unsigned long value = (i + 1 < argc) ? strtoul(argv[i + 1], &endptr, 10) : 0;
+            if (i + 1 >= argc || *endptr != '\0' || (argv[i][2] == 'r' && (value < 1 || value > 3600)) || value > 1000000UL) {
+                fprintf(stderr, "Error: %s requires a numeric value.\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+            if (argv[i][2] == 'r') sim_rpm = (uint32_t)value;
+            else if (argv[i][2] == 'h') sim_host_us = (uint32_t)value;
+            else sim_step_ms = (uint32_t)value;
+            i++;
+        }
+        else if (strcmp(argv[i], "--identify") == 0) {
+            identify_mode = 1;
+        }
+        else if (strcmp(argv[i], "--emit-b2i") == 0) {
+            emit_b2i_mode = 1;
+        }
+        else if (strcmp(argv[i], "--corpus") == 0) {
+            /* Handled above */
+        }
+        else if (strcmp(argv[i], "--jobs") == 0) {
+            if (++i >= argc || (corpus_jobs = atoi(argv[i])) < 1 || corpus_jobs > MAX_CORPUS_JOBS) {
+                fprintf(stderr, "Error: --jobs requires a value from 1 to %d.\n", MAX_CORPUS_JOBS);
+                return EXIT_FAILURE;
+            }
+        }
         else if (argv[i][0] == '-') {
             fprintf(stderr, "Warning: Unknown option '%s'\n", argv[i]);
         }
+        else if (corpus_mode) {
+            /* Corpus arguments are collected in place (argv entries are compacted) */
+            if (!corpus_args) corpus_args = &argv[i];
+            corpus_args[corpus_arg_count++] = argv[i];
+        }
         else if (!input_filename) {
             input_filename = argv[i];
         }
@@ -165,12 +2007,36 @@ int main(int argc, char* argv[]) {
         }
     }
 
+    /* Set verbosity level for reporting library */
+    imd_set_verbosity(quiet_mode, 0); /* imda only has quiet mode */
+
+    if (corpus_mode) {
+        if (corpus_arg_count == 0) {
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        return run_corpus(corpus_args, corpus_arg_count, corpus_jobs, identify_mode) == EXIT_SUCCESS ? 0 : 1;
+    }
+
     if (!input_filename) {
         print_usage(argv[0]);
         return EXIT_FAILURE;
     }
-    /* Set verbosity level for reporting library */
-    imd_set_verbosity(quiet_mode, 0); /* imda only has quiet mode */
+
+    if (emit_b2i_mode) {
+        /* Only the option file goes to stdout */
+        fimd = fopen(input_filename, "rb");
+        if (!fimd) {
+            fprintf(stderr, "Error: Cannot open input file '%s': %s\n", input_filename, strerror(errno));
+            goto cleanup;
+        }
+        if (imd_read_file_header(fimd, NULL, header_line, sizeof(header_line)) != 0 || imd_skip_comment_block(fimd) != 0) {
+            fprintf(stderr, "Error: Failed to read IMD header or comment of '%s'.\n", input_filename);
+            goto cleanup;
+        }
+        if (emit_b2i(fimd, input_filename, stdout) == 0) result = EXIT_SUCCESS;
+        goto cleanup;
+    }
 
     if (!quiet_mode) printf("ImageDisk Analyzer (Cross-Platform) %s [%s] - Analyzing '%s'\n",
         CMAKE_VERSION_STR, GIT_VERSION_STR, input_filename);
@@ -223,42 +2089,15 @@ int main(int argc, char* argv[]) {
 
 
     /* --- Analyze Tracks --- */
-    uint8_t max_cyl = 0;
-    uint8_t max_head = 0;
-    uint8_t modes_used = 0; /* Bitmask: bit 0=500k, bit 1=300k, bit 2=250k */
-    uint32_t max_track_bytes_estimate = 0;
-    uint32_t track_count = 0;
-
-    while (1) {
-        /* Use imd_read_track_header to only read header info, not data */
-        int load_status = imd_read_track_header(fimd, &track_info);
-        if (load_status == 0) break; /* EOF */
-        if (load_status < 0) {
-            fprintf(stderr, "Error reading track header for track index %u.\n", track_count);
-            goto cleanup;
-        }
-        track_count++;
-
-        if (track_info.cyl > max_cyl) max_cyl = track_info.cyl;
-        if (track_info.head > max_head) max_head = track_info.head;
-
-        /* Track modes used */
-        switch (track_info.mode % 3) { /* Logic relies on mode numbering pattern */
-        case 0: modes_used |= 1; break; /* 500 kbps */
-        case 1: modes_used |= 2; break; /* 300 kbps */
-        case 2: modes_used |= 4; break; /* 250 kbps */
-        }
-
-        /* Estimate track size */
-        if (track_info.num_sectors > 0) {
-            uint32_t track_bytes = (track_info.sector_size + SECTOR_OVERHEAD_GUESS) * track_info.num_sectors
-                + CYLINDER_OVERHEAD_GUESS;
-            if (track_bytes > max_track_bytes_estimate) {
-                max_track_bytes_estimate = track_bytes;
-            }
-        }
-        /* No need to free track data as imd_read_track_header doesn't load it */
+    long tracks_pos = ftell(fimd);
+    if (analyze_track_headers(fimd, &summary, (identify_mode || simulate_mode) ? &track_index : NULL) != 0) {
+        fprintf(stderr, "Error reading track header for track index %u.\n", summary.track_count);
+        goto cleanup;
     }
+    uint8_t max_cyl = summary.max_cyl;
+    uint8_t max_head = summary.max_head;
+    uint8_t modes_used = summary.modes_used;
+    const TrackFit* max_fit = &summary.max_fit;
 
     /* --- Print Summary --- */
     if (!quiet_mode) {
@@ -271,73 +2110,70 @@ int main(int argc, char* argv[]) {
         if (modes_used & 1) printf(" 500kbps");
         if (modes_used == 0) printf(" (None found)");
         printf("\n");
-        printf("  Est. Max Track Size: %u bytes\n", max_track_bytes_estimate);
+        if (max_fit->bytes > 0) {
+            printf("  Max Track Size     : %u bytes (Cyl %u Head %u: %u x %u %s, minimum gaps)\n",
+                max_fit->bytes, max_fit->cyl, max_fit->head, max_fit->num_sectors, max_fit->sector_size, max_fit->layout->name);
+            printf("  Max Track Time     : %u us at %u kbps (revolution %u us @ 300 RPM, %u us @ 360 RPM)\n",
+                max_fit->time_us, max_fit->rate_kbps, revolution_us(300), revolution_us(360));
+        }
     }
 
-    /* --- Determine Recommendations --- */
-    int num_modes = (modes_used & 1) + ((modes_used >> 1) & 1) + ((modes_used >> 2) & 1);
-    if (num_modes > 1) {
-        imd_report_error_exit("Mixed data rates found - cannot recommend single drive type.");
+    /* --- Format Fingerprint (optional) --- */
+    if (identify_mode) {
+        char detail[FINGERPRINT_DETAIL];
+        uint32_t tracks_loaded = 0;
+        int format_id = classify_image(fimd, &track_index, &summary, detail, sizeof(detail), &tracks_loaded);
+        printf("\nFormat Fingerprint:\n");
+        if (format_id >= 0 && FORMAT_SIGNATURES[format_id].probe) {
+            printf("  %s\n", FORMAT_SIGNATURES[format_id].system);
+            printf("  %s\n", detail);
+        }
+        else if (format_id >= 0) {
+            printf("  Geometry consistent with %s\n", FORMAT_SIGNATURES[format_id].system);
+            printf("  (no sector content checked; other systems share this geometry)\n");
+        }
+        else {
+            printf("  No signature matched (%lu checked).\n", (unsigned long)NUM_FORMAT_SIGNATURES);
+        }
+        printf("  %u track(s) decoded to classify.\n", tracks_loaded);
+    }
+
+    /* --- Interleave / Skew Simulation (optional) --- */
+    if (simulate_mode && summary.track_count > 0) {
+        if (simulate_latency(fimd, &track_index, &summary, input_filename, sim_rpm, sim_host_us, sim_step_ms * 1000u) != 0) goto cleanup;
+    }
+
+    /* --- Decode Sector Data (optional) --- */
+    if (content_mode && summary.track_count > 0) {
+        if (tracks_pos < 0 || analyze_content(fimd, tracks_pos, &summary) != 0) goto cleanup;
     }
-    if (modes_used == 0 && track_count > 0) {
+
+    /* --- Determine Recommendations --- */
+    if (modes_used == 0 && summary.track_count > 0) {
         imd_report_error_exit("Image contains tracks but no identifiable data rate.");
     }
-    if (track_count == 0) {
+    if (summary.track_count == 0) {
         printf("\nImage appears to contain no tracks.\n");
         result = EXIT_SUCCESS;
         goto cleanup;
     }
 
 
-    printf("\nPossible Drive Types / IMD Options:\n");
-
-    uint32_t drive_flags = 0;
+    uint32_t recommendations[MAX_RECOMMENDATIONS];
     uint8_t notes_printed[3] = { 0 }; /* 40t, 77t, 360rpm */
     int note_idx = 0;
 
-    /* Determine base options */
-    if (max_cyl < 40) drive_flags |= OPTION_DSTEP; /* Needs double step if less than 40 */
-    else if (max_cyl == 39) drive_flags |= NOTE_40TRACK; /* Specific note for exactly 40 tracks */
-
-    if (max_cyl == 76) drive_flags |= NOTE_77TRACK; /* Specific note for 77 tracks (8") */
-
-
-    switch (modes_used) {
-    case 1: /* 500 kbps only */
-        if (max_track_bytes_estimate < (BYTES_PER_SEC_500K / 6)) { /* Heuristic from original */
-            drive_flags |= NOTE_360RPM;
-        }
-        print_drive_recommendation(DRIVE_TYPE_D35_HD | drive_flags, notes_printed, &note_idx);
-        print_drive_recommendation(DRIVE_TYPE_D525_HD | drive_flags, notes_printed, &note_idx);
-        if (max_cyl <= 76) { /* Check if it fits 8" drive */
-            print_drive_recommendation(DRIVE_TYPE_D8 | drive_flags, notes_printed, &note_idx);
-        }
-        break;
-
-    case 2: /* 300 kbps only */
-        /* 300kbps implies a 5.25" HD drive running at low speed (needs T32) OR a 3.5" drive */
-        print_drive_recommendation(DRIVE_TYPE_D525_HD | OPTION_T32 | drive_flags, notes_printed, &note_idx);
-        print_drive_recommendation(DRIVE_TYPE_D35_DD | drive_flags, notes_printed, &note_idx);
-        print_drive_recommendation(DRIVE_TYPE_D35_HD | drive_flags, notes_printed, &note_idx);
-        /* Original IMDA also listed D525_DD_80 + T32, seems less common */
-        print_drive_recommendation(DRIVE_TYPE_D525_DD_80 | OPTION_T32 | drive_flags, notes_printed, &note_idx);
-        /* Original IMDA also listed D525_DD_40 + T32, only if 40 tracks */
-        if (drive_flags & NOTE_40TRACK) {
-            print_drive_recommendation(DRIVE_TYPE_D525_DD_40 | OPTION_T32 | drive_flags, notes_printed, &note_idx);
-        }
-
-        break;
-
-    case 4: /* 250 kbps only */
-        /* 250kbps implies standard DD drives (3.5" or 5.25") OR 5.25" HD needing T23 */
-        if (drive_flags & NOTE_40TRACK) { /* Only show 40 track drive if image fits */
-            print_drive_recommendation(DRIVE_TYPE_D525_DD_40 | drive_flags, notes_printed, &note_idx);
+    if (summary.zone_count > 1) {
+        /* Mixed rates or FM/MFM (e.g. an FM track 0): recommend per zone, then one drive for the whole disk */
+        print_zone_recommendations(&summary, notes_printed, &note_idx);
+    }
+    else {
+        printf("\nPossible Drive Types / IMD Options:\n");
+        int num_recommendations = recommend_drives(&summary, recommendations);
+        if (num_recommendations <= 0) printf("\n (none: the largest track does not fit one revolution of any drive)\n");
+        for (int i = 0; i < num_recommendations; ++i) {
+            print_drive_recommendation(recommendations[i], max_fit, notes_printed, &note_idx);
         }
-        print_drive_recommendation(DRIVE_TYPE_D525_DD_80 | drive_flags, notes_printed, &note_idx);
-        print_drive_recommendation(DRIVE_TYPE_D525_HD | OPTION_T23 | drive_flags, notes_printed, &note_idx);
-        print_drive_recommendation(DRIVE_TYPE_D35_DD | drive_flags, notes_printed, &note_idx);
-        print_drive_recommendation(DRIVE_TYPE_D35_HD | drive_flags, notes_printed, &note_idx);
-        break;
     }
 
     /* Print collected notes */
@@ -352,6 +2188,7 @@ int main(int argc, char* argv[]) {
     result = EXIT_SUCCESS; /* Success! */
 
 cleanup:
+    track_index_free(&track_index);
     if (fimd) fclose(fimd);
     return (result == EXIT_SUCCESS ? 0 : 1);
 }
@@ -8,6 +8,9 @@
  * Copyright (c) 2025, Howard M. Harte
  */
 
+/* Define _DEFAULT_SOURCE to enable POSIX features (inotify, pthreads, poll) for --watch */
+#define _DEFAULT_SOURCE
+
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
@@ -15,6 +18,26 @@
 #include <stdint.h>
 #include <errno.h>
 #include <limits.h>
+#include <ctype.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>   /* SSE2 intrinsics for the uniform-sector scan */
+#define IMDCHK_HAVE_SSE2 1
+#endif
+#ifdef __linux__
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/inotify.h>
+#define IMDCHK_HAVE_WATCH 1
+#endif
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 #include "libimd.h"      /* For IMD defines, still needed by libimdchk */
 #include "libimd_utils.h" /* For reporting and utilities */
 #include "libimdchk.h"   /* Use the checking library */
@@ -29,11 +52,144 @@
 #define GIT_VERSION_STR "dev"
 #endif
 
+#define MAX_INPUT_FILES 1024 /* Max input files accepted on one command line */
+
+/* Directory watch mode (--watch) limits */
+#define WATCH_MAX_JOBS        16   /* Upper bound for --jobs */
+#define WATCH_DEFAULT_JOBS    2
+#define WATCH_DEFAULT_DEBOUNCE_MS 250
+#define WATCH_MAX_DEBOUNCE_MS 60000
+#define WATCH_QUEUE_DEPTH     64   /* Files waiting for a worker; the watcher blocks when full */
+#define WATCH_MAX_PENDING     256  /* Files waiting for their debounce interval to expire */
+#define WATCH_MAX_PATH        4096
+#define WATCH_MAX_QUARANTINE_SUFFIX 9999 /* name-9999.imd is the last name tried in --quarantine */
+
+/* Results cache (--cache) file format */
+#define CACHE_MAGIC           "IMDCHKC1"
+#define CACHE_VERSION         1
+
+#define SHA1_DIGEST_SIZE      20
+
+/* Resync scanner limits */
+#define RESYNC_MAX_REGIONS    64   /* Damaged regions reported per file */
+#define RESYNC_DEFAULT_MAX_CYL 99  /* Cylinder bound for plausible headers unless -c is given */
+
+/* --- Storage Audit --- */
+/* Per-file results of the uniform-but-uncompressed sector audit (-a). */
+typedef struct {
+    const char* filename;
+    long long data_sector_count;       /* Sectors carrying data (normal or compressed) */
+    long long uniform_uncompressed;    /* Uniform sectors stored as normal (uncompressed) records */
+    unsigned long long bytes_saved;    /* Bytes 'imdu -C' would save on this file */
+    int status;                        /* 0 = audited, -1 = file could not be read */
+} ImdChkAudit;
+
+/* --- Results Cache --- */
+/* One cached check result. Records are stored sorted by (dev, ino). */
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    uint64_t mtime_ns;
+    uint64_t options_hash;             /* Hash of ImdChkOptions the result was computed with */
+    ImdChkResults results;
+} ImdChkCacheRecord;
+
+/* Cache file header, followed by 'count' ImdChkCacheRecord entries. */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;              /* sizeof(ImdChkCacheRecord) of the writer; mismatch = ignore file */
+    uint64_t count;
+} ImdChkCacheHeader;
+
+typedef struct {
+    const char* path;
+    void* map;                         /* Mapped cache file (read-only) */
+    size_t map_size;
+    const ImdChkCacheRecord* records;  /* Sorted records inside map */
+    size_t count;
+    ImdChkCacheRecord* added;          /* Results computed this run */
+    size_t added_count;
+    size_t added_capacity;
+    size_t* added_slots;               /* Open-addressed hash of 'added' by (dev, ino): index + 1, 0 = empty */
+    size_t slot_count;                 /* Power of two, at least twice added_capacity */
+    uint64_t options_hash;
+} ImdChkCache;
+
+/* --- Known-Good Hash Database (--dat) --- */
+typedef struct {
+    uint32_t state[5];
+    uint64_t length;
+    uint8_t buffer[64];
+    size_t buffered;
+} Sha1Context;
+
+typedef struct {
+    uint8_t digest[SHA1_DIGEST_SIZE];
+    const char* name;                  /* File name (basename) listed for this image */
+    const char* title;                 /* Display title; the file name if none given */
+} ImdChkDatEntry;
+
+typedef struct {
+    char* text;                        /* DAT file contents; names and titles point into it */
+    ImdChkDatEntry* entries;
+    size_t count;
+    uint32_t* by_digest;               /* Open-addressing tables of entry index + 1 (0 = empty) */
+    uint32_t* by_name;
+    size_t table_mask;
+} ImdChkDat;
+
+enum { DAT_UNKNOWN = 0, DAT_VERIFIED, DAT_MISMATCH };
+
+typedef struct {
+    int verdict;                       /* DAT_UNKNOWN, DAT_VERIFIED or DAT_MISMATCH */
+    uint8_t digest[SHA1_DIGEST_SIZE];  /* Hash computed for the checked image */
+    const ImdChkDatEntry* entry;       /* Matching entry (by hash if verified, by name if mismatched) */
+} ImdChkDatResult;
+
+/* --- Resync Scanner --- */
+typedef struct {
+    size_t offset;                     /* File offset of the track record */
+    size_t length;                     /* Record length in bytes */
+    uint8_t mode, cyl, head, num_sectors;
+    uint32_t sector_size;
+} ImdChkResyncTrack;
+
+typedef struct {
+    size_t damage_offset;              /* First byte that did not parse as a track record */
+    size_t resume_offset;              /* Next plausible track header (file length if none) */
+    size_t tracks_before;              /* Index into tracks[] of the first track after the damage */
+} ImdChkResyncRegion;
+
+typedef struct {
+    ImdChkResyncTrack* tracks;         /* Every readable track, in file order */
+    size_t track_count;
+    size_t track_capacity;
+    ImdChkResyncRegion regions[RESYNC_MAX_REGIONS];
+    int region_count;
+} ImdChkResyncScan;
+
 /* --- Global Options (for main) --- */
 static int g_verbose_mode = 0;
 static int g_quiet_mode = 0;
+static int g_audit_mode = 0;
+static int g_force_recheck = 0;
+static const char* g_cache_path = NULL;
+static ImdChkCache g_cache;
+static const char* g_dat_path = NULL;
+static int g_dat_track_hash = 0;
+static ImdChkDat g_dat;
+static long long g_dat_counts[3];      /* Indexed by DAT_UNKNOWN/VERIFIED/MISMATCH */
 static ImdChkOptions g_options; /* Populated by arg parsing */
 
+/* Directory watch mode options */
+static const char* g_watch_dir = NULL;
+static const char* g_watch_log = NULL;
+static const char* g_watch_quarantine = NULL;
+static long g_watch_jobs = WATCH_DEFAULT_JOBS;
+static long g_watch_debounce_ms = WATCH_DEFAULT_DEBOUNCE_MS;
+
 /* --- Forward Declarations --- */
 void print_usage(const char* prog_name);
 void print_version_info(FILE* stream);
@@ -41,6 +197,27 @@ int parse_long_arg(const char* arg_name, const char* arg_val_str, long* dest);
 int parse_ulong_arg(const char* arg_name, const char* arg_val_str, uint32_t* dest);
 void report_results(const char* filename, const ImdChkOptions* options, const ImdChkResults* results);
 const char* get_check_description(uint32_t check_bit);
+int is_uniform_fast(const uint8_t* data, size_t size);
+int audit_file(const char* filename, ImdChkAudit* audit);
+void report_audit(const ImdChkAudit* audit);
+void report_audit_summary(ImdChkAudit* audits, int count);
+uint64_t fnv1a64_update(uint64_t hash, const void* data, size_t size);
+int cache_open(ImdChkCache* cache, const char* path, const ImdChkOptions* options);
+int cache_check_file(ImdChkCache* cache, const char* filename, const ImdChkOptions* options, ImdChkResults* results, int* cached);
+int cache_save(ImdChkCache* cache);
+void cache_close(ImdChkCache* cache);
+void sha1_init(Sha1Context* ctx);
+void sha1_update(Sha1Context* ctx, const void* data, size_t size);
+void sha1_final(Sha1Context* ctx, uint8_t digest[SHA1_DIGEST_SIZE]);
+int dat_load(ImdChkDat* dat, const char* path);
+void dat_free(ImdChkDat* dat);
+int dat_verify_file(const ImdChkDat* dat, const char* filename, int track_hash, ImdChkDatResult* result);
+void report_dat_result(const char* filename, const ImdChkDatResult* result);
+int resync_scan_file(const char* filename, const ImdChkOptions* options, ImdChkResyncScan* scan);
+void resync_free(ImdChkResyncScan* scan);
+void report_resync(const char* filename, const ImdChkResyncScan* scan);
+int check_file(const char* filename, ImdChkAudit* audit);
+int watch_directory(const char* dir);
 
 /* --- Helper Functions (Argument Parsing, copied from original imdchk.c) --- */
 
@@ -160,13 +337,164 @@ void report_results(const char* filename, const ImdChkOptions* options, const Im
     printf("--------------------------\n");
 }
 
+/* --- Storage Audit Functions --- */
+
+/*
+ * Returns 1 if all bytes in data are identical, 0 otherwise.
+ * Compares 16 bytes per step against a broadcast of the first byte (SSE2 when
+ * available, otherwise two 64-bit words), then finishes the tail bytewise.
+ */
+int is_uniform_fast(const uint8_t* data, size_t size) {
+    size_t i = 0;
+    uint8_t first;
+
+    if (data == NULL || size == 0) return 0;
+    first = data[0];
+
+#ifdef IMDCHK_HAVE_SSE2
+    {
+        const __m128i pattern = _mm_set1_epi8((char)first);
+        for (; i + 16 <= size; i += 16) {
+            __m128i block = _mm_loadu_si128((const __m128i*)(data + i));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(block, pattern)) != 0xFFFF) return 0;
+        }
+    }
+#else
+    {
+        uint64_t pattern = 0x0101010101010101ULL * first;
+        for (; i + 16 <= size; i += 16) {
+            uint64_t w0, w1;
+            memcpy(&w0, data + i, sizeof(w0));
+            memcpy(&w1, data + i + 8, sizeof(w1));
+            if ((w0 ^ pattern) | (w1 ^ pattern)) return 0;
+        }
+    }
+#endif
+    for (; i < size; ++i) {
+        if (data[i] != first) return 0;
+    }
+    return 1;
+}
+
+/*
+ * Scans every track of an IMD file for sectors stored as normal (uncompressed)
+ * records whose data is uniform. Each such sector would shrink from
+ * sector_size bytes to a single fill byte when rewritten with 'imdu -C'.
+ * Returns 0 on success, -1 if the file could not be read.
+ */
+int audit_file(const char* filename, ImdChkAudit* audit) {
+    FILE* fimd = NULL;
+    ImdTrackInfo track = { 0 };
+    int load_status;
+
+    memset(audit, 0, sizeof(ImdChkAudit));
+    audit->filename = filename;
+    audit->status = -1;
+
+    fimd = fopen(filename, "rb");
+    if (!fimd) return -1;
+
+    if (imd_read_file_header(fimd, NULL, NULL, 0) != 0 || imd_skip_comment_block(fimd) != 0) {
+        fclose(fimd);
+        return -1;
+    }
+
+    while ((load_status = imd_load_track(fimd, &track, LIBIMD_FILL_BYTE_DEFAULT)) > 0) {
+        for (int i = 0; i < track.num_sectors; ++i) {
+            uint8_t flag = track.sflag[i];
+            if (!IMD_SDR_HAS_DATA(flag)) continue;
+            audit->data_sector_count++;
+            if (IMD_SDR_IS_COMPRESSED(flag) || track.sector_size < 2) continue;
+            if (track.data == NULL || track.data_size < ((size_t)i + 1) * track.sector_size) continue;
+            if (is_uniform_fast(track.data + ((size_t)i * track.sector_size), track.sector_size)) {
+                audit->uniform_uncompressed++;
+                audit->bytes_saved += track.sector_size - 1; /* Data record shrinks to one fill byte */
+            }
+        }
+        imd_free_track_data(&track);
+        memset(&track, 0, sizeof(ImdTrackInfo));
+    }
+    imd_free_track_data(&track);
+    fclose(fimd);
+
+    if (load_status < 0) return -1;
+    audit->status = 0;
+    return 0;
+}
+
+/* Report storage audit results for one file */
+void report_audit(const ImdChkAudit* audit) {
+    if (g_quiet_mode) return;
+
+    printf("\n--- Storage Audit ---\n");
+    if (audit->status != 0) {
+        printf("  Audit failed: could not read all tracks.\n");
+        return;
+    }
+    printf("  Data Sectors:              %lld\n", audit->data_sector_count);
+    printf("  Uniform, Not Compressed:   %lld\n", audit->uniform_uncompressed);
+    printf("  Bytes Saved by 'imdu -C':  %llu\n", audit->bytes_saved);
+}
+
+/* Sort helper: largest savings first */
+static int compare_audit_savings(const void* a, const void* b) {
+    const ImdChkAudit* audit_a = (const ImdChkAudit*)a;
+    const ImdChkAudit* audit_b = (const ImdChkAudit*)b;
+    if (audit_a->bytes_saved > audit_b->bytes_saved) return -1;
+    if (audit_a->bytes_saved < audit_b->bytes_saved) return 1;
+    return 0;
+}
+
+/* Report aggregate audit results, with files ranked by recompression payoff.
+ * Quiet mode drops the per-file reports, so it always gets a compact summary. */
+void report_audit_summary(ImdChkAudit* audits, int count) {
+    long long total_uniform = 0;
+    unsigned long long total_saved = 0;
+    int files_with_savings = 0;
+    int files_audited = 0;
+
+    if (!g_quiet_mode && count < 2) return;
+
+    for (int i = 0; i < count; ++i) {
+        if (audits[i].status != 0) continue;
+        files_audited++;
+        total_uniform += audits[i].uniform_uncompressed;
+        total_saved += audits[i].bytes_saved;
+        if (audits[i].bytes_saved > 0) files_with_savings++;
+    }
+    qsort(audits, (size_t)count, sizeof(ImdChkAudit), compare_audit_savings);
+
+    if (g_quiet_mode) {
+        printf("Audit Summary: %d audited, %d not audited, %d would shrink, %llu bytes saved\n",
+            files_audited, count - files_audited, files_with_savings, total_saved);
+        for (int i = 0; i < count; ++i) {
+            if (audits[i].status != 0 || audits[i].bytes_saved == 0) continue;
+            printf("%12llu  %s\n", audits[i].bytes_saved, audits[i].filename);
+        }
+        return;
+    }
+
+    printf("\n=== Storage Audit Summary (%d files) ===\n", files_audited);
+    if (files_audited < count) printf("  Not Audited (unreadable):  %d\n", count - files_audited);
+    printf("  Files That Would Shrink:   %d\n", files_with_savings);
+    printf("  Uniform, Not Compressed:   %lld\n", total_uniform);
+    printf("  Total Bytes Saved:         %llu\n", total_saved);
+    if (files_with_savings > 0) {
+        printf("  Recompression Candidates (largest savings first):\n");
+        for (int i = 0; i < count; ++i) {
+            if (audits[i].status != 0 || audits[i].bytes_saved == 0) continue;
+            printf("    %12llu  %s\n", audits[i].bytes_saved, audits[i].filename);
+        }
+    }
+}
+
 /* Print usage instructions (copied from original imdchk.c) */
 void print_usage(const char* prog_name) {
     fprintf(stderr, "%s %s [%s] - Check IMD file format consistency.\n",
         IMDCHECK_NAME, CMAKE_VERSION_STR, GIT_VERSION_STR);
     fprintf(stderr, "Copyright (C) 2025 - Howard M. Harte - https://github.com/hharte/imd-utils\n\n");
-    fprintf(stderr, "Usage: %s [options] <input_file.imd>\n\n", prog_name);
-    fprintf(stderr, "  Checks an IMD file for format consistency using libimd.\n");
+    fprintf(stderr, "Usage: %s [options] <input_file.imd> [input_file.imd ...]\n\n", prog_name);
+    fprintf(stderr, "  Checks one or more IMD files for format consistency using libimd.\n");
     fprintf(stderr, "  Displays a summary of the disk parameters found (unless -q).\n\n");
     fprintf(stderr, "Options:\n");
     fprintf(stderr, "  -v                : Verbose output (prints info for each track - handled by library).\n");
@@ -178,6 +506,26 @@ void print_usage(const char* prog_name) {
     fprintf(stderr, "  -c, --cylinders N : Set maximum allowed cylinder number to N.\n");
     fprintf(stderr, "  -h, --head N      : Require all tracks to use head number N (0 or 1).\n");
     fprintf(stderr, "  -s, --sectors N   : Set maximum allowed sectors per track to N.\n");
+    fprintf(stderr, "  -a, --audit       : Storage audit. Count uniform sectors stored uncompressed and\n");
+    fprintf(stderr, "                      report the bytes 'imdu -C' would save (per file and in total).\n");
+    fprintf(stderr, "                      With -q only the total and the ranked candidates are printed.\n");
+    fprintf(stderr, "  --cache FILE      : Keep check results in FILE and reuse them for files whose\n");
+    fprintf(stderr, "                      device, inode, size, mtime and check options are unchanged.\n");
+    fprintf(stderr, "  --recheck         : (--cache) Ignore cached results and check every file again.\n");
+    fprintf(stderr, "  --dat FILE        : Verify each file's SHA-1 against a known-good list. Lines are\n");
+    fprintf(stderr, "                      '<sha1> TAB <file name> [TAB <title>]' or sha1sum output;\n");
+    fprintf(stderr, "                      Logiqx XML DATs (<game><rom name=.. sha1=../>) also work.\n");
+    fprintf(stderr, "                      Reports VERIFIED, UNKNOWN, or MISMATCH (name listed, hash differs).\n");
+    fprintf(stderr, "                      With -q, only files that do not verify are listed.\n");
+    fprintf(stderr, "  --track-hash      : (--dat) Hash decoded track content only, ignoring the header,\n");
+    fprintf(stderr, "                      comment and sector compression.\n");
+    fprintf(stderr, "  --watch DIR       : (Linux) Watch DIR and check each new .imd file once it is\n");
+    fprintf(stderr, "                      completely written or moved in. Runs until Ctrl+C.\n");
+    fprintf(stderr, "                      Cannot be combined with --cache or --dat.\n");
+    fprintf(stderr, "  --log FILE        : (--watch) Append one result line per file to FILE.\n");
+    fprintf(stderr, "  --quarantine DIR  : (--watch) Move files that fail the error mask into DIR.\n");
+    fprintf(stderr, "  --jobs N          : (--watch) Number of worker threads (1-%d, default %d).\n", WATCH_MAX_JOBS, WATCH_DEFAULT_JOBS);
+    fprintf(stderr, "  --debounce MS     : (--watch) Wait MS milliseconds after the last event (0-%d, default %d).\n", WATCH_MAX_DEBOUNCE_MS, WATCH_DEFAULT_DEBOUNCE_MS);
     fprintf(stderr, "  --help            : Display this help message and exit.\n");
     fprintf(stderr, "  --version         : Display version information and exit.\n\n");
     fprintf(stderr, "Error Mask Bits (Hex):\n");
@@ -189,7 +537,8 @@ void print_usage(const char* prog_name) {
     fprintf(stderr, "  (*) Denotes checks treated as warnings by default.\n\n");
     fprintf(stderr, "Exit Codes:\n");
     fprintf(stderr, "  0 : File format OK (no checks failed OR failures were masked by --error-mask).\n");
-    fprintf(stderr, "  1 : Checks failed AND were considered errors according to --error-mask.\n");
+    fprintf(stderr, "  1 : Checks failed AND were considered errors according to --error-mask,\n");
+    fprintf(stderr, "      or (--dat) a listed file's hash did not match.\n");
     fprintf(stderr, "  -1: Usage error, file access error, or invalid arguments.\n");
     fprintf(stderr, "Output:\n");
     fprintf(stderr, "  Informational output to stdout (suppressed by -q).\n");
@@ -204,85 +553,1023 @@ void print_version_info(FILE* stream) {
     fprintf(stream, "Utility to check IMD file format consistency using libimd.\n");
 }
 
-/* --- Main Function --- */
-int main(int argc, char* argv[]) {
-    const char* input_filename = NULL;
-    int final_exit_code = 0; /* 0 or 1 based on checks and mask */
-    ImdChkResults results;
-    /* Use library function to get basename */
-    const char* prog_name = imd_get_basename(argv[0]);
-    if (!prog_name) { prog_name = argv[0]; }
+/* --- Results Cache --- */
 
-    /* Initialize options to defaults */
-    /* Initialize reporting first */
-    imd_set_verbosity(0, 0); /* Default */
+#define FNV1A64_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV1A64_PRIME        0x100000001b3ULL
 
-    g_options.error_mask = DEFAULT_ERROR_MASK;
-    g_options.max_allowed_cyl = -1;
-    g_options.required_head = -1;
-    g_options.max_allowed_sectors = -1;
+uint64_t fnv1a64_update(uint64_t hash, const void* data, size_t size) {
+    const uint8_t* p = (const uint8_t*)data;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= p[i];
+        hash *= FNV1A64_PRIME;
+    }
+    return hash;
+}
 
-    /* Argument Parsing */
-    for (int i = 1; i < argc; ++i) {
-        if (strcmp(argv[i], "-v") == 0) { g_verbose_mode = 1; } /* Keep for potential future use */
-        else if (strcmp(argv[i], "-q") == 0 || strcmp(argv[i], "--quiet") == 0) { g_quiet_mode = 1; }
-        else if (strcmp(argv[i], "--help") == 0) { print_usage(prog_name); return 0; }
-        else if (strcmp(argv[i], "--version") == 0) { if (!g_quiet_mode) print_version_info(stdout); return 0; }
-        else if (strcmp(argv[i], "--error-mask") == 0 || strcmp(argv[i], "-e") == 0) {
-            if (++i < argc) { if (!parse_ulong_arg(argv[i - 1], argv[i], &g_options.error_mask)) return -1; }
-            else { fprintf(stderr, "Error: Option %s requires MASK.\n", argv[i - 1]); return -1; }
+/* Hash of everything that influences a check result, including the result layout itself */
+static uint64_t cache_options_hash(const ImdChkOptions* options) {
+    uint64_t h = FNV1A64_OFFSET_BASIS;
+    uint64_t v;
+    v = options->error_mask;                    h = fnv1a64_update(h, &v, sizeof(v));
+    v = (uint64_t)options->max_allowed_cyl;     h = fnv1a64_update(h, &v, sizeof(v));
+    v = (uint64_t)options->required_head;       h = fnv1a64_update(h, &v, sizeof(v));
+    v = (uint64_t)options->max_allowed_sectors; h = fnv1a64_update(h, &v, sizeof(v));
+    v = sizeof(ImdChkResults);                  h = fnv1a64_update(h, &v, sizeof(v));
+    return h;
+}
+
+/* Fill the identity fields of a cache record from the file's metadata */
+static int cache_get_file_key(const char* filename, ImdChkCacheRecord* key) {
+    memset(key, 0, sizeof(*key));
+#ifdef _WIN32
+    struct _stat64 st;
+    if (_stat64(filename, &st) != 0) return -1;
+    /* No stable inode on Windows: identify the file by its path instead */
+    key->dev = (uint64_t)st.st_dev;
+    key->ino = fnv1a64_update(FNV1A64_OFFSET_BASIS, filename, strlen(filename));
+    key->mtime_ns = (uint64_t)st.st_mtime * 1000000000ULL;
+#else
+    struct stat st;
+    if (stat(filename, &st) != 0) return -1;
+    key->dev = (uint64_t)st.st_dev;
+    key->ino = (uint64_t)st.st_ino;
+#if defined(__APPLE__)
+    key->mtime_ns = (uint64_t)st.st_mtimespec.tv_sec * 1000000000ULL + (uint64_t)st.st_mtimespec.tv_nsec;
+#else
+    key->mtime_ns = (uint64_t)st.st_mtim.tv_sec * 1000000000ULL + (uint64_t)st.st_mtim.tv_nsec;
+#endif
+#endif
+    key->size = (uint64_t)st.st_size;
+    return 0;
+}
+
+static int cache_compare_key(const ImdChkCacheRecord* a, const ImdChkCacheRecord* b) {
+    if (a->dev != b->dev) return (a->dev < b->dev) ? -1 : 1;
+    if (a->ino != b->ino) return (a->ino < b->ino) ? -1 : 1;
+    return 0;
+}
+
+static int compare_cache_records(const void* a, const void* b) {
+    return cache_compare_key((const ImdChkCacheRecord*)a, (const ImdChkCacheRecord*)b);
+}
+
+static void cache_unmap(ImdChkCache* cache) {
+    if (!cache->map) return;
+#ifdef _WIN32
+    free(cache->map);
+#else
+    munmap(cache->map, cache->map_size);
+#endif
+    cache->map = NULL;
+    cache->map_size = 0;
+    cache->records = NULL;
+    cache->count = 0;
+}
+
+/*
+ * Open the results cache. A missing, truncated or incompatible cache file is
+ * not an error: the cache simply starts empty and is rewritten by cache_save().
+ * Returns 0 on success.
+ */
+int cache_open(ImdChkCache* cache, const char* path, const ImdChkOptions* options) {
+    const ImdChkCacheHeader* hdr;
+    memset(cache, 0, sizeof(*cache));
+    cache->path = path;
+    cache->options_hash = cache_options_hash(options);
+
+#ifdef _WIN32
+    /* No mmap on Windows; the cache is small enough to read in one go */
+    FILE* f = fopen(path, "rb");
+    if (!f) return 0;
+    if (fseek(f, 0, SEEK_END) == 0) {
+        long len = ftell(f);
+        if (len > 0 && fseek(f, 0, SEEK_SET) == 0) {
+            cache->map = malloc((size_t)len);
+            if (cache->map && fread(cache->map, 1, (size_t)len, f) == (size_t)len) cache->map_size = (size_t)len;
+            else { free(cache->map); cache->map = NULL; }
         }
-        else if (strcmp(argv[i], "--cylinders") == 0 || strcmp(argv[i], "-c") == 0) {
-            if (++i < argc) { if (!parse_long_arg(argv[i - 1], argv[i], &g_options.max_allowed_cyl)) return -1; }
-            else { fprintf(stderr, "Error: Option %s requires N.\n", argv[i - 1]); return -1; }
+    }
+    fclose(f);
+#else
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            cache->map = map;
+            cache->map_size = (size_t)st.st_size;
         }
-        else if (strcmp(argv[i], "--head") == 0 || strcmp(argv[i], "-h") == 0) {
-            if (++i < argc) {
-                if (!parse_long_arg(argv[i - 1], argv[i], &g_options.required_head)) return -1;
-                if (g_options.required_head != 0 && g_options.required_head != 1) { fprintf(stderr, "Error: Head must be 0 or 1.\n"); return -1; }
+    }
+    close(fd);
+#endif
+    if (!cache->map) return 0;
+
+    hdr = (const ImdChkCacheHeader*)cache->map;
+    if (cache->map_size < sizeof(*hdr) ||
+        memcmp(hdr->magic, CACHE_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->version != CACHE_VERSION ||
+        hdr->record_size != sizeof(ImdChkCacheRecord) ||
+        hdr->count > (cache->map_size - sizeof(*hdr)) / sizeof(ImdChkCacheRecord)) {
+        imd_report(IMD_REPORT_LEVEL_WARNING, "Ignoring incompatible results cache '%s'.", path);
+        cache_unmap(cache);
+        return 0;
+    }
+    cache->records = (const ImdChkCacheRecord*)((const uint8_t*)cache->map + sizeof(*hdr));
+    cache->count = (size_t)hdr->count;
+    return 0;
+}
+
+/* Look in the (small) list added this run first, then binary search the mapped records */
+static size_t cache_key_hash(const ImdChkCacheRecord* key) {
+    uint64_t h = fnv1a64_update(FNV1A64_OFFSET_BASIS, &key->dev, sizeof(key->dev));
+    return (size_t)fnv1a64_update(h, &key->ino, sizeof(key->ino));
+}
+
+/* Slot of 'key' in the added-records hash: the one holding it, or the empty one where it belongs */
+static size_t* cache_added_slot(const ImdChkCache* cache, const ImdChkCacheRecord* key) {
+    size_t mask = cache->slot_count - 1;
+    for (size_t i = cache_key_hash(key) & mask; ; i = (i + 1) & mask) {
+        size_t* slot = &cache->added_slots[i];
+        if (*slot == 0 || cache_compare_key(&cache->added[*slot - 1], key) == 0) return slot;
+    }
+}
+
+/* Rebuild the added-records hash with more slots */
+static int cache_rehash(ImdChkCache* cache, size_t slot_count) {
+    size_t* slots = (size_t*)calloc(slot_count, sizeof(size_t));
+    if (!slots) return -1;
+    free(cache->added_slots);
+    cache->added_slots = slots;
+    cache->slot_count = slot_count;
+    for (size_t i = 0; i < cache->added_count; ++i) *cache_added_slot(cache, &cache->added[i]) = i + 1;
+    return 0;
+}
+
+static const ImdChkCacheRecord* cache_find(const ImdChkCache* cache, const ImdChkCacheRecord* key) {
+    if (cache->added_count > 0) {
+        size_t slot = *cache_added_slot(cache, key);
+        if (slot != 0) return &cache->added[slot - 1];
+    }
+    if (cache->count == 0) return NULL;
+    return (const ImdChkCacheRecord*)bsearch(key, cache->records, cache->count, sizeof(ImdChkCacheRecord), compare_cache_records);
+}
+
+static void cache_store(ImdChkCache* cache, const ImdChkCacheRecord* rec) {
+    if (cache->added_count > 0) {
+        size_t slot = *cache_added_slot(cache, rec);
+        if (slot != 0) { cache->added[slot - 1] = *rec; return; }
+    }
+    if (cache->added_count == cache->added_capacity) {
+        size_t new_capacity = cache->added_capacity ? cache->added_capacity * 2 : 64;
+        if (cache_rehash(cache, new_capacity * 2) != 0) return; /* Caching is best-effort */
+        ImdChkCacheRecord* grown = (ImdChkCacheRecord*)realloc(cache->added, new_capacity * sizeof(ImdChkCacheRecord));
+        if (!grown) return;
+        cache->added = grown;
+        cache->added_capacity = new_capacity;
+    }
+    cache->added[cache->added_count++] = *rec;
+    *cache_added_slot(cache, rec) = cache->added_count;
+}
+
+/*
+ * Check a file through the cache. An unchanged file (same dev, inode, size and
+ * mtime) checked earlier with the same options is answered from the cache.
+ * Anything else, or every file when --recheck is given, is checked by
+ * libimdchk and the result recorded. Sets *cached to 1 on a cache hit.
+ * Returns the imdchk_check_file() status.
+ */
+int cache_check_file(ImdChkCache* cache, const char* filename, const ImdChkOptions* options, ImdChkResults* results, int* cached) {
+    ImdChkCacheRecord key;
+    int have_key = (cache_get_file_key(filename, &key) == 0);
+    *cached = 0;
+
+    if (have_key && !g_force_recheck) {
+        const ImdChkCacheRecord* rec = cache_find(cache, &key);
+        if (rec && rec->size == key.size && rec->mtime_ns == key.mtime_ns && rec->options_hash == cache->options_hash) {
+            *results = rec->results;
+            *cached = 1;
+            return 0;
+        }
+    }
+
+    int status = imdchk_check_file(filename, options, results);
+    if (status == 0 && have_key) {
+        key.options_hash = cache->options_hash;
+        key.results = *results;
+        cache_store(cache, &key);
+    }
+    return status;
+}
+
+/* Merge this run's results into the cache file (written to a temporary file, then renamed). */
+int cache_save(ImdChkCache* cache) {
+    ImdChkCacheRecord* merged = NULL;
+    ImdChkCacheHeader hdr;
+    size_t merged_count = 0;
+    char tmp_path[WATCH_MAX_PATH];
+    FILE* f = NULL;
+    int result = -1;
+
+    if (cache->added_count == 0) return 0;
+
+    merged = (ImdChkCacheRecord*)malloc((cache->count + cache->added_count) * sizeof(ImdChkCacheRecord));
+    if (!merged) {
+        fprintf(stderr, "Error: Memory allocation failed for results cache.\n");
+        return -1;
+    }
+    /*
+     * Keep old records not superseded by this run. A sorted copy of the added
+     * list sits at the end of 'merged' for bsearch; old records kept never
+     * reach it, and 'added' itself stays in hash order.
+     */
+    ImdChkCacheRecord* added_sorted = &merged[cache->count];
+    memcpy(added_sorted, cache->added, cache->added_count * sizeof(ImdChkCacheRecord));
+    qsort(added_sorted, cache->added_count, sizeof(ImdChkCacheRecord), compare_cache_records);
+    for (size_t i = 0; i < cache->count; ++i) {
+        if (!bsearch(&cache->records[i], added_sorted, cache->added_count, sizeof(ImdChkCacheRecord), compare_cache_records)) {
+            merged[merged_count++] = cache->records[i];
+        }
+    }
+    memmove(&merged[merged_count], added_sorted, cache->added_count * sizeof(ImdChkCacheRecord));
+    merged_count += cache->added_count;
+    qsort(merged, merged_count, sizeof(ImdChkCacheRecord), compare_cache_records);
+
+    /* Release the mapping before replacing the file underneath it */
+    cache_unmap(cache);
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.version = CACHE_VERSION;
+    hdr.record_size = (uint32_t)sizeof(ImdChkCacheRecord);
+    hdr.count = (uint64_t)merged_count;
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", cache->path);
+    f = fopen(tmp_path, "wb");
+    if (!f) {
+        fprintf(stderr, "Error: Cannot write results cache '%s': %s\n", tmp_path, strerror(errno));
+        goto cleanup;
+    }
+    if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+        fwrite(merged, sizeof(ImdChkCacheRecord), merged_count, f) != merged_count) {
+        fprintf(stderr, "Error: Failed writing results cache '%s'.\n", tmp_path);
+        fclose(f);
+        remove(tmp_path);
+        goto cleanup;
+    }
+    if (fclose(f) != 0) {
+        fprintf(stderr, "Error: Failed writing results cache '%s'.\n", tmp_path);
+        remove(tmp_path);
+        goto cleanup;
+    }
+#ifdef _WIN32
+    remove(cache->path); /* rename() does not replace an existing file on Windows */
+#endif
+    if (rename(tmp_path, cache->path) != 0) {
+        fprintf(stderr, "Error: Cannot replace results cache '%s': %s\n", cache->path, strerror(errno));
+        remove(tmp_path);
+        goto cleanup;
+    }
+    result = 0;
+
+cleanup:
+    free(merged);
+    return result;
+}
+
+void cache_close(ImdChkCache* cache) {
+    cache_unmap(cache);
+    free(cache->added);
+    free(cache->added_slots);
+    memset(cache, 0, sizeof(*cache));
+}
+
+/* --- SHA-1 (content hash for --dat) --- */
+
+static uint32_t sha1_rol(uint32_t v, int n) { return (v << n) | (v >> (32 - n)); }
+
+static void sha1_block(Sha1Context* ctx, const uint8_t* p) {
+    uint32_t w[80];
+    uint32_t a, b, c, d, e;
+    for (int i = 0; i < 16; ++i) {
+        w[i] = ((uint32_t)p[i * 4] << 24) | ((uint32_t)p[i * 4 + 1] << 16) | ((uint32_t)p[i * 4 + 2] << 8) | p[i * 4 + 3];
+    }
+    for (int i = 16; i < 80; ++i) w[i] = sha1_rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    a = ctx->state[0]; b = ctx->state[1]; c = ctx->state[2]; d = ctx->state[3]; e = ctx->state[4];
+    for (int i = 0; i < 80; ++i) {
+        uint32_t f, k;
+        if (i < 20)      { f = (b & c) | (~b & d);          k = 0x5A827999; }
+        else if (i < 40) { f = b ^ c ^ d;                   k = 0x6ED9EBA1; }
+        else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+        else             { f = b ^ c ^ d;                   k = 0xCA62C1D6; }
+        uint32_t t = sha1_rol(a, 5) + f + e + k + w[i];
+        e = d; d = c; c = sha1_rol(b, 30); b = a; a = t;
+    }
+    ctx->state[0] += a; ctx->state[1] += b; ctx->state[2] += c; ctx->state[3] += d; ctx->state[4] += e;
+}
+
+void sha1_init(Sha1Context* ctx) {
+    ctx->state[0] = 0x67452301; ctx->state[1] = 0xEFCDAB89; ctx->state[2] = 0x98BADCFE;
+    ctx->state[3] = 0x10325476; ctx->state[4] = 0xC3D2E1F0;
+    ctx->length = 0;
+    ctx->buffered = 0;
+}
+
+void sha1_update(Sha1Context* ctx, const void* data, size_t size) {
+    const uint8_t* p = (const uint8_t*)data;
+    ctx->length += (uint64_t)size;
+    if (ctx->buffered) {
+        size_t take = 64 - ctx->buffered;
+        if (take > size) take = size;
+        memcpy(ctx->buffer + ctx->buffered, p, take);
+        ctx->buffered += take; p += take; size -= take;
+        if (ctx->buffered < 64) return;
+        sha1_block(ctx, ctx->buffer);
+        ctx->buffered = 0;
+    }
+    for (; size >= 64; p += 64, size -= 64) sha1_block(ctx, p);
+    memcpy(ctx->buffer, p, size);
+    ctx->buffered = size;
+}
+
+void sha1_final(Sha1Context* ctx, uint8_t digest[SHA1_DIGEST_SIZE]) {
+    uint64_t bits = ctx->length * 8;
+    uint8_t pad = 0x80;
+    uint8_t len_be[8];
+    for (int i = 0; i < 8; ++i) len_be[i] = (uint8_t)(bits >> (56 - 8 * i));
+    sha1_update(ctx, &pad, 1);
+    pad = 0;
+    while (ctx->buffered != 56) sha1_update(ctx, &pad, 1);
+    sha1_update(ctx, len_be, sizeof(len_be));
+    for (int i = 0; i < 5; ++i) {
+        digest[i * 4] = (uint8_t)(ctx->state[i] >> 24); digest[i * 4 + 1] = (uint8_t)(ctx->state[i] >> 16);
+        digest[i * 4 + 2] = (uint8_t)(ctx->state[i] >> 8); digest[i * 4 + 3] = (uint8_t)ctx->state[i];
+    }
+}
+
+/* --- Known-Good Hash Database (--dat) --- */
+
+static int hex_nibble(int c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static int parse_sha1_hex(const char* s, uint8_t digest[SHA1_DIGEST_SIZE]) {
+    for (int i = 0; i < SHA1_DIGEST_SIZE; ++i) {
+        int hi = hex_nibble((unsigned char)s[i * 2]);
+        int lo = hex_nibble((unsigned char)s[i * 2 + 1]);
+        if (hi < 0 || lo < 0) return 0;
+        digest[i] = (uint8_t)((hi << 4) | lo);
+    }
+    return 1;
+}
+
+static void format_sha1_hex(const uint8_t digest[SHA1_DIGEST_SIZE], char out[SHA1_DIGEST_SIZE * 2 + 1]) {
+    static const char hex[] = "0123456789abcdef";
+    for (int i = 0; i < SHA1_DIGEST_SIZE; ++i) {
+        out[i * 2] = hex[digest[i] >> 4];
+        out[i * 2 + 1] = hex[digest[i] & 0x0F];
+    }
+    out[SHA1_DIGEST_SIZE * 2] = '\0';
+}
+
+/* Case-insensitive FNV-1a of a file name (DAT names are matched like DOS names) */
+static uint64_t dat_name_hash(const char* name) {
+    uint64_t h = FNV1A64_OFFSET_BASIS;
+    for (; *name; ++name) {
+        uint8_t c = (uint8_t)tolower((unsigned char)*name);
+        h = fnv1a64_update(h, &c, 1);
+    }
+    return h;
+}
+
+static uint64_t dat_digest_hash(const uint8_t digest[SHA1_DIGEST_SIZE]) {
+    uint64_t h;
+    memcpy(&h, digest, sizeof(h)); /* SHA-1 output is already uniformly distributed */
+    return h;
+}
+
+/* Insert entry index 'idx' into an open-addressing table of size mask+1 (slots hold idx+1, 0 = empty) */
+static void dat_table_insert(uint32_t* table, size_t mask, uint64_t hash, uint32_t idx) {
+    size_t slot = (size_t)hash & mask;
+    while (table[slot] != 0) slot = (slot + 1) & mask;
+    table[slot] = idx + 1;
+}
+
+/*
+ * Parse a line-based list. Each non-blank line not starting with '#' or ';' is
+ *     <sha1-hex> <TAB> <file name> [<TAB> <title>]
+ * or sha1sum output ("<sha1-hex>  <file name>"), in which case the title is
+ * the file name. Lines are tokenized in place.
+ */
+static void dat_parse_lines(ImdChkDat* dat, const char* path) {
+    int line_no = 0;
+    for (char* line = dat->text; line && *line; ) {
+        char* next = strchr(line, '\n');
+        char* name;
+        char* title;
+        ImdChkDatEntry* e = &dat->entries[dat->count];
+        if (next) *next++ = '\0';
+        line_no++;
+
+        size_t line_len = strlen(line);
+        while (line_len > 0 && (line[line_len - 1] == '\r' || line[line_len - 1] == ' ' || line[line_len - 1] == '\t')) line[--line_len] = '\0';
+        if (line_len == 0 || line[0] == '#' || line[0] == ';') { line = next; continue; }
+
+        if (line_len < SHA1_DIGEST_SIZE * 2 + 2 || !parse_sha1_hex(line, e->digest) ||
+            (line[SHA1_DIGEST_SIZE * 2] != ' ' && line[SHA1_DIGEST_SIZE * 2] != '\t')) {
+            imd_report(IMD_REPORT_LEVEL_WARNING, "%s:%d: Skipping malformed DAT line.", path, line_no);
+            line = next;
+            continue;
+        }
+        name = line + SHA1_DIGEST_SIZE * 2;
+        while (*name == ' ' || *name == '\t') name++;
+        if (*name == '*') name++; /* sha1sum binary-mode marker */
+        title = strchr(name, '\t');
+        if (title) {
+            *title++ = '\0';
+            while (*title == ' ' || *title == '\t') title++;
+        }
+        e->name = imd_get_basename(name);
+        e->title = (title && *title) ? title : e->name;
+        dat->count++;
+        line = next;
+    }
+}
+
+/* Decode the predefined XML entities of an attribute value in place */
+static void dat_xml_unescape(char* s) {
+    static const struct { const char* entity; char c; } entities[] = {
+        { "&amp;", '&' }, { "&lt;", '<' }, { "&gt;", '>' }, { "&quot;", '"' }, { "&apos;", '\'' }
+    };
+    char* out = s;
+    while (*s) {
+        size_t i;
+        for (i = 0; *s == '&' && i < sizeof(entities) / sizeof(entities[0]); ++i) {
+            size_t n = strlen(entities[i].entity);
+            if (strncmp(s, entities[i].entity, n) == 0) { *out++ = entities[i].c; s += n; break; }
+        }
+        if (*s != '&' || i == sizeof(entities) / sizeof(entities[0])) *out++ = *s++;
+    }
+    *out = '\0';
+}
+
+/* Does the NUL-terminated tag body start with element 'name'? */
+static int dat_xml_is_element(const char* tag, const char* name) {
+    size_t n = strlen(name);
+    return strncmp(tag, name, n) == 0 && (tag[n] == '\0' || tag[n] == '/' || isspace((unsigned char)tag[n]));
+}
+
+/* Pick the name and sha1 attributes out of a NUL-terminated tag body, terminating values in place */
+static void dat_xml_attrs(char* s, char** name, char** sha1) {
+    *name = NULL;
+    *sha1 = NULL;
+    while (*s && !isspace((unsigned char)*s)) s++; /* Element name */
+    for (;;) {
+        char* key;
+        char* value;
+        char* close;
+        size_t key_len;
+        while (*s == '/' || isspace((unsigned char)*s)) s++;
+        if (*s == '\0') return;
+        key = s;
+        while (*s && *s != '=' && !isspace((unsigned char)*s)) s++;
+        key_len = (size_t)(s - key);
+        while (isspace((unsigned char)*s)) s++;
+        if (*s++ != '=') return;
+        while (isspace((unsigned char)*s)) s++;
+        if (*s != '"' && *s != '\'') return;
+        value = s + 1;
+        close = strchr(value, *s);
+        if (!close) return;
+        *close = '\0';
+        s = close + 1;
+        dat_xml_unescape(value);
+        if (key_len == 4 && strncmp(key, "name", 4) == 0) *name = value;
+        else if (key_len == 4 && strncmp(key, "sha1", 4) == 0) *sha1 = value;
+    }
+}
+
+/*
+ * Parse a Logiqx XML DAT (the format used by No-Intro, TOSEC and Redump):
+ *     <game name="Title"> <rom name="disk.imd" size=".." sha1=".."/> </game>
+ * ("machine" is accepted for "game"). Each rom with a SHA-1 becomes one
+ * entry titled by its game. Tags are tokenized in place.
+ */
+static void dat_parse_xml(ImdChkDat* dat, const char* path) {
+    const char* title = NULL;
+    size_t no_sha1 = 0;
+    char* p = dat->text;
+
+    while ((p = strchr(p, '<')) != NULL) {
+        char* tag = p + 1;
+        char* end;
+        char* name;
+        char* sha1;
+        if (strncmp(tag, "!--", 3) == 0) {
+            p = strstr(tag + 3, "-->");
+            if (!p) break;
+            p += 3;
+            continue;
+        }
+        for (end = tag; *end && *end != '>'; ++end) {
+            if (*end == '"' || *end == '\'') {
+                char* close = strchr(end + 1, *end);
+                if (!close) break;
+                end = close;
             }
-            else { fprintf(stderr, "Error: Option %s requires N.\n", argv[i - 1]); return -1; }
         }
-        else if (strcmp(argv[i], "--sectors") == 0 || strcmp(argv[i], "-s") == 0) {
-            if (++i < argc) { if (!parse_long_arg(argv[i - 1], argv[i], &g_options.max_allowed_sectors)) return -1; }
-            else { fprintf(stderr, "Error: Option %s requires N.\n", argv[i - 1]); return -1; }
+        if (*end != '>') break;
+        *end = '\0';
+        p = end + 1;
+
+        if (dat_xml_is_element(tag, "game") || dat_xml_is_element(tag, "machine")) {
+            dat_xml_attrs(tag, &name, &sha1);
+            title = name;
         }
-        else if (argv[i][0] == '-' && argv[i][1] != '\0') {
-            fprintf(stderr, "Error: Unknown option '%s'\n", argv[i]); print_usage(prog_name); return -1;
+        else if (dat_xml_is_element(tag, "/game") || dat_xml_is_element(tag, "/machine")) {
+            title = NULL;
+        }
+        else if (dat_xml_is_element(tag, "rom")) {
+            ImdChkDatEntry* e = &dat->entries[dat->count];
+            dat_xml_attrs(tag, &name, &sha1);
+            if (!name || !sha1 || strlen(sha1) != SHA1_DIGEST_SIZE * 2 || !parse_sha1_hex(sha1, e->digest)) {
+                no_sha1++;
+                continue;
+            }
+            e->name = imd_get_basename(name);
+            e->title = (title && *title) ? title : e->name;
+            dat->count++;
         }
-        else if (input_filename == NULL) { input_filename = argv[i]; }
-        else { fprintf(stderr, "Error: Too many input files ('%s').\n", argv[i]); print_usage(prog_name); return -1; }
     }
-    /* Update reporting verbosity based on parsed args (final check) */
-    imd_set_verbosity(g_quiet_mode, g_verbose_mode);
+    if (no_sha1 > 0) {
+        imd_report(IMD_REPORT_LEVEL_WARNING, "%s: Skipped %zu rom entries without a name or SHA-1.", path, no_sha1);
+    }
+}
+
+/*
+ * Load a known-good list: a Logiqx XML DAT, or a line-based list (see
+ * dat_parse_lines). The file is read once and tokenized in place.
+ * Returns 0 on success, -1 on error (including a list with no usable entries).
+ */
+int dat_load(ImdChkDat* dat, const char* path) {
+    FILE* f = NULL;
+    long len;
+    size_t entry_estimate = 1;
+    const char* first;
+    memset(dat, 0, sizeof(*dat));
+
+    f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "Error: Cannot open DAT file '%s': %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (fseek(f, 0, SEEK_END) != 0 || (len = ftell(f)) < 0 || fseek(f, 0, SEEK_SET) != 0) {
+        fprintf(stderr, "Error: Cannot determine size of DAT file '%s'.\n", path);
+        fclose(f);
+        return -1;
+    }
+    dat->text = (char*)malloc((size_t)len + 1);
+    if (!dat->text || fread(dat->text, 1, (size_t)len, f) != (size_t)len) {
+        fprintf(stderr, "Error: Failed to read DAT file '%s'.\n", path);
+        fclose(f);
+        dat_free(dat);
+        return -1;
+    }
+    fclose(f);
+    dat->text[len] = '\0';
+
+    /* One entry per line or per tag at most */
+    for (long i = 0; i < len; ++i) if (dat->text[i] == '\n' || dat->text[i] == '<') entry_estimate++;
+    dat->entries = (ImdChkDatEntry*)malloc(entry_estimate * sizeof(ImdChkDatEntry));
+    if (!dat->entries) goto alloc_fail;
+
+    first = dat->text;
+    if (strncmp(first, "\xEF\xBB\xBF", 3) == 0) first += 3; /* UTF-8 byte order mark */
+    while (isspace((unsigned char)*first)) first++;
+    if (*first == '<') dat_parse_xml(dat, path);
+    else dat_parse_lines(dat, path);
+
+    if (dat->count == 0) {
+        fprintf(stderr, "Error: No entries found in DAT file '%s'. Expected a Logiqx XML DAT,\n"
+            "       sha1sum output, or '<sha1> TAB <file name> [TAB <title>]' lines.\n", path);
+        dat_free(dat);
+        return -1;
+    }
+
+    /* Two tables: by digest (verification) and by file name (mismatch detection) */
+    dat->table_mask = 1;
+    while (dat->table_mask < dat->count * 2) dat->table_mask <<= 1;
+    dat->table_mask--;
+    dat->by_digest = (uint32_t*)calloc(dat->table_mask + 1, sizeof(uint32_t));
+    dat->by_name = (uint32_t*)calloc(dat->table_mask + 1, sizeof(uint32_t));
+    if (!dat->by_digest || !dat->by_name) goto alloc_fail;
+    for (size_t i = 0; i < dat->count; ++i) {
+        dat_table_insert(dat->by_digest, dat->table_mask, dat_digest_hash(dat->entries[i].digest), (uint32_t)i);
+        dat_table_insert(dat->by_name, dat->table_mask, dat_name_hash(dat->entries[i].name), (uint32_t)i);
+    }
+    return 0;
+
+alloc_fail:
+    fprintf(stderr, "Error: Memory allocation failed for DAT file '%s'.\n", path);
+    dat_free(dat);
+    return -1;
+}
+
+void dat_free(ImdChkDat* dat) {
+    free(dat->by_name);
+    free(dat->by_digest);
+    free(dat->entries);
+    free(dat->text);
+    memset(dat, 0, sizeof(*dat));
+}
+
+static const ImdChkDatEntry* dat_find_digest(const ImdChkDat* dat, const uint8_t digest[SHA1_DIGEST_SIZE]) {
+    if (dat->count == 0) return NULL;
+    for (size_t slot = (size_t)dat_digest_hash(digest) & dat->table_mask; dat->by_digest[slot] != 0; slot = (slot + 1) & dat->table_mask) {
+        const ImdChkDatEntry* e = &dat->entries[dat->by_digest[slot] - 1];
+        if (memcmp(e->digest, digest, SHA1_DIGEST_SIZE) == 0) return e;
+    }
+    return NULL;
+}
 
-    if (input_filename == NULL) { fprintf(stderr, "Error: Input file not specified.\n"); print_usage(prog_name); return -1; }
+static const ImdChkDatEntry* dat_find_name(const ImdChkDat* dat, const char* name) {
+    if (dat->count == 0) return NULL;
+    for (size_t slot = (size_t)dat_name_hash(name) & dat->table_mask; dat->by_name[slot] != 0; slot = (slot + 1) & dat->table_mask) {
+        const ImdChkDatEntry* e = &dat->entries[dat->by_name[slot] - 1];
+        const char* a = e->name;
+        const char* b = name;
+        while (*a && tolower((unsigned char)*a) == tolower((unsigned char)*b)) { a++; b++; }
+        if (*a == '\0' && *b == '\0') return e;
+    }
+    return NULL;
+}
+
+/* SHA-1 of the whole file, byte for byte (matches sha1sum) */
+static int hash_file_content(const char* filename, uint8_t digest[SHA1_DIGEST_SIZE]) {
+    uint8_t buf[65536];
+    size_t n;
+    Sha1Context ctx;
+    FILE* f = fopen(filename, "rb");
+    if (!f) return -1;
+    sha1_init(&ctx);
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) sha1_update(&ctx, buf, n);
+    int read_error = ferror(f);
+    fclose(f);
+    if (read_error) return -1;
+    sha1_final(&ctx, digest);
+    return 0;
+}
+
+/*
+ * SHA-1 of the decoded track content only. The header line and comment are
+ * skipped, and sectors are hashed expanded, so re-compressing an image
+ * (imdu -C / -U) or editing its comment does not change the hash.
+ */
+static int hash_track_content(const char* filename, uint8_t digest[SHA1_DIGEST_SIZE]) {
+    ImdHeaderInfo header_info = { 0 };
+    ImdTrackInfo track = { 0 };
+    Sha1Context ctx;
+    int result = -1;
+    FILE* f = fopen(filename, "rb");
+    if (!f) return -1;
+
+    if (imd_read_file_header(f, &header_info, NULL, 0) != 0 || imd_skip_comment_block(f) != 0) goto cleanup;
+
+    sha1_init(&ctx);
+    for (;;) {
+        int status = imd_load_track(f, &track, LIBIMD_FILL_BYTE_DEFAULT);
+        if (status == 0) break;
+        if (status < 0) { imd_free_track_data(&track); goto cleanup; }
+
+        uint8_t geom[5] = { track.mode, track.cyl, track.head, track.num_sectors, track.sector_size_code };
+        sha1_update(&ctx, geom, sizeof(geom));
+        sha1_update(&ctx, track.smap, track.num_sectors);
+        if (track.hflag & IMD_HFLAG_CMAP_PRES) sha1_update(&ctx, track.cmap, track.num_sectors);
+        if (track.hflag & IMD_HFLAG_HMAP_PRES) sha1_update(&ctx, track.hmap, track.num_sectors);
+        for (uint8_t i = 0; i < track.num_sectors; ++i) {
+            /* Keep availability, deleted-DAM and error state; drop the compressed bit */
+            uint8_t state = (uint8_t)((IMD_SDR_HAS_DATA(track.sflag[i]) ? 1 : 0) |
+                (IMD_SDR_HAS_DAM(track.sflag[i]) ? 2 : 0) | (IMD_SDR_HAS_ERR(track.sflag[i]) ? 4 : 0));
+            sha1_update(&ctx, &state, 1);
+            if (IMD_SDR_HAS_DATA(track.sflag[i])) {
+                sha1_update(&ctx, track.data + (size_t)i * track.sector_size, track.sector_size);
+            }
+        }
+        imd_free_track_data(&track);
+    }
+    sha1_final(&ctx, digest);
+    result = 0;
+
+cleanup:
+    fclose(f);
+    return result;
+}
+
+/* Hash a file and classify it against the DAT. Returns the verdict, or -1 if the file could not be hashed. */
+int dat_verify_file(const ImdChkDat* dat, const char* filename, int track_hash, ImdChkDatResult* result) {
+    memset(result, 0, sizeof(*result));
+    if ((track_hash ? hash_track_content(filename, result->digest) : hash_file_content(filename, result->digest)) != 0) {
+        return -1;
+    }
+    result->entry = dat_find_digest(dat, result->digest);
+    if (result->entry) {
+        result->verdict = DAT_VERIFIED;
+    }
+    else {
+        const char* base = imd_get_basename(filename);
+        result->entry = dat_find_name(dat, base ? base : filename);
+        result->verdict = result->entry ? DAT_MISMATCH : DAT_UNKNOWN;
+    }
+    return result->verdict;
+}
+
+void report_dat_result(const char* filename, const ImdChkDatResult* result) {
+    char hex[SHA1_DIGEST_SIZE * 2 + 1];
+    char expected_hex[SHA1_DIGEST_SIZE * 2 + 1];
+    const char* base = imd_get_basename(filename);
+    format_sha1_hex(result->digest, hex);
+
+    switch (result->verdict) {
+    case DAT_VERIFIED:
+        printf("DAT: VERIFIED  %s\n", result->entry->title);
+        break;
+    case DAT_MISMATCH:
+        format_sha1_hex(result->entry->digest, expected_hex);
+        printf("DAT: MISMATCH  %s (expected %s, got %s)\n", result->entry->title, expected_hex, hex);
+        break;
+    default:
+        /* Print a ready-to-append DAT line for images not yet listed */
+        printf("DAT: UNKNOWN   %s\t%s\n", hex, base ? base : filename);
+        break;
+    }
+}
+
+/* --- Resync Scanner (recovery after CHECK_BIT_TRACK_READ) --- */
+
+/*
+ * Parse one track record at buf[pos] without trusting anything: every map and
+ * sector record must fit in the remaining bytes. Returns the record length,
+ * or 0 if no complete, well-formed track record starts at pos.
+ */
+static size_t resync_parse_track(const uint8_t* buf, size_t len, size_t pos, ImdChkResyncTrack* track) {
+    size_t size_count;
+    const uint32_t* sizes = imd_get_sector_size_lookup(&size_count);
+    size_t p = pos + 5;
+    uint8_t mode, head_byte, num_sectors, size_code;
+    uint32_t sector_size;
+
+    if (pos + 5 > len) return 0;
+    mode = buf[pos];
+    head_byte = buf[pos + 2];
+    num_sectors = buf[pos + 3];
+    size_code = buf[pos + 4];
+    if (mode >= LIBIMD_NUM_MODES || (head_byte & 0x0F) > 1 || (head_byte & 0x30) != 0 ||
+        !sizes || size_code >= size_count) return 0;
+    sector_size = sizes[size_code];
+
+    p += num_sectors;                                           /* Sector numbering map */
+    if (head_byte & IMD_HFLAG_CMAP_PRES) p += num_sectors;      /* Cylinder map */
+    if (head_byte & IMD_HFLAG_HMAP_PRES) p += num_sectors;      /* Head map */
+    if (p > len) return 0;
+
+    for (uint8_t i = 0; i < num_sectors; ++i) {
+        uint8_t sflag;
+        if (p >= len) return 0;
+        sflag = buf[p++];
+        if (sflag > IMD_SDR_COMPRESSED_DEL_ERR) return 0;
+        if (sflag == IMD_SDR_UNAVAILABLE) continue;
+        p += IMD_SDR_IS_COMPRESSED(sflag) ? 1 : sector_size;
+        if (p > len) return 0;
+    }
+
+    track->offset = pos;
+    track->length = p - pos;
+    track->mode = mode;
+    track->cyl = buf[pos + 1];
+    track->head = (uint8_t)(head_byte & 0x0F);
+    track->num_sectors = num_sectors;
+    track->sector_size = sector_size;
+    return track->length;
+}
+
+/* Cheap first-stage filter on the five fixed header bytes */
+static int resync_is_candidate(const uint8_t* buf, size_t len, size_t pos, int max_cyl) {
+    if (pos + 5 > len) return 0;
+    return buf[pos] < LIBIMD_NUM_MODES &&
+        buf[pos + 1] <= max_cyl &&
+        (buf[pos + 2] & 0x3E) == 0 &&               /* Head 0/1, only the map flags may be set */
+        buf[pos + 3] != 0 &&
+        buf[pos + 4] <= 6;
+}
+
+/*
+ * Second stage: the record must parse, be plausible in sequence, and be followed by EOF or another candidate.
+ * Cylinders only have to rise per head, so images that store all of side 0 before side 1 still resync.
+ */
+static size_t resync_validate(const uint8_t* buf, size_t len, size_t pos, int max_cyl, const int min_cyl[2], ImdChkResyncTrack* track) {
+    uint8_t seen[256];
+    size_t n = resync_parse_track(buf, len, pos, track);
+    if (n == 0 || track->cyl < min_cyl[track->head]) return 0;
+    memset(seen, 0, sizeof(seen));
+    for (uint8_t i = 0; i < track->num_sectors; ++i) {
+        uint8_t id = buf[pos + 5 + i];
+        if (seen[id]) return 0;                     /* Duplicate sector IDs: almost certainly not a header */
+        seen[id] = 1;
+    }
+    if (pos + n != len && !resync_is_candidate(buf, len, pos + n, max_cyl)) return 0;
+    return n;
+}
+
+/*
+ * Walk the track records of a damaged file and, at each record that fails to
+ * parse, scan forward for the next plausible track header. Every track that
+ * can be read (before and after the damage) is recorded in *scan.
+ * Returns 0 on success, -1 if the file could not be read.
+ */
+int resync_scan_file(const char* filename, const ImdChkOptions* options, ImdChkResyncScan* scan) {
+    uint8_t* buf = NULL;
+    const uint8_t* comment_end;
+    size_t len, pos;
+    long file_len;
+    int max_cyl = (options->max_allowed_cyl >= 0 && options->max_allowed_cyl < 255) ? (int)options->max_allowed_cyl : RESYNC_DEFAULT_MAX_CYL;
+    int last_cyl[2] = { 0, 0 }; /* Per head */
+    int result = -1;
+    FILE* f;
+
+    memset(scan, 0, sizeof(*scan));
+    f = fopen(filename, "rb");
+    if (!f) return -1;
+    if (fseek(f, 0, SEEK_END) != 0 || (file_len = ftell(f)) < 0 || fseek(f, 0, SEEK_SET) != 0) goto cleanup;
+    len = (size_t)file_len;
+    buf = (uint8_t*)malloc(len ? len : 1);
+    if (!buf || fread(buf, 1, len, f) != len) goto cleanup;
+
+    comment_end = (const uint8_t*)memchr(buf, LIBIMD_COMMENT_EOF_MARKER, len);
+    if (!comment_end) goto cleanup;
+    pos = (size_t)(comment_end - buf) + 1;
+
+    while (pos < len) {
+        ImdChkResyncTrack track;
+        size_t n = resync_parse_track(buf, len, pos, &track);
+        if (n == 0) {
+            /* Damage: look for the next plausible header */
+            size_t q;
+            ImdChkResyncRegion* region;
+            if (scan->region_count == RESYNC_MAX_REGIONS) break;
+            region = &scan->regions[scan->region_count++];
+            region->damage_offset = pos;
+            region->resume_offset = len;
+            region->tracks_before = scan->track_count;
+            for (q = pos + 1; q < len; ++q) {
+                if (!resync_is_candidate(buf, len, q, max_cyl)) continue;
+                n = resync_validate(buf, len, q, max_cyl, last_cyl, &track);
+                if (n != 0) break;
+            }
+            if (q >= len) break;    /* Nothing recoverable after this point */
+            region->resume_offset = q;
+            pos = q;
+        }
+        if (scan->track_count == scan->track_capacity) {
+            size_t new_capacity = scan->track_capacity ? scan->track_capacity * 2 : 256;
+            ImdChkResyncTrack* grown = (ImdChkResyncTrack*)realloc(scan->tracks, new_capacity * sizeof(ImdChkResyncTrack));
+            if (!grown) goto cleanup;
+            scan->tracks = grown;
+            scan->track_capacity = new_capacity;
+        }
+        scan->tracks[scan->track_count++] = track;
+        last_cyl[track.head] = track.cyl;
+        pos += n;
+    }
+    result = 0;
+
+cleanup:
+    free(buf);
+    fclose(f);
+    return result;
+}
+
+void resync_free(ImdChkResyncScan* scan) {
+    free(scan->tracks);
+    memset(scan, 0, sizeof(*scan));
+}
+
+void report_resync(const char* filename, const ImdChkResyncScan* scan) {
+    size_t next_track = 0;
+    size_t recovered = 0;
+
+    if (g_quiet_mode) {
+        /* One line per damaged file: every track after the first damaged region was recovered */
+        if (scan->region_count > 0) {
+            printf("%s: %lu tracks recoverable\n", filename, (unsigned long)(scan->track_count - scan->regions[0].tracks_before));
+        }
+        return;
+    }
+
+    printf("\n--- Resync Scan ---\n");
+    if (scan->region_count == 0) {
+        printf("No damaged track records found by the resync scan.\n");
+        return;
+    }
+    for (int r = 0; r < scan->region_count; ++r) {
+        const ImdChkResyncRegion* region = &scan->regions[r];
+        size_t end = (r + 1 < scan->region_count) ? scan->regions[r + 1].tracks_before : scan->track_count;
+        next_track = region->tracks_before;
+
+        printf("Damaged record at offset 0x%06lX", (unsigned long)region->damage_offset);
+        if (next_track > 0) {
+            printf(" (after Cyl %u Head %u)", scan->tracks[next_track - 1].cyl, scan->tracks[next_track - 1].head);
+        }
+        if (next_track == end) {
+            printf(": no plausible track header follows.\n");
+            continue;
+        }
+        printf(": resynchronized at 0x%06lX (%lu bytes skipped)\n",
+            (unsigned long)region->resume_offset, (unsigned long)(region->resume_offset - region->damage_offset));
+        for (; next_track < end; ++next_track) {
+            const ImdChkResyncTrack* t = &scan->tracks[next_track];
+            printf("  Recovered: Cyl %2u Head %u  Mode %u  %3u x %5u bytes  at 0x%06lX\n",
+                t->cyl, t->head, t->mode, t->num_sectors, (unsigned)t->sector_size, (unsigned long)t->offset);
+            recovered++;
+        }
+    }
+    printf("Recovered %lu track(s) after %d damaged region(s).\n", (unsigned long)recovered, scan->region_count);
+}
+
+/* Check a single file, report the results and return its exit code (-1, 0 or 1) */
+int check_file(const char* input_filename, ImdChkAudit* audit) {
+    int final_exit_code = 0; /* 0 or 1 based on checks and mask */
+    ImdChkResults results;
 
     /* Print sign-on message */
     if (!g_quiet_mode) {
-        print_version_info(stdout);
         printf("\nChecking IMD file: %s\n", input_filename);
         printf("Error Mask: 0x%04X\n", g_options.error_mask);
         if (g_options.max_allowed_cyl != -1) printf("Constraint: Max Cylinder <= %ld\n", g_options.max_allowed_cyl);
         if (g_options.required_head != -1) printf("Constraint: Head == %ld\n", g_options.required_head);
         if (g_options.max_allowed_sectors != -1) printf("Constraint: Sectors <= %ld\n", g_options.max_allowed_sectors);
         if (g_options.max_allowed_cyl != -1 || g_options.required_head != -1 || g_options.max_allowed_sectors != -1 || g_options.error_mask != DEFAULT_ERROR_MASK) printf("\n");
-        printf("Scanning tracks...\n");
     }
 
-    /* Call the library function to perform checks */
-    int check_status = imdchk_check_file(input_filename, &g_options, &results);
+    /* Call the library function to perform checks (through the results cache if enabled) */
+    int check_status;
+    if (g_cache_path) {
+        int cached = 0;
+        check_status = cache_check_file(&g_cache, input_filename, &g_options, &results, &cached);
+        if (!g_quiet_mode) printf(cached ? "Using cached results (file unchanged).\n" : "Scanning tracks...\n");
+    }
+    else {
+        if (!g_quiet_mode) printf("Scanning tracks...\n");
+        check_status = imdchk_check_file(input_filename, &g_options, &results);
+    }
 
     if (check_status != 0) {
         fprintf(stderr, "Error: Failed to open or process file '%s'.\n", input_filename);
         /* Always print failure mask even on critical error */
         fprintf(stderr, "FINAL_FAILURE_MASK: 0x%04X\n", results.check_failures_mask);
+        if (audit) audit->status = -1; /* Not audited; keep it out of the summary */
         return -1; /* Indicate critical file/processing error */
     }
 
     /* Report results based on the returned structure */
     report_results(input_filename, &g_options, &results);
 
+    /* The library stops at the first unreadable track; look for intact tracks beyond it */
+    if (results.check_failures_mask & CHECK_BIT_TRACK_READ) {
+        ImdChkResyncScan scan;
+        if (resync_scan_file(input_filename, &g_options, &scan) == 0) report_resync(input_filename, &scan);
+        else imd_report(IMD_REPORT_LEVEL_WARNING, "Resync scan of '%s' failed.", input_filename);
+        resync_free(&scan);
+    }
+
+    if (audit) {
+        audit_file(input_filename, audit);
+        report_audit(audit);
+    }
+
+    int dat_mismatch = 0;
+    if (g_dat_path) {
+        ImdChkDatResult dat_result;
+        if (dat_verify_file(&g_dat, input_filename, g_dat_track_hash, &dat_result) < 0) {
+            imd_report(IMD_REPORT_LEVEL_WARNING, "Could not hash '%s' for DAT verification.", input_filename);
+        }
+        else {
+            g_dat_counts[dat_result.verdict]++;
+            dat_mismatch = (dat_result.verdict == DAT_MISMATCH);
+            if (!g_quiet_mode) {
+                report_dat_result(input_filename, &dat_result);
+            }
+            else if (dat_result.verdict != DAT_VERIFIED) {
+                /* Quiet mode still names every file that did not verify */
+                printf("%s: ", input_filename);
+                report_dat_result(input_filename, &dat_result);
+            }
+        }
+    }
+
     /* Determine final exit code (0 or 1) */
 //    if ((results.checks_performed_mask & results.check_failures_mask & g_options.error_mask) != 0) {
         final_exit_code = 1; /* At least one failure was considered an error */
@@ -290,6 +1577,7 @@ int main(int argc, char* argv[]) {
 //    else {
 //        final_exit_code = 0; /* No failures or only warnings */
 //    }
+    if (dat_mismatch) final_exit_code = 1; /* A listed image with the wrong hash is a bad dump */
 
     /* Always print the raw failure mask to stderr */
     fprintf(stderr, "FINAL_FAILURE_MASK: 0x%04X\n", results.check_failures_mask);
@@ -311,3 +1599,472 @@ int main(int argc, char* argv[]) {
 
     return final_exit_code;
 }
+
+/* --- Directory Watch Mode --- */
+
+#ifdef IMDCHK_HAVE_WATCH
+
+/* File whose debounce interval has not yet expired */
+typedef struct {
+    char name[WATCH_MAX_PATH];
+    uint64_t due_ms;
+} WatchPending;
+
+/* Bounded queue of files handed to the worker pool */
+typedef struct {
+    char paths[WATCH_QUEUE_DEPTH][WATCH_MAX_PATH];
+    int head;
+    int count;
+    int shutdown;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} WatchQueue;
+
+static WatchQueue g_watch_queue;
+static pthread_mutex_t g_watch_output_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE* g_watch_log_file = NULL;
+static volatile sig_atomic_t g_watch_stop = 0;
+
+static void watch_signal_handler(int sig) {
+    (void)sig;
+    g_watch_stop = 1;
+}
+
+static uint64_t watch_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)(ts.tv_nsec / 1000000);
+}
+
+/* Only complete, visible .imd files are checked; dot-files are in-flight temporaries */
+static int watch_name_is_candidate(const char* name) {
+    size_t len = strlen(name);
+    if (len < 5 || name[0] == '.') return 0;
+    return tolower((unsigned char)name[len - 4]) == '.' &&
+        tolower((unsigned char)name[len - 3]) == 'i' &&
+        tolower((unsigned char)name[len - 2]) == 'm' &&
+        tolower((unsigned char)name[len - 1]) == 'd';
+}
+
+static void watch_queue_push(WatchQueue* q, const char* path) {
+    pthread_mutex_lock(&q->lock);
+    while (q->count == WATCH_QUEUE_DEPTH && !q->shutdown) {
+        pthread_cond_wait(&q->not_full, &q->lock);
+    }
+    if (!q->shutdown) {
+        int tail = (q->head + q->count) % WATCH_QUEUE_DEPTH;
+        snprintf(q->paths[tail], WATCH_MAX_PATH, "%s", path);
+        q->count++;
+        pthread_cond_signal(&q->not_empty);
+    }
+    pthread_mutex_unlock(&q->lock);
+}
+
+/* Returns 1 with path filled in, or 0 once the queue is shut down and drained */
+static int watch_queue_pop(WatchQueue* q, char* path) {
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0 && !q->shutdown) {
+        pthread_cond_wait(&q->not_empty, &q->lock);
+    }
+    if (q->count == 0) {
+        pthread_mutex_unlock(&q->lock);
+        return 0;
+    }
+    memcpy(path, q->paths[q->head], WATCH_MAX_PATH);
+    q->head = (q->head + 1) % WATCH_QUEUE_DEPTH;
+    q->count--;
+    pthread_cond_signal(&q->not_full);
+    pthread_mutex_unlock(&q->lock);
+    return 1;
+}
+
+/*
+ * Move a failed image into the quarantine directory; returns 0 or the errno.
+ * An earlier image with the same name is kept: the new one gets a -N suffix
+ * before its extension. The name is claimed with O_EXCL first, so workers
+ * quarantining at the same time cannot pick the same one.
+ */
+static int watch_quarantine_file(const char* path, char* dest, size_t dest_size) {
+    const char* base = imd_get_basename(path);
+    const char* ext;
+    int len;
+
+    if (!base) base = path;
+    ext = strrchr(base, '.');
+    if (!ext || ext == base) ext = base + strlen(base);
+    for (int n = 0; n <= WATCH_MAX_QUARANTINE_SUFFIX; ++n) {
+        int fd;
+        if (n == 0) len = snprintf(dest, dest_size, "%s/%s", g_watch_quarantine, base);
+        else len = snprintf(dest, dest_size, "%s/%.*s-%d%s", g_watch_quarantine, (int)(ext - base), base, n, ext);
+        if (len < 0 || (size_t)len >= dest_size) return ENAMETOOLONG;
+        fd = open(dest, O_WRONLY | O_CREAT | O_EXCL, 0600);
+        if (fd < 0) {
+            if (errno == EEXIST) continue;
+            return errno;
+        }
+        close(fd);
+        if (rename(path, dest) != 0) {
+            int err = errno;
+            unlink(dest);
+            return err;
+        }
+        return 0;
+    }
+    return EEXIST;
+}
+
+/* Check one file and emit a single result line (workers run this concurrently) */
+static void watch_check_one(const char* path) {
+    ImdChkResults results;
+    ImdChkAudit audit;
+    char quarantine_path[WATCH_MAX_PATH + 256] = "";
+    char timestamp[32];
+    const char* verdict;
+    int failed;
+    int quarantined = 0;
+    int quarantine_errno = 0;
+    time_t now = time(NULL);
+    struct tm tm_now;
+
+    memset(&results, 0, sizeof(results));
+    int check_status = imdchk_check_file(path, &g_options, &results);
+    failed = (check_status != 0) || (results.check_failures_mask & g_options.error_mask) != 0;
+    verdict = (check_status != 0) ? "ERROR" : (failed ? "FAIL" : "OK");
+
+    if (g_audit_mode && check_status == 0) audit_file(path, &audit);
+
+    if (failed && g_watch_quarantine) {
+        quarantine_errno = watch_quarantine_file(path, quarantine_path, sizeof(quarantine_path));
+        quarantined = (quarantine_errno == 0);
+    }
+
+    localtime_r(&now, &tm_now);
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%S", &tm_now);
+
+    pthread_mutex_lock(&g_watch_output_lock);
+    FILE* out = g_watch_log_file ? g_watch_log_file : stdout;
+    if (g_watch_log_file || !g_quiet_mode) {
+        fprintf(out, "%s %-5s 0x%04X %s", timestamp, verdict, results.check_failures_mask, path);
+        if (g_audit_mode && check_status == 0 && audit.status == 0) fprintf(out, " saved=%llu", audit.bytes_saved);
+        if (quarantined) fprintf(out, " -> %s", quarantine_path);
+        else if (failed && g_watch_quarantine) fprintf(out, " (quarantine failed: %s)", strerror(quarantine_errno));
+        fprintf(out, "\n");
+        fflush(out);
+    }
+    pthread_mutex_unlock(&g_watch_output_lock);
+}
+
+static void* watch_worker(void* arg) {
+    char path[WATCH_MAX_PATH];
+    (void)arg;
+    while (watch_queue_pop(&g_watch_queue, path)) {
+        watch_check_one(path);
+    }
+    return NULL;
+}
+
+/* Record (or re-arm) the debounce deadline for a file name in dir */
+static void watch_pending_touch(WatchPending* pending, int* pending_count, const char* dir, const char* name, uint64_t due_ms) {
+    for (int i = 0; i < *pending_count; ++i) {
+        if (strcmp(pending[i].name, name) == 0) {
+            pending[i].due_ms = due_ms;
+            return;
+        }
+    }
+    if (*pending_count == WATCH_MAX_PENDING) {
+        /* Table full: hand the oldest entry to the workers now */
+        int oldest = 0;
+        for (int i = 1; i < *pending_count; ++i) {
+            if (pending[i].due_ms < pending[oldest].due_ms) oldest = i;
+        }
+        char path[WATCH_MAX_PATH + 1];
+        snprintf(path, sizeof(path), "%s/%s", dir, pending[oldest].name);
+        watch_queue_push(&g_watch_queue, path);
+        pending[oldest] = pending[--(*pending_count)];
+    }
+    snprintf(pending[*pending_count].name, WATCH_MAX_PATH, "%s", name);
+    pending[*pending_count].due_ms = due_ms;
+    (*pending_count)++;
+}
+
+/*
+ * Watch a directory with inotify and check each .imd file once, as soon as
+ * it has been closed after writing (IN_CLOSE_WRITE) or moved in (IN_MOVED_TO).
+ * Events for the same file within the debounce interval are merged.
+ * Runs until interrupted (SIGINT/SIGTERM). Returns 0 on clean exit, -1 on error.
+ */
+int watch_directory(const char* dir) {
+    pthread_t workers[WATCH_MAX_JOBS];
+    int worker_count = 0;
+    WatchPending* pending = NULL;
+    int pending_count = 0;
+    char event_buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int result = -1;
+    int fd, wd;
+
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Error: inotify_init1 failed: %s\n", strerror(errno));
+        return -1;
+    }
+    wd = inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (wd < 0) {
+        fprintf(stderr, "Error: Cannot watch directory '%s': %s\n", dir, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    pending = (WatchPending*)calloc(WATCH_MAX_PENDING, sizeof(WatchPending));
+    if (!pending) {
+        fprintf(stderr, "Error: Memory allocation failed for watch state.\n");
+        goto cleanup;
+    }
+
+    if (g_watch_log) {
+        g_watch_log_file = fopen(g_watch_log, "a");
+        if (!g_watch_log_file) {
+            fprintf(stderr, "Error: Cannot open log file '%s': %s\n", g_watch_log, strerror(errno));
+            goto cleanup;
+        }
+    }
+
+    memset(&g_watch_queue, 0, sizeof(g_watch_queue));
+    pthread_mutex_init(&g_watch_queue.lock, NULL);
+    pthread_cond_init(&g_watch_queue.not_empty, NULL);
+    pthread_cond_init(&g_watch_queue.not_full, NULL);
+    for (worker_count = 0; worker_count < g_watch_jobs; ++worker_count) {
+        if (pthread_create(&workers[worker_count], NULL, watch_worker, NULL) != 0) {
+            fprintf(stderr, "Error: Failed to start worker thread.\n");
+            break;
+        }
+    }
+    if (worker_count == 0) goto shutdown;
+
+    signal(SIGINT, watch_signal_handler);
+    signal(SIGTERM, watch_signal_handler);
+
+    if (!g_quiet_mode) {
+        printf("Watching '%s' (%d worker%s, %ld ms debounce). Press Ctrl+C to stop.\n",
+            dir, worker_count, worker_count == 1 ? "" : "s", g_watch_debounce_ms);
+        fflush(stdout);
+    }
+
+    while (!g_watch_stop) {
+        uint64_t now = watch_now_ms();
+        int poll_timeout = -1;
+        struct pollfd pfd;
+
+        /* Dispatch files whose debounce interval has expired */
+        for (int i = 0; i < pending_count; ) {
+            if (pending[i].due_ms <= now) {
+                char path[WATCH_MAX_PATH + 1];
+                snprintf(path, sizeof(path), "%s/%s", dir, pending[i].name);
+                watch_queue_push(&g_watch_queue, path);
+                pending[i] = pending[--pending_count];
+            }
+            else {
+                uint64_t wait_ms = pending[i].due_ms - now;
+                int remaining = wait_ms > (uint64_t)INT_MAX ? INT_MAX : (int)wait_ms;
+                if (poll_timeout < 0 || remaining < poll_timeout) poll_timeout = remaining;
+                ++i;
+            }
+        }
+
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        int ready = poll(&pfd, 1, poll_timeout);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "Error: poll failed: %s\n", strerror(errno));
+            break;
+        }
+        if (ready == 0) continue;
+
+        for (;;) {
+            ssize_t len = read(fd, event_buf, sizeof(event_buf));
+            if (len <= 0) break;
+            for (char* p = event_buf; p < event_buf + len; ) {
+                const struct inotify_event* ev = (const struct inotify_event*)p;
+                if (ev->len > 0 && !(ev->mask & IN_ISDIR) && watch_name_is_candidate(ev->name)) {
+                    watch_pending_touch(pending, &pending_count, dir, ev->name, watch_now_ms() + (uint64_t)g_watch_debounce_ms);
+                }
+                p += sizeof(struct inotify_event) + ev->len;
+            }
+        }
+    }
+    result = 0;
+
+shutdown:
+    /* Let workers drain what is already queued, then stop them */
+    pthread_mutex_lock(&g_watch_queue.lock);
+    g_watch_queue.shutdown = 1;
+    pthread_cond_broadcast(&g_watch_queue.not_empty);
+    pthread_cond_broadcast(&g_watch_queue.not_full);
+    pthread_mutex_unlock(&g_watch_queue.lock);
+    for (int i = 0; i < worker_count; ++i) pthread_join(workers[i], NULL);
+    pthread_cond_destroy(&g_watch_queue.not_full);
+    pthread_cond_destroy(&g_watch_queue.not_empty);
+    pthread_mutex_destroy(&g_watch_queue.lock);
+
+cleanup:
+    if (g_watch_log_file) { fclose(g_watch_log_file); g_watch_log_file = NULL; }
+    free(pending);
+    inotify_rm_watch(fd, wd);
+    close(fd);
+    return result;
+}
+
+#else /* !IMDCHK_HAVE_WATCH */
+
+int watch_directory(const char* dir) {
+    (void)dir;
+    fprintf(stderr, "Error: --watch requires inotify and is only available on Linux.\n");
+    return -1;
+}
+
+#endif /* IMDCHK_HAVE_WATCH */
+
+/* --- Main Function --- */
+int main(int argc, char* argv[]) {
+    const char* input_filenames[MAX_INPUT_FILES];
+    int input_file_count = 0;
+    int final_exit_code = 0;
+    ImdChkAudit* audits = NULL;
+    /* Use library function to get basename */
+    const char* prog_name = imd_get_basename(argv[0]);
+    if (!prog_name) { prog_name = argv[0]; }
+
+    /* Initialize options to defaults */
+    /* Initialize reporting first */
+    imd_set_verbosity(0, 0); /* Default */
+
+    g_options.error_mask = DEFAULT_ERROR_MASK;
+    g_options.max_allowed_cyl = -1;
+    g_options.required_head = -1;
+    g_options.max_allowed_sectors = -1;
+
+    /* Argument Parsing */
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-v") == 0) { g_verbose_mode = 1; } /* Keep for potential future use */
+        else if (strcmp(argv[i], "-q") == 0 || strcmp(argv[i], "--quiet") == 0) { g_quiet_mode = 1; }
+        else if (strcmp(argv[i], "-a") == 0 || strcmp(argv[i], "--audit") == 0) { g_audit_mode = 1; }
+        else if (strcmp(argv[i], "--help") == 0) { print_usage(prog_name); return 0; }
+        else if (strcmp(argv[i], "--version") == 0) { if (!g_quiet_mode) print_version_info(stdout); return 0; }
+        else if (strcmp(argv[i], "--error-mask") == 0 || strcmp(argv[i], "-e") == 0) {
+            if (++i < argc) { if (!parse_ulong_arg(argv[i - 1], argv[i], &g_options.error_mask)) return -1; }
+            else { fprintf(stderr, "Error: Option %s requires MASK.\n", argv[i - 1]); return -1; }
+        }
+        else if (strcmp(argv[i], "--cylinders") == 0 || strcmp(argv[i], "-c") == 0) {
+            if (++i < argc) { if (!parse_long_arg(argv[i - 1], argv[i], &g_options.max_allowed_cyl)) return -1; }
+            else { fprintf(stderr, "Error: Option %s requires N.\n", argv[i - 1]); return -1; }
+        }
+        else if (strcmp(argv[i], "--head") == 0 || strcmp(argv[i], "-h") == 0) {
+            if (++i < argc) {
+                if (!parse_long_arg(argv[i - 1], argv[i], &g_options.required_head)) return -1;
+                if (g_options.required_head != 0 && g_options.required_head != 1) { fprintf(stderr, "Error: Head must be 0 or 1.\n"); return -1; }
+            }
+            else { fprintf(stderr, "Error: Option %s requires N.\n", argv[i - 1]); return -1; }
+        }
+        else if (strcmp(argv[i], "--sectors") == 0 || strcmp(argv[i], "-s") == 0) {
+            if (++i < argc) { if (!parse_long_arg(argv[i - 1], argv[i], &g_options.max_allowed_sectors)) return -1; }
+            else { fprintf(stderr, "Error: Option %s requires N.\n", argv[i - 1]); return -1; }
+        }
+        else if (strcmp(argv[i], "--cache") == 0) {
+            if (++i < argc) { g_cache_path = argv[i]; }
+            else { fprintf(stderr, "Error: Option %s requires FILE.\n", argv[i - 1]); return -1; }
+        }
+        else if (strcmp(argv[i], "--recheck") == 0) { g_force_recheck = 1; }
+        else if (strcmp(argv[i], "--dat") == 0) {
+            if (++i < argc) { g_dat_path = argv[i]; }
+            else { fprintf(stderr, "Error: Option %s requires FILE.\n", argv[i - 1]); return -1; }
+        }
+        else if (strcmp(argv[i], "--track-hash") == 0) { g_dat_track_hash = 1; }
+        else if (strcmp(argv[i], "--watch") == 0 || strcmp(argv[i], "--log") == 0 || strcmp(argv[i], "--quarantine") == 0) {
+            if (++i < argc) {
+                if (strcmp(argv[i - 1], "--watch") == 0) g_watch_dir = argv[i];
+                else if (strcmp(argv[i - 1], "--log") == 0) g_watch_log = argv[i];
+                else g_watch_quarantine = argv[i];
+            }
+            else { fprintf(stderr, "Error: Option %s requires DIR/FILE.\n", argv[i - 1]); return -1; }
+        }
+        else if (strcmp(argv[i], "--jobs") == 0) {
+            if (++i < argc) {
+                if (!parse_long_arg(argv[i - 1], argv[i], &g_watch_jobs)) return -1;
+                if (g_watch_jobs < 1 || g_watch_jobs > WATCH_MAX_JOBS) { fprintf(stderr, "Error: --jobs must be 1-%d.\n", WATCH_MAX_JOBS); return -1; }
+            }
+            else { fprintf(stderr, "Error: Option %s requires N.\n", argv[i - 1]); return -1; }
+        }
+        else if (strcmp(argv[i], "--debounce") == 0) {
+            if (++i < argc) {
+                if (!parse_long_arg(argv[i - 1], argv[i], &g_watch_debounce_ms)) return -1;
+                if (g_watch_debounce_ms > WATCH_MAX_DEBOUNCE_MS) { fprintf(stderr, "Error: --debounce must be 0-%d.\n", WATCH_MAX_DEBOUNCE_MS); return -1; }
+            }
+            else { fprintf(stderr, "Error: Option %s requires MS.\n", argv[i - 1]); return -1; }
+        }
+        else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            fprintf(stderr, "Error: Unknown option '%s'\n", argv[i]); print_usage(prog_name); return -1;
+        }
+        else if (input_file_count < MAX_INPUT_FILES) { input_filenames[input_file_count++] = argv[i]; }
+        else { fprintf(stderr, "Error: Too many input files ('%s').\n", argv[i]); print_usage(prog_name); return -1; }
+    }
+    /* Update reporting verbosity based on parsed args (final check) */
+    imd_set_verbosity(g_quiet_mode, g_verbose_mode);
+
+    if (g_watch_dir) {
+        if (input_file_count > 0) { fprintf(stderr, "Error: Input files cannot be combined with --watch.\n"); return -1; }
+        if (g_cache_path || g_force_recheck || g_dat_path || g_dat_track_hash) {
+            fprintf(stderr, "Error: --cache, --recheck, --dat and --track-hash cannot be combined with --watch.\n");
+            print_usage(prog_name);
+            return -1;
+        }
+        if (!g_quiet_mode) print_version_info(stdout);
+        return watch_directory(g_watch_dir);
+    }
+    if (g_watch_log || g_watch_quarantine) { fprintf(stderr, "Error: --log and --quarantine require --watch.\n"); return -1; }
+    if (g_force_recheck && !g_cache_path) { fprintf(stderr, "Error: --recheck requires --cache.\n"); return -1; }
+    if (g_dat_track_hash && !g_dat_path) { fprintf(stderr, "Error: --track-hash requires --dat.\n"); return -1; }
+
+    if (input_file_count == 0) { fprintf(stderr, "Error: Input file not specified.\n"); print_usage(prog_name); return -1; }
+
+    if (g_audit_mode) {
+        audits = (ImdChkAudit*)calloc((size_t)input_file_count, sizeof(ImdChkAudit));
+        if (!audits) { fprintf(stderr, "Error: Memory allocation failed for audit results.\n"); return -1; }
+    }
+
+    if (!g_quiet_mode) print_version_info(stdout);
+
+    if (g_cache_path) cache_open(&g_cache, g_cache_path, &g_options);
+    if (g_dat_path) {
+        if (dat_load(&g_dat, g_dat_path) != 0) { free(audits); return -1; }
+        if (!g_quiet_mode) printf("Loaded %zu known-good entries from '%s'.\n", g_dat.count, g_dat_path);
+    }
+
+    for (int f = 0; f < input_file_count; ++f) {
+        int file_exit_code = check_file(input_filenames[f], audits ? &audits[f] : NULL);
+        /* Critical errors (-1) take precedence over check failures (1) */
+        if (file_exit_code < 0 || final_exit_code < 0) final_exit_code = -1;
+        else if (file_exit_code > final_exit_code) final_exit_code = file_exit_code;
+    }
+
+    if (g_dat_path) {
+        if (input_file_count > 1 && (!g_quiet_mode || g_dat_counts[DAT_VERIFIED] != input_file_count)) {
+            printf("%sDAT Summary: %lld verified, %lld unknown, %lld mismatched\n", g_quiet_mode ? "" : "\n",
+                g_dat_counts[DAT_VERIFIED], g_dat_counts[DAT_UNKNOWN], g_dat_counts[DAT_MISMATCH]);
+        }
+        dat_free(&g_dat);
+    }
+
+    if (g_cache_path) {
+        cache_save(&g_cache);
+        cache_close(&g_cache);
+    }
+
+    if (audits) {
+        report_audit_summary(audits, input_file_count);
+        free(audits);
+    }
+
+    return final_exit_code;
+}
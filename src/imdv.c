@@ -11,12 +11,25 @@
  *
  */
 
+/* Define _DEFAULT_SOURCE to enable POSIX features (mmap of the search index, pthreads for find all) */
+#define _DEFAULT_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <errno.h>
 #include <ctype.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#define IMDV_HAVE_THREADS 1         /* Searches and prefetch run on worker threads */
+#endif
 #include <curses.h>  /* Requires curses library */
 #include <locale.h>  /* For wide character support in ncurses */
 
@@ -35,6 +48,29 @@
 #define DATA_LINES 16 /* Lines to display in hex view */
 #define BYTES_PER_LINE 16
 #define MAX_SEARCH_TERM 100
+#define SEARCH_SECTORS_PER_SLICE 32 /* Sectors a background search scans between key checks */
+#define MAX_FIND_ALL_RESULTS 10000
+#define FIND_ALL_CONTEXT 16         /* Bytes shown with each find-all result */
+#define SEARCH_MAX_CARRY 256        /* Bytes kept from earlier sectors to locate matches spanning them */
+#define DIFF_SECTORS_PER_SLICE 16   /* Sector pairs the difference index compares between key checks */
+#define FIND_ALL_MAX_WORKERS 4      /* Threads a find all without the search index is split across */
+#define FIND_ALL_MIN_TRACKS 8       /* Tracks per find-all thread; smaller images are scanned on the UI thread */
+#define FIND_ALL_POLL_MS 50         /* How often the UI checks on search and index threads */
+
+/* Wildcard hex / regex compilation limits */
+#define REGEX_MAX_NFA   512
+#define REGEX_SET_WORDS (REGEX_MAX_NFA / 64)
+#define REGEX_MAX_DFA   2048
+#define REGEX_DFA_HASH  4099        /* Open-addressed table of DFA states, > 2 * REGEX_MAX_DFA */
+
+/* Search index sidecar (<image>.imdx) */
+#define SEARCH_INDEX_MAGIC      "IMDVIDX1"
+#define SEARCH_INDEX_VERSION    1
+#define SEARCH_INDEX_BUCKET_BITS 16
+#define SEARCH_INDEX_BUCKETS    (1u << SEARCH_INDEX_BUCKET_BITS)
+
+#define FNV1A64_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV1A64_PRIME        0x100000001b3ULL
 
 /* UI Window IDs (conceptual) */
 #define WIN_INFO 0
@@ -57,6 +93,7 @@
 #define CP_INFO_SECTOR_HIGHLIGHT 13
 #define CP_SEARCH_BOX 14
 #define CP_SEARCH_HIGHLIGHT 15
+#define CP_DIFF_HIGHLIGHT 16
 
 
 /* Character Sets */
@@ -71,6 +108,8 @@
 #define SEARCH_TYPE_NONE 0
 #define SEARCH_TYPE_TEXT 1
 #define SEARCH_TYPE_HEX  2
+#define SEARCH_TYPE_HEX_PATTERN 3  /* Hex with ?? / * wildcards */
+#define SEARCH_TYPE_REGEX 4
 
 /* ESCape key */
 #define ESC_KEY         (27)
@@ -116,14 +155,226 @@ char last_search_term_text[MAX_SEARCH_TERM] = "";
 uint8_t last_search_term_hex[MAX_SEARCH_TERM / 2];
 int last_search_term_hex_len = 0;
 int last_search_type = SEARCH_TYPE_NONE;
+char last_search_pattern[MAX_SEARCH_TERM] = "";  /* Wildcard hex or regex */
+int g_search_active = 0;           /* A search is running in the background */
+int g_search_is_text = 0;
 
 size_t g_found_on_track_idx = (size_t)-1;
 uint32_t g_found_on_sector_log_idx = (uint32_t)-1;
 long g_found_offset_in_sector = -1;
 int g_found_len = 0;
+/* Just past a wildcard/regex match, where F5 continues; offset -1 for a literal match */
+size_t g_found_end_track_idx = (size_t)-1;
+uint32_t g_found_end_sector_log_idx = (uint32_t)-1;
+long g_found_end_offset = -1;
+
+/* Sector edits are buffered here until saved, keyed by the sector's address on disk */
+typedef struct {
+    uint8_t cyl;
+    uint8_t head;
+    uint8_t sector_id;
+    uint32_t size;
+    uint8_t* data;                  /* Contents as edited */
+    uint8_t* saved;                 /* Contents in the image file */
+} DirtySector;
+
+/* One kept edit session: bytes [offset, offset + length) of a sector before and after it */
+typedef struct {
+    uint8_t cyl;
+    uint8_t head;
+    uint8_t sector_id;
+    uint32_t offset;
+    uint32_t length;
+    uint8_t* bytes;                 /* 'length' bytes before, then 'length' bytes after */
+} EditRecord;
+
+#define MAX_EDIT_JOURNAL 1000       /* Oldest records are dropped beyond this */
+
+DirtySector* g_dirty_sectors = NULL;    /* Sorted by cyl, head, sector_id */
+size_t g_dirty_count = 0;
+size_t g_dirty_capacity = 0;
+EditRecord* g_edit_journal = NULL;
+size_t g_edit_journal_count = 0;
+size_t g_edit_journal_pos = 0;          /* Records applied; those after it can be redone */
+size_t g_edit_journal_capacity = 0;
+
+/* Sectors read for the viewer, most recently used first, within a memory budget */
+typedef struct SectorCacheEntry {
+    uint32_t key;                   /* cyl << 16 | head << 8 | sector_id */
+    int status;                     /* imdf_read_sector() result: IMDF_ERR_OK or IMDF_ERR_UNAVAILABLE */
+    uint32_t size;
+    struct SectorCacheEntry* lru_prev;
+    struct SectorCacheEntry* lru_next;
+    struct SectorCacheEntry* hash_next;
+    uint8_t data[];                 /* 'size' bytes if status is IMDF_ERR_OK */
+} SectorCacheEntry;
+
+#define SECTOR_CACHE_BUCKETS 1024
+#define SECTOR_CACHE_DEFAULT_KB 4096
+#define PREFETCH_MAX_TRACKS 4       /* The track itself, cylinder - 1, cylinder + 1, other head */
+#define PREFETCH_SECTORS_PER_SLICE 8
+
+typedef struct {
+    SectorCacheEntry* buckets[SECTOR_CACHE_BUCKETS];
+    SectorCacheEntry* lru_head;
+    SectorCacheEntry* lru_tail;
+    size_t bytes;                   /* Sector data held */
+    size_t budget;
+} SectorCache;
+
+SectorCache g_sector_cache = { { NULL }, NULL, NULL, 0, (size_t)SECTOR_CACHE_DEFAULT_KB * 1024 };
+
+/* The displayed track and its neighbors, read into the cache in the background */
+size_t g_prefetch_tracks[PREFETCH_MAX_TRACKS];
+int g_prefetch_count = 0;
+int g_prefetch_track = 0;           /* Index into g_prefetch_tracks being read */
+uint32_t g_prefetch_sector = 0;     /* Next physical sector on that track */
+
+#ifdef IMDV_HAVE_THREADS
+/* Guards g_sector_cache and the prefetch queue above once the prefetch worker runs */
+pthread_mutex_t g_sector_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t g_prefetch_wake = PTHREAD_COND_INITIALIZER;
+unsigned g_sector_cache_generation = 0; /* Bumped by sector_cache_clear(), so reads begun before it are dropped */
+pthread_t g_prefetch_thread;
+ImdImageFile* g_prefetch_handle = NULL; /* Worker's own read-only handle; NULL while it is not running */
+int g_prefetch_quit = 0;
+int g_prefetch_failed = 0;          /* The image could not be opened again; prefetch on the UI thread */
+#endif
 
 
 ImdImageFile* g_imdf_handle = NULL;
+const char* g_image_path = NULL;    /* File g_imdf_handle was opened from */
+
+/* Logical -> physical sector permutation of one track, rebuilt only when the track or ordering changes */
+typedef struct {
+    size_t track_idx;               /* (size_t)-1 when empty */
+    int ignore_interleave;          /* Ordering the permutation was built for */
+    uint8_t num_sectors;
+    uint8_t physical_idx[LIBIMD_MAX_SECTORS_PER_TRACK]; /* Indexed by logical (sorted) position */
+} SectorOrderCache;
+
+SectorOrderCache g_display_order = { (size_t)-1, 0, 0, { 0 } }; /* Track shown in the viewer */
+SectorOrderCache g_search_order = { (size_t)-1, 0, 0, { 0 } };  /* Track being searched */
+
+/*
+ * Damage tracking: what each window currently shows, so a redraw only
+ * repaints what changed. Anything else that draws into a window (help,
+ * find-all panel, edit cursor, popups) must invalidate it.
+ */
+#define DATA_VIEW_MAX_LINES 256     /* Lines beyond this are always repainted */
+#define DATA_LINE_BLANK 0xFFFFFFFFu
+#define DATA_LINE_UNKNOWN 0xFFFFFFFEu
+
+typedef struct {
+    uint32_t offset;                /* In the sector, DATA_LINE_BLANK for an empty line */
+    uint32_t highlight;             /* Bit i set: byte i is part of the search match */
+    uint32_t differs;               /* Bit i set: byte i differs from the other image */
+    uint8_t count;                  /* Bytes shown on the line */
+    uint8_t bytes[BYTES_PER_LINE];
+} DataLineState;
+
+typedef struct {
+    int valid;                      /* 0: window content unknown, repaint every line */
+    int lines;
+    int charset;
+    uint8_t xor_mask;
+    DataLineState line[DATA_VIEW_MAX_LINES];
+} DataViewState;
+
+typedef struct {
+    int valid;
+    size_t track_idx;
+    uint32_t sector_physical_idx;
+    uint32_t sector_id;
+    uint8_t sector_flag;            /* Stored form (compressed, deleted, error) can change on save */
+    uint8_t num_sectors;
+    int charset;
+    uint8_t xor_mask;
+    int write_protected;
+    int unsaved;
+    int width;
+} InfoViewState;
+
+DataViewState g_data_view;
+InfoViewState g_info_view;
+char g_status_shown[sizeof(status_message)] = "";
+int g_status_valid = 0;
+
+int g_coalescing_input = 0;         /* Applying queued navigation keys: no sector reads or drawing */
+int g_sector_load_pending = 0;      /* The displayed sector changed but its data was not read yet */
+
+/* Two-image comparison (imdv A.imd B.imd): image B is shown below the data window */
+#define DIFF_KIND_NO_SECTOR 0
+#define DIFF_KIND_NO_DATA   1
+#define DIFF_KIND_DATA      2
+
+/* One sector of image A and the sector with the same C/H/S in image B */
+typedef struct {
+    uint64_t hash_a;                /* Size, DAM/error flags and data */
+    uint64_t hash_b;
+    uint8_t kind_a;                 /* DIFF_KIND_* */
+    uint8_t kind_b;
+    uint8_t edited_a;               /* hash_a is from an edit made before the entry was indexed; kept by the build */
+} DiffSector;
+
+typedef struct {
+    ImdImageFile* handle;           /* Image B, read-only; NULL when not comparing */
+    char* path;                     /* Image B, for the index worker's own handle */
+    char name[MAX_FILENAME];
+    int32_t track_of_a[256][2];     /* Track index by cylinder and head, -1 if none */
+    int32_t track_of_b[256][2];
+    size_t num_tracks_b;
+    size_t* first_entry;            /* Per track of A (+1): index of its first sector in 'entries' */
+    DiffSector* entries;            /* Per sector of A, in physical order */
+    uint16_t* track_differs;        /* Per track of A: sectors known to differ */
+    size_t num_entries;
+    size_t next_entry;              /* Index build progress: entries before this are known */
+    size_t build_track;             /* Track of A holding next_entry */
+    size_t differing;
+    size_t only_in_b;               /* Sectors of B with no C/H/S in A, counted when the index completes */
+    SectorOrderCache order;         /* Display order of A's tracks while looking for a difference */
+    /* The sector of B shown, matching the displayed sector of A */
+    int shown_valid;
+    uint32_t shown_key;             /* cyl << 16 | head << 8 | sector_id */
+    int shown_kind;
+    uint8_t shown_sflag;
+    uint32_t shown_size;
+    uint8_t shown[LIBIMD_MAX_SECTOR_SIZE];
+#ifdef IMDV_HAVE_THREADS
+    /* Index worker; while it runs, 'lock' guards entries, track_differs, next_entry, build_track, differing and only_in_b */
+    int worker_running;
+    int worker_failed;              /* It could not open the images; the UI thread builds the index */
+    int worker_done;                /* Under lock */
+    int worker_cancel;              /* Under lock */
+    size_t shown_progress;          /* next_entry when the header was last drawn */
+    pthread_mutex_t lock;
+    pthread_t thread;
+    DirtySector* edits;             /* Unsaved edits of A when the worker started */
+    size_t edit_count;
+#endif
+} DiffState;
+
+WINDOW* win_diff = NULL;            /* Image B: a header line and the same data lines as win_data */
+DiffState g_diff;
+DataViewState g_diff_view;
+char g_diff_header_shown[sizeof(status_message)] = "";
+
+/* Sectors by sflag class, for jumping to the next/previous one */
+#define FLAG_CLASS_ERROR       0
+#define FLAG_CLASS_DELETED     1    /* Deleted data address mark */
+#define FLAG_CLASS_UNAVAILABLE 2
+#define FLAG_CLASS_COMPRESSED  3
+#define FLAG_CLASSES           4
+#define FLAG_POSITION(track_idx, logical_idx) ((uint32_t)(track_idx) << 8 | (uint32_t)(logical_idx))
+
+typedef struct {
+    int valid;
+    int in_physical_order;          /* Navigation order the positions are in */
+    uint32_t* positions[FLAG_CLASSES]; /* FLAG_POSITION of each sector in the class, ascending */
+    size_t count[FLAG_CLASSES];
+} FlagIndex;
+
+FlagIndex g_flag_index;
 
 const unsigned char ebcdic_to_ascii[256] = {
     0x00,0x01,0x02,0x03,0x9C,0x09,0x86,0x7F,0x97,0x8D,0x8E,0x0B,0x0C,0x0D,0x0E,0x0F,
@@ -147,12 +398,15 @@ const unsigned char ebcdic_to_ascii[256] = {
 /* --- Forward Declarations --- */
 void draw_info_window(void);
 void draw_data_window(void);
+void invalidate_windows(void);
+void data_window_damage_line(int line);
 void update_status(const char* msg);
 void display_error(const char* msg);
 void display_help_window(void);
 void edit_sector(void);
+void handle_key(int ch);
 int ctoh(int c);
-int compare_sector_map_entries(const void* a, const void* b);
+const uint8_t* get_sector_order(SectorOrderCache* cache, size_t track_idx, const ImdTrackInfo* track, int in_physical_order);
 const char* get_basename(const char* path);
 int load_track_for_display(size_t track_idx);
 int load_sector_for_display(void); /* Returns 0 on success, -1 on error (not IMDF_ERR_UNAVAILABLE) */
@@ -160,12 +414,64 @@ int load_specific_sector_data(size_t track_idx, uint32_t sector_log_id, uint8_t*
 uint32_t get_physical_idx_for_display(uint32_t logical_idx_in_track);
 const char* get_mode_string(uint8_t mode_code);
 void build_status_message(void);
-int get_search_input(const char* prompt, char* buffer, int buffer_size, int is_hex);
+int get_search_input(const char* prompt, char* buffer, int buffer_size, int search_type);
 void search_text_from_current(const char* term, int start_from_next_byte);
 void search_hex_from_current(const uint8_t* hex_term, int term_len, int start_from_next_byte);
+void search_pattern_from_current(const char* pattern, int is_hex_pattern, int start_from_next_byte);
 void repeat_last_search(void);
+void find_all_last_search(void);
+void search_poll(void);
+#ifdef IMDV_HAVE_THREADS
+int search_workers_running(void);
+int find_all_workers_poll(void);
+size_t find_all_workers_progress(int* num_workers);
+void search_stop_workers(void);
+#endif
+void cancel_search(void);
+void search_handle_replaced(ImdImageFile* old_handle);
+void rebuild_search_index(void);
+void search_index_close(void);
 void clear_search_highlight(void);
 void adjust_view_for_match(long match_offset_in_sector, int term_len);
+void dirty_sector_overlay(uint8_t cyl, uint8_t head, uint8_t sector_id, uint8_t* buffer, uint32_t size);
+size_t dirty_sector_count(void);
+int edit_journal_record(uint8_t cyl, uint8_t head, uint8_t sector_id, const uint8_t* before, const uint8_t* after, uint32_t size);
+int undo_redo_edit(int redo);
+int write_dirty_sectors(char* err, size_t err_size);
+int run_script(const char* script_path, char** images, int num_images);
+int flush_dirty_sectors(void);
+int write_recovery_file(const char* path);
+void exit_on_signal(int sig);
+int exit_signal_pending(void);
+int modal_getch(WINDOW* win);
+int confirm_quit(void);
+void edit_cache_free(void);
+int sector_cache_read(uint8_t cyl, uint8_t head, uint8_t sector_id, uint8_t* buffer, uint32_t size);
+void sector_cache_clear(void);
+void prefetch_neighbors(size_t track_idx);
+void prefetch_poll(void);
+int prefetch_pending(void);
+#ifdef IMDV_HAVE_THREADS
+void prefetch_stop(void);
+#endif
+uint64_t fnv1a64_update(uint64_t hash, const void* data, size_t size);
+const char* diff_open(const char* path);
+void diff_close(void);
+int diff_building(void);
+int diff_pending(void);
+void diff_poll(void);
+void diff_sector_edited(uint8_t cyl, uint8_t head, uint8_t sector_id, const uint8_t* data, uint32_t size);
+void diff_sync_sector(void);
+void draw_diff_window(void);
+void diff_jump(int forward);
+#ifdef IMDV_HAVE_THREADS
+int diff_worker_running(void);
+void diff_stop_worker(void);
+#endif
+int flag_index_build(void);
+void flag_index_free(void);
+void flag_jump(int flag_class, int forward);
+static void draw_data_line(WINDOW* win, int y, const DataLineState* ls, int max_x);
 
 
 const char* get_basename(const char* path) {
@@ -205,6 +511,7 @@ void init_ui(void) {
         init_pair(CP_INFO_SECTOR_HIGHLIGHT, COLOR_BLACK, COLOR_YELLOW);
         init_pair(CP_SEARCH_BOX, COLOR_BLACK, COLOR_WHITE);
         init_pair(CP_SEARCH_HIGHLIGHT, COLOR_BLACK, COLOR_MAGENTA);
+        init_pair(CP_DIFF_HIGHLIGHT, COLOR_WHITE, COLOR_RED);
 
         bkgd(COLOR_PAIR(CP_NORMAL));
     }
@@ -224,6 +531,7 @@ void init_ui(void) {
         init_pair(CP_INFO_SECTOR_HIGHLIGHT, COLOR_BLACK, COLOR_WHITE);
         init_pair(CP_SEARCH_BOX, COLOR_BLACK, COLOR_WHITE);
         init_pair(CP_SEARCH_HIGHLIGHT, COLOR_BLACK, COLOR_WHITE);
+        init_pair(CP_DIFF_HIGHLIGHT, COLOR_BLACK, COLOR_WHITE);
 
         bkgd(COLOR_PAIR(CP_NORMAL));
     }
@@ -235,10 +543,19 @@ void init_ui(void) {
     getmaxyx(stdscr, screen_h, screen_w);
 
     win_info = newwin(6, screen_w, 0, 0);
-    win_data = newwin(screen_h - (6 + 1), screen_w, 6, 0);
+    if (g_diff.handle) {
+        /* Comparing: image B gets the lower half, below a header line */
+        int data_h = (screen_h - (6 + 1)) / 2;
+        win_data = newwin(data_h, screen_w, 6, 0);
+        win_diff = newwin(screen_h - (6 + 1) - data_h, screen_w, 6 + data_h, 0);
+        if (win_diff) wbkgd(win_diff, COLOR_PAIR(CP_NORMAL));
+    }
+    else {
+        win_data = newwin(screen_h - (6 + 1), screen_w, 6, 0);
+    }
     win_status = newwin(1, screen_w, screen_h - 1, 0);
 
-    if (!win_info || !win_data || !win_status) {
+    if (!win_info || !win_data || !win_status || (g_diff.handle && !win_diff)) {
         endwin();
         fprintf(stderr, "Error creating ncurses windows.\n");
         exit(EXIT_FAILURE);
@@ -254,6 +571,7 @@ void init_ui(void) {
 
 
 void cleanup_ui(void) {
+    if (win_diff) delwin(win_diff);
     if (win_status) delwin(win_status);
     if (win_data) delwin(win_data);
     if (win_info) delwin(win_info);
@@ -268,6 +586,10 @@ void build_status_message(void) {
 
 void update_status(const char* msg) {
     if (!win_status) return;
+    if (g_status_valid && strcmp(g_status_shown, msg) == 0) return; /* Already on screen */
+    strncpy(g_status_shown, msg, sizeof(g_status_shown) - 1);
+    g_status_shown[sizeof(g_status_shown) - 1] = '\0';
+    g_status_valid = 1;
     int max_w = getmaxx(win_status);
     werase(win_status);
     wbkgd(win_status, COLOR_PAIR(CP_STATUS));
@@ -283,13 +605,14 @@ void update_status(const char* msg) {
 void display_error(const char* msg) {
     if (!win_status) return;
     int max_w = getmaxx(win_status);
+    g_status_valid = 0;
     werase(win_status);
     wbkgd(win_status, COLOR_PAIR(CP_ERROR));
     mvwprintw(win_status, 0, 0, "ERROR: %.*s", max_w - 7, msg);
     wrefresh(win_status);
     beep();
     timeout(-1);
-    wgetch(stdscr);
+    modal_getch(stdscr);
     timeout(100);
     build_status_message();
     update_status(status_message);
@@ -316,8 +639,24 @@ const char* help_text[] = {
     "  F2               : Toggle Charset (ASCII / EBCDIC)",
     "  F3               : Search for text string (pre-fills last text search)",
     "  F4               : Search for hex bytes (pre-fills last hex search)",
+    "                     Wildcards: ?? any byte, 4? any low nibble, * any run (4C ?? 00 *)",
     "  F5               : Repeat last search from current position onward",
+    "  F6               : Find all occurrences of the last search (results list)",
+    "  ESC              : Cancel a running search",
+    "  F7               : Build the search index (<image>.imdx) for instant searches",
+    "  F8               : Search for a regular expression: . [a-z] [^...] \\xHH ( | ) * + ?",
+    "                     Patterns match leftmost-longest: the earliest start, then the",
+    "                     longest run from it; F5 and F6 continue after the whole match",
     "  I                : Toggle interleave ignore for sector navigation",
+    "  U / R            : Undo / redo the last kept sector edit",
+    "  S                : Save kept sector edits to the image (offered on quit)",
+    "                     Until saved they are only in memory; on SIGHUP/SIGTERM they",
+    "                     go to <image>.recover (replay with --script), otherwise lost",
+    "  [ / ]            : Previous / next sector that differs from the second image",
+    "  e / E            : Next / previous sector with a data error",
+    "  d / D            : Next / previous sector with a deleted data address mark",
+    "  a / A            : Next / previous unavailable sector (no data)",
+    "  c / C            : Next / previous compressed sector",
     "  Enter            : Edit current sector (if -W enabled)",
     "                     In Edit Mode:",
     "                       Arrows   : Move cursor",
@@ -325,7 +664,7 @@ const char* help_text[] = {
     "                       Home/End : Move to start/end of line",
     "                       F3       : Toggle HEX/ASCII edit mode",
     "                       Type     : Modify data at cursor",
-    "                       Enter    : Save changes (prompts for confirmation)",
+    "                       Enter    : Keep changes (prompts for confirmation)",
     "                       ESC/F10  : Exit edit mode (discard changes if any)",
     "  Q / F10          : Quit IMDV",
     "",
@@ -334,6 +673,12 @@ const char* help_text[] = {
     "  -W      : Enable writing (editing) - if image not Read-Only",
     "  -E      : Start in EBCDIC display mode",
     "  -X=xx   : Apply hex XOR mask 'xx' to data view (e.g., -X=FF)",
+    "  -N      : Build the search index on open if missing or out of date",
+    "  -C=kb   : Sector cache size in KB, neighbor tracks are prefetched (0 = off)",
+    "",
+    "Comparing two images: imdv A.imd B.imd [options]",
+    "  B's sector with the same C/H/S is shown below A's; differing bytes are",
+    "  highlighted in both. Only A can be edited.",
     NULL
 };
 
@@ -393,7 +738,7 @@ void display_help_window(void) {
         update_status("Arrows/PgUp/PgDn=Scroll | SPACE/Enter/ESC/F10=Exit Help");
         doupdate(); /* Update the physical screen */
 
-        ch = wgetch(win_data); /* Wait for user input */
+        ch = modal_getch(win_data); /* Wait for user input */
 
         /* Check for exit keys first */
         if (ch == '\n' || ch == ' ' || ch == 'q' || ch == 'Q' || ch == KEY_ENTER || ch == ESC_KEY || ch == KEY_F(10)) {
@@ -444,6 +789,7 @@ void display_help_window(void) {
     timeout(100); /* Restore the default non-blocking timeout for the main application */
 
     /* Restore original status and redraw main application windows */
+    invalidate_windows();
     update_status(original_status_buffer_temp);
     /* Force redraw of info and data windows as they were covered */
     draw_info_window();
@@ -452,6 +798,7 @@ void display_help_window(void) {
 }
 
 void copy_track_metadata_for_display(const ImdTrackInfo* source_track) {
+    g_info_view.valid = 0; /* Sector map and flags may have changed */
     if (!source_track) {
         memset(&current_track_display, 0, sizeof(ImdTrackInfo));
         current_track_display.loaded = 0;
@@ -487,6 +834,7 @@ int load_track_for_display(size_t track_idx) {
 
     copy_track_metadata_for_display(imdf_track);
     current_track_index_in_image = track_idx;
+    prefetch_neighbors(track_idx);
 
     if (!(g_found_len > 0 && g_found_on_track_idx == track_idx)) {
         current_sector_logical_idx = 0;
@@ -521,6 +869,7 @@ int load_track_for_display(size_t track_idx) {
 
 int load_sector_for_display(void) {
     if (!current_track_display.loaded || current_track_display.num_sectors == 0) {
+        g_sector_load_pending = 0;
         current_sector_logical_id = 0;
         current_sector_physical_idx = 0;
         memset(current_sector_buffer, 0, sizeof(current_sector_buffer));
@@ -550,9 +899,18 @@ int load_sector_for_display(void) {
         return -1;
     }
     current_sector_logical_id = current_track_display.smap[current_sector_physical_idx];
+    if (g_coalescing_input) {
+        g_sector_load_pending = 1;
+        return 0;
+    }
+    g_sector_load_pending = 0;
 
-    int res = imdf_read_sector(g_imdf_handle, current_track_display.cyl, current_track_display.head,
-        current_sector_logical_id, current_sector_buffer, current_track_display.sector_size);
+    int res = sector_cache_read(current_track_display.cyl, current_track_display.head,
+        (uint8_t)current_sector_logical_id, current_sector_buffer, current_track_display.sector_size);
+    if (res == IMDF_ERR_OK) {
+        dirty_sector_overlay(current_track_display.cyl, current_track_display.head, current_sector_logical_id,
+            current_sector_buffer, current_track_display.sector_size);
+    }
 
     if (res != IMDF_ERR_OK) {
         if (res == IMDF_ERR_UNAVAILABLE) {
@@ -584,19 +942,8 @@ int load_specific_sector_data(size_t track_idx, uint32_t target_sector_logical_i
         memcpy(out_track_info, track_info_ptr, sizeof(ImdTrackInfo));
     }
 
-    uint32_t temp_physical_idx = 0;
-    /* Get physical index for the target_sector_logical_idx on track_idx */
-    /* This requires a temporary way to use get_physical_idx_for_display or similar logic */
-    /* For now, assume ignore_interleave=0 for this helper, or adapt get_physical_idx_for_display to take track_info */
-    typedef struct { uint32_t physical_idx; uint8_t logical_id; } SectorMapEntry;
-    SectorMapEntry sorted_map[LIBIMD_MAX_SECTORS_PER_TRACK];
-    if (track_info_ptr->num_sectors > LIBIMD_MAX_SECTORS_PER_TRACK) return 0;
-    for (uint32_t p = 0; p < track_info_ptr->num_sectors; ++p) {
-        sorted_map[p].physical_idx = p;
-        sorted_map[p].logical_id = track_info_ptr->smap[p];
-    }
-    qsort(sorted_map, track_info_ptr->num_sectors, sizeof(SectorMapEntry), compare_sector_map_entries);
-    temp_physical_idx = sorted_map[target_sector_logical_idx].physical_idx;
+    /* Physical index of the target_sector_logical_idx on track_idx (searches always use sector ID order) */
+    uint32_t temp_physical_idx = get_sector_order(&g_search_order, track_idx, track_info_ptr, 0)[target_sector_logical_idx];
 
 
     uint32_t target_sector_id_on_disk = track_info_ptr->smap[temp_physical_idx];
@@ -615,988 +962,4469 @@ int load_specific_sector_data(size_t track_idx, uint32_t target_sector_logical_i
     else if (res != IMDF_ERR_OK) {
         return 0; /* Error */
     }
+    dirty_sector_overlay(track_info_ptr->cyl, track_info_ptr->head, (uint8_t)target_sector_id_on_disk, buffer, read_size);
     return read_size;
 }
 
 
-const char* get_mode_string(uint8_t mode_code) {
-    switch (mode_code) {
-    case IMD_MODE_FM_500:  return "500KHz  FM";
-    case IMD_MODE_FM_300:  return "300KHz  FM";
-    case IMD_MODE_FM_250:  return "250KHz  FM";
-    case IMD_MODE_MFM_500: return "500KHz MFM";
-    case IMD_MODE_MFM_300: return "300KHz MFM";
-    case IMD_MODE_MFM_250: return "250KHz MFM";
-    default:               return "Unknown Mode";
+/* --- Write-Back Cache and Undo Journal --- */
+
+/*
+ * Kept sector edits live in g_dirty_sectors and are only written to the
+ * image by flush_dirty_sectors() (S, or when quitting). Every sector read goes
+ * through dirty_sector_overlay(), so the viewer and searches see the edits.
+ * Each kept edit session is also journaled as a byte range so it can be
+ * undone and redone, both before and after saving.
+ */
+
+static int dirty_sector_compare(const DirtySector* d, uint8_t cyl, uint8_t head, uint8_t sector_id) {
+    if (d->cyl != cyl) return d->cyl < cyl ? -1 : 1;
+    if (d->head != head) return d->head < head ? -1 : 1;
+    if (d->sector_id != sector_id) return d->sector_id < sector_id ? -1 : 1;
+    return 0;
+}
+
+/* Index of the first entry of a sorted list not before the given sector */
+static size_t dirty_sector_lower_bound(const DirtySector* list, size_t count, uint8_t cyl, uint8_t head, uint8_t sector_id) {
+    size_t lo = 0, hi = count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (dirty_sector_compare(&list[mid], cyl, head, sector_id) < 0) lo = mid + 1; else hi = mid;
     }
+    return lo;
 }
 
-void draw_info_window(void) {
-    if (!win_info) return;
-    werase(win_info);
-    box(win_info, 0, 0);
-    int max_w = getmaxx(win_info);
-    int current_x_pos_line1 = 2; /* Starting X position for C/H/S info on line 1 */
-    int filename_len_on_screen = 0;
-    int filename_start_x = 0;
+/* Returns the cached sector, or NULL with *insert_at set to where it belongs */
+static DirtySector* dirty_sector_find(uint8_t cyl, uint8_t head, uint8_t sector_id, size_t* insert_at) {
+    size_t at = dirty_sector_lower_bound(g_dirty_sectors, g_dirty_count, cyl, head, sector_id);
+    if (at < g_dirty_count && dirty_sector_compare(&g_dirty_sectors[at], cyl, head, sector_id) == 0) return &g_dirty_sectors[at];
+    if (insert_at) *insert_at = at;
+    return NULL;
+}
 
-    /* Display basename of .imd filename in the right corner of line 1 */
-    if (strlen(current_filename_base) > 0) {
-        filename_len_on_screen = (int)strlen(current_filename_base);
-        filename_start_x = max_w - filename_len_on_screen - 2; /* 2 for padding from right border */
+/* Returns the cached sector, adding it with 'contents' (its data in the image) if new */
+static DirtySector* dirty_sector_get(uint8_t cyl, uint8_t head, uint8_t sector_id, const uint8_t* contents, uint32_t size) {
+    size_t at = 0;
+    DirtySector* d = dirty_sector_find(cyl, head, sector_id, &at);
+    if (d) return d;
+
+    if (g_dirty_count == g_dirty_capacity) {
+        size_t new_capacity = g_dirty_capacity ? g_dirty_capacity * 2 : 16;
+        DirtySector* grown = (DirtySector*)realloc(g_dirty_sectors, new_capacity * sizeof(DirtySector));
+        if (!grown) return NULL;
+        g_dirty_sectors = grown;
+        g_dirty_capacity = new_capacity;
+    }
+    uint8_t* data = (uint8_t*)malloc((size_t)size * 2);
+    if (!data) return NULL;
+    memcpy(data, contents, size);
+    memcpy(data + size, contents, size);
+
+    memmove(&g_dirty_sectors[at + 1], &g_dirty_sectors[at], (g_dirty_count - at) * sizeof(DirtySector));
+    d = &g_dirty_sectors[at];
+    d->cyl = cyl;
+    d->head = head;
+    d->sector_id = sector_id;
+    d->size = size;
+    d->data = data;
+    d->saved = data + size;
+    g_dirty_count++;
+    return d;
+}
 
-        /* Ensure filename_start_x is not too far left, clipping if necessary */
-        if (filename_start_x < 2) {
-            filename_start_x = 2;
-        }
-        /* If filename is very long, it might overwrite C/H/S. Truncate filename display if it would overlap too much. */
-        /* A simple check: if filename would start left of where C/H/S info starts + some buffer, truncate */
-        if (filename_start_x < current_x_pos_line1 + 10 && filename_len_on_screen > 15) { /* Arbitrary small buffer and min length to care about */
-            /* This is a basic truncation. A more robust solution might scroll or abbreviate filename */
-            filename_len_on_screen = max_w - (current_x_pos_line1 + 10) - 2;
-            if (filename_len_on_screen < 0) filename_len_on_screen = 0;
-            filename_start_x = max_w - filename_len_on_screen - 2;
-        }
+/* Replaces sector data just read from the image with its edited contents, if any */
+void dirty_sector_overlay(uint8_t cyl, uint8_t head, uint8_t sector_id, uint8_t* buffer, uint32_t size) {
+    const DirtySector* d = g_dirty_count ? dirty_sector_find(cyl, head, sector_id, NULL) : NULL;
+    if (d) memcpy(buffer, d->data, size < d->size ? size : d->size);
+}
 
+/* dirty_sector_overlay() from a copy of the edits made by dirty_sector_snapshot() */
+static void dirty_sector_overlay_from(const DirtySector* edits, size_t edit_count, uint8_t cyl, uint8_t head,
+    uint8_t sector_id, uint8_t* buffer, uint32_t size) {
+    size_t at = dirty_sector_lower_bound(edits, edit_count, cyl, head, sector_id);
+    if (at < edit_count && dirty_sector_compare(&edits[at], cyl, head, sector_id) == 0) {
+        memcpy(buffer, edits[at].data, size < edits[at].size ? size : edits[at].size);
+    }
+}
 
-        wattron(win_info, COLOR_PAIR(CP_INFO_HL)); /* Use a distinct color for the filename */
-        mvwprintw(win_info, 1, filename_start_x, "%.*s", filename_len_on_screen, current_filename_base);
-        wattroff(win_info, COLOR_PAIR(CP_INFO_HL));
+#ifdef IMDV_HAVE_THREADS
+/*
+ * Copies the unsaved edits (only sectors whose data differs from the image)
+ * for a worker thread reading the image through its own handle, in the same
+ * sorted order. Returns -1 if memory runs out.
+ */
+static int dirty_sector_snapshot(DirtySector** edits, size_t* edit_count) {
+    *edits = NULL;
+    *edit_count = 0;
+    if (g_dirty_count == 0) return 0;
+    *edits = (DirtySector*)calloc(g_dirty_count, sizeof(DirtySector));
+    if (!*edits) return -1;
+    for (size_t i = 0; i < g_dirty_count; ++i) {
+        const DirtySector* d = &g_dirty_sectors[i];
+        DirtySector* copy = &(*edits)[*edit_count];
+        if (memcmp(d->data, d->saved, d->size) == 0) continue;
+        *copy = *d;
+        copy->saved = NULL;
+        copy->data = (uint8_t*)malloc(d->size);
+        if (!copy->data) return -1; /* The caller frees what was copied */
+        memcpy(copy->data, d->data, d->size);
+        (*edit_count)++;
     }
+    return 0;
+}
 
-    char line1_buf[120];
-    uint8_t physical_cyl_val = 0, physical_head_val = 0;
-    uint32_t physical_sec_idx_val = 0;
-    uint8_t logical_cyl_val = 0, logical_head_val = 0, logical_sec_id_val = 0;
+static void dirty_sector_snapshot_free(DirtySector* edits, size_t edit_count) {
+    for (size_t i = 0; i < edit_count; ++i) free(edits[i].data);
+    free(edits);
+}
+#endif
 
-    if (current_track_display.loaded) {
-        physical_cyl_val = current_track_display.cyl;
-        physical_head_val = current_track_display.head;
+/* Number of sectors whose edits have not been written to the image */
+size_t dirty_sector_count(void) {
+    size_t count = 0;
+    for (size_t i = 0; i < g_dirty_count; ++i) {
+        if (memcmp(g_dirty_sectors[i].data, g_dirty_sectors[i].saved, g_dirty_sectors[i].size) != 0) count++;
+    }
+    return count;
+}
 
-        if (current_track_display.num_sectors > 0 && current_sector_physical_idx < current_track_display.num_sectors) {
-            physical_sec_idx_val = current_sector_physical_idx;
-            logical_sec_id_val = current_sector_logical_id;
+static void edit_record_free(EditRecord* rec) {
+    free(rec->bytes);
+    rec->bytes = NULL;
+}
 
-            if (current_track_display.hflag & IMD_HFLAG_CMAP_PRES) {
-                logical_cyl_val = current_track_display.cmap[physical_sec_idx_val];
-            }
-            else {
-                logical_cyl_val = physical_cyl_val;
-            }
-            if (current_track_display.hflag & IMD_HFLAG_HMAP_PRES) {
-                logical_head_val = current_track_display.hmap[physical_sec_idx_val];
-            }
-            else {
-                logical_head_val = physical_head_val;
-            }
-        }
-        snprintf(line1_buf, sizeof(line1_buf), "Physical C/H/S: %3u/%1u/%-2u   Logical C/H/S: %3u/%1u/%-2u",
-            physical_cyl_val,
-            physical_head_val,
-            current_track_display.num_sectors > 0 ? physical_sec_idx_val + 1 : 0,
-            logical_cyl_val,
-            logical_head_val,
-            current_track_display.num_sectors > 0 ? logical_sec_id_val : 0);
+/*
+ * Keeps an edit session: journals the changed byte range of the sector and
+ * applies it to the cache. Anything that could be redone is discarded.
+ * Returns 1 if bytes changed, 0 if none did, -1 if out of memory.
+ */
+int edit_journal_record(uint8_t cyl, uint8_t head, uint8_t sector_id, const uint8_t* before, const uint8_t* after, uint32_t size) {
+    uint32_t first = 0, last = size;
+    while (first < size && before[first] == after[first]) first++;
+    if (first == size) return 0;
+    while (last > first && before[last - 1] == after[last - 1]) last--;
+
+    DirtySector* d = dirty_sector_get(cyl, head, sector_id, before, size);
+    if (!d) return -1;
+
+    while (g_edit_journal_count > g_edit_journal_pos) edit_record_free(&g_edit_journal[--g_edit_journal_count]);
+    if (g_edit_journal_count == MAX_EDIT_JOURNAL) {
+        edit_record_free(&g_edit_journal[0]);
+        memmove(&g_edit_journal[0], &g_edit_journal[1], (g_edit_journal_count - 1) * sizeof(EditRecord));
+        g_edit_journal_count--;
     }
-    else {
-        snprintf(line1_buf, sizeof(line1_buf), "Track info not loaded.");
+    if (g_edit_journal_count == g_edit_journal_capacity) {
+        size_t new_capacity = g_edit_journal_capacity ? g_edit_journal_capacity * 2 : 64;
+        EditRecord* grown = (EditRecord*)realloc(g_edit_journal, new_capacity * sizeof(EditRecord));
+        if (!grown) return -1;
+        g_edit_journal = grown;
+        g_edit_journal_capacity = new_capacity;
     }
 
-    /* Calculate max width for C/H/S info to avoid overwriting filename */
-    int chs_info_max_len = max_w - current_x_pos_line1 - 2; /* Default max width */
-    if (filename_len_on_screen > 0) {
-        /* If filename is displayed, C/H/S info must end before filename starts */
-        chs_info_max_len = filename_start_x - current_x_pos_line1 - 1; /* -1 for a space separator */
+    EditRecord* rec = &g_edit_journal[g_edit_journal_count];
+    rec->length = last - first;
+    rec->bytes = (uint8_t*)malloc((size_t)rec->length * 2);
+    if (!rec->bytes) return -1;
+    rec->cyl = cyl;
+    rec->head = head;
+    rec->sector_id = sector_id;
+    rec->offset = first;
+    memcpy(rec->bytes, before + first, rec->length);
+    memcpy(rec->bytes + rec->length, after + first, rec->length);
+    g_edit_journal_pos = ++g_edit_journal_count;
+
+    memcpy(d->data + first, after + first, rec->length);
+    diff_sector_edited(cyl, head, sector_id, d->data, size);
+    search_index_close(); /* The sidecar no longer matches what searches see */
+    return 1;
+}
+
+/* Re-reads the current track's metadata and sector after the image changed */
+static void refresh_track_after_write(void) {
+    const ImdTrackInfo* updated_imdf_track = imdf_get_track_info(g_imdf_handle, current_track_index_in_image);
+    if (!updated_imdf_track) {
+        display_error("ERR: Post-write track info fetch failed!");
+        return;
     }
-    if (chs_info_max_len < 0) chs_info_max_len = 0; /* Prevent negative length */
+    uint32_t preserved_logical_idx = current_sector_logical_idx;
+    long preserved_data_offset = current_data_offset_in_sector;
 
-    wattron(win_info, COLOR_PAIR(CP_INFO));
-    mvwprintw(win_info, 1, current_x_pos_line1, "%.*s", chs_info_max_len, line1_buf); /* Print C/H/S info */
-    wattroff(win_info, COLOR_PAIR(CP_INFO));
+    copy_track_metadata_for_display(updated_imdf_track);
+    if (current_track_display.num_sectors == 0) {
+        current_sector_logical_idx = 0; current_data_offset_in_sector = 0;
+    }
+    else {
+        if (preserved_logical_idx >= current_track_display.num_sectors) {
+            current_sector_logical_idx = current_track_display.num_sectors - 1; preserved_data_offset = 0;
+        }
+        else { current_sector_logical_idx = preserved_logical_idx; }
 
+        if (preserved_data_offset >= (long)current_track_display.sector_size) {
+            current_data_offset_in_sector = 0;
+        }
+        else { current_data_offset_in_sector = preserved_data_offset; }
+    }
+    load_sector_for_display();
+}
 
-    if (current_track_display.loaded && current_track_display.num_sectors > 0) {
-        int current_x = 2;
-        char track_prefix[20]; /* Buffer for "Track: ttt - " */
+/* Undoes the last applied edit, or redoes the next one. Returns 1 if one was applied, 0 if none is left. */
+int undo_redo_edit(int redo) {
+    char msg[sizeof(status_message)];
+    if (redo ? g_edit_journal_pos == g_edit_journal_count : g_edit_journal_pos == 0) return 0;
 
-        /* Format track number, padded to 3 characters (e.g., "  0", " 12", "123") */
-        snprintf(track_prefix, sizeof(track_prefix), "Track: %3zu - ", current_track_index_in_image);
+    const EditRecord* rec = &g_edit_journal[redo ? g_edit_journal_pos++ : --g_edit_journal_pos];
+    DirtySector* d = dirty_sector_find(rec->cyl, rec->head, rec->sector_id, NULL);
+    if (d) {
+        memcpy(d->data + rec->offset, rec->bytes + (redo ? rec->length : 0), rec->length);
+        diff_sector_edited(d->cyl, d->head, d->sector_id, d->data, d->size);
+    }
+    search_index_close();
 
-        wattron(win_info, COLOR_PAIR(CP_INFO));
-        mvwprintw(win_info, 2, current_x, "%sSectors: ", track_prefix);
-        wattroff(win_info, COLOR_PAIR(CP_INFO));
-        current_x += (int)strlen(track_prefix) + (int)strlen("Sectors: ");
+    load_sector_for_display();
+    draw_data_window();
+    snprintf(msg, sizeof(msg), "%s edit of C%u H%u S%u (%u byte%s at 0x%03X), %zu sector(s) unsaved.",
+        redo ? "Redid" : "Undid", rec->cyl, rec->head, rec->sector_id,
+        rec->length, rec->length == 1 ? "" : "s", rec->offset, dirty_sector_count());
+    update_status(msg);
+    draw_info_window();
+    doupdate();
+    return 1;
+}
 
-        for (uint32_t p_idx = 0; p_idx < current_track_display.num_sectors; ++p_idx) {
-            uint8_t logical_id_at_physical_p = current_track_display.smap[p_idx];
-            char sector_str[5];
-            snprintf(sector_str, sizeof(sector_str), "%u ", logical_id_at_physical_p);
+/* Copies the image file to path, keeping its permissions. Returns 0 or an errno. */
+static int copy_image_file(const char* from, const char* to) {
+    uint8_t buf[65536];
+    size_t n;
+    int err = 0;
+    FILE* in = fopen(from, "rb");
+    FILE* out;
+
+    if (!in) return errno;
+    out = fopen(to, "wb");
+    if (!out) { err = errno; fclose(in); return err; }
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+        if (fwrite(buf, 1, n, out) != n) { err = errno ? errno : EIO; break; }
+    }
+    if (!err && ferror(in)) err = EIO;
+    fclose(in);
+    if (fclose(out) != 0 && !err) err = errno ? errno : EIO;
+#ifndef _WIN32
+    if (!err) {
+        struct stat st;
+        if (stat(from, &st) == 0) chmod(to, st.st_mode & 07777);
+    }
+#endif
+    return err;
+}
 
-            if (current_x + (int)strlen(sector_str) >= max_w - 1) {
-                wattron(win_info, COLOR_PAIR(CP_INFO) | A_REVERSE);
-                mvwaddch(win_info, 2, max_w - 2, '>');
-                wattroff(win_info, COLOR_PAIR(CP_INFO) | A_REVERSE);
-                break;
-            }
+/*
+ * Writes every sector with unsaved edits to the image, without touching the
+ * UI. The edits go into a copy of the image (<image>.tmp) through a handle of
+ * its own; the copy is read back and checked, and only then renamed over the
+ * image, so a failure part way leaves the image as it was. How often libimdf
+ * rewrites the copy while the sectors go in is up to libimdf. g_imdf_handle is
+ * reopened on the new file. Returns the number of sectors written, or -1 (err
+ * says why; every edit stays unsaved).
+ */
+int write_dirty_sectors(char* err, size_t err_size) {
+    char tmp_path[MAX_FILENAME + 8];
+    ImdImageFile* tmp_handle = NULL;
+    ImdImageFile* reopened = NULL;
+    uint8_t check[LIBIMD_MAX_SECTOR_SIZE];
+    int written = 0;
+    int res;
+
+    for (size_t i = 0; i < g_dirty_count; ++i) {
+        if (memcmp(g_dirty_sectors[i].data, g_dirty_sectors[i].saved, g_dirty_sectors[i].size) != 0) written++;
+    }
+    if (written == 0) return 0;
+    if (!g_image_path || strlen(g_image_path) + 5 > sizeof(tmp_path)) {
+        snprintf(err, err_size, "Cannot save: image path is too long.");
+        return -1;
+    }
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", g_image_path);
+    if ((res = copy_image_file(g_image_path, tmp_path)) != 0) {
+        snprintf(err, err_size, "Cannot save: copying the image failed: %.50s", strerror(res));
+        remove(tmp_path);
+        return -1;
+    }
 
-            if (logical_id_at_physical_p == current_sector_logical_id) {
-                wattron(win_info, COLOR_PAIR(CP_INFO_SECTOR_HIGHLIGHT));
-            }
-            else {
-                wattron(win_info, COLOR_PAIR(CP_INFO_SECTOR_NORMAL));
-            }
-            mvwprintw(win_info, 2, current_x, "%s", sector_str);
-            if (logical_id_at_physical_p == current_sector_logical_id) {
-                wattroff(win_info, COLOR_PAIR(CP_INFO_SECTOR_HIGHLIGHT));
-            }
-            else {
-                wattroff(win_info, COLOR_PAIR(CP_INFO_SECTOR_NORMAL));
-            }
-            current_x += (int)strlen(sector_str);
+    res = imdf_open(tmp_path, 0, &tmp_handle);
+    if (res != IMDF_ERR_OK) {
+        snprintf(err, err_size, "Cannot save: opening the copy failed (Error %d).", res);
+        remove(tmp_path);
+        return -1;
+    }
+    for (size_t i = 0; i < g_dirty_count; ++i) {
+        const DirtySector* d = &g_dirty_sectors[i];
+        if (memcmp(d->data, d->saved, d->size) == 0) continue;
+        res = imdf_write_sector(tmp_handle, d->cyl, d->head, d->sector_id, d->data, d->size);
+        if (res != IMDF_ERR_OK) {
+            snprintf(err, err_size, "Error writing sector C%u H%u S%u: %d (image unchanged)", d->cyl, d->head, d->sector_id, res);
+            imdf_close(tmp_handle);
+            remove(tmp_path);
+            return -1;
         }
     }
-    else {
-        char track_prefix[20];
-        snprintf(track_prefix, sizeof(track_prefix), "Track: %3zu - ", current_track_index_in_image);
-        wattron(win_info, COLOR_PAIR(CP_INFO));
-        mvwprintw(win_info, 2, 2, "%sSectors: N/A", track_prefix);
-        wattroff(win_info, COLOR_PAIR(CP_INFO));
+    imdf_close(tmp_handle);
+
+    /* Read the copy back as it is on disk before it replaces the image */
+    res = imdf_open(tmp_path, 1, &tmp_handle);
+    for (size_t i = 0; res == IMDF_ERR_OK && i < g_dirty_count; ++i) {
+        const DirtySector* d = &g_dirty_sectors[i];
+        res = imdf_read_sector(tmp_handle, d->cyl, d->head, d->sector_id, check, d->size);
+        if (res == IMDF_ERR_OK && memcmp(check, d->data, d->size) != 0) res = -1;
+    }
+    if (tmp_handle) imdf_close(tmp_handle);
+    if (res != IMDF_ERR_OK) {
+        snprintf(err, err_size, "Cannot save: the written copy does not read back (Error %d); image unchanged.", res);
+        remove(tmp_path);
+        return -1;
     }
 
-    const char* mode_str = "N/A";
-    uint32_t num_s = 0;
-    uint32_t sect_sz = 0;
-    const char* data_status_str = "N/A";
-    char err_indicator[10] = "";
-    char dam_indicator[10] = "";
+#ifdef _WIN32
+    remove(g_image_path);           /* rename() does not replace on Windows; <image>.tmp holds the data until renamed */
+#endif
+    if (rename(tmp_path, g_image_path) != 0) {
+        snprintf(err, err_size, "Cannot save: replacing the image failed: %.50s", strerror(errno));
+        remove(tmp_path);
+        return -1;
+    }
+    for (size_t i = 0; i < g_dirty_count; ++i) {
+        memcpy(g_dirty_sectors[i].saved, g_dirty_sectors[i].data, g_dirty_sectors[i].size);
+    }
+#ifdef IMDV_HAVE_THREADS
+    prefetch_stop();                /* Its handle holds the old contents too; the next track shown restarts it */
+#endif
+    sector_cache_clear();           /* Holds the image's old contents */
+    g_flag_index.valid = 0;         /* Writing may change how a sector is stored (compressed) */
 
-    if (current_track_display.loaded) {
-        mode_str = get_mode_string(current_track_display.mode);
-        num_s = current_track_display.num_sectors;
-        sect_sz = current_track_display.sector_size;
+    res = imdf_open(g_image_path, 0, &reopened);
+    if (res != IMDF_ERR_OK) {
+        /* Saved, but the old handle still shows the image as it was before */
+        snprintf(err, err_size, "Saved, but reopening the image failed (Error %d).", res);
+        return -1;
+    }
+    if (g_imdf_handle) {
+        ImdImageFile* old_handle = g_imdf_handle;
+        g_imdf_handle = reopened;
+        search_handle_replaced(old_handle);
+        imdf_close(old_handle);
+    }
+    else {
+        g_imdf_handle = reopened;
+    }
+    return written;
+}
 
-        if (num_s > 0 && current_sector_physical_idx < num_s) {
-            uint8_t sflag_val = current_track_display.sflag[current_sector_physical_idx];
-            if (!IMD_SDR_HAS_DATA(sflag_val)) {
-                data_status_str = "Unavailable";
-            }
-            else if (IMD_SDR_IS_COMPRESSED(sflag_val)) {
-                data_status_str = "Compressed";
-            }
-            else {
-                data_status_str = "Normal Data";
-            }
-            if (IMD_SDR_HAS_ERR(sflag_val)) strcpy(err_indicator, " +ERR");
-            if (IMD_SDR_HAS_DAM(sflag_val)) strcpy(dam_indicator, " +DAM");
+/* Saves all unsaved edits (S, or on quit). Returns the number of sectors written, or -1 after showing the error. */
+int flush_dirty_sectors(void) {
+    char err_buf[100];
+    int written;
+
+    if (dirty_sector_count() > 0) {
+#ifdef IMDV_HAVE_THREADS
+        /* Search workers read the image through their own handles; stop them before it is rewritten */
+        if (search_workers_running()) {
+            search_stop_workers();
+            g_search_active = 0;
         }
+#endif
+        update_status("Writing sectors..."); doupdate();
     }
-    char line3_buf[120];
-    snprintf(line3_buf, sizeof(line3_buf), "%s, %u sectors of %u bytes, %s%s%s",
-        mode_str, num_s, sect_sz, data_status_str, dam_indicator, err_indicator);
-    wattron(win_info, COLOR_PAIR(CP_INFO));
-    mvwprintw(win_info, 3, 2, "%.*s", max_w - 3, line3_buf);
-    wattroff(win_info, COLOR_PAIR(CP_INFO));
+    written = write_dirty_sectors(err_buf, sizeof(err_buf));
+    if (written != 0) refresh_track_after_write(); /* Writing may change the sector's stored form */
+    if (written < 0) display_error(err_buf);
+    return written;
+}
 
-    wattron(win_info, COLOR_PAIR(CP_INFO));
-    for (int col_idx = 1; col_idx < max_w - 1; ++col_idx) {
-        mvwaddch(win_info, 4, col_idx, ' '); /* Clear line 4 */
-    }
-    wattroff(win_info, COLOR_PAIR(CP_INFO));
+/* Offers to save unsaved edits before quitting. Returns 1 to quit, 0 to stay. */
+int confirm_quit(void) {
+    char msg[sizeof(status_message)];
+    size_t unsaved = dirty_sector_count();
+    int confirm_ch;
 
+    if (unsaved == 0) return 1;
+    snprintf(msg, sizeof(msg), "%zu sector(s) have unsaved changes. Save before quitting? (Y/N, ESC=Cancel)", unsaved);
+    update_status(msg); doupdate();
+    do { confirm_ch = tolower(modal_getch(win_data)); } while (confirm_ch != 'y' && confirm_ch != 'n' && confirm_ch != ESC_KEY);
 
-    if (write_enabled) {
-        int wp_stat = 0;
-        imdf_get_write_protect(g_imdf_handle, &wp_stat);
-        const char* write_label_str = wp_stat ? " DISK RO " : " WRITE ENABLED ";
-        int label_attr = wp_stat ? COLOR_PAIR(CP_INFO) : (COLOR_PAIR(CP_INFO_HL) | A_BOLD);
+    if (confirm_ch == 'n') return 1;
+    if (confirm_ch == 'y' && flush_dirty_sectors() >= 0) return 1;
+    build_status_message();
+    update_status(status_message);
+    draw_info_window();
+    draw_data_window();
+    doupdate();
+    return 0;
+}
 
-        wattron(win_info, label_attr);
-        mvwprintw(win_info, 4, 2, "%s", write_label_str);
-        wattroff(win_info, label_attr);
-    }
-    else {
-        int wp_stat = 1;
-        if (g_imdf_handle) {
-            imdf_get_write_protect(g_imdf_handle, &wp_stat);
-        }
-        if (wp_stat) {
-            wattron(win_info, COLOR_PAIR(CP_INFO));
-            mvwprintw(win_info, 4, 2, " DISK RO ");
-            wattroff(win_info, COLOR_PAIR(CP_INFO));
-        }
-    }
+void edit_cache_free(void) {
+    for (size_t i = 0; i < g_dirty_count; ++i) free(g_dirty_sectors[i].data);
+    for (size_t i = 0; i < g_edit_journal_count; ++i) edit_record_free(&g_edit_journal[i]);
+    free(g_dirty_sectors);
+    free(g_edit_journal);
+    g_dirty_sectors = NULL;
+    g_edit_journal = NULL;
+    g_dirty_count = g_dirty_capacity = 0;
+    g_edit_journal_count = g_edit_journal_pos = g_edit_journal_capacity = 0;
+}
 
-    if (xor_mask != 0) {
-        char xor_str[20];
-        snprintf(xor_str, sizeof(xor_str), "XOR: 0x%02X", xor_mask);
-        int center_pos = (max_w - (int)strlen(xor_str)) / 2;
-        if (center_pos < 2) center_pos = 2;
-        /* Ensure it doesn't overwrite WRITE ENABLED/DISK RO if they are long */
-        int write_label_len = 0;
-        if (write_enabled) write_label_len = (int)strlen((imdf_get_write_protect(g_imdf_handle, &write_label_len), write_label_len ? " DISK RO " : " WRITE ENABLED "));
-        else if (g_imdf_handle && (imdf_get_write_protect(g_imdf_handle, &write_label_len), write_label_len)) write_label_len = (int)strlen(" DISK RO ");
 
-        if (center_pos <= 2 + write_label_len + 1) center_pos = 2 + write_label_len + 2; /* Move after write status + space*/
+/* --- Decoded Sector Cache and Prefetch --- */
+
+/*
+ * The viewer reads sectors through sector_cache_read(), so moving back and
+ * forth between recently visited sectors does not go back to libimdf. When a
+ * track is displayed, the rest of it and its neighbors (cylinder - 1 and + 1
+ * on the same head, and the other head) are read into the cache by a worker
+ * thread with its own read-only handle, started with the first track shown;
+ * g_sector_cache_lock guards the cache and the queue between it and the UI.
+ * The worker reads a sector without the lock and drops it if the cache was
+ * cleared meanwhile (a save). Without threads, or if the image cannot be
+ * opened again, the main loop reads a few sectors at a time while the UI
+ * waits for keys, like the background search. Edits are overlaid after the
+ * cache, which only ever holds the image's contents. -C=0 turns the cache
+ * and prefetch off.
+ */
 
+static void sector_cache_lock(void) {
+#ifdef IMDV_HAVE_THREADS
+    pthread_mutex_lock(&g_sector_cache_lock);
+#endif
+}
 
-        if (center_pos + (int)strlen(xor_str) < max_w - 1) {
-            wattron(win_info, COLOR_PAIR(CP_INFO));
-            mvwprintw(win_info, 4, center_pos, "%s", xor_str);
-            wattroff(win_info, COLOR_PAIR(CP_INFO));
-        }
+static void sector_cache_unlock(void) {
+#ifdef IMDV_HAVE_THREADS
+    pthread_mutex_unlock(&g_sector_cache_lock);
+#endif
+}
+
+static uint32_t sector_cache_key(uint8_t cyl, uint8_t head, uint8_t sector_id) {
+    return ((uint32_t)cyl << 16) | ((uint32_t)head << 8) | sector_id;
+}
+
+static SectorCacheEntry** sector_cache_bucket(uint32_t key) {
+    return &g_sector_cache.buckets[(key * 2654435761u) >> 22]; /* Top 10 bits: SECTOR_CACHE_BUCKETS */
+}
+
+static void sector_cache_unlink(SectorCacheEntry* e) {
+    if (e->lru_prev) e->lru_prev->lru_next = e->lru_next; else g_sector_cache.lru_head = e->lru_next;
+    if (e->lru_next) e->lru_next->lru_prev = e->lru_prev; else g_sector_cache.lru_tail = e->lru_prev;
+}
+
+static void sector_cache_push_front(SectorCacheEntry* e) {
+    e->lru_prev = NULL;
+    e->lru_next = g_sector_cache.lru_head;
+    if (g_sector_cache.lru_head) g_sector_cache.lru_head->lru_prev = e;
+    g_sector_cache.lru_head = e;
+    if (!g_sector_cache.lru_tail) g_sector_cache.lru_tail = e;
+}
+
+static void sector_cache_remove(SectorCacheEntry* e) {
+    SectorCacheEntry** link = sector_cache_bucket(e->key);
+    while (*link != e) link = &(*link)->hash_next;
+    *link = e->hash_next;
+    sector_cache_unlink(e);
+    g_sector_cache.bytes -= e->size;
+    free(e);
+}
+
+static SectorCacheEntry* sector_cache_find(uint32_t key, uint32_t size) {
+    for (SectorCacheEntry* e = *sector_cache_bucket(key); e; e = e->hash_next) {
+        if (e->key == key && e->size == size) return e;
     }
+    return NULL;
+}
 
-    const char* charset_str = (current_charset == CHARSET_ASCII) ? "ASCII" : "EBCDIC";
-    int charset_len = (int)strlen(charset_str);
-    int charset_pos = max_w - charset_len - 2; /* Position from the right */
-    if (charset_pos >= 1 && (charset_pos + charset_len < max_w - 1)) {
-        /* Check if XOR string is displayed and would overlap */
-        if (xor_mask != 0) {
-            char xor_str_check[20];
-            snprintf(xor_str_check, sizeof(xor_str_check), "XOR: 0x%02X", xor_mask);
-            int xor_center_pos = (max_w - (int)strlen(xor_str_check)) / 2;
-            if (xor_center_pos < 2) xor_center_pos = 2;
-            int write_label_len_check = 0;
-            if (write_enabled) imdf_get_write_protect(g_imdf_handle, &write_label_len_check);
-            else if (g_imdf_handle) imdf_get_write_protect(g_imdf_handle, &write_label_len_check);
-            if (write_label_len_check) write_label_len_check = (int)strlen((write_enabled && !write_label_len_check) ? " WRITE ENABLED " : " DISK RO ");
+/* Adds a sector read with the given imdf_read_sector() result, evicting the least recently used to fit */
+static void sector_cache_insert(SectorCacheEntry* e, uint32_t key, int status, uint32_t size) {
+    while (g_sector_cache.lru_tail && g_sector_cache.bytes + size > g_sector_cache.budget) {
+        sector_cache_remove(g_sector_cache.lru_tail);
+    }
+    e->key = key;
+    e->status = status;
+    e->size = size;
+    e->hash_next = *sector_cache_bucket(key);
+    *sector_cache_bucket(key) = e;
+    g_sector_cache.bytes += size;
+    sector_cache_push_front(e);
+}
+
+/*
+ * Returns the cache entry of a sector, reading it from the image if it is not
+ * cached yet; *res is its imdf_read_sector() result. NULL if it was not cached:
+ * on a read error (*res says which), or if it cannot be (*res is IMDF_ERR_OK).
+ * Called with the cache locked.
+ */
+static SectorCacheEntry* sector_cache_fill(uint8_t cyl, uint8_t head, uint8_t sector_id, uint32_t size, int* res) {
+    uint32_t key = sector_cache_key(cyl, head, sector_id);
+    SectorCacheEntry* e = sector_cache_find(key, size);
+    if (e) {
+        *res = e->status;
+        return e;
+    }
+    *res = IMDF_ERR_OK;
+    if (size > g_sector_cache.budget) return NULL;
+    e = (SectorCacheEntry*)malloc(sizeof(SectorCacheEntry) + size);
+    if (!e) return NULL;
+
+    *res = imdf_read_sector(g_imdf_handle, cyl, head, sector_id, e->data, size);
+    if (*res != IMDF_ERR_OK && *res != IMDF_ERR_UNAVAILABLE) {
+        free(e);
+        return NULL;
+    }
+    sector_cache_insert(e, key, *res, size);
+    return e;
+}
 
+/* imdf_read_sector() through the cache: same result codes, the buffer is not filled for IMDF_ERR_UNAVAILABLE */
+int sector_cache_read(uint8_t cyl, uint8_t head, uint8_t sector_id, uint8_t* buffer, uint32_t size) {
+    int res;
+    SectorCacheEntry* e;
+
+    sector_cache_lock();
+    e = sector_cache_fill(cyl, head, sector_id, size, &res);
+    if (e) {
+        sector_cache_unlink(e);
+        sector_cache_push_front(e);
+        res = e->status;
+        if (res == IMDF_ERR_OK) memcpy(buffer, e->data, size);
+    }
+    sector_cache_unlock();
+    if (!e && res == IMDF_ERR_OK) res = imdf_read_sector(g_imdf_handle, cyl, head, sector_id, buffer, size);
+    return res;
+}
 
-            if (xor_center_pos <= 2 + write_label_len_check + 1) xor_center_pos = 2 + write_label_len_check + 2;
+void sector_cache_clear(void) {
+    sector_cache_lock();
+#ifdef IMDV_HAVE_THREADS
+    g_sector_cache_generation++;
+#endif
+    while (g_sector_cache.lru_head) sector_cache_remove(g_sector_cache.lru_head);
+    sector_cache_unlock();
+}
 
+/*
+ * Takes the next queued sector to prefetch from 'handle'. Returns 0 once the
+ * queue is done. Called with the cache locked.
+ */
+static int prefetch_next(ImdImageFile* handle, uint8_t* cyl, uint8_t* head, uint8_t* sector_id, uint32_t* size) {
+    while (g_prefetch_track < g_prefetch_count) {
+        const ImdTrackInfo* t = imdf_get_track_info(handle, g_prefetch_tracks[g_prefetch_track]);
+        if (!t || g_prefetch_sector >= t->num_sectors || t->sector_size == 0) {
+            g_prefetch_track++;
+            g_prefetch_sector = 0;
+            continue;
+        }
+        *cyl = t->cyl;
+        *head = t->head;
+        *sector_id = t->smap[g_prefetch_sector++];
+        *size = t->sector_size;
+        return 1;
+    }
+    return 0;
+}
 
-            if (charset_pos < xor_center_pos + (int)strlen(xor_str_check) + 1) {
-                /* Overlap, move charset further left if possible, or don't print */
-                charset_pos = xor_center_pos - charset_len - 2; /* Place before XOR */
-            }
+#ifdef IMDV_HAVE_THREADS
+/* Reads queued sectors into the cache until prefetch_stop(), sleeping while the queue is done */
+static void* prefetch_worker(void* arg) {
+    uint8_t cyl, head, sector_id;
+    uint32_t size;
+    (void)arg;
+
+    pthread_mutex_lock(&g_sector_cache_lock);
+    while (!g_prefetch_quit) {
+        uint32_t key;
+        unsigned generation;
+        SectorCacheEntry* e;
+        int res;
+
+        if (!prefetch_next(g_prefetch_handle, &cyl, &head, &sector_id, &size)) {
+            pthread_cond_wait(&g_prefetch_wake, &g_sector_cache_lock);
+            continue;
         }
-        if (charset_pos >= 1) { /* Recheck after potential move */
-            wattron(win_info, COLOR_PAIR(CP_INFO));
-            mvwprintw(win_info, 4, charset_pos, "%s", charset_str);
-            wattroff(win_info, COLOR_PAIR(CP_INFO));
+        key = sector_cache_key(cyl, head, sector_id);
+        if (size > g_sector_cache.budget || sector_cache_find(key, size)) continue;
+        generation = g_sector_cache_generation;
+        pthread_mutex_unlock(&g_sector_cache_lock);
+
+        e = (SectorCacheEntry*)malloc(sizeof(SectorCacheEntry) + size);
+        res = e ? imdf_read_sector(g_prefetch_handle, cyl, head, sector_id, e->data, size) : IMDF_ERR_OK;
+
+        pthread_mutex_lock(&g_sector_cache_lock);
+        if (e && (res == IMDF_ERR_OK || res == IMDF_ERR_UNAVAILABLE) &&
+            generation == g_sector_cache_generation && !sector_cache_find(key, size)) {
+            sector_cache_insert(e, key, res, size);
+        }
+        else {
+            free(e);
         }
     }
-    wnoutrefresh(win_info);
+    pthread_mutex_unlock(&g_sector_cache_lock);
+    return NULL;
 }
 
-void draw_data_window(void) {
-    if (!win_data) return;
-    werase(win_data);
+/* Opens the image again for the prefetch worker and starts it. Returns 0 if it could not be. */
+static int prefetch_start(void) {
+    size_t num_tracks = 0;
 
-    if (!current_track_display.loaded || current_track_display.num_sectors == 0 || current_track_display.sector_size == 0) {
-        wnoutrefresh(win_data);
+    if (g_prefetch_failed || !g_image_path) return 0;
+    if (imdf_open(g_image_path, 1, &g_prefetch_handle) != IMDF_ERR_OK) {
+        g_prefetch_handle = NULL;
+        g_prefetch_failed = 1;
+        return 0;
+    }
+    g_prefetch_quit = 0;
+    if (imdf_get_num_tracks(g_prefetch_handle, &num_tracks) != IMDF_ERR_OK || num_tracks != total_tracks_in_image ||
+        pthread_create(&g_prefetch_thread, NULL, prefetch_worker, NULL) != 0) {
+        imdf_close(g_prefetch_handle);
+        g_prefetch_handle = NULL;
+        g_prefetch_failed = 1;
+        return 0;
+    }
+    return 1;
+}
+
+/* Stops the prefetch worker, if running, and closes its handle; the next track shown starts it again */
+void prefetch_stop(void) {
+    if (!g_prefetch_handle) return;
+    pthread_mutex_lock(&g_sector_cache_lock);
+    g_prefetch_quit = 1;
+    pthread_cond_signal(&g_prefetch_wake);
+    pthread_mutex_unlock(&g_sector_cache_lock);
+    pthread_join(g_prefetch_thread, NULL);
+    imdf_close(g_prefetch_handle);
+    g_prefetch_handle = NULL;
+}
+#endif
+
+/* Queues track_idx and the tracks next to it for prefetching, replacing any earlier queue */
+void prefetch_neighbors(size_t track_idx) {
+    const ImdTrackInfo* track = imdf_get_track_info(g_imdf_handle, track_idx);
+#ifdef IMDV_HAVE_THREADS
+    if (track && g_sector_cache.budget > 0 && !g_prefetch_handle) prefetch_start();
+#endif
+    sector_cache_lock();
+    g_prefetch_count = 0;
+    g_prefetch_track = 0;
+    g_prefetch_sector = 0;
+    if (!track || g_sector_cache.budget == 0) {
+        sector_cache_unlock();
         return;
     }
+    g_prefetch_tracks[g_prefetch_count++] = track_idx;
+
+    /* Neighbors are stored close by: cylinders in order, heads interleaved */
+    size_t first = track_idx > 4 ? track_idx - 4 : 0;
+    for (size_t i = first; i <= track_idx + 4 && i < total_tracks_in_image; ++i) {
+        const ImdTrackInfo* t = (i == track_idx) ? NULL : imdf_get_track_info(g_imdf_handle, i);
+        if (!t || !t->loaded || g_prefetch_count == PREFETCH_MAX_TRACKS) continue;
+        if ((t->head == track->head && (t->cyl + 1 == track->cyl || t->cyl == track->cyl + 1)) ||
+            (t->cyl == track->cyl && t->head != track->head)) {
+            g_prefetch_tracks[g_prefetch_count++] = i;
+        }
+    }
+#ifdef IMDV_HAVE_THREADS
+    if (g_prefetch_handle) pthread_cond_signal(&g_prefetch_wake);
+#endif
+    sector_cache_unlock();
+}
 
-    int max_y, max_x; getmaxyx(win_data, max_y, max_x);
-    int lines_to_draw = (max_y > 0) ? max_y : DATA_LINES;
-    int current_highlight_active = (g_found_len > 0 &&
-        g_found_on_track_idx == current_track_index_in_image &&
-        g_found_on_sector_log_idx == current_sector_logical_idx);
+/* Prefetch is left for prefetch_poll() to do on the UI thread */
+int prefetch_pending(void) {
+#ifdef IMDV_HAVE_THREADS
+    if (g_prefetch_handle) return 0;
+#endif
+    return g_prefetch_track < g_prefetch_count;
+}
 
-    for (int line = 0; line < lines_to_draw; ++line) {
-        uint32_t line_offset_in_sector = (uint32_t)current_data_offset_in_sector + (line * BYTES_PER_LINE);
-        if (line_offset_in_sector >= current_track_display.sector_size) break;
+/* Reads the next few queued neighbor sectors into the cache when there is no prefetch worker; called from the main loop */
+void prefetch_poll(void) {
+    int budget = PREFETCH_SECTORS_PER_SLICE;
+    uint8_t cyl, head, sector_id;
+    uint32_t size;
+    int res;
 
-        wattron(win_data, COLOR_PAIR(CP_DATA_ADDR));
-        mvwprintw(win_data, line, 0, "%04X:", line_offset_in_sector);
-        wattroff(win_data, COLOR_PAIR(CP_DATA_ADDR));
+    if (!prefetch_pending() || g_search_active) return; /* The search has the image to itself */
+    while (budget-- > 0 && prefetch_next(g_imdf_handle, &cyl, &head, &sector_id, &size)) {
+        sector_cache_fill(cyl, head, sector_id, size, &res);
+    }
+}
 
-        wmove(win_data, line, 6);
-        for (int i = 0; i < BYTES_PER_LINE; ++i) {
-            uint32_t byte_offset_in_sector = line_offset_in_sector + i;
-            int is_highlighted_byte = 0;
 
-            if (current_highlight_active &&
-                byte_offset_in_sector >= (uint32_t)g_found_offset_in_sector &&
-                byte_offset_in_sector < (uint32_t)(g_found_offset_in_sector + g_found_len)) {
-                is_highlighted_byte = 1;
-            }
+/* --- Two-Image Difference View --- */
 
-            if (byte_offset_in_sector >= current_track_display.sector_size) {
-                wprintw(win_data, "   ");
-            }
-            else {
-                uint8_t val = current_sector_buffer[byte_offset_in_sector] ^ xor_mask;
-                wattron(win_data, COLOR_PAIR(is_highlighted_byte ? CP_SEARCH_HIGHLIGHT : CP_DATA_HEX));
-                wprintw(win_data, " %02X", val);
-                wattroff(win_data, COLOR_PAIR(is_highlighted_byte ? CP_SEARCH_HIGHLIGHT : CP_DATA_HEX));
-            }
-            if ((i + 1) % 8 == 0 && i < 15) waddch(win_data, ' ');
-        }
+/*
+ * imdv A.imd B.imd shows the sector of B with the same C/H/S below the
+ * sector of A, with differing bytes highlighted in both. A per-sector
+ * index of hashes is built in the background, and [ and ] jump to the
+ * previous/next differing sector without reading any data. The index is
+ * built by a worker thread with its own read-only handles on A and B and a
+ * copy of A's unsaved edits taken when it starts; g_diff.lock guards the
+ * index between it and the UI. Edits happen on the UI thread: an edit or undo
+ * rehashes its sector there at once, and one not indexed yet is marked so the
+ * worker keeps that hash over the one it read. Without threads, or if the
+ * images cannot be opened again, the index is built a slice at a time while
+ * the UI is idle. B is never written.
+ */
 
-        int ascii_start_col = 6 + (BYTES_PER_LINE * 3) + (BYTES_PER_LINE / 8) + 1;
-        if (ascii_start_col < max_x) {
-            wmove(win_data, line, ascii_start_col);
-            for (int i = 0; i < BYTES_PER_LINE; ++i) {
-                uint32_t byte_offset_in_sector = line_offset_in_sector + i;
-                int is_highlighted_byte = 0;
+static void diff_lock(void) {
+#ifdef IMDV_HAVE_THREADS
+    if (g_diff.worker_running) pthread_mutex_lock(&g_diff.lock);
+#endif
+}
 
-                if (current_highlight_active &&
-                    byte_offset_in_sector >= (uint32_t)g_found_offset_in_sector &&
-                    byte_offset_in_sector < (uint32_t)(g_found_offset_in_sector + g_found_len)) {
-                    is_highlighted_byte = 1;
-                }
+static void diff_unlock(void) {
+#ifdef IMDV_HAVE_THREADS
+    if (g_diff.worker_running) pthread_mutex_unlock(&g_diff.lock);
+#endif
+}
 
-                if (byte_offset_in_sector >= current_track_display.sector_size) {
-                    waddch(win_data, ' ');
-                }
-                else {
-                    uint8_t val = current_sector_buffer[byte_offset_in_sector] ^ xor_mask;
-                    uint8_t display_char = (current_charset == CHARSET_EBCDIC) ? ebcdic_to_ascii[val] : val;
-                    if (display_char == '\t') display_char = ' ';
-                    else if (display_char == '\r') display_char = '<';
-                    else if (display_char == '\n') display_char = '>';
-
-                    wattron(win_data, COLOR_PAIR(is_highlighted_byte ? CP_SEARCH_HIGHLIGHT : CP_DATA_ASC));
-                    waddch(win_data, (isprint(display_char) ? display_char : '.'));
-                    wattroff(win_data, COLOR_PAIR(is_highlighted_byte ? CP_SEARCH_HIGHLIGHT : CP_DATA_ASC));
-                }
-            }
-        }
+static void diff_map_tracks(ImdImageFile* handle, size_t num_tracks, int32_t track_of[256][2]) {
+    for (int c = 0; c < 256; ++c) track_of[c][0] = track_of[c][1] = -1;
+    for (size_t t = 0; t < num_tracks; ++t) {
+        const ImdTrackInfo* track = imdf_get_track_info(handle, t);
+        if (track && track->head < 2 && track_of[track->cyl][track->head] < 0) track_of[track->cyl][track->head] = (int32_t)t;
     }
-    wnoutrefresh(win_data);
 }
 
-uint32_t get_physical_idx_for_display(uint32_t logical_idx_in_track_smap_order) {
-    if (!current_track_display.loaded || logical_idx_in_track_smap_order >= current_track_display.num_sectors) {
-        if (current_track_display.num_sectors == 0 && logical_idx_in_track_smap_order == 0) return 0;
-        return 0;
+/* Finds a sector by C/H/S. Returns its physical index (*track_out set) or -1. */
+static int diff_find_sector(ImdImageFile* handle, int32_t track_of[256][2], uint8_t cyl, uint8_t head, uint8_t sector_id,
+    const ImdTrackInfo** track_out) {
+    if (head >= 2 || track_of[cyl][head] < 0) return -1;
+    const ImdTrackInfo* track = imdf_get_track_info(handle, (size_t)track_of[cyl][head]);
+    if (!track || !track->loaded) return -1;
+    for (uint32_t p = 0; p < track->num_sectors; ++p) {
+        if (track->smap[p] != sector_id) continue;
+        *track_out = track;
+        return (int)p;
     }
+    return -1;
+}
+
+static uint64_t diff_hash(uint8_t sflag, const uint8_t* data, uint32_t size) {
+    uint8_t meta[6] = { (uint8_t)size, (uint8_t)(size >> 8), (uint8_t)(size >> 16), (uint8_t)(size >> 24),
+        (uint8_t)IMD_SDR_HAS_DAM(sflag), (uint8_t)IMD_SDR_HAS_ERR(sflag) };
+    return fnv1a64_update(fnv1a64_update(FNV1A64_OFFSET_BASIS, meta, sizeof(meta)), data, size);
+}
 
-    if (ignore_interleave) {
-        return logical_idx_in_track_smap_order;
+/*
+ * Reads one sector of either image. Returns its DIFF_KIND_*. A read through
+ * g_imdf_handle gets the unsaved edits; another handle gets 'edits', if any.
+ */
+static int diff_read_sector(ImdImageFile* handle, const DirtySector* edits, size_t edit_count, const ImdTrackInfo* track,
+    int physical_idx, uint8_t* buffer) {
+    if (!track || physical_idx < 0) return DIFF_KIND_NO_SECTOR;
+    uint8_t sector_id = track->smap[physical_idx];
+    if (!IMD_SDR_HAS_DATA(track->sflag[physical_idx]) || track->sector_size == 0 ||
+        imdf_read_sector(handle, track->cyl, track->head, sector_id, buffer, track->sector_size) != IMDF_ERR_OK) {
+        return DIFF_KIND_NO_DATA;
     }
-    else {
-        typedef struct { uint32_t physical_idx; uint8_t logical_id; } SectorMapEntry;
-        SectorMapEntry sorted_map[LIBIMD_MAX_SECTORS_PER_TRACK];
+    if (handle == g_imdf_handle) dirty_sector_overlay(track->cyl, track->head, sector_id, buffer, track->sector_size);
+    else if (edits) dirty_sector_overlay_from(edits, edit_count, track->cyl, track->head, sector_id, buffer, track->sector_size);
+    return DIFF_KIND_DATA;
+}
 
-        if (current_track_display.num_sectors > LIBIMD_MAX_SECTORS_PER_TRACK) return 0;
+static int diff_entry_differs(const DiffSector* e) {
+    return e->kind_a != e->kind_b || (e->kind_a == DIFF_KIND_DATA && e->hash_a != e->hash_b);
+}
 
-        for (uint32_t p = 0; p < current_track_display.num_sectors; ++p) {
-            sorted_map[p].physical_idx = p;
-            sorted_map[p].logical_id = current_track_display.smap[p];
-        }
+/* Replaces an entry, keeping the difference counts up to date; entries not indexed yet are not counted */
+static void diff_set_entry(size_t entry_idx, size_t track_idx, const DiffSector* e) {
+    DiffSector* old = &g_diff.entries[entry_idx];
+    int indexed = entry_idx < g_diff.next_entry;
+    int was = indexed && diff_entry_differs(old);
+    int now = indexed && diff_entry_differs(e);
+    *old = *e;
+    g_diff.track_differs[track_idx] = (uint16_t)(g_diff.track_differs[track_idx] + now - was);
+    g_diff.differing = g_diff.differing + (size_t)now - (size_t)was;
+}
 
-        qsort(sorted_map, current_track_display.num_sectors, sizeof(SectorMapEntry), compare_sector_map_entries);
-        return sorted_map[logical_idx_in_track_smap_order].physical_idx;
+/* Records the next entry of the index build, keeping A's hash from an edit made while it was being read */
+static void diff_add_entry(size_t entry_idx, size_t track_idx, DiffSector* e) {
+    const DiffSector* old = &g_diff.entries[entry_idx];
+    if (old->edited_a) {
+        e->kind_a = old->kind_a;
+        e->hash_a = old->hash_a;
+        e->edited_a = 1;
+    }
+    diff_set_entry(entry_idx, track_idx, e); /* Not counted yet */
+    g_diff.next_entry = entry_idx + 1;
+    g_diff.build_track = track_idx;
+    if (diff_entry_differs(e)) {
+        g_diff.track_differs[track_idx]++;
+        g_diff.differing++;
     }
 }
 
+/* Opens image B and sizes the index for image A. Returns an error message or NULL. */
+const char* diff_open(const char* path) {
+    static char err[MAX_FILENAME + 64];
+    const char* base = get_basename(path);
+    int res = imdf_open(path, 1, &g_diff.handle);
+    if (res != IMDF_ERR_OK) {
+        g_diff.handle = NULL;
+        snprintf(err, sizeof(err), "Cannot open IMD file '%s' using libimdf (Error %d).", path, res);
+        return err;
+    }
+    g_diff.path = strdup(path);
+    if (!g_diff.path) return "Out of memory for the difference index.";
+    strncpy(g_diff.name, base ? base : path, MAX_FILENAME - 1);
+    g_diff.name[MAX_FILENAME - 1] = '\0';
+    imdf_get_num_tracks(g_diff.handle, &g_diff.num_tracks_b);
+    diff_map_tracks(g_imdf_handle, total_tracks_in_image, g_diff.track_of_a);
+    diff_map_tracks(g_diff.handle, g_diff.num_tracks_b, g_diff.track_of_b);
+
+    g_diff.first_entry = (size_t*)malloc((total_tracks_in_image + 1) * sizeof(size_t));
+    g_diff.track_differs = (uint16_t*)calloc(total_tracks_in_image + 1, sizeof(uint16_t));
+    if (!g_diff.first_entry || !g_diff.track_differs) return "Out of memory for the difference index.";
+    g_diff.num_entries = 0;
+    for (size_t t = 0; t < total_tracks_in_image; ++t) {
+        const ImdTrackInfo* track = imdf_get_track_info(g_imdf_handle, t);
+        g_diff.first_entry[t] = g_diff.num_entries;
+        if (track && track->loaded) g_diff.num_entries += track->num_sectors;
+    }
+    g_diff.first_entry[total_tracks_in_image] = g_diff.num_entries;
+    g_diff.entries = (DiffSector*)calloc(g_diff.num_entries + 1, sizeof(DiffSector));
+    if (!g_diff.entries) return "Out of memory for the difference index.";
+    g_diff.next_entry = 0;
+    g_diff.build_track = 0;
+    g_diff.differing = 0;
+    g_diff.order.track_idx = (size_t)-1;    /* Describes image A only */
+    g_diff.shown_valid = 0;
+    return NULL;
+}
 
-int compare_sector_map_entries(const void* a, const void* b) {
-    typedef struct { uint32_t physical_idx; uint8_t logical_id; } SectorMapEntry;
-    const SectorMapEntry* entry_a = (const SectorMapEntry*)a;
-    const SectorMapEntry* entry_b = (const SectorMapEntry*)b;
-
-    if (entry_a->logical_id < entry_b->logical_id) return -1;
-    if (entry_a->logical_id > entry_b->logical_id) return 1;
-    if (entry_a->physical_idx < entry_b->physical_idx) return -1;
-    if (entry_a->physical_idx > entry_b->physical_idx) return 1;
-    return 0;
+void diff_close(void) {
+#ifdef IMDV_HAVE_THREADS
+    diff_stop_worker();
+#endif
+    if (g_diff.handle) imdf_close(g_diff.handle);
+    free(g_diff.path);
+    free(g_diff.first_entry);
+    free(g_diff.entries);
+    free(g_diff.track_differs);
+    memset(&g_diff, 0, sizeof(g_diff));
 }
 
-void clear_search_highlight(void) {
-    g_found_on_track_idx = (size_t)-1;
-    g_found_on_sector_log_idx = (uint32_t)-1;
-    g_found_offset_in_sector = -1;
-    g_found_len = 0;
+int diff_building(void) {
+    int building;
+    if (!g_diff.handle) return 0;
+    diff_lock();
+    building = g_diff.next_entry < g_diff.num_entries;
+    diff_unlock();
+    return building;
 }
 
-void adjust_view_for_match(long match_offset_in_sector, int term_len) {
-    if (!win_data) return; /* Should not happen */
-    int data_win_height = getmaxy(win_data);
-    if (data_win_height <= 0) data_win_height = DATA_LINES; /* Fallback if window not sized */
+/* The index is left for diff_poll() to build on the UI thread */
+int diff_pending(void) {
+#ifdef IMDV_HAVE_THREADS
+    if (g_diff.worker_running) return 0;
+#endif
+    return diff_building();
+}
 
+/* Compares one sector of A (through handle_a) with its counterpart in B (through handle_b) */
+static void diff_index_entry(ImdImageFile* handle_a, ImdImageFile* handle_b, const DirtySector* edits, size_t edit_count,
+    size_t entry_idx, size_t track_idx, uint8_t* data, DiffSector* e) {
+    const ImdTrackInfo* track = imdf_get_track_info(handle_a, track_idx);
+    const ImdTrackInfo* track_b = NULL;
+    int physical_idx = (int)(entry_idx - g_diff.first_entry[track_idx]);
 
-    long match_line_start_offset = (match_offset_in_sector / BYTES_PER_LINE) * BYTES_PER_LINE;
-    long match_end_offset = match_offset_in_sector + term_len - 1;
+    memset(e, 0, sizeof(*e));
+    e->kind_a = (uint8_t)diff_read_sector(handle_a, edits, edit_count, track, physical_idx, data);
+    if (e->kind_a == DIFF_KIND_DATA) e->hash_a = diff_hash(track->sflag[physical_idx], data, track->sector_size);
 
-    long current_view_first_byte_offset = current_data_offset_in_sector;
-    long current_view_last_byte_offset = current_data_offset_in_sector + (data_win_height * BYTES_PER_LINE) - 1;
+    int physical_b = diff_find_sector(handle_b, g_diff.track_of_b, track->cyl, track->head, track->smap[physical_idx], &track_b);
+    e->kind_b = (uint8_t)diff_read_sector(handle_b, NULL, 0, track_b, physical_b, data);
+    if (e->kind_b == DIFF_KIND_DATA) e->hash_b = diff_hash(track_b->sflag[physical_b], data, track_b->sector_size);
+}
 
-    /* Check if the start of the match is already visible */
-    if (match_offset_in_sector >= current_view_first_byte_offset && match_offset_in_sector <= current_view_last_byte_offset) {
-        /* Start is visible. Check if end is also visible. */
-        if (match_end_offset <= current_view_last_byte_offset) {
-            /* Entire match is visible, no scroll needed. */
-            return;
+/* Sectors of B whose C/H/S is not in A: no sector of A leads to them */
+static size_t diff_count_only_in_b(ImdImageFile* handle_a, ImdImageFile* handle_b) {
+    size_t count = 0;
+    for (size_t t = 0; t < g_diff.num_tracks_b; ++t) {
+        const ImdTrackInfo* track = imdf_get_track_info(handle_b, t);
+        const ImdTrackInfo* track_a;
+        if (!track || !track->loaded) continue;
+        for (uint32_t p = 0; p < track->num_sectors; ++p) {
+            if (diff_find_sector(handle_a, g_diff.track_of_a, track->cyl, track->head, track->smap[p], &track_a) < 0) count++;
         }
     }
-    /* Match is not (fully) visible, scroll to make its starting line the top line */
-    current_data_offset_in_sector = match_line_start_offset;
+    return count;
 }
 
+#ifdef IMDV_HAVE_THREADS
+/* Builds the rest of the index through its own handles on A and B */
+static void* diff_worker(void* arg) {
+    static uint8_t data[LIBIMD_MAX_SECTOR_SIZE]; /* Only this thread builds while it runs */
+    ImdImageFile* handle_a = NULL;
+    ImdImageFile* handle_b = NULL;
+    size_t num_tracks = 0, entry_idx, track_idx, only_in_b;
+    int failed = 0, cancel = 0;
+    (void)arg;
+
+    if (imdf_open(g_image_path, 1, &handle_a) != IMDF_ERR_OK) {
+        handle_a = NULL;
+        failed = 1;
+    }
+    else if (imdf_get_num_tracks(handle_a, &num_tracks) != IMDF_ERR_OK || num_tracks != total_tracks_in_image ||
+        imdf_open(g_diff.path, 1, &handle_b) != IMDF_ERR_OK) {
+        handle_b = NULL;
+        failed = 1;
+    }
 
-void handle_input(void) {
-    int ch = wgetch(win_data);
-    if (ch == ERR) return;
+    if (!failed) {
+        only_in_b = diff_count_only_in_b(handle_a, handle_b);
+        pthread_mutex_lock(&g_diff.lock);
+        g_diff.only_in_b = only_in_b;
+        entry_idx = g_diff.next_entry;
+        track_idx = g_diff.build_track;
+        pthread_mutex_unlock(&g_diff.lock);
+
+        for (; entry_idx < g_diff.num_entries && !cancel; ++entry_idx) {
+            DiffSector e;
+            while (g_diff.first_entry[track_idx + 1] <= entry_idx) track_idx++;
+            diff_index_entry(handle_a, handle_b, g_diff.edits, g_diff.edit_count, entry_idx, track_idx, data, &e);
+            pthread_mutex_lock(&g_diff.lock);
+            cancel = g_diff.worker_cancel;
+            if (!cancel) diff_add_entry(entry_idx, track_idx, &e);
+            pthread_mutex_unlock(&g_diff.lock);
+        }
+    }
 
-    int redraw_info = 0;
-    int redraw_data = 0;
-    int needs_sector_load = 0;
-    int navigation_key_pressed = 0;
+    if (handle_a) imdf_close(handle_a);
+    if (handle_b) imdf_close(handle_b);
+    pthread_mutex_lock(&g_diff.lock);
+    g_diff.worker_done = 1;
+    g_diff.worker_failed = failed;
+    pthread_mutex_unlock(&g_diff.lock);
+    return NULL;
+}
 
-    size_t target_track_idx = current_track_index_in_image;
-    uint32_t target_logical_sector_idx = current_sector_logical_idx;
-    long target_data_offset = current_data_offset_in_sector;
+/* Starts the index worker. Returns 0, leaving the index to the UI thread, if it could not be started. */
+static int diff_start_worker(void) {
+    if (g_diff.worker_failed || !g_image_path || !g_diff.path) return 0;
+    if (dirty_sector_snapshot(&g_diff.edits, &g_diff.edit_count) != 0) {
+        dirty_sector_snapshot_free(g_diff.edits, g_diff.edit_count);
+        g_diff.edits = NULL;
+        g_diff.edit_count = 0;
+        return 0;
+    }
+    pthread_mutex_init(&g_diff.lock, NULL);
+    g_diff.worker_done = 0;
+    g_diff.worker_cancel = 0;
+    if (pthread_create(&g_diff.thread, NULL, diff_worker, NULL) != 0) {
+        pthread_mutex_destroy(&g_diff.lock);
+        dirty_sector_snapshot_free(g_diff.edits, g_diff.edit_count);
+        g_diff.edits = NULL;
+        g_diff.edit_count = 0;
+        g_diff.worker_failed = 1;
+        return 0;
+    }
+    g_diff.worker_running = 1;
+    return 1;
+}
 
-    switch (ch) {
-    case KEY_UP:
-    case KEY_DOWN:
-    case KEY_LEFT:
-    case KEY_RIGHT:
-    case KEY_PPAGE:
-    case KEY_NPAGE:
-    case KEY_HOME:  /* Corrected behavior */
-    case KEY_END:   /* Corrected behavior */
-    case KEY_SHOME: /* Covers KEY_SHOME for all platforms */
-#ifdef PDCURSES
-    case CTL_HOME:  /* Also covers CTL_HOME if PDCURSES is defined */
-#endif
-    case KEY_SEND:  /* Covers KEY_SEND for all platforms */
-#ifdef PDCURSES
-    case CTL_END:   /* Also covers CTL_END if PDCURSES is defined */
+/* Joins the index worker once it is done, or after cancelling it */
+static void diff_join_worker(void) {
+    pthread_join(g_diff.thread, NULL);
+    g_diff.worker_running = 0;
+    pthread_mutex_destroy(&g_diff.lock);
+    dirty_sector_snapshot_free(g_diff.edits, g_diff.edit_count);
+    g_diff.edits = NULL;
+    g_diff.edit_count = 0;
+}
+
+int diff_worker_running(void) {
+    return g_diff.worker_running;
+}
+
+/* Cancels the index worker, if running; the UI thread finishes the index from where it stopped */
+void diff_stop_worker(void) {
+    if (!g_diff.worker_running) return;
+    pthread_mutex_lock(&g_diff.lock);
+    g_diff.worker_cancel = 1;
+    pthread_mutex_unlock(&g_diff.lock);
+    diff_join_worker();
+    g_diff.worker_failed = 1;
+}
 #endif
-        navigation_key_pressed = 1;
-        clear_search_highlight(); /* Cleared for any navigation */
 
-        if (ch == KEY_UP) {
-            if (current_track_index_in_image > 0) {
-                target_track_idx--; target_logical_sector_idx = 0; target_data_offset = 0;
-            }
-            else { beep(); }
-        }
-        else if (ch == KEY_DOWN) {
-            if (current_track_index_in_image < total_tracks_in_image - 1) {
-                target_track_idx++; target_logical_sector_idx = 0; target_data_offset = 0;
-            }
-            else { beep(); }
-        }
-        else if (ch == KEY_LEFT) {
-            if (current_sector_logical_idx > 0) {
-                target_logical_sector_idx--; target_data_offset = 0;
-            }
-            else if (current_track_index_in_image > 0) {
-                target_track_idx--; target_logical_sector_idx = 0xFFFF; /* Signal to wrap to last sector */ target_data_offset = 0;
-            }
-            else { beep(); }
+/*
+ * Starts the index worker, then redraws B's header as it progresses; without
+ * one, builds one slice of the difference index. Called from the main loop.
+ */
+void diff_poll(void) {
+#ifdef IMDV_HAVE_THREADS
+    if (!g_diff.worker_running && diff_building()) diff_start_worker();
+    if (g_diff.worker_running) {
+        size_t progress;
+        int done;
+        pthread_mutex_lock(&g_diff.lock);
+        progress = g_diff.next_entry;
+        done = g_diff.worker_done;
+        pthread_mutex_unlock(&g_diff.lock);
+        if (done) diff_join_worker();
+        if (progress != g_diff.shown_progress || done) {
+            g_diff.shown_progress = progress;
+            draw_diff_window();
+            doupdate();
         }
-        else if (ch == KEY_RIGHT) {
-            if (current_track_display.loaded && current_track_display.num_sectors > 0 && current_sector_logical_idx < (uint32_t)(current_track_display.num_sectors - 1)) {
-                target_logical_sector_idx++; target_data_offset = 0;
-            }
-            else if (current_track_index_in_image < total_tracks_in_image - 1) {
-                target_track_idx++; target_logical_sector_idx = 0; target_data_offset = 0;
-            }
+        if (!done || !g_diff.worker_failed) return;
+        /* It could not open the images: build on this thread */
+    }
+#endif
+    if (!diff_building() || g_search_active) return;
+    for (int n = 0; n < DIFF_SECTORS_PER_SLICE && g_diff.next_entry < g_diff.num_entries; ++n) {
+        static uint8_t data[LIBIMD_MAX_SECTOR_SIZE];
+        DiffSector e;
+        while (g_diff.first_entry[g_diff.build_track + 1] <= g_diff.next_entry) g_diff.build_track++;
+        diff_index_entry(g_imdf_handle, g_diff.handle, NULL, 0, g_diff.next_entry, g_diff.build_track, data, &e);
+        diff_add_entry(g_diff.next_entry, g_diff.build_track, &e);
+    }
+    if (!diff_building()) g_diff.only_in_b = diff_count_only_in_b(g_imdf_handle, g_diff.handle);
+    draw_diff_window();
+    doupdate();
+}
+
+/*
+ * A sector of A was edited (or the edit undone): rehash it. One the index
+ * build has not reached yet keeps this hash when the build gets there.
+ */
+void diff_sector_edited(uint8_t cyl, uint8_t head, uint8_t sector_id, const uint8_t* data, uint32_t size) {
+    const ImdTrackInfo* track;
+    int physical_idx;
+    if (!g_diff.handle) return;
+    g_diff.shown_valid = 0;
+    physical_idx = diff_find_sector(g_imdf_handle, g_diff.track_of_a, cyl, head, sector_id, &track);
+    if (physical_idx < 0) return;
+    size_t track_idx = (size_t)g_diff.track_of_a[cyl][head];
+    size_t entry_idx = g_diff.first_entry[track_idx] + (size_t)physical_idx;
+    diff_lock();
+    DiffSector e = g_diff.entries[entry_idx];
+    e.hash_a = diff_hash(track->sflag[physical_idx], data, size);
+    if (entry_idx >= g_diff.next_entry) {
+        e.kind_a = DIFF_KIND_DATA;  /* Only sectors with data can be edited */
+        e.edited_a = 1;
+    }
+    diff_set_entry(entry_idx, track_idx, &e);
+    diff_unlock();
+}
+
+/* Reads the sector of B matching the displayed sector of A, unless it is already shown */
+void diff_sync_sector(void) {
+    const ImdTrackInfo* track_b = NULL;
+    uint32_t key;
+    int physical_b;
+
+    if (!g_diff.handle) return;
+    if (!current_track_display.loaded || current_track_display.num_sectors == 0) {
+        g_diff.shown_valid = 1;
+        g_diff.shown_key = 0xFFFFFFFFu;
+        g_diff.shown_kind = DIFF_KIND_NO_SECTOR;
+        g_diff.shown_size = 0;
+        return;
+    }
+    key = ((uint32_t)current_track_display.cyl << 16) | ((uint32_t)current_track_display.head << 8) | (current_sector_logical_id & 0xFF);
+    if (g_diff.shown_valid && g_diff.shown_key == key) return;
+    g_diff.shown_valid = 1;
+    g_diff.shown_key = key;
+    physical_b = diff_find_sector(g_diff.handle, g_diff.track_of_b, current_track_display.cyl, current_track_display.head,
+        (uint8_t)current_sector_logical_id, &track_b);
+    g_diff.shown_kind = diff_read_sector(g_diff.handle, NULL, 0, track_b, physical_b, g_diff.shown);
+    g_diff.shown_sflag = physical_b >= 0 ? track_b->sflag[physical_b] : 0;
+    g_diff.shown_size = g_diff.shown_kind == DIFF_KIND_DATA ? track_b->sector_size : 0;
+}
+
+/* Bit i set: byte 'offset + i' differs between the shown sectors of A and B */
+static uint32_t diff_line_mask(uint32_t offset, int count) {
+    uint32_t mask = 0;
+    uint32_t size_a = current_track_display.sector_size;
+    if (!g_diff.handle || g_diff.shown_kind != DIFF_KIND_DATA ||
+        !IMD_SDR_HAS_DATA(current_track_display.sflag[current_sector_physical_idx])) return 0;
+    for (int i = 0; i < count; ++i) {
+        uint32_t at = offset + (uint32_t)i;
+        if (at >= size_a || at >= g_diff.shown_size || current_sector_buffer[at] != g_diff.shown[at]) mask |= 1u << i;
+    }
+    return mask;
+}
+
+/* One line of B's sector; zeroed first so states compare with memcmp */
+static void diff_line_state(DataLineState* ls, int line) {
+    uint32_t offset = (uint32_t)current_data_offset_in_sector + (uint32_t)(line * BYTES_PER_LINE);
+    memset(ls, 0, sizeof(*ls));
+    if (g_diff.shown_kind != DIFF_KIND_DATA || offset >= g_diff.shown_size) {
+        ls->offset = DATA_LINE_BLANK;
+        return;
+    }
+    ls->offset = offset;
+    for (int i = 0; i < BYTES_PER_LINE && offset + (uint32_t)i < g_diff.shown_size; ++i) {
+        ls->bytes[i] = g_diff.shown[offset + (uint32_t)i];
+        ls->count++;
+    }
+    ls->differs = diff_line_mask(offset, ls->count);
+}
+
+/* How the shown sectors compare, for the header line */
+static const char* diff_sector_verdict(void) {
+    int kind_a;
+    if (!current_track_display.loaded || current_track_display.num_sectors == 0) return "no sector in A";
+    kind_a = IMD_SDR_HAS_DATA(current_track_display.sflag[current_sector_physical_idx]) ? DIFF_KIND_DATA : DIFF_KIND_NO_DATA;
+    if (g_diff.shown_kind == DIFF_KIND_NO_SECTOR) return "not in B";
+    if (kind_a != g_diff.shown_kind) return kind_a == DIFF_KIND_DATA ? "no data in B" : "no data in A";
+    if (kind_a == DIFF_KIND_NO_DATA) return "no data in either";
+    if (current_track_display.sector_size != g_diff.shown_size) return "sizes differ";
+    if (memcmp(current_sector_buffer, g_diff.shown, g_diff.shown_size) != 0) return "data differs";
+    uint8_t sflag_a = current_track_display.sflag[current_sector_physical_idx];
+    if (IMD_SDR_HAS_DAM(sflag_a) != IMD_SDR_HAS_DAM(g_diff.shown_sflag) ||
+        IMD_SDR_HAS_ERR(sflag_a) != IMD_SDR_HAS_ERR(g_diff.shown_sflag)) return "flags differ";
+    return "identical";
+}
+
+/* Header line and data lines of image B; repaints only what changed */
+void draw_diff_window(void) {
+    char header[sizeof(status_message)];
+    size_t next_entry, differing, only_in_b;
+    int max_y, max_x;
+
+    if (!win_diff) return;
+    diff_sync_sector();
+    getmaxyx(win_diff, max_y, max_x);
+
+    diff_lock();
+    next_entry = g_diff.next_entry;
+    differing = g_diff.differing;
+    only_in_b = g_diff.only_in_b;
+    diff_unlock();
+    if (next_entry < g_diff.num_entries) {
+        snprintf(header, sizeof(header), " B: %.60s | C%u H%u S%u %s | %zu differ so far (indexing %zu%%) | [ ]=Prev/Next",
+            g_diff.name, current_track_display.cyl, current_track_display.head, current_sector_logical_id,
+            diff_sector_verdict(), differing, next_entry * 100 / g_diff.num_entries);
+    }
+    else {
+        snprintf(header, sizeof(header), " B: %.60s | C%u H%u S%u %s | %zu sector(s) differ, %zu only in B | [ ]=Prev/Next",
+            g_diff.name, current_track_display.cyl, current_track_display.head, current_sector_logical_id,
+            diff_sector_verdict(), differing, only_in_b);
+    }
+    if (!g_diff_view.valid || strcmp(header, g_diff_header_shown) != 0) {
+        strcpy(g_diff_header_shown, header);
+        wattron(win_diff, COLOR_PAIR(CP_INFO));
+        mvwprintw(win_diff, 0, 0, "%-*.*s", max_x, max_x, header);
+        wattroff(win_diff, COLOR_PAIR(CP_INFO));
+    }
+
+    /* As many lines as the data window, so both show the same offsets */
+    int lines_to_draw = max_y - 1;
+    if (win_data && getmaxy(win_data) < lines_to_draw) lines_to_draw = getmaxy(win_data);
+    if (!g_diff_view.valid || g_diff_view.lines != lines_to_draw ||
+        g_diff_view.charset != current_charset || g_diff_view.xor_mask != xor_mask) {
+        for (int line = 0; line < DATA_VIEW_MAX_LINES; ++line) g_diff_view.line[line].offset = DATA_LINE_UNKNOWN;
+        g_diff_view.lines = lines_to_draw;
+        g_diff_view.charset = current_charset;
+        g_diff_view.xor_mask = xor_mask;
+        g_diff_view.valid = 1;
+    }
+    for (int line = 0; line < lines_to_draw; ++line) {
+        DataLineState ls;
+        diff_line_state(&ls, line);
+        if (line < DATA_VIEW_MAX_LINES) {
+            if (memcmp(&ls, &g_diff_view.line[line], sizeof(ls)) == 0) continue;
+            g_diff_view.line[line] = ls;
+        }
+        draw_data_line(win_diff, line + 1, &ls, max_x);
+    }
+    wnoutrefresh(win_diff);
+}
+
+/*
+ * Moves to the next (forward) or previous differing sector in navigation
+ * order, using only the index: tracks without differences are skipped
+ * by their count, and no sector data is read until the jump lands.
+ */
+void diff_jump(int forward) {
+    char msg[sizeof(status_message)];
+    size_t track_idx = current_track_index_in_image;
+    long pos = (long)current_sector_logical_idx;
+
+    if (!g_diff.handle) {
+        display_error("No second image to compare with (imdv A.imd B.imd).");
+        return;
+    }
+    diff_lock();
+    for (;;) {
+        const ImdTrackInfo* track = imdf_get_track_info(g_imdf_handle, track_idx);
+        int is_current = track_idx == current_track_index_in_image;
+        if (track && track->loaded && track->num_sectors > 0 && g_diff.track_differs[track_idx] > 0) {
+            const uint8_t* order = get_sector_order(&g_diff.order, track_idx, track, ignore_interleave);
+            long n = track->num_sectors;
+            if (!is_current) pos = forward ? -1 : n;
+            for (pos += forward ? 1 : -1; pos >= 0 && pos < n; pos += forward ? 1 : -1) {
+                size_t entry_idx = g_diff.first_entry[track_idx] + order[pos];
+                if (entry_idx < g_diff.next_entry && diff_entry_differs(&g_diff.entries[entry_idx])) break;
+            }
+            if (pos >= 0 && pos < n) break;
+        }
+        if (forward ? track_idx + 1 >= total_tracks_in_image : track_idx == 0) {
+            if (g_diff.next_entry < g_diff.num_entries) {
+                snprintf(msg, sizeof(msg), "No %s difference indexed yet (indexing %zu%%).", forward ? "further" : "earlier",
+                    g_diff.next_entry * 100 / g_diff.num_entries);
+            }
+            else {
+                snprintf(msg, sizeof(msg), "No %s differing sector.", forward ? "further" : "earlier");
+            }
+            diff_unlock();
+            update_status(msg);
+            doupdate();
+            beep();
+            return;
+        }
+        track_idx = forward ? track_idx + 1 : track_idx - 1;
+    }
+    diff_unlock();
+
+    clear_search_highlight();
+    if (track_idx != current_track_index_in_image) load_track_for_display(track_idx);
+    current_sector_logical_idx = (uint32_t)pos;
+    current_data_offset_in_sector = 0;
+    load_sector_for_display();
+    diff_sync_sector();
+
+    /* Scroll to the first differing byte */
+    long first = -1;
+    uint32_t size = current_track_display.sector_size;
+    for (uint32_t at = 0; at < size && first < 0; at += BYTES_PER_LINE) {
+        int count = (int)(size - at < BYTES_PER_LINE ? size - at : BYTES_PER_LINE);
+        if (diff_line_mask(at, count)) first = (long)at;
+    }
+    if (first >= 0) adjust_view_for_match(first, 1);
+
+    snprintf(msg, sizeof(msg), "Difference at C%u H%u S%u: %s.", current_track_display.cyl, current_track_display.head,
+        current_sector_logical_id, diff_sector_verdict());
+    update_status(msg);
+    draw_info_window();
+    draw_data_window();
+    doupdate();
+}
+
+/* --- Sector Flag Index --- */
+
+/*
+ * Sectors by flag class, built from the sflag arrays alone (no data reads).
+ * Each class is a sorted list of positions in navigation order, so the
+ * next/previous sector of a class is a binary search away. Rebuilt when
+ * the navigation order changes (I) or a save may have changed how sectors
+ * are stored.
+ */
+
+static const char* const flag_class_names[FLAG_CLASSES] = { "error", "deleted-DAM", "unavailable", "compressed" };
+
+static int flag_class_of(uint8_t sflag, int flag_class) {
+    switch (flag_class) {
+    case FLAG_CLASS_ERROR:       return IMD_SDR_HAS_ERR(sflag);
+    case FLAG_CLASS_DELETED:     return IMD_SDR_HAS_DAM(sflag);
+    case FLAG_CLASS_UNAVAILABLE: return !IMD_SDR_HAS_DATA(sflag);
+    default:                     return IMD_SDR_HAS_DATA(sflag) && IMD_SDR_IS_COMPRESSED(sflag);
+    }
+}
+
+void flag_index_free(void) {
+    for (int c = 0; c < FLAG_CLASSES; ++c) {
+        free(g_flag_index.positions[c]);
+        g_flag_index.positions[c] = NULL;
+        g_flag_index.count[c] = 0;
+    }
+    g_flag_index.valid = 0;
+}
+
+/* Builds the index for the current navigation order. Returns 0, or -1 if out of memory. */
+int flag_index_build(void) {
+    static SectorOrderCache order = { (size_t)-1, 0, 0, { 0 } };
+    size_t capacity[FLAG_CLASSES] = { 0 };
+
+    flag_index_free();
+    /* Count first, so each list is allocated once */
+    for (int pass = 0; pass < 2; ++pass) {
+        for (size_t t = 0; t < total_tracks_in_image; ++t) {
+            const ImdTrackInfo* track = imdf_get_track_info(g_imdf_handle, t);
+            if (!track || !track->loaded || track->num_sectors == 0) continue;
+            const uint8_t* physical_idx = get_sector_order(&order, t, track, ignore_interleave);
+            for (uint32_t pos = 0; pos < track->num_sectors; ++pos) {
+                uint8_t sflag = track->sflag[physical_idx[pos]];
+                for (int c = 0; c < FLAG_CLASSES; ++c) {
+                    if (!flag_class_of(sflag, c)) continue;
+                    if (pass == 0) capacity[c]++;
+                    else g_flag_index.positions[c][g_flag_index.count[c]++] = FLAG_POSITION(t, pos);
+                }
+            }
+        }
+        for (int c = 0; pass == 0 && c < FLAG_CLASSES; ++c) {
+            g_flag_index.positions[c] = (uint32_t*)malloc((capacity[c] ? capacity[c] : 1) * sizeof(uint32_t));
+            if (!g_flag_index.positions[c]) {
+                flag_index_free();
+                return -1;
+            }
+        }
+    }
+    order.track_idx = (size_t)-1;   /* The image's tracks may change before the next build */
+    g_flag_index.in_physical_order = ignore_interleave;
+    g_flag_index.valid = 1;
+    return 0;
+}
+
+/* Number of positions in a class list that are < key (<= key if inclusive) */
+static size_t flag_index_rank(const uint32_t* positions, size_t count, uint32_t key, int inclusive) {
+    size_t lo = 0, hi = count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (positions[mid] < key || (inclusive && positions[mid] == key)) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/* Moves to the next (forward) or previous sector of a flag class */
+void flag_jump(int flag_class, int forward) {
+    char msg[sizeof(status_message)];
+
+    if ((!g_flag_index.valid || g_flag_index.in_physical_order != ignore_interleave) && flag_index_build() != 0) {
+        display_error("Out of memory building the sector flag index.");
+        return;
+    }
+    const uint32_t* positions = g_flag_index.positions[flag_class];
+    size_t count = g_flag_index.count[flag_class];
+    uint32_t key = FLAG_POSITION(current_track_index_in_image, current_sector_logical_idx);
+    size_t rank = flag_index_rank(positions, count, key, forward);
+
+    if (forward ? rank == count : rank == 0) {
+        snprintf(msg, sizeof(msg), "No %s %s sector (%zu in image).", forward ? "further" : "earlier",
+            flag_class_names[flag_class], count);
+        update_status(msg);
+        doupdate();
+        beep();
+        return;
+    }
+    if (!forward) rank--;
+    size_t track_idx = positions[rank] >> 8;
+
+    clear_search_highlight();
+    if (track_idx != current_track_index_in_image) load_track_for_display(track_idx);
+    current_sector_logical_idx = positions[rank] & 0xFF;
+    current_data_offset_in_sector = 0;
+    load_sector_for_display();
+
+    snprintf(msg, sizeof(msg), "%c%s sector at C%u H%u S%u (%zu of %zu).", toupper((unsigned char)flag_class_names[flag_class][0]),
+        flag_class_names[flag_class] + 1, current_track_display.cyl, current_track_display.head, current_sector_logical_id,
+        rank + 1, count);
+    update_status(msg);
+    draw_info_window();
+    draw_data_window();
+    doupdate();
+}
+
+const char* get_mode_string(uint8_t mode_code) {
+    switch (mode_code) {
+    case IMD_MODE_FM_500:  return "500KHz  FM";
+    case IMD_MODE_FM_300:  return "300KHz  FM";
+    case IMD_MODE_FM_250:  return "250KHz  FM";
+    case IMD_MODE_MFM_500: return "500KHz MFM";
+    case IMD_MODE_MFM_300: return "300KHz MFM";
+    case IMD_MODE_MFM_250: return "250KHz MFM";
+    default:               return "Unknown Mode";
+    }
+}
+
+void draw_info_window(void) {
+    if (!win_info) return;
+
+    /* Nothing it shows changed: leave the window alone */
+    InfoViewState state;
+    memset(&state, 0, sizeof(state));
+    state.valid = 1;
+    state.track_idx = current_track_index_in_image;
+    state.sector_physical_idx = current_sector_physical_idx;
+    state.sector_id = current_sector_logical_id;
+    state.num_sectors = current_track_display.loaded ? current_track_display.num_sectors : 0;
+    if (current_sector_physical_idx < state.num_sectors) state.sector_flag = current_track_display.sflag[current_sector_physical_idx];
+    state.charset = current_charset;
+    state.xor_mask = xor_mask;
+    state.write_protected = 1;
+    if (g_imdf_handle) imdf_get_write_protect(g_imdf_handle, &state.write_protected);
+    state.unsaved = dirty_sector_count() > 0;
+    state.width = getmaxx(win_info);
+    if (memcmp(&state, &g_info_view, sizeof(state)) == 0) return;
+    g_info_view = state;
+
+    werase(win_info);
+    box(win_info, 0, 0);
+    int max_w = getmaxx(win_info);
+    int current_x_pos_line1 = 2; /* Starting X position for C/H/S info on line 1 */
+    int filename_len_on_screen = 0;
+    int filename_start_x = 0;
+
+    /* Display basename of .imd filename in the right corner of line 1 */
+    char shown_filename[MAX_FILENAME + 1];
+    /* A trailing '*' marks sector edits not yet saved to the image */
+    snprintf(shown_filename, sizeof(shown_filename), "%s%s", current_filename_base, dirty_sector_count() > 0 ? "*" : "");
+    if (strlen(current_filename_base) > 0) {
+        filename_len_on_screen = (int)strlen(shown_filename);
+        filename_start_x = max_w - filename_len_on_screen - 2; /* 2 for padding from right border */
+
+        /* Ensure filename_start_x is not too far left, clipping if necessary */
+        if (filename_start_x < 2) {
+            filename_start_x = 2;
+        }
+        /* If filename is very long, it might overwrite C/H/S. Truncate filename display if it would overlap too much. */
+        /* A simple check: if filename would start left of where C/H/S info starts + some buffer, truncate */
+        if (filename_start_x < current_x_pos_line1 + 10 && filename_len_on_screen > 15) { /* Arbitrary small buffer and min length to care about */
+            /* This is a basic truncation. A more robust solution might scroll or abbreviate filename */
+            filename_len_on_screen = max_w - (current_x_pos_line1 + 10) - 2;
+            if (filename_len_on_screen < 0) filename_len_on_screen = 0;
+            filename_start_x = max_w - filename_len_on_screen - 2;
+        }
+
+
+        wattron(win_info, COLOR_PAIR(CP_INFO_HL)); /* Use a distinct color for the filename */
+        mvwprintw(win_info, 1, filename_start_x, "%.*s", filename_len_on_screen, shown_filename);
+        wattroff(win_info, COLOR_PAIR(CP_INFO_HL));
+    }
+
+    char line1_buf[120];
+    uint8_t physical_cyl_val = 0, physical_head_val = 0;
+    uint32_t physical_sec_idx_val = 0;
+    uint8_t logical_cyl_val = 0, logical_head_val = 0, logical_sec_id_val = 0;
+
+    if (current_track_display.loaded) {
+        physical_cyl_val = current_track_display.cyl;
+        physical_head_val = current_track_display.head;
+
+        if (current_track_display.num_sectors > 0 && current_sector_physical_idx < current_track_display.num_sectors) {
+            physical_sec_idx_val = current_sector_physical_idx;
+            logical_sec_id_val = current_sector_logical_id;
+
+            if (current_track_display.hflag & IMD_HFLAG_CMAP_PRES) {
+                logical_cyl_val = current_track_display.cmap[physical_sec_idx_val];
+            }
+            else {
+                logical_cyl_val = physical_cyl_val;
+            }
+            if (current_track_display.hflag & IMD_HFLAG_HMAP_PRES) {
+                logical_head_val = current_track_display.hmap[physical_sec_idx_val];
+            }
+            else {
+                logical_head_val = physical_head_val;
+            }
+        }
+        snprintf(line1_buf, sizeof(line1_buf), "Physical C/H/S: %3u/%1u/%-2u   Logical C/H/S: %3u/%1u/%-2u",
+            physical_cyl_val,
+            physical_head_val,
+            current_track_display.num_sectors > 0 ? physical_sec_idx_val + 1 : 0,
+            logical_cyl_val,
+            logical_head_val,
+            current_track_display.num_sectors > 0 ? logical_sec_id_val : 0);
+    }
+    else {
+        snprintf(line1_buf, sizeof(line1_buf), "Track info not loaded.");
+    }
+
+    /* Calculate max width for C/H/S info to avoid overwriting filename */
+    int chs_info_max_len = max_w - current_x_pos_line1 - 2; /* Default max width */
+    if (filename_len_on_screen > 0) {
+        /* If filename is displayed, C/H/S info must end before filename starts */
+        chs_info_max_len = filename_start_x - current_x_pos_line1 - 1; /* -1 for a space separator */
+    }
+    if (chs_info_max_len < 0) chs_info_max_len = 0; /* Prevent negative length */
+
+    wattron(win_info, COLOR_PAIR(CP_INFO));
+    mvwprintw(win_info, 1, current_x_pos_line1, "%.*s", chs_info_max_len, line1_buf); /* Print C/H/S info */
+    wattroff(win_info, COLOR_PAIR(CP_INFO));
+
+
+    if (current_track_display.loaded && current_track_display.num_sectors > 0) {
+        int current_x = 2;
+        char track_prefix[20]; /* Buffer for "Track: ttt - " */
+
+        /* Format track number, padded to 3 characters (e.g., "  0", " 12", "123") */
+        snprintf(track_prefix, sizeof(track_prefix), "Track: %3zu - ", current_track_index_in_image);
+
+        wattron(win_info, COLOR_PAIR(CP_INFO));
+        mvwprintw(win_info, 2, current_x, "%sSectors: ", track_prefix);
+        wattroff(win_info, COLOR_PAIR(CP_INFO));
+        current_x += (int)strlen(track_prefix) + (int)strlen("Sectors: ");
+
+        for (uint32_t p_idx = 0; p_idx < current_track_display.num_sectors; ++p_idx) {
+            uint8_t logical_id_at_physical_p = current_track_display.smap[p_idx];
+            char sector_str[5];
+            snprintf(sector_str, sizeof(sector_str), "%u ", logical_id_at_physical_p);
+
+            if (current_x + (int)strlen(sector_str) >= max_w - 1) {
+                wattron(win_info, COLOR_PAIR(CP_INFO) | A_REVERSE);
+                mvwaddch(win_info, 2, max_w - 2, '>');
+                wattroff(win_info, COLOR_PAIR(CP_INFO) | A_REVERSE);
+                break;
+            }
+
+            if (logical_id_at_physical_p == current_sector_logical_id) {
+                wattron(win_info, COLOR_PAIR(CP_INFO_SECTOR_HIGHLIGHT));
+            }
+            else {
+                wattron(win_info, COLOR_PAIR(CP_INFO_SECTOR_NORMAL));
+            }
+            mvwprintw(win_info, 2, current_x, "%s", sector_str);
+            if (logical_id_at_physical_p == current_sector_logical_id) {
+                wattroff(win_info, COLOR_PAIR(CP_INFO_SECTOR_HIGHLIGHT));
+            }
+            else {
+                wattroff(win_info, COLOR_PAIR(CP_INFO_SECTOR_NORMAL));
+            }
+            current_x += (int)strlen(sector_str);
+        }
+    }
+    else {
+        char track_prefix[20];
+        snprintf(track_prefix, sizeof(track_prefix), "Track: %3zu - ", current_track_index_in_image);
+        wattron(win_info, COLOR_PAIR(CP_INFO));
+        mvwprintw(win_info, 2, 2, "%sSectors: N/A", track_prefix);
+        wattroff(win_info, COLOR_PAIR(CP_INFO));
+    }
+
+    const char* mode_str = "N/A";
+    uint32_t num_s = 0;
+    uint32_t sect_sz = 0;
+    const char* data_status_str = "N/A";
+    char err_indicator[10] = "";
+    char dam_indicator[10] = "";
+
+    if (current_track_display.loaded) {
+        mode_str = get_mode_string(current_track_display.mode);
+        num_s = current_track_display.num_sectors;
+        sect_sz = current_track_display.sector_size;
+
+        if (num_s > 0 && current_sector_physical_idx < num_s) {
+            uint8_t sflag_val = current_track_display.sflag[current_sector_physical_idx];
+            if (!IMD_SDR_HAS_DATA(sflag_val)) {
+                data_status_str = "Unavailable";
+            }
+            else if (IMD_SDR_IS_COMPRESSED(sflag_val)) {
+                data_status_str = "Compressed";
+            }
+            else {
+                data_status_str = "Normal Data";
+            }
+            if (IMD_SDR_HAS_ERR(sflag_val)) strcpy(err_indicator, " +ERR");
+            if (IMD_SDR_HAS_DAM(sflag_val)) strcpy(dam_indicator, " +DAM");
+        }
+    }
+    char line3_buf[120];
+    snprintf(line3_buf, sizeof(line3_buf), "%s, %u sectors of %u bytes, %s%s%s",
+        mode_str, num_s, sect_sz, data_status_str, dam_indicator, err_indicator);
+    wattron(win_info, COLOR_PAIR(CP_INFO));
+    mvwprintw(win_info, 3, 2, "%.*s", max_w - 3, line3_buf);
+    wattroff(win_info, COLOR_PAIR(CP_INFO));
+
+    wattron(win_info, COLOR_PAIR(CP_INFO));
+    for (int col_idx = 1; col_idx < max_w - 1; ++col_idx) {
+        mvwaddch(win_info, 4, col_idx, ' '); /* Clear line 4 */
+    }
+    wattroff(win_info, COLOR_PAIR(CP_INFO));
+
+
+    if (write_enabled) {
+        int wp_stat = 0;
+        imdf_get_write_protect(g_imdf_handle, &wp_stat);
+        const char* write_label_str = wp_stat ? " DISK RO " : " WRITE ENABLED ";
+        int label_attr = wp_stat ? COLOR_PAIR(CP_INFO) : (COLOR_PAIR(CP_INFO_HL) | A_BOLD);
+
+        wattron(win_info, label_attr);
+        mvwprintw(win_info, 4, 2, "%s", write_label_str);
+        wattroff(win_info, label_attr);
+    }
+    else {
+        int wp_stat = 1;
+        if (g_imdf_handle) {
+            imdf_get_write_protect(g_imdf_handle, &wp_stat);
+        }
+        if (wp_stat) {
+            wattron(win_info, COLOR_PAIR(CP_INFO));
+            mvwprintw(win_info, 4, 2, " DISK RO ");
+            wattroff(win_info, COLOR_PAIR(CP_INFO));
+        }
+    }
+
+    if (xor_mask != 0) {
+        char xor_str[20];
+        snprintf(xor_str, sizeof(xor_str), "XOR: 0x%02X", xor_mask);
+        int center_pos = (max_w - (int)strlen(xor_str)) / 2;
+        if (center_pos < 2) center_pos = 2;
+        /* Ensure it doesn't overwrite WRITE ENABLED/DISK RO if they are long */
+        int write_label_len = 0;
+        if (write_enabled) write_label_len = (int)strlen((imdf_get_write_protect(g_imdf_handle, &write_label_len), write_label_len ? " DISK RO " : " WRITE ENABLED "));
+        else if (g_imdf_handle && (imdf_get_write_protect(g_imdf_handle, &write_label_len), write_label_len)) write_label_len = (int)strlen(" DISK RO ");
+
+        if (center_pos <= 2 + write_label_len + 1) center_pos = 2 + write_label_len + 2; /* Move after write status + space*/
+
+
+        if (center_pos + (int)strlen(xor_str) < max_w - 1) {
+            wattron(win_info, COLOR_PAIR(CP_INFO));
+            mvwprintw(win_info, 4, center_pos, "%s", xor_str);
+            wattroff(win_info, COLOR_PAIR(CP_INFO));
+        }
+    }
+
+    const char* charset_str = (current_charset == CHARSET_ASCII) ? "ASCII" : "EBCDIC";
+    int charset_len = (int)strlen(charset_str);
+    int charset_pos = max_w - charset_len - 2; /* Position from the right */
+    if (charset_pos >= 1 && (charset_pos + charset_len < max_w - 1)) {
+        /* Check if XOR string is displayed and would overlap */
+        if (xor_mask != 0) {
+            char xor_str_check[20];
+            snprintf(xor_str_check, sizeof(xor_str_check), "XOR: 0x%02X", xor_mask);
+            int xor_center_pos = (max_w - (int)strlen(xor_str_check)) / 2;
+            if (xor_center_pos < 2) xor_center_pos = 2;
+            int write_label_len_check = 0;
+            if (write_enabled) imdf_get_write_protect(g_imdf_handle, &write_label_len_check);
+            else if (g_imdf_handle) imdf_get_write_protect(g_imdf_handle, &write_label_len_check);
+            if (write_label_len_check) write_label_len_check = (int)strlen((write_enabled && !write_label_len_check) ? " WRITE ENABLED " : " DISK RO ");
+
+
+            if (xor_center_pos <= 2 + write_label_len_check + 1) xor_center_pos = 2 + write_label_len_check + 2;
+
+
+            if (charset_pos < xor_center_pos + (int)strlen(xor_str_check) + 1) {
+                /* Overlap, move charset further left if possible, or don't print */
+                charset_pos = xor_center_pos - charset_len - 2; /* Place before XOR */
+            }
+        }
+        if (charset_pos >= 1) { /* Recheck after potential move */
+            wattron(win_info, COLOR_PAIR(CP_INFO));
+            mvwprintw(win_info, 4, charset_pos, "%s", charset_str);
+            wattroff(win_info, COLOR_PAIR(CP_INFO));
+        }
+    }
+    wnoutrefresh(win_info);
+}
+
+/* Forgets what the windows show, so the next draw repaints them completely */
+void invalidate_windows(void) {
+    g_data_view.valid = 0;
+    g_diff_view.valid = 0;
+    g_info_view.valid = 0;
+    g_status_valid = 0;
+}
+
+/* Marks one data window line as drawn over (e.g. by the edit cursor) */
+void data_window_damage_line(int line) {
+    if (line >= 0 && line < DATA_VIEW_MAX_LINES) g_data_view.line[line].offset = DATA_LINE_UNKNOWN;
+}
+
+/* What a data window line should show; zeroed first so states compare with memcmp */
+static void data_line_state(DataLineState* ls, int line, int highlight_active) {
+    uint32_t line_offset_in_sector = (uint32_t)current_data_offset_in_sector + (line * BYTES_PER_LINE);
+    memset(ls, 0, sizeof(*ls));
+    if (!current_track_display.loaded || current_track_display.num_sectors == 0 ||
+        line_offset_in_sector >= current_track_display.sector_size) {
+        ls->offset = DATA_LINE_BLANK;
+        return;
+    }
+    ls->offset = line_offset_in_sector;
+    for (int i = 0; i < BYTES_PER_LINE && line_offset_in_sector + i < current_track_display.sector_size; ++i) {
+        uint32_t byte_offset_in_sector = line_offset_in_sector + i;
+        ls->bytes[i] = current_sector_buffer[byte_offset_in_sector];
+        ls->count++;
+        if (highlight_active &&
+            byte_offset_in_sector >= (uint32_t)g_found_offset_in_sector &&
+            byte_offset_in_sector < (uint32_t)(g_found_offset_in_sector + g_found_len)) {
+            ls->highlight |= 1u << i;
+        }
+    }
+    ls->differs = diff_line_mask(line_offset_in_sector, ls->count);
+}
+
+static void draw_data_line(WINDOW* win, int y, const DataLineState* ls, int max_x) {
+    wmove(win, y, 0);
+    wclrtoeol(win);
+    if (ls->offset == DATA_LINE_BLANK) return;
+
+    wattron(win, COLOR_PAIR(CP_DATA_ADDR));
+    mvwprintw(win, y, 0, "%04X:", ls->offset);
+    wattroff(win, COLOR_PAIR(CP_DATA_ADDR));
+
+    wmove(win, y, 6);
+    for (int i = 0; i < BYTES_PER_LINE; ++i) {
+        int pair = (ls->highlight & (1u << i)) ? CP_SEARCH_HIGHLIGHT : (ls->differs & (1u << i)) ? CP_DIFF_HIGHLIGHT : CP_DATA_HEX;
+        if (i >= ls->count) {
+            wprintw(win, "   ");
+        }
+        else {
+            wattron(win, COLOR_PAIR(pair));
+            wprintw(win, " %02X", ls->bytes[i] ^ xor_mask);
+            wattroff(win, COLOR_PAIR(pair));
+        }
+        if ((i + 1) % 8 == 0 && i < 15) waddch(win, ' ');
+    }
+
+    int ascii_start_col = 6 + (BYTES_PER_LINE * 3) + (BYTES_PER_LINE / 8) + 1;
+    if (ascii_start_col < max_x) {
+        wmove(win, y, ascii_start_col);
+        for (int i = 0; i < ls->count; ++i) {
+            int pair = (ls->highlight & (1u << i)) ? CP_SEARCH_HIGHLIGHT : (ls->differs & (1u << i)) ? CP_DIFF_HIGHLIGHT : CP_DATA_ASC;
+            uint8_t val = ls->bytes[i] ^ xor_mask;
+            uint8_t display_char = (current_charset == CHARSET_EBCDIC) ? ebcdic_to_ascii[val] : val;
+            if (display_char == '\t') display_char = ' ';
+            else if (display_char == '\r') display_char = '<';
+            else if (display_char == '\n') display_char = '>';
+
+            wattron(win, COLOR_PAIR(pair));
+            waddch(win, (isprint(display_char) ? display_char : '.'));
+            wattroff(win, COLOR_PAIR(pair));
+        }
+    }
+}
+
+/* Repaints only the lines whose offset, bytes or highlight changed since the last draw */
+void draw_data_window(void) {
+    if (!win_data) return;
+
+    int max_y, max_x; getmaxyx(win_data, max_y, max_x);
+    int lines_to_draw = (max_y > 0) ? max_y : DATA_LINES;
+    int current_highlight_active = (g_found_len > 0 &&
+        g_found_on_track_idx == current_track_index_in_image &&
+        g_found_on_sector_log_idx == current_sector_logical_idx);
+
+    diff_sync_sector(); /* Differing bytes are highlighted against it */
+    if (!g_data_view.valid || g_data_view.lines != lines_to_draw ||
+        g_data_view.charset != current_charset || g_data_view.xor_mask != xor_mask) {
+        for (int line = 0; line < DATA_VIEW_MAX_LINES; ++line) g_data_view.line[line].offset = DATA_LINE_UNKNOWN;
+        g_data_view.lines = lines_to_draw;
+        g_data_view.charset = current_charset;
+        g_data_view.xor_mask = xor_mask;
+        g_data_view.valid = 1;
+    }
+
+    for (int line = 0; line < lines_to_draw; ++line) {
+        DataLineState ls;
+        data_line_state(&ls, line, current_highlight_active);
+        if (line < DATA_VIEW_MAX_LINES) {
+            if (memcmp(&ls, &g_data_view.line[line], sizeof(ls)) == 0) continue;
+            g_data_view.line[line] = ls;
+        }
+        draw_data_line(win_data, line, &ls, max_x);
+    }
+    wnoutrefresh(win_data);
+    draw_diff_window();
+}
+
+uint32_t get_physical_idx_for_display(uint32_t logical_idx_in_track_smap_order) {
+    if (!current_track_display.loaded || logical_idx_in_track_smap_order >= current_track_display.num_sectors) {
+        return 0;
+    }
+    return get_sector_order(&g_display_order, current_track_index_in_image, &current_track_display, ignore_interleave)[logical_idx_in_track_smap_order];
+}
+
+/*
+ * Returns the physical index of each logical position on a track: sector ID
+ * order, ties in physical order (or plain physical order if in_physical_order).
+ * The permutation is cached and only rebuilt when the track or the ordering
+ * changes. Sector IDs are bytes, so a stable counting sort replaces qsort.
+ */
+const uint8_t* get_sector_order(SectorOrderCache* cache, size_t track_idx, const ImdTrackInfo* track, int in_physical_order) {
+    uint16_t next_pos[256];
+    uint8_t n = track->num_sectors;
+
+    if (cache->track_idx == track_idx && cache->ignore_interleave == in_physical_order && cache->num_sectors == n) {
+        return cache->physical_idx;
+    }
+    if (in_physical_order) {
+        for (uint32_t p = 0; p < n; ++p) cache->physical_idx[p] = (uint8_t)p;
+    }
+    else {
+        uint16_t sum = 0;
+        memset(next_pos, 0, sizeof(next_pos));
+        for (uint32_t p = 0; p < n; ++p) next_pos[track->smap[p]]++;
+        for (int id = 0; id < 256; ++id) {     /* Counts -> first position of each ID */
+            uint16_t count = next_pos[id];
+            next_pos[id] = sum;
+            sum = (uint16_t)(sum + count);
+        }
+        for (uint32_t p = 0; p < n; ++p) cache->physical_idx[next_pos[track->smap[p]]++] = (uint8_t)p;
+    }
+    cache->track_idx = track_idx;
+    cache->ignore_interleave = in_physical_order;
+    cache->num_sectors = n;
+    return cache->physical_idx;
+}
+
+void clear_search_highlight(void) {
+    g_found_on_track_idx = (size_t)-1;
+    g_found_on_sector_log_idx = (uint32_t)-1;
+    g_found_offset_in_sector = -1;
+    g_found_len = 0;
+    g_found_end_offset = -1;
+}
+
+void adjust_view_for_match(long match_offset_in_sector, int term_len) {
+    if (!win_data) return; /* Should not happen */
+    int data_win_height = getmaxy(win_data);
+    if (data_win_height <= 0) data_win_height = DATA_LINES; /* Fallback if window not sized */
+
+
+    long match_line_start_offset = (match_offset_in_sector / BYTES_PER_LINE) * BYTES_PER_LINE;
+    long match_end_offset = match_offset_in_sector + term_len - 1;
+
+    long current_view_first_byte_offset = current_data_offset_in_sector;
+    long current_view_last_byte_offset = current_data_offset_in_sector + (data_win_height * BYTES_PER_LINE) - 1;
+
+    /* Check if the start of the match is already visible */
+    if (match_offset_in_sector >= current_view_first_byte_offset && match_offset_in_sector <= current_view_last_byte_offset) {
+        /* Start is visible. Check if end is also visible. */
+        if (match_end_offset <= current_view_last_byte_offset) {
+            /* Entire match is visible, no scroll needed. */
+            return;
+        }
+    }
+    /* Match is not (fully) visible, scroll to make its starting line the top line */
+    current_data_offset_in_sector = match_line_start_offset;
+}
+
+
+static int is_navigation_key(int ch) {
+    switch (ch) {
+    case KEY_UP: case KEY_DOWN: case KEY_LEFT: case KEY_RIGHT:
+    case KEY_PPAGE: case KEY_NPAGE: case KEY_HOME: case KEY_END:
+        return 1;
+    default:
+        return IS_KEY_CTRL_HOME(ch) || IS_KEY_CTRL_END(ch);
+    }
+}
+
+/*
+ * Reads the next key and acts on it. Navigation keys already queued behind
+ * it (key repeat) are applied first without reading sector data or drawing,
+ * so only the final position is loaded and rendered.
+ */
+void handle_input(void) {
+    int ch;
+    /* Only poll while a search, prefetch or difference index runs on this thread, so it gets the time between keys */
+    int idle_work = g_search_active || prefetch_pending() || diff_pending();
+#ifdef IMDV_HAVE_THREADS
+    if (search_workers_running()) idle_work = prefetch_pending() || diff_pending();
+    if (!idle_work && (search_workers_running() || diff_worker_running())) {
+        wtimeout(win_data, FIND_ALL_POLL_MS); /* Workers do the work; only check on them */
+    }
+    else
+#endif
+    wtimeout(win_data, idle_work ? 0 : -1);
+    ch = wgetch(win_data);
+    wtimeout(win_data, -1);
+    if (ch == ERR) return;
+    if (ch == ESC_KEY && g_search_active) {
+        cancel_search();
+        return;
+    }
+
+    int coalesced = 0;
+    if (is_navigation_key(ch)) {
+        int next;
+        g_coalescing_input = 1;
+        wtimeout(win_data, 0);
+        while ((next = wgetch(win_data)) != ERR) {
+            if (!is_navigation_key(next)) {
+                ungetch(next);
+                break;
+            }
+            handle_key(ch);
+            ch = next;
+            coalesced = 1;
+        }
+        wtimeout(win_data, -1);
+        g_coalescing_input = 0;
+    }
+    handle_key(ch);
+
+    if (coalesced) {
+        /* The last key may not have moved, but the ones before it did */
+        if (g_sector_load_pending) load_sector_for_display();
+        draw_info_window();
+        draw_data_window();
+        doupdate();
+    }
+}
+
+void handle_key(int ch) {
+    int redraw_info = 0;
+    int redraw_data = 0;
+    int needs_sector_load = 0;
+    int navigation_key_pressed = 0;
+
+    size_t target_track_idx = current_track_index_in_image;
+    uint32_t target_logical_sector_idx = current_sector_logical_idx;
+    long target_data_offset = current_data_offset_in_sector;
+
+    switch (ch) {
+    case KEY_UP:
+    case KEY_DOWN:
+    case KEY_LEFT:
+    case KEY_RIGHT:
+    case KEY_PPAGE:
+    case KEY_NPAGE:
+    case KEY_HOME:  /* Corrected behavior */
+    case KEY_END:   /* Corrected behavior */
+    case KEY_SHOME: /* Covers KEY_SHOME for all platforms */
+#ifdef PDCURSES
+    case CTL_HOME:  /* Also covers CTL_HOME if PDCURSES is defined */
+#endif
+    case KEY_SEND:  /* Covers KEY_SEND for all platforms */
+#ifdef PDCURSES
+    case CTL_END:   /* Also covers CTL_END if PDCURSES is defined */
+#endif
+        navigation_key_pressed = 1;
+        clear_search_highlight(); /* Cleared for any navigation */
+
+        if (ch == KEY_UP) {
+            if (current_track_index_in_image > 0) {
+                target_track_idx--; target_logical_sector_idx = 0; target_data_offset = 0;
+            }
+            else { beep(); }
+        }
+        else if (ch == KEY_DOWN) {
+            if (current_track_index_in_image < total_tracks_in_image - 1) {
+                target_track_idx++; target_logical_sector_idx = 0; target_data_offset = 0;
+            }
+            else { beep(); }
+        }
+        else if (ch == KEY_LEFT) {
+            if (current_sector_logical_idx > 0) {
+                target_logical_sector_idx--; target_data_offset = 0;
+            }
+            else if (current_track_index_in_image > 0) {
+                target_track_idx--; target_logical_sector_idx = 0xFFFF; /* Signal to wrap to last sector */ target_data_offset = 0;
+            }
+            else { beep(); }
+        }
+        else if (ch == KEY_RIGHT) {
+            if (current_track_display.loaded && current_track_display.num_sectors > 0 && current_sector_logical_idx < (uint32_t)(current_track_display.num_sectors - 1)) {
+                target_logical_sector_idx++; target_data_offset = 0;
+            }
+            else if (current_track_index_in_image < total_tracks_in_image - 1) {
+                target_track_idx++; target_logical_sector_idx = 0; target_data_offset = 0;
+            }
+            else { beep(); }
+        }
+        else if (ch == KEY_PPAGE) {
+            int data_win_h_pp = getmaxy(win_data) > 0 ? getmaxy(win_data) : DATA_LINES;
+            if (current_data_offset_in_sector >= (long)(data_win_h_pp * BYTES_PER_LINE)) {
+                target_data_offset -= (data_win_h_pp * BYTES_PER_LINE);
+            }
+            else if (current_data_offset_in_sector > 0) {
+                target_data_offset = 0;
+            }
+            else { /* At the top of the current sector's data */
+                if (current_sector_logical_idx > 0) {
+                    target_logical_sector_idx--;
+                    /* Position at end of previous sector's view */
+                    const ImdTrackInfo* prev_track_info = imdf_get_track_info(g_imdf_handle, current_track_index_in_image);
+                    if (prev_track_info && prev_track_info->sector_size > 0) {
+                        target_data_offset = (long)prev_track_info->sector_size - (data_win_h_pp * BYTES_PER_LINE);
+                        if (target_data_offset < 0) target_data_offset = 0;
+                        target_data_offset = (target_data_offset / BYTES_PER_LINE) * BYTES_PER_LINE; /* Align */
+                    }
+                    else {
+                        target_data_offset = 0;
+                    }
+                }
+                else if (current_track_index_in_image > 0) {
+                    target_track_idx--; target_logical_sector_idx = 0xFFFF; /* Signal to wrap to last sector */
+                    target_data_offset = 0xFFFFFFFF; /* Signal to go to end of data view on new track/sector */
+                }
+                else { beep(); }
+            }
+        }
+        else if (ch == KEY_NPAGE) {
+            int data_win_h_np = getmaxy(win_data) > 0 ? getmaxy(win_data) : DATA_LINES;
+            if (current_data_offset_in_sector + (long)(data_win_h_np * BYTES_PER_LINE) < (long)current_track_display.sector_size) {
+                target_data_offset += (data_win_h_np * BYTES_PER_LINE);
+            }
+            else if (current_track_display.sector_size > 0 &&
+                current_data_offset_in_sector < (((long)current_track_display.sector_size - 1) / BYTES_PER_LINE * BYTES_PER_LINE)) {
+                target_data_offset = (((long)current_track_display.sector_size - 1) / BYTES_PER_LINE) * BYTES_PER_LINE;
+                if ((long)current_track_display.sector_size > (long)(data_win_h_np * BYTES_PER_LINE)) {
+                    long temp_offset = (long)current_track_display.sector_size - (data_win_h_np * BYTES_PER_LINE);
+                    if (temp_offset < 0) temp_offset = 0;
+                    target_data_offset = (temp_offset / BYTES_PER_LINE) * BYTES_PER_LINE;
+                    if (target_data_offset + (long)(data_win_h_np * BYTES_PER_LINE) < (long)current_track_display.sector_size && target_data_offset < (((long)current_track_display.sector_size - 1) / BYTES_PER_LINE * BYTES_PER_LINE)) {
+                        target_data_offset = ((long)current_track_display.sector_size - 1) - ((data_win_h_np - 1) * BYTES_PER_LINE);
+                        if (target_data_offset < 0) target_data_offset = 0;
+                        target_data_offset = (target_data_offset / BYTES_PER_LINE) * BYTES_PER_LINE;
+                    }
+                }
+                else {
+                    target_data_offset = 0;
+                }
+                if (target_data_offset < 0) target_data_offset = 0;
+            }
+            else {
+                if (current_track_display.loaded && current_track_display.num_sectors > 0 && current_sector_logical_idx < (uint32_t)(current_track_display.num_sectors - 1)) {
+                    target_logical_sector_idx++; target_data_offset = 0;
+                }
+                else if (current_track_index_in_image < total_tracks_in_image - 1) {
+                    target_track_idx++; target_logical_sector_idx = 0; target_data_offset = 0;
+                }
+                else { beep(); }
+            }
+        }
+        else if (ch == KEY_HOME) {
+            /* Corrected: Go to first sector of current track, top of data */
+            if (current_track_display.loaded) { /* Ensure track info is available */
+                target_logical_sector_idx = 0;
+                target_data_offset = 0;
+            }
+            else {
+                beep(); /* Should not happen if track is loaded */
+            }
+        }
+        else if (ch == KEY_END) {
+            /* Corrected: Go to last sector of current track, top of data */
+            if (current_track_display.loaded && current_track_display.num_sectors > 0) {
+                target_logical_sector_idx = current_track_display.num_sectors - 1;
+                target_data_offset = 0;
+            }
+            else {
+                beep(); /* No sectors or track not loaded */
+            }
+        }
+        else if (IS_KEY_CTRL_HOME(ch)) { /* Handles KEY_SHOME and CTL_HOME (if PDCURSES) */
+            target_track_idx = 0; target_logical_sector_idx = 0; target_data_offset = 0;
+        }
+        else if (IS_KEY_CTRL_END(ch)) { /* Handles KEY_SEND and CTL_END (if PDCURSES) */
+            if (total_tracks_in_image > 0) {
+                target_track_idx = total_tracks_in_image - 1;
+                target_logical_sector_idx = 0; target_data_offset = 0;
+            }
             else { beep(); }
         }
-        else if (ch == KEY_PPAGE) {
-            int data_win_h_pp = getmaxy(win_data) > 0 ? getmaxy(win_data) : DATA_LINES;
-            if (current_data_offset_in_sector >= (long)(data_win_h_pp * BYTES_PER_LINE)) {
-                target_data_offset -= (data_win_h_pp * BYTES_PER_LINE);
+        break; /* End of grouped navigation key handling */
+
+    case 'q': case 'Q': case KEY_F(10):
+        if (!confirm_quit()) return;
+#ifdef IMDV_HAVE_THREADS
+        search_stop_workers();
+        prefetch_stop();
+#endif
+        cleanup_ui();
+        if (g_imdf_handle) imdf_close(g_imdf_handle);
+        edit_cache_free();
+        sector_cache_clear();
+        diff_close();
+        flag_index_free();
+        exit(EXIT_SUCCESS);
+        break;
+    case '[':
+    case ']':
+        diff_jump(ch == ']');
+        return;
+    case 'e': case 'E':
+        flag_jump(FLAG_CLASS_ERROR, ch == 'e');
+        return;
+    case 'd': case 'D':
+        flag_jump(FLAG_CLASS_DELETED, ch == 'd');
+        return;
+    case 'a': case 'A':
+        flag_jump(FLAG_CLASS_UNAVAILABLE, ch == 'a');
+        return;
+    case 'c': case 'C':
+        flag_jump(FLAG_CLASS_COMPRESSED, ch == 'c');
+        return;
+    case 'u': case 'U':
+    case 'r': case 'R':
+        if (!undo_redo_edit(ch == 'r' || ch == 'R')) {
+            update_status((ch == 'r' || ch == 'R') ? "Nothing to redo." : "Nothing to undo.");
+            doupdate();
+        }
+        return;
+    case 's': case 'S':
+    {
+        char msg[sizeof(status_message)];
+        int stopped_search = 0;
+#ifdef IMDV_HAVE_THREADS
+        stopped_search = dirty_sector_count() > 0 && search_workers_running();
+#endif
+        int written = flush_dirty_sectors();
+        if (written < 0) return; /* Error already shown */
+        if (written == 0) snprintf(msg, sizeof(msg), "No unsaved changes.");
+        else snprintf(msg, sizeof(msg), "Saved %d sector(s) to the image.%s", written,
+            stopped_search ? " The search was cancelled." : "");
+        draw_info_window();
+        draw_data_window();
+        update_status(msg);
+        doupdate();
+    }
+    return;
+    case ESC_KEY:
+        update_status("Press F10 or Q to quit.");
+        doupdate();
+        timeout(1000);
+        modal_getch(win_data);
+        timeout(100);
+        build_status_message();
+        update_status(status_message);
+        break;
+    case KEY_F(1):
+        clear_search_highlight();
+        display_help_window();
+        return;
+    case KEY_F(2):
+        current_charset = (current_charset == CHARSET_ASCII) ? CHARSET_EBCDIC : CHARSET_ASCII;
+        redraw_info = 1; redraw_data = 1;
+        clear_search_highlight();
+        break;
+    case KEY_F(3):
+    {
+        char search_input_buf[MAX_SEARCH_TERM];
+        clear_search_highlight();
+        if (get_search_input("Text?", search_input_buf, sizeof(search_input_buf), SEARCH_TYPE_TEXT)) {
+            strncpy(last_search_term_text, search_input_buf, MAX_SEARCH_TERM - 1);
+            last_search_term_text[MAX_SEARCH_TERM - 1] = '\0';
+            last_search_type = SEARCH_TYPE_TEXT;
+            search_text_from_current(last_search_term_text, 0);
+        }
+        else {
+            build_status_message();
+            update_status(status_message);
+            draw_info_window();
+            draw_data_window();
+            doupdate();
+        }
+    }
+    return;
+    case KEY_F(4):
+    {
+        char search_input_buf[MAX_SEARCH_TERM];
+        clear_search_highlight();
+        if (get_search_input("Hex Bytes?", search_input_buf, sizeof(search_input_buf), SEARCH_TYPE_HEX)) {
+            last_search_term_hex_len = 0;
+            if (strpbrk(search_input_buf, "?* ") != NULL) {
+                /* Wildcards: compiled into a DFA */
+                strncpy(last_search_pattern, search_input_buf, MAX_SEARCH_TERM - 1);
+                last_search_pattern[MAX_SEARCH_TERM - 1] = '\0';
+                last_search_type = SEARCH_TYPE_HEX_PATTERN;
+                search_pattern_from_current(last_search_pattern, 1, 0);
+                return;
+            }
+            if (strlen(search_input_buf) > 0) {
+                for (size_t i = 0; (i + 1) < strlen(search_input_buf); i += 2) {
+                    if (last_search_term_hex_len < (MAX_SEARCH_TERM / 2)) {
+                        int hi = ctoh(search_input_buf[i]);
+                        int lo = ctoh(search_input_buf[i + 1]);
+                        if (hi != -1 && lo != -1) {
+                            last_search_term_hex[last_search_term_hex_len++] = (uint8_t)((hi << 4) | lo);
+                        }
+                        else {
+                            display_error("Invalid hex character in input.");
+                            last_search_term_hex_len = 0;
+                            break;
+                        }
+                    }
+                    else {
+                        display_error("Hex search term too long.");
+                        last_search_term_hex_len = 0;
+                        break;
+                    }
+                }
+            }
+
+            if (last_search_term_hex_len > 0) {
+                last_search_type = SEARCH_TYPE_HEX;
+                search_hex_from_current(last_search_term_hex, last_search_term_hex_len, 0);
+            }
+            else if (strlen(search_input_buf) > 0) {
+                int error_shown = (strstr(status_message, "Invalid hex") != NULL ||
+                    strstr(status_message, "Hex search term too long") != NULL ||
+                    strstr(status_message, "even number of digits") != NULL);
+                if (!error_shown) display_error("No valid hex bytes entered for search.");
+            }
+            else {
+                build_status_message();
+                update_status(status_message);
+                draw_info_window();
+                draw_data_window();
+                doupdate();
+            }
+        }
+        else {
+            build_status_message();
+            update_status(status_message);
+            draw_info_window();
+            draw_data_window();
+            doupdate();
+        }
+    }
+    return;
+    case KEY_F(5):
+        repeat_last_search();
+        return;
+    case KEY_F(8):
+    {
+        char search_input_buf[MAX_SEARCH_TERM];
+        clear_search_highlight();
+        if (get_search_input("Regex?", search_input_buf, sizeof(search_input_buf), SEARCH_TYPE_REGEX)) {
+            strncpy(last_search_pattern, search_input_buf, MAX_SEARCH_TERM - 1);
+            last_search_pattern[MAX_SEARCH_TERM - 1] = '\0';
+            last_search_type = SEARCH_TYPE_REGEX;
+            search_pattern_from_current(last_search_pattern, 0, 0);
+        }
+        else {
+            build_status_message();
+            update_status(status_message);
+            draw_info_window();
+            draw_data_window();
+            doupdate();
+        }
+    }
+    return;
+    case KEY_F(6):
+        find_all_last_search();
+        return;
+    case KEY_F(7):
+        if (g_search_active) cancel_search();
+        rebuild_search_index();
+        return;
+
+    case '\n':
+    case KEY_ENTER:
+        clear_search_highlight();
+        if (write_enabled) {
+            if (current_track_display.loaded && current_track_display.num_sectors > 0 && current_track_display.sector_size > 0) {
+                uint8_t sflag_check = 0;
+                if (current_sector_physical_idx < LIBIMD_MAX_SECTORS_PER_TRACK) {
+                    sflag_check = current_track_display.sflag[current_sector_physical_idx];
+                }
+                else {
+                    display_error("Sector index out of bounds for sflag check.");
+                    return;
+                }
+                if (!IMD_SDR_HAS_DATA(sflag_check)) {
+                    display_error("Sector unavailable (no data), cannot edit.");
+                }
+                else {
+                    edit_sector();
+                }
+            }
+            else {
+                if (current_track_display.loaded && current_track_display.num_sectors > 0 && current_track_display.sector_size == 0) {
+                    display_error("Cannot edit 0-byte sector.");
+                }
+                else {
+                    display_error("No sector loaded to edit.");
+                }
+            }
+        }
+        else {
+            display_error("Write mode not enabled (-W).");
+        }
+        return;
+    case 'i': case 'I':
+        clear_search_highlight();
+        ignore_interleave = !ignore_interleave;
+        build_status_message();
+        update_status(status_message);
+        needs_sector_load = 1;
+        redraw_info = 1;
+        redraw_data = 1;
+        break;
+    default:
+        break;
+    }
+
+    /* Apply navigation changes */
+    if (target_track_idx != current_track_index_in_image) {
+        current_track_index_in_image = target_track_idx;
+        load_track_for_display(current_track_index_in_image);
+
+        if (target_logical_sector_idx == 0xFFFF && current_track_display.num_sectors > 0) {
+            current_sector_logical_idx = current_track_display.num_sectors - 1;
+        }
+        else if (target_logical_sector_idx == 0xFFFF) {
+            current_sector_logical_idx = 0;
+        }
+        else {
+            current_sector_logical_idx = target_logical_sector_idx;
+        }
+        if (current_track_display.num_sectors > 0 && current_sector_logical_idx >= current_track_display.num_sectors) {
+            current_sector_logical_idx = current_track_display.num_sectors - 1;
+        }
+        else if (current_track_display.num_sectors == 0) {
+            current_sector_logical_idx = 0;
+        }
+
+        if (target_data_offset == 0xFFFFFFFF) {
+            if (current_track_display.sector_size > 0) {
+                int data_win_h_nav = getmaxy(win_data) > 0 ? getmaxy(win_data) : DATA_LINES;
+                current_data_offset_in_sector = (long)current_track_display.sector_size - (data_win_h_nav * BYTES_PER_LINE);
+                if (current_data_offset_in_sector < 0) current_data_offset_in_sector = 0;
+                current_data_offset_in_sector = (current_data_offset_in_sector / BYTES_PER_LINE) * BYTES_PER_LINE;
             }
-            else if (current_data_offset_in_sector > 0) {
-                target_data_offset = 0;
+            else { current_data_offset_in_sector = 0; }
+        }
+        else {
+            current_data_offset_in_sector = target_data_offset;
+        }
+        if (current_data_offset_in_sector < 0) current_data_offset_in_sector = 0;
+        if (current_track_display.sector_size > 0 && current_data_offset_in_sector >= (long)current_track_display.sector_size) {
+            current_data_offset_in_sector = (((long)current_track_display.sector_size - 1) / BYTES_PER_LINE) * BYTES_PER_LINE;
+            if (current_data_offset_in_sector < 0) current_data_offset_in_sector = 0;
+        }
+        else if (current_track_display.sector_size == 0) {
+            current_data_offset_in_sector = 0;
+        }
+
+        load_sector_for_display();
+        redraw_info = 1; redraw_data = 1;
+    }
+    else if (target_logical_sector_idx != current_sector_logical_idx) {
+        if (target_logical_sector_idx == 0xFFFF && current_track_display.num_sectors > 0) {
+            current_sector_logical_idx = current_track_display.num_sectors - 1;
+        }
+        else if (target_logical_sector_idx == 0xFFFF) {
+            current_sector_logical_idx = 0;
+        }
+        else {
+            current_sector_logical_idx = target_logical_sector_idx;
+        }
+        if (current_track_display.num_sectors > 0 && current_sector_logical_idx >= current_track_display.num_sectors) {
+            current_sector_logical_idx = current_track_display.num_sectors - 1;
+        }
+        else if (current_track_display.num_sectors == 0) {
+            current_sector_logical_idx = 0;
+        }
+
+        current_data_offset_in_sector = target_data_offset;
+        if (target_data_offset == 0xFFFFFFFF) {
+            if (current_track_display.sector_size > 0) {
+                int data_win_h_nav = getmaxy(win_data) > 0 ? getmaxy(win_data) : DATA_LINES;
+                current_data_offset_in_sector = (long)current_track_display.sector_size - (data_win_h_nav * BYTES_PER_LINE);
+                if (current_data_offset_in_sector < 0) current_data_offset_in_sector = 0;
+                current_data_offset_in_sector = (current_data_offset_in_sector / BYTES_PER_LINE) * BYTES_PER_LINE;
             }
-            else { /* At the top of the current sector's data */
-                if (current_sector_logical_idx > 0) {
-                    target_logical_sector_idx--;
-                    /* Position at end of previous sector's view */
-                    const ImdTrackInfo* prev_track_info = imdf_get_track_info(g_imdf_handle, current_track_index_in_image);
-                    if (prev_track_info && prev_track_info->sector_size > 0) {
-                        target_data_offset = (long)prev_track_info->sector_size - (data_win_h_pp * BYTES_PER_LINE);
-                        if (target_data_offset < 0) target_data_offset = 0;
-                        target_data_offset = (target_data_offset / BYTES_PER_LINE) * BYTES_PER_LINE; /* Align */
+            else { current_data_offset_in_sector = 0; }
+        }
+        if (current_data_offset_in_sector < 0) current_data_offset_in_sector = 0;
+        if (current_track_display.sector_size > 0 && current_data_offset_in_sector >= (long)current_track_display.sector_size) {
+            current_data_offset_in_sector = (((long)current_track_display.sector_size - 1) / BYTES_PER_LINE) * BYTES_PER_LINE;
+            if (current_data_offset_in_sector < 0) current_data_offset_in_sector = 0;
+        }
+        else if (current_track_display.sector_size == 0) {
+            current_data_offset_in_sector = 0;
+        }
+
+        load_sector_for_display();
+        redraw_info = 1; redraw_data = 1;
+    }
+    else if (target_data_offset != current_data_offset_in_sector) {
+        current_data_offset_in_sector = target_data_offset;
+        if (current_data_offset_in_sector < 0) current_data_offset_in_sector = 0;
+
+        if (current_track_display.sector_size > 0) {
+            if (current_data_offset_in_sector >= (long)current_track_display.sector_size) {
+                int data_win_h_nav = getmaxy(win_data) > 0 ? getmaxy(win_data) : DATA_LINES;
+                long last_line_start_offset = (((long)current_track_display.sector_size - 1) / BYTES_PER_LINE) * BYTES_PER_LINE;
+                current_data_offset_in_sector = last_line_start_offset;
+                /* Adjust so the view shows the last page containing data, not just the last line */
+                if ((long)current_track_display.sector_size > (long)(data_win_h_nav * BYTES_PER_LINE)) {
+                    long temp_offset = (long)current_track_display.sector_size - (data_win_h_nav * BYTES_PER_LINE);
+                    if (temp_offset < 0) temp_offset = 0;
+                    current_data_offset_in_sector = (temp_offset / BYTES_PER_LINE) * BYTES_PER_LINE;
+                    /* Ensure this adjustment does not hide the actual last line if sector ends mid-page */
+                    if (current_data_offset_in_sector > last_line_start_offset && last_line_start_offset >= 0) {
+                        current_data_offset_in_sector = last_line_start_offset;
                     }
-                    else {
-                        target_data_offset = 0;
+                    else if (current_data_offset_in_sector < 0) {
+                        current_data_offset_in_sector = 0;
                     }
                 }
-                else if (current_track_index_in_image > 0) {
-                    target_track_idx--; target_logical_sector_idx = 0xFFFF; /* Signal to wrap to last sector */
-                    target_data_offset = 0xFFFFFFFF; /* Signal to go to end of data view on new track/sector */
+                if (current_data_offset_in_sector < 0) current_data_offset_in_sector = 0;
+            }
+        }
+        else {
+            current_data_offset_in_sector = 0;
+        }
+        redraw_data = 1;
+    }
+
+
+    if (needs_sector_load) {
+        if (current_track_display.num_sectors > 0 && current_sector_logical_idx >= current_track_display.num_sectors) {
+            current_sector_logical_idx = 0;
+            current_data_offset_in_sector = 0;
+        }
+        else if (current_track_display.num_sectors == 0) {
+            current_sector_logical_idx = 0;
+            current_data_offset_in_sector = 0;
+        }
+        load_sector_for_display();
+        redraw_info = 1; redraw_data = 1;
+    }
+
+    if (g_coalescing_input) return; /* More keys follow; only the final position is drawn */
+    if (redraw_info) draw_info_window();
+    if (redraw_data) draw_data_window();
+
+    if (redraw_info || redraw_data || navigation_key_pressed || needs_sector_load || ch == ESC_KEY) {
+        doupdate();
+    }
+}
+
+int ctoh(int c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/* search_type: SEARCH_TYPE_TEXT, SEARCH_TYPE_HEX (also takes ?? / * wildcards) or SEARCH_TYPE_REGEX */
+int get_search_input(const char* prompt, char* buffer, int buffer_size, int search_type) {
+    WINDOW* popup_win;
+    int is_hex = (search_type == SEARCH_TYPE_HEX);
+    int screen_h, screen_w;
+    getmaxyx(stdscr, screen_h, screen_w);
+
+    int win_h = 4;
+    int term_display_width = is_hex ? (MAX_SEARCH_TERM / 2 * 2) : MAX_SEARCH_TERM;
+    int win_w = (int)strlen(prompt) + term_display_width + 8;
+    if (win_w > screen_w - 4) win_w = screen_w - 4;
+    int input_field_width = win_w - (int)strlen(prompt) - 4;
+    if (input_field_width < 10) input_field_width = 10;
+    if (input_field_width >= buffer_size) input_field_width = buffer_size - 1;
+
+
+    int start_y = (screen_h - win_h) / 2;
+    int start_x = (screen_w - win_w) / 2;
+
+    popup_win = newwin(win_h, win_w, start_y, start_x);
+    wbkgd(popup_win, COLOR_PAIR(CP_SEARCH_BOX));
+    box(popup_win, 0, 0);
+    keypad(popup_win, TRUE);
+
+    mvwprintw(popup_win, 1, 2, "%s", prompt);
+
+    buffer[0] = '\0';
+    if (is_hex) {
+        if (last_search_type == SEARCH_TYPE_HEX && last_search_term_hex_len > 0) {
+            for (int i = 0; i < last_search_term_hex_len; ++i) {
+                if ((size_t)(i * 2 + 2) < (size_t)buffer_size) {
+                    snprintf(buffer + (i * 2), 3, "%02X", last_search_term_hex[i]);
                 }
-                else { beep(); }
+                else break;
             }
         }
-        else if (ch == KEY_NPAGE) {
-            int data_win_h_np = getmaxy(win_data) > 0 ? getmaxy(win_data) : DATA_LINES;
-            if (current_data_offset_in_sector + (long)(data_win_h_np * BYTES_PER_LINE) < (long)current_track_display.sector_size) {
-                target_data_offset += (data_win_h_np * BYTES_PER_LINE);
+        else if (last_search_type == SEARCH_TYPE_HEX_PATTERN) {
+            strncpy(buffer, last_search_pattern, buffer_size - 1);
+            buffer[buffer_size - 1] = '\0';
+        }
+    }
+    else if (search_type == SEARCH_TYPE_REGEX) {
+        if (last_search_type == SEARCH_TYPE_REGEX) {
+            strncpy(buffer, last_search_pattern, buffer_size - 1);
+            buffer[buffer_size - 1] = '\0';
+        }
+    }
+    else {
+        if (last_search_type == SEARCH_TYPE_TEXT && strlen(last_search_term_text) > 0) {
+            strncpy(buffer, last_search_term_text, buffer_size - 1);
+            buffer[buffer_size - 1] = '\0';
+        }
+    }
+
+    int current_len = (int)strlen(buffer);
+    int cursor_pos = current_len;
+    int ch_input;
+    int MveX = 2;
+
+    curs_set(1);
+
+    while (1) {
+        wattron(popup_win, COLOR_PAIR(CP_SEARCH_BOX));
+        mvwprintw(popup_win, 2, MveX, "%-*.*s", input_field_width, input_field_width, buffer);
+        for (int k = current_len; k < input_field_width; ++k) {
+            mvwaddch(popup_win, 2, MveX + k, ' ');
+        }
+        wattroff(popup_win, COLOR_PAIR(CP_SEARCH_BOX));
+
+        wmove(popup_win, 2, MveX + cursor_pos);
+        wrefresh(popup_win);
+
+        ch_input = modal_getch(popup_win);
+
+        switch (ch_input) {
+        case KEY_BACKSPACE: case 127: case '\b':
+            if (cursor_pos > 0) {
+                memmove(&buffer[cursor_pos - 1], &buffer[cursor_pos], current_len - cursor_pos + 1);
+                cursor_pos--;
+                current_len--;
             }
-            else if (current_track_display.sector_size > 0 &&
-                current_data_offset_in_sector < (((long)current_track_display.sector_size - 1) / BYTES_PER_LINE * BYTES_PER_LINE)) {
-                target_data_offset = (((long)current_track_display.sector_size - 1) / BYTES_PER_LINE) * BYTES_PER_LINE;
-                if ((long)current_track_display.sector_size > (long)(data_win_h_np * BYTES_PER_LINE)) {
-                    long temp_offset = (long)current_track_display.sector_size - (data_win_h_np * BYTES_PER_LINE);
-                    if (temp_offset < 0) temp_offset = 0;
-                    target_data_offset = (temp_offset / BYTES_PER_LINE) * BYTES_PER_LINE;
-                    if (target_data_offset + (long)(data_win_h_np * BYTES_PER_LINE) < (long)current_track_display.sector_size && target_data_offset < (((long)current_track_display.sector_size - 1) / BYTES_PER_LINE * BYTES_PER_LINE)) {
-                        target_data_offset = ((long)current_track_display.sector_size - 1) - ((data_win_h_np - 1) * BYTES_PER_LINE);
-                        if (target_data_offset < 0) target_data_offset = 0;
-                        target_data_offset = (target_data_offset / BYTES_PER_LINE) * BYTES_PER_LINE;
+            break;
+        case KEY_DC:
+            if (cursor_pos < current_len) {
+                memmove(&buffer[cursor_pos], &buffer[cursor_pos + 1], current_len - cursor_pos);
+                current_len--;
+            }
+            break;
+        case KEY_LEFT:
+            if (cursor_pos > 0) cursor_pos--;
+            break;
+        case KEY_RIGHT:
+            if (cursor_pos < current_len) cursor_pos++;
+            break;
+        case '\n': case KEY_ENTER:
+            goto process_input_label;
+        case ESC_KEY:
+            buffer[0] = '\0';
+            goto process_input_label;
+        default:
+            if (isprint(ch_input)) {
+                if (is_hex && !isxdigit(ch_input) && ch_input != '?' && ch_input != '*' && ch_input != ' ') {
+                    beep();
+                }
+                else if (current_len < input_field_width && current_len < buffer_size - 1) {
+                    if (cursor_pos < current_len) {
+                        memmove(&buffer[cursor_pos + 1], &buffer[cursor_pos], current_len - cursor_pos);
                     }
+                    buffer[cursor_pos] = (char)ch_input;
+                    cursor_pos++;
+                    current_len++;
+                    buffer[current_len] = '\0';
                 }
                 else {
-                    target_data_offset = 0;
-                }
-                if (target_data_offset < 0) target_data_offset = 0;
-            }
-            else {
-                if (current_track_display.loaded && current_track_display.num_sectors > 0 && current_sector_logical_idx < (uint32_t)(current_track_display.num_sectors - 1)) {
-                    target_logical_sector_idx++; target_data_offset = 0;
-                }
-                else if (current_track_index_in_image < total_tracks_in_image - 1) {
-                    target_track_idx++; target_logical_sector_idx = 0; target_data_offset = 0;
+                    beep();
                 }
-                else { beep(); }
             }
+            break;
         }
-        else if (ch == KEY_HOME) {
-            /* Corrected: Go to first sector of current track, top of data */
-            if (current_track_display.loaded) { /* Ensure track info is available */
-                target_logical_sector_idx = 0;
-                target_data_offset = 0;
+    }
+
+process_input_label:
+    curs_set(0);
+    delwin(popup_win);
+
+    /* Repaint only the cells the popup covered: touched windows are diffed against the screen */
+    touchwin(win_info); wnoutrefresh(win_info);
+    touchwin(win_data); wnoutrefresh(win_data);
+    if (win_diff) { touchwin(win_diff); wnoutrefresh(win_diff); }
+    touchwin(win_status); wnoutrefresh(win_status);
+    doupdate();
+
+
+    if (strlen(buffer) == 0) return 0;
+
+    if (is_hex && strpbrk(buffer, "?* ") == NULL) {
+        if (strlen(buffer) % 2 != 0) {
+            display_error("Hex string must have an even number of digits.");
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* --- Wildcard Hex and Regular Expression Patterns --- */
+
+/*
+ * Patterns are parsed into a Thompson NFA and compiled once into an anchored
+ * DFA over byte classes. The search runs one attempt of that DFA from every
+ * start byte, merging attempts that reach the same state into the one that
+ * started first, so it needs no backtracking and at most one step per DFA
+ * state and byte. Matches are leftmost-longest: the earliest start wins, and
+ * from it the longest run the pattern accepts.
+ *
+ * Wildcard hex: byte pairs ("4C", "4?", "??" for any byte) and "*" for any
+ * run of bytes, separated by optional spaces.
+ * Regex (byte-oriented): literals, ".", [set] with ranges and ^, \xHH,
+ * \n \r \t \0 and escaped metacharacters, grouping ( ), | and * + ?.
+ */
+typedef struct {
+    int16_t out1, out2;             /* Next nodes, -1 if none */
+    uint8_t is_set;                 /* 1: consumes one byte in 'set'; 0: epsilon */
+    uint32_t set[8];
+} NfaNode;
+
+typedef struct {
+    int count;
+    int start;
+    int accept;
+    NfaNode nodes[REGEX_MAX_NFA];
+} RegexNfa;
+
+typedef struct {
+    int start;
+    int end;                        /* Epsilon node the fragment leaves through */
+} NfaFrag;
+
+typedef struct {
+    const char* p;
+    RegexNfa* nfa;
+    const char* error;
+} PatternParser;
+
+/* A DFA over byte classes. State 0 is the dead state. */
+typedef struct {
+    int num_states;
+    int num_classes;
+    int start;
+    uint8_t byte_class[256];
+    uint16_t* next;                 /* [state * num_classes + class] */
+    uint8_t* accept;
+} ByteDfa;
+
+typedef struct {
+    ByteDfa anchored;               /* Matches starting at the first byte it is given */
+} CompiledPattern;
+
+uint64_t fnv1a64_update(uint64_t hash, const void* data, size_t size) {
+    const uint8_t* p = (const uint8_t*)data;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= p[i];
+        hash *= FNV1A64_PRIME;
+    }
+    return hash;
+}
+
+CompiledPattern g_search_pattern = { { 0, 0, 0, { 0 }, NULL, NULL } };
+
+static int nfa_node(PatternParser* ps, int is_set) {
+    RegexNfa* nfa = ps->nfa;
+    if (nfa->count >= REGEX_MAX_NFA) {
+        if (!ps->error) ps->error = "Pattern too long.";
+        return -1;
+    }
+    memset(&nfa->nodes[nfa->count], 0, sizeof(NfaNode));
+    nfa->nodes[nfa->count].out1 = -1;
+    nfa->nodes[nfa->count].out2 = -1;
+    nfa->nodes[nfa->count].is_set = (uint8_t)is_set;
+    return nfa->count++;
+}
+
+static NfaFrag frag_set(PatternParser* ps, const uint32_t* set) {
+    NfaFrag f = { -1, -1 };
+    int a = nfa_node(ps, 1), b = nfa_node(ps, 0);
+    if (a < 0 || b < 0) return f;
+    memcpy(ps->nfa->nodes[a].set, set, sizeof(ps->nfa->nodes[a].set));
+    ps->nfa->nodes[a].out1 = (int16_t)b;
+    f.start = a; f.end = b;
+    return f;
+}
+
+static NfaFrag frag_empty(PatternParser* ps) {
+    NfaFrag f;
+    f.start = f.end = nfa_node(ps, 0);
+    return f;
+}
+
+static NfaFrag frag_concat(PatternParser* ps, NfaFrag a, NfaFrag b) {
+    NfaFrag f = { -1, -1 };
+    if (a.start < 0 || b.start < 0) return f;
+    ps->nfa->nodes[a.end].out1 = (int16_t)b.start;
+    f.start = a.start; f.end = b.end;
+    return f;
+}
+
+static NfaFrag frag_alt(PatternParser* ps, NfaFrag a, NfaFrag b) {
+    NfaFrag f = { -1, -1 };
+    int s = nfa_node(ps, 0), e = nfa_node(ps, 0);
+    if (a.start < 0 || b.start < 0 || s < 0 || e < 0) return f;
+    ps->nfa->nodes[s].out1 = (int16_t)a.start;
+    ps->nfa->nodes[s].out2 = (int16_t)b.start;
+    ps->nfa->nodes[a.end].out1 = (int16_t)e;
+    ps->nfa->nodes[b.end].out1 = (int16_t)e;
+    f.start = s; f.end = e;
+    return f;
+}
+
+/* op: '*' zero or more, '+' one or more, '?' zero or one */
+static NfaFrag frag_repeat(PatternParser* ps, NfaFrag a, char op) {
+    NfaFrag f = { -1, -1 };
+    int s = nfa_node(ps, 0), e = nfa_node(ps, 0);
+    if (a.start < 0 || s < 0 || e < 0) return f;
+    ps->nfa->nodes[s].out1 = (int16_t)a.start;
+    if (op != '+') ps->nfa->nodes[s].out2 = (int16_t)e;
+    ps->nfa->nodes[a.end].out1 = (int16_t)e;
+    if (op != '?') ps->nfa->nodes[a.end].out2 = (int16_t)a.start;
+    f.start = s; f.end = e;
+    return f;
+}
+
+static void set_add(uint32_t* set, int b) { set[b >> 5] |= 1u << (b & 31); }
+static int set_has(const uint32_t* set, int b) { return (set[b >> 5] >> (b & 31)) & 1; }
+
+/* Parses \xHH and the other escapes; returns the byte or -1 */
+static int parse_escape(PatternParser* ps) {
+    int c = (unsigned char)*ps->p;
+    if (c == '\0') { ps->error = "Pattern ends with '\\'."; return -1; }
+    ps->p++;
+    switch (c) {
+    case 'n': return '\n';
+    case 'r': return '\r';
+    case 't': return '\t';
+    case '0': return 0;
+    case 'x': {
+        int hi = ctoh((unsigned char)ps->p[0]), lo = (hi >= 0) ? ctoh((unsigned char)ps->p[1]) : -1;
+        if (hi < 0 || lo < 0) { ps->error = "\\x needs two hex digits."; return -1; }
+        ps->p += 2;
+        return (hi << 4) | lo;
+    }
+    default: return c;
+    }
+}
+
+static NfaFrag parse_regex_alt(PatternParser* ps);
+
+static NfaFrag parse_regex_atom(PatternParser* ps) {
+    uint32_t set[8];
+    NfaFrag bad = { -1, -1 };
+    int c = (unsigned char)*ps->p++;
+    memset(set, 0, sizeof(set));
+
+    if (c == '(') {
+        NfaFrag f = parse_regex_alt(ps);
+        if (*ps->p != ')') { if (!ps->error) ps->error = "Missing ')'."; return bad; }
+        ps->p++;
+        return f;
+    }
+    if (c == '.') {
+        memset(set, 0xFF, sizeof(set));
+        return frag_set(ps, set);
+    }
+    if (c == '[') {
+        int negate = (*ps->p == '^');
+        if (negate) ps->p++;
+        do {
+            int lo, hi;
+            if (*ps->p == '\0') { ps->error = "Missing ']'."; return bad; }
+            lo = (unsigned char)*ps->p++;
+            if (lo == '\\' && (lo = parse_escape(ps)) < 0) return bad;
+            hi = lo;
+            if (ps->p[0] == '-' && ps->p[1] != ']' && ps->p[1] != '\0') {
+                ps->p++;
+                hi = (unsigned char)*ps->p++;
+                if (hi == '\\' && (hi = parse_escape(ps)) < 0) return bad;
+                if (hi < lo) { ps->error = "Bad range in [ ]."; return bad; }
             }
-            else {
-                beep(); /* Should not happen if track is loaded */
+            for (int b = lo; b <= hi; ++b) set_add(set, b);
+        } while (*ps->p != ']');
+        ps->p++;
+        if (negate) for (int w = 0; w < 8; ++w) set[w] = ~set[w];
+        return frag_set(ps, set);
+    }
+    if (c == '\\') {
+        if ((c = parse_escape(ps)) < 0) return bad;
+    }
+    else if (c == '*' || c == '+' || c == '?') {
+        ps->error = "Nothing to repeat.";
+        return bad;
+    }
+    set_add(set, c);
+    return frag_set(ps, set);
+}
+
+static NfaFrag parse_regex_concat(PatternParser* ps) {
+    NfaFrag f = frag_empty(ps);
+    while (*ps->p && *ps->p != '|' && *ps->p != ')' && !ps->error) {
+        NfaFrag atom = parse_regex_atom(ps);
+        while (*ps->p == '*' || *ps->p == '+' || *ps->p == '?') atom = frag_repeat(ps, atom, *ps->p++);
+        f = frag_concat(ps, f, atom);
+    }
+    return f;
+}
+
+static NfaFrag parse_regex_alt(PatternParser* ps) {
+    NfaFrag f = parse_regex_concat(ps);
+    while (*ps->p == '|' && !ps->error) {
+        ps->p++;
+        f = frag_alt(ps, f, parse_regex_concat(ps));
+    }
+    return f;
+}
+
+static NfaFrag parse_hex_wildcard(PatternParser* ps) {
+    NfaFrag f = frag_empty(ps), bad = { -1, -1 };
+    while (*ps->p && !ps->error) {
+        uint32_t set[8];
+        char c = *ps->p;
+        memset(set, 0, sizeof(set));
+        if (c == ' ') { ps->p++; continue; }
+        if (c == '*') {
+            memset(set, 0xFF, sizeof(set));
+            f = frag_concat(ps, f, frag_repeat(ps, frag_set(ps, set), '*'));
+            ps->p++;
+            continue;
+        }
+        /* Byte with either nibble possibly '?' */
+        int hi = (c == '?') ? -2 : ctoh((unsigned char)c);
+        int lo = (ps->p[1] == '?') ? -2 : ctoh((unsigned char)ps->p[1]);
+        if (hi == -1 || lo == -1 || ps->p[1] == '\0') {
+            ps->error = "Wildcard hex: use byte pairs (4C, 4?, ?\?) and '*'.";
+            return bad;
+        }
+        for (int b = 0; b < 256; ++b) {
+            if ((hi < 0 || (b >> 4) == hi) && (lo < 0 || (b & 0x0F) == lo)) set_add(set, b);
+        }
+        f = frag_concat(ps, f, frag_set(ps, set));
+        ps->p += 2;
+    }
+    return f;
+}
+
+/* Builds the NFA; returns NULL on success or an error message */
+static const char* build_pattern_nfa(RegexNfa* nfa, const char* pattern, int is_hex_pattern) {
+    PatternParser ps;
+    NfaFrag f;
+    memset(&ps, 0, sizeof(ps));
+    ps.p = pattern;
+    ps.nfa = nfa;
+    nfa->count = 0;
+    f = is_hex_pattern ? parse_hex_wildcard(&ps) : parse_regex_alt(&ps);
+    if (!ps.error && *ps.p == ')') ps.error = "Unbalanced ')'.";
+    if (!ps.error && f.start < 0) ps.error = "Pattern too long.";
+    if (ps.error) return ps.error;
+    nfa->start = f.start;
+    nfa->accept = f.end;
+    return NULL;
+}
+
+/* Adds the epsilon closure of the nodes already in 'set' */
+static void nfa_closure(const RegexNfa* nfa, uint64_t* set) {
+    int stack[REGEX_MAX_NFA];
+    int top = 0;
+    for (int n = 0; n < nfa->count; ++n) {
+        if ((set[n >> 6] >> (n & 63)) & 1) stack[top++] = n;
+    }
+    while (top > 0) {
+        const NfaNode* node = &nfa->nodes[stack[--top]];
+        int outs[2];
+        if (node->is_set) continue;
+        outs[0] = node->out1; outs[1] = node->out2;
+        for (int k = 0; k < 2; ++k) {
+            int o = outs[k];
+            if (o < 0 || ((set[o >> 6] >> (o & 63)) & 1)) continue;
+            set[o >> 6] |= 1ULL << (o & 63);
+            stack[top++] = o;
+        }
+    }
+}
+
+void free_byte_dfa(ByteDfa* dfa) {
+    free(dfa->next);
+    free(dfa->accept);
+    memset(dfa, 0, sizeof(*dfa));
+}
+
+/*
+ * Subset construction of the anchored DFA.
+ * Returns NULL on success or an error message.
+ */
+static const char* build_byte_dfa(const RegexNfa* nfa, ByteDfa* dfa) {
+    uint64_t (*sets)[REGEX_SET_WORDS] = NULL;
+    int* hash = NULL;
+    uint8_t class_rep[256];
+    uint64_t start_set[REGEX_SET_WORDS];
+    const char* error = NULL;
+
+    free_byte_dfa(dfa);
+
+    /* Bytes no set node tells apart share a class */
+    dfa->num_classes = 0;
+    for (int b = 0; b < 256; ++b) {
+        int c;
+        for (c = 0; c < dfa->num_classes; ++c) {
+            int same = 1;
+            for (int n = 0; n < nfa->count && same; ++n) {
+                const NfaNode* node = &nfa->nodes[n];
+                if (node->is_set && set_has(node->set, b) != set_has(node->set, class_rep[c])) same = 0;
             }
+            if (same) break;
         }
-        else if (ch == KEY_END) {
-            /* Corrected: Go to last sector of current track, top of data */
-            if (current_track_display.loaded && current_track_display.num_sectors > 0) {
-                target_logical_sector_idx = current_track_display.num_sectors - 1;
-                target_data_offset = 0;
+        if (c == dfa->num_classes) class_rep[dfa->num_classes++] = (uint8_t)b;
+        dfa->byte_class[b] = (uint8_t)c;
+    }
+
+    sets = (uint64_t (*)[REGEX_SET_WORDS])malloc(sizeof(*sets) * REGEX_MAX_DFA);
+    hash = (int*)malloc(sizeof(int) * REGEX_DFA_HASH);
+    dfa->next = (uint16_t*)calloc((size_t)REGEX_MAX_DFA * dfa->num_classes, sizeof(uint16_t));
+    dfa->accept = (uint8_t*)calloc(REGEX_MAX_DFA, 1);
+    if (!sets || !hash || !dfa->next || !dfa->accept) { error = "Out of memory compiling pattern."; goto cleanup; }
+    for (int i = 0; i < REGEX_DFA_HASH; ++i) hash[i] = -1;
+
+    memset(start_set, 0, sizeof(start_set));
+    start_set[nfa->start >> 6] |= 1ULL << (nfa->start & 63);
+    nfa_closure(nfa, start_set);
+
+    memset(sets[0], 0, sizeof(sets[0])); /* Dead state */
+    memcpy(sets[1], start_set, sizeof(start_set));
+    dfa->num_states = 2;
+    dfa->start = 1;
+    for (int s = 0; s < 2; ++s) {
+        uint64_t h = fnv1a64_update(FNV1A64_OFFSET_BASIS, sets[s], sizeof(sets[s]));
+        int slot = (int)(h % REGEX_DFA_HASH);
+        while (hash[slot] >= 0) slot = (slot + 1) % REGEX_DFA_HASH;
+        hash[slot] = s;
+    }
+
+    for (int s = 1; s < dfa->num_states; ++s) {
+        dfa->accept[s] = (uint8_t)((sets[s][nfa->accept >> 6] >> (nfa->accept & 63)) & 1);
+        for (int c = 0; c < dfa->num_classes; ++c) {
+            uint64_t next_set[REGEX_SET_WORDS];
+            int id;
+            memset(next_set, 0, sizeof(next_set));
+            for (int n = 0; n < nfa->count; ++n) {
+                const NfaNode* node = &nfa->nodes[n];
+                if (!((sets[s][n >> 6] >> (n & 63)) & 1) || !node->is_set || !set_has(node->set, class_rep[c])) continue;
+                next_set[node->out1 >> 6] |= 1ULL << (node->out1 & 63);
             }
-            else {
-                beep(); /* No sectors or track not loaded */
+            nfa_closure(nfa, next_set);
+
+            uint64_t h = fnv1a64_update(FNV1A64_OFFSET_BASIS, next_set, sizeof(next_set));
+            int slot = (int)(h % REGEX_DFA_HASH);
+            for (id = -1; hash[slot] >= 0; slot = (slot + 1) % REGEX_DFA_HASH) {
+                if (memcmp(sets[hash[slot]], next_set, sizeof(next_set)) == 0) { id = hash[slot]; break; }
             }
-        }
-        else if (IS_KEY_CTRL_HOME(ch)) { /* Handles KEY_SHOME and CTL_HOME (if PDCURSES) */
-            target_track_idx = 0; target_logical_sector_idx = 0; target_data_offset = 0;
-        }
-        else if (IS_KEY_CTRL_END(ch)) { /* Handles KEY_SEND and CTL_END (if PDCURSES) */
-            if (total_tracks_in_image > 0) {
-                target_track_idx = total_tracks_in_image - 1;
-                target_logical_sector_idx = 0; target_data_offset = 0;
+            if (id < 0) {
+                if (dfa->num_states >= REGEX_MAX_DFA) { error = "Pattern too complex."; goto cleanup; }
+                id = dfa->num_states++;
+                memcpy(sets[id], next_set, sizeof(next_set));
+                hash[slot] = id;
             }
-            else { beep(); }
+            dfa->next[s * dfa->num_classes + c] = (uint16_t)id;
         }
-        break; /* End of grouped navigation key handling */
+    }
 
-    case 'q': case 'Q': case KEY_F(10):
-        cleanup_ui();
-        if (g_imdf_handle) imdf_close(g_imdf_handle);
-        exit(EXIT_SUCCESS);
-        break;
-    case ESC_KEY:
-        update_status("Press F10 or Q to quit.");
-        doupdate();
-        timeout(1000);
-        wgetch(win_data);
-        timeout(100);
-        build_status_message();
-        update_status(status_message);
-        break;
-    case KEY_F(1):
-        clear_search_highlight();
-        display_help_window();
-        return;
-    case KEY_F(2):
-        current_charset = (current_charset == CHARSET_ASCII) ? CHARSET_EBCDIC : CHARSET_ASCII;
-        redraw_info = 1; redraw_data = 1;
-        clear_search_highlight();
-        break;
-    case KEY_F(3):
-    {
-        char search_input_buf[MAX_SEARCH_TERM];
-        clear_search_highlight();
-        if (get_search_input("Text?", search_input_buf, sizeof(search_input_buf), 0)) {
-            strncpy(last_search_term_text, search_input_buf, MAX_SEARCH_TERM - 1);
-            last_search_term_text[MAX_SEARCH_TERM - 1] = '\0';
-            last_search_type = SEARCH_TYPE_TEXT;
-            search_text_from_current(last_search_term_text, 0);
+cleanup:
+    free(hash);
+    free(sets);
+    if (error) free_byte_dfa(dfa);
+    return error;
+}
+
+/* Compiles a wildcard hex pattern or regex. Returns NULL on success or an error message. */
+const char* compile_search_pattern(CompiledPattern* cp, const char* pattern, int is_hex_pattern) {
+    static RegexNfa nfa;
+    const char* error;
+
+    if ((error = build_pattern_nfa(&nfa, pattern, is_hex_pattern)) != NULL) return error;
+    if ((error = build_byte_dfa(&nfa, &cp->anchored)) != NULL) return error;
+    if (cp->anchored.accept[cp->anchored.start]) {
+        free_byte_dfa(&cp->anchored);
+        return "Pattern matches empty data.";
+    }
+    return NULL;
+}
+
+/* --- Logical Sector Stream and Pattern Search --- */
+
+/*
+ * Iterates the image's sector data in logical order: tracks in image order,
+ * sectors in ID order, each translated through xlat (XOR mask and, for text
+ * searches, EBCDIC). 'gap' is set when sectors were skipped (no data or
+ * track not loaded) before the one returned, i.e. the bytes are not contiguous.
+ * A find-all worker points 'handle' at its own image handle and 'edits' at a
+ * snapshot of the unsaved edits; otherwise reads go through g_imdf_handle.
+ */
+typedef struct {
+    ImdImageFile* handle;
+    SectorOrderCache* order;        /* Sector ID order of 'handle''s tracks */
+    const DirtySector* edits;       /* Unsaved edits overlaid when handle is not g_imdf_handle */
+    size_t edit_count;
+    size_t track_idx;
+    uint32_t sector_log_idx;        /* Of the sector in 'data' */
+    int size;                       /* Bytes in 'data' */
+    int started;
+    int gap;
+    int data_only;                  /* Skip sectors without data instead of reading their fill bytes */
+    uint8_t xlat[256];
+    uint8_t data[LIBIMD_MAX_SECTOR_SIZE];
+} LogicalStream;
+
+/* Where a byte of the search window came from */
+typedef struct {
+    size_t track_idx;
+    uint32_t sector_log_idx;
+    long offset;
+} StreamPosition;
+
+/* Boyer-Moore-Horspool pattern with its bad-character shift table */
+typedef struct {
+    int len;
+    uint8_t bytes[MAX_SEARCH_TERM];
+    int shift[256];
+} HorspoolPattern;
+
+/* A wildcard/regex match attempt: the anchored DFA run from one start byte */
+typedef struct {
+    uint16_t state;                 /* DFA state after the last scanned byte */
+    uint64_t start_serial;          /* Stream byte number of its first byte */
+    StreamPosition start;
+} DfaAttempt;
+
+/*
+ * Resumable search state. The window holds the last (len - 1) bytes of the
+ * previous sectors followed by the current sector, so matches spanning
+ * sector (and track) boundaries are found by the same scan. A DFA pattern
+ * carries its live match attempts across sectors instead; each one knows
+ * where it started.
+ */
+typedef struct {
+    LogicalStream stream;
+    HorspoolPattern pattern;
+    size_t start_track_idx;
+    uint32_t start_sector_log_idx;
+    long first_sector_start;        /* Matches in the starting sector start here or later */
+    int first_sector;
+    const CompiledPattern* dfa;     /* Wildcard/regex pattern, NULL for a literal */
+    int carry;                      /* Bytes carried over at the start of 'window' */
+    long window_len;                /* Bytes in 'window' while a match is pending */
+    long resume_at;                 /* Window offset to continue at after a match, -1 for the next sector */
+    long match_at;                  /* Window offset of the last match */
+    long match_len;
+    int match_outside_window;       /* The last match is read back from match_start_pos, not the window */
+    StreamPosition match_start_pos;
+    StreamPosition match_end_pos;   /* Just past the last wildcard/regex match */
+    int reseek;                     /* Continue at match_end_pos; attempts may have read beyond it */
+    /* Wildcard/regex attempts, earliest start first; at most one per DFA state */
+    int attempt_count;
+    uint64_t serial;                /* Stream bytes scanned */
+    int best_valid;                 /* An attempt accepted: the match to report once no earlier or longer one can */
+    uint64_t best_start_serial;
+    uint64_t best_end_serial;
+    StreamPosition best_start;
+    StreamPosition best_end;
+    uint32_t stamp_gen;             /* Marks the states already reached by the current byte */
+    uint32_t state_stamp[REGEX_MAX_DFA];
+    DfaAttempt attempts[REGEX_MAX_DFA];
+    StreamPosition carry_pos[SEARCH_MAX_CARRY];
+    uint8_t window[SEARCH_MAX_CARRY + LIBIMD_MAX_SECTOR_SIZE];
+} PatternSearch;
+
+void logical_stream_begin(LogicalStream* s, size_t track_idx, uint32_t sector_log_idx, int is_text_search) {
+    s->handle = g_imdf_handle;
+    s->order = &g_search_order;
+    s->edits = NULL;
+    s->edit_count = 0;
+    s->track_idx = track_idx;
+    s->sector_log_idx = sector_log_idx;
+    s->size = 0;
+    s->started = 0;
+    s->gap = 0;
+    s->data_only = 0;
+    for (int v = 0; v < 256; ++v) {
+        uint8_t b = (uint8_t)(v ^ xor_mask);
+        s->xlat[v] = (is_text_search && current_charset == CHARSET_EBCDIC) ? ebcdic_to_ascii[b] : b;
+    }
+}
+
+/* Reads the stream's sector through a worker's own handle, with its snapshot of the unsaved edits applied */
+static int logical_stream_read_own(LogicalStream* s, const ImdTrackInfo* track) {
+    uint8_t sector_id = track->smap[get_sector_order(s->order, s->track_idx, track, 0)[s->sector_log_idx]];
+    uint32_t size = track->sector_size < LIBIMD_MAX_SECTOR_SIZE ? track->sector_size : LIBIMD_MAX_SECTOR_SIZE;
+    int res;
+
+    if (size == 0) return 0;
+    res = imdf_read_sector(s->handle, track->cyl, track->head, sector_id, s->data, size);
+    if (res == IMDF_ERR_UNAVAILABLE) {
+        memset(s->data, LIBIMD_FILL_BYTE_DEFAULT, size);
+        return (int)size;
+    }
+    if (res != IMDF_ERR_OK) return 0;
+    dirty_sector_overlay_from(s->edits, s->edit_count, track->cyl, track->head, sector_id, s->data, size);
+    return (int)size;
+}
+
+/* Advances to the next sector with data. Returns 1 if one was loaded, 0 at the end of the image. */
+int logical_stream_next(LogicalStream* s) {
+    s->gap = 0;
+    if (s->started) s->sector_log_idx++;
+    s->started = 1;
+    while (s->track_idx < total_tracks_in_image) {
+        const ImdTrackInfo* track = imdf_get_track_info(s->handle, s->track_idx);
+        if (!track || !track->loaded || s->sector_log_idx >= track->num_sectors) {
+            if (!track || !track->loaded) s->gap = 1;
+            s->track_idx++;
+            s->sector_log_idx = 0;
+            continue;
+        }
+        if (s->data_only &&
+            !IMD_SDR_HAS_DATA(track->sflag[get_sector_order(s->order, s->track_idx, track, 0)[s->sector_log_idx]])) {
+            s->sector_log_idx++;
+            continue;
+        }
+        if (s->handle == g_imdf_handle) {
+            s->size = load_specific_sector_data(s->track_idx, s->sector_log_idx, s->data, LIBIMD_MAX_SECTOR_SIZE, NULL);
         }
         else {
-            build_status_message();
-            update_status(status_message);
-            draw_info_window();
-            draw_data_window();
-            doupdate();
+            s->size = logical_stream_read_own(s, track);
         }
+        if (s->size == 0) {
+            s->gap = 1;
+            s->sector_log_idx++;
+            continue;
+        }
+        for (int i = 0; i < s->size; ++i) s->data[i] = s->xlat[s->data[i]];
+        return 1;
     }
-    return;
-    case KEY_F(4):
-    {
-        char search_input_buf[MAX_SEARCH_TERM];
-        clear_search_highlight();
-        if (get_search_input("Hex Bytes?", search_input_buf, sizeof(search_input_buf), 1)) {
-            last_search_term_hex_len = 0;
-            if (strlen(search_input_buf) > 0) {
-                for (size_t i = 0; (i + 1) < strlen(search_input_buf); i += 2) {
-                    if (last_search_term_hex_len < (MAX_SEARCH_TERM / 2)) {
-                        int hi = ctoh(search_input_buf[i]);
-                        int lo = ctoh(search_input_buf[i + 1]);
-                        if (hi != -1 && lo != -1) {
-                            last_search_term_hex[last_search_term_hex_len++] = (uint8_t)((hi << 4) | lo);
-                        }
-                        else {
-                            display_error("Invalid hex character in input.");
-                            last_search_term_hex_len = 0;
-                            break;
-                        }
-                    }
-                    else {
-                        display_error("Hex search term too long.");
-                        last_search_term_hex_len = 0;
-                        break;
-                    }
-                }
+    return 0;
+}
+
+void horspool_init(HorspoolPattern* p, const uint8_t* bytes, int len) {
+    p->len = len;
+    memcpy(p->bytes, bytes, (size_t)len);
+    for (int c = 0; c < 256; ++c) p->shift[c] = len;
+    for (int i = 0; i < len - 1; ++i) p->shift[bytes[i]] = len - 1 - i;
+}
+
+/* Returns the offset of the first match at or after 'start', or -1 */
+long horspool_find(const HorspoolPattern* p, const uint8_t* text, long text_len, long start) {
+    const uint8_t last = p->bytes[p->len - 1];
+    for (long i = start; i + p->len <= text_len; i += p->shift[text[i + p->len - 1]]) {
+        if (text[i + p->len - 1] == last && memcmp(text + i, p->bytes, (size_t)p->len - 1) == 0) return i;
+    }
+    return -1;
+}
+
+/* cp: compiled wildcard/regex pattern, or NULL to search for the literal term */
+void pattern_search_begin(PatternSearch* search, const uint8_t* term, int term_len, const CompiledPattern* cp,
+    int is_text_search, size_t track_idx, uint32_t sector_log_idx, long start_offset) {
+    logical_stream_begin(&search->stream, track_idx, sector_log_idx, is_text_search);
+    search->dfa = cp;
+    if (!cp) horspool_init(&search->pattern, term, term_len);
+    search->attempt_count = 0;
+    search->serial = 0;
+    search->best_valid = 0;
+    search->reseek = 0;
+    search->stamp_gen = 0;
+    memset(search->state_stamp, 0, sizeof(search->state_stamp));
+    search->start_track_idx = track_idx;
+    search->start_sector_log_idx = sector_log_idx;
+    search->first_sector_start = start_offset < 0 ? 0 : start_offset;
+    search->first_sector = 1;
+    search->carry = 0;
+    search->resume_at = -1;
+    search->window_len = 0;
+    search->match_at = 0;
+    search->match_len = 0;
+    search->match_outside_window = 0;
+}
+
+/* Stream position of a byte of the search window */
+static StreamPosition pattern_search_position(const PatternSearch* search, long w) {
+    StreamPosition pos;
+    if (w < search->carry) return search->carry_pos[w];
+    pos.track_idx = search->stream.track_idx;
+    pos.sector_log_idx = search->stream.sector_log_idx;
+    pos.offset = w - search->carry;
+    return pos;
+}
+
+/*
+ * Steps back to the sector logical_stream_next visits before (*track_idx,
+ * *sector_log_idx). Returns 0 at the start of the image or at a gap.
+ */
+static int logical_stream_prev(LogicalStream* s, size_t* track_idx, uint32_t* sector_log_idx) {
+    size_t t = *track_idx;
+    long i = (long)*sector_log_idx;
+    for (;;) {
+        const ImdTrackInfo* track = imdf_get_track_info(s->handle, t);
+        if (--i < 0) {
+            if (t == 0) return 0;
+            track = imdf_get_track_info(s->handle, --t);
+            if (!track || !track->loaded) return 0;
+            i = track->num_sectors;
+            continue;
+        }
+        if (!track) return 0;
+        if (s->data_only && !IMD_SDR_HAS_DATA(track->sflag[get_sector_order(s->order, t, track, 0)[i]])) continue;
+        *track_idx = t;
+        *sector_log_idx = (uint32_t)i;
+        return 1;
+    }
+}
+
+/* Loads the stream's sector at pos into reader (a copy of the stream). Returns 1 if that exact sector was read. */
+static int logical_stream_read_at(LogicalStream* reader, const LogicalStream* s, const StreamPosition* pos) {
+    *reader = *s;
+    reader->track_idx = pos->track_idx;
+    reader->sector_log_idx = pos->sector_log_idx;
+    reader->started = 0;
+    return logical_stream_next(reader) && reader->track_idx == pos->track_idx && reader->sector_log_idx == pos->sector_log_idx;
+}
+
+/*
+ * Runs the match attempts over window[start, window_len). Until one accepts, a
+ * new attempt starts at every byte; attempts reaching the same DFA state merge
+ * into the one that started first, as they match the same bytes from there on.
+ * An accepting attempt becomes the pending match, and attempts starting after
+ * it are dropped. The match is final once every attempt that could still
+ * start earlier or run longer has died.
+ * Returns 1 when it is (search->best_*), 0 after consuming the window.
+ */
+static int dfa_scan(PatternSearch* search, long window_len, long start) {
+    const ByteDfa* dfa = &search->dfa->anchored;
+
+    for (long i = start; i < window_len; ++i) {
+        int byte_class = dfa->byte_class[search->window[i]];
+        int kept = 0;
+
+        if (!search->best_valid) {
+            DfaAttempt* attempt = &search->attempts[search->attempt_count++];
+            attempt->state = (uint16_t)dfa->start;
+            attempt->start_serial = search->serial;
+            attempt->start = pattern_search_position(search, i);
+        }
+        if (++search->stamp_gen == 0) {
+            memset(search->state_stamp, 0, sizeof(search->state_stamp));
+            search->stamp_gen = 1;
+        }
+        for (int k = 0; k < search->attempt_count; ++k) {
+            DfaAttempt attempt = search->attempts[k];
+            int next = dfa->next[attempt.state * dfa->num_classes + byte_class];
+            if (next == 0 || search->state_stamp[next] == search->stamp_gen) continue;
+            search->state_stamp[next] = search->stamp_gen;
+            attempt.state = (uint16_t)next;
+            search->attempts[kept++] = attempt;
+        }
+        search->attempt_count = kept;
+        search->serial++;
+
+        for (int k = 0; k < kept; ++k) {
+            const DfaAttempt* attempt = &search->attempts[k];
+            if (!dfa->accept[attempt->state]) continue;
+            search->best_valid = 1;
+            search->best_start_serial = attempt->start_serial;
+            search->best_end_serial = search->serial;
+            search->best_start = attempt->start;
+            search->best_end = pattern_search_position(search, i);
+            search->best_end.offset++;
+            while (search->attempt_count > k + 1 &&
+                search->attempts[search->attempt_count - 1].start_serial > attempt->start_serial) {
+                search->attempt_count--;
             }
+            break;
+        }
+        if (search->best_valid && search->attempt_count == 0) return 1;
+    }
+    return 0;
+}
 
-            if (last_search_term_hex_len > 0) {
-                last_search_type = SEARCH_TYPE_HEX;
-                search_hex_from_current(last_search_term_hex, last_search_term_hex_len, 0);
-            }
-            else if (strlen(search_input_buf) > 0) {
-                int error_shown = (strstr(status_message, "Invalid hex") != NULL ||
-                    strstr(status_message, "Hex search term too long") != NULL ||
-                    strstr(status_message, "even number of digits") != NULL);
-                if (!error_shown) display_error("No valid hex bytes entered for search.");
+/* Reports the pending wildcard/regex match; the next step continues just past it */
+static void dfa_take_match(PatternSearch* search, StreamPosition* found) {
+    *found = search->best_start;
+    search->match_start_pos = search->best_start;
+    search->match_end_pos = search->best_end;
+    search->match_len = (long)(search->best_end_serial - search->best_start_serial);
+    search->match_outside_window = 1;
+    search->best_valid = 0;
+    search->attempt_count = 0;
+    search->reseek = 1;
+}
+
+/*
+ * Scans up to max_sectors further sectors (<= 0: no limit). After a match the
+ * next call continues just past it, so repeated calls find every occurrence.
+ * Returns 1 if found (*found filled in), 0 if the end of the image was reached, -1 if the budget ran out first.
+ */
+int pattern_search_step(PatternSearch* search, int max_sectors, StreamPosition* found) {
+    LogicalStream* s = &search->stream;
+    int keep_max = search->dfa ? 0 : search->pattern.len - 1;
+
+    for (int scanned = 0; max_sectors <= 0 || scanned < max_sectors; ++scanned) {
+        long start = 0;
+        long window_len;
+
+        if (search->reseek) {
+            /* Deciding the last wildcard/regex match may have read past its end: go back there */
+            const StreamPosition* end = &search->match_end_pos;
+            search->reseek = 0;
+            if (s->started && s->track_idx == end->track_idx && s->sector_log_idx == end->sector_log_idx) {
+                search->resume_at = end->offset;
             }
             else {
-                build_status_message();
-                update_status(status_message);
-                draw_info_window();
-                draw_data_window();
-                doupdate();
+                s->track_idx = end->track_idx;
+                s->sector_log_idx = end->sector_log_idx;
+                s->started = 0;
+                search->start_track_idx = end->track_idx;
+                search->start_sector_log_idx = end->sector_log_idx;
+                search->first_sector_start = end->offset;
+                search->first_sector = 1;
             }
         }
-        else {
-            build_status_message();
-            update_status(status_message);
-            draw_info_window();
-            draw_data_window();
-            doupdate();
-        }
-    }
-    return;
-    case KEY_F(5):
-        repeat_last_search();
-        return;
 
-    case '\n':
-    case KEY_ENTER:
-        clear_search_highlight();
-        if (write_enabled) {
-            if (current_track_display.loaded && current_track_display.num_sectors > 0 && current_track_display.sector_size > 0) {
-                uint8_t sflag_check = 0;
-                if (current_sector_physical_idx < LIBIMD_MAX_SECTORS_PER_TRACK) {
-                    sflag_check = current_track_display.sflag[current_sector_physical_idx];
-                }
-                else {
-                    display_error("Sector index out of bounds for sflag check.");
-                    return;
-                }
-                if (!IMD_SDR_HAS_DATA(sflag_check)) {
-                    display_error("Sector unavailable (no data), cannot edit.");
-                }
-                else {
-                    edit_sector();
+        if (search->resume_at >= 0) {
+            /* Rest of the window after the previous match */
+            start = search->resume_at;
+            window_len = search->window_len;
+            search->resume_at = -1;
+        }
+        else {
+            if (!logical_stream_next(s)) {
+                if (search->dfa && search->best_valid) {
+                    dfa_take_match(search, found);
+                    return 1;
                 }
+                return 0;
             }
-            else {
-                if (current_track_display.loaded && current_track_display.num_sectors > 0 && current_track_display.sector_size == 0) {
-                    display_error("Cannot edit 0-byte sector.");
+
+            int new_run = search->first_sector || s->gap;
+            if (search->first_sector) {
+                /* Only the sector the search started in honors the start offset */
+                if (s->track_idx == search->start_track_idx && s->sector_log_idx == search->start_sector_log_idx) {
+                    start = search->first_sector_start;
                 }
-                else {
-                    display_error("No sector loaded to edit.");
+                search->first_sector = 0;
+                search->carry = 0;
+            }
+            else if (s->gap) {
+                search->carry = 0;
+            }
+            if (search->dfa && new_run) {
+                /* Attempts do not run across a gap */
+                if (search->best_valid) {
+                    dfa_take_match(search, found);
+                    return 1;
                 }
+                search->attempt_count = 0;
+            }
+
+            memcpy(search->window + search->carry, s->data, (size_t)s->size);
+            window_len = search->carry + s->size;
+            if (start > s->size) start = s->size;
+        }
+
+        if (search->dfa) {
+            if (dfa_scan(search, window_len, start)) {
+                search->window_len = window_len;
+                dfa_take_match(search, found);
+                return 1;
             }
         }
         else {
-            display_error("Write mode not enabled (-W).");
+            long pos = horspool_find(&search->pattern, search->window, window_len, start);
+            if (pos >= 0) {
+                *found = pattern_search_position(search, pos);
+                search->match_at = pos;
+                search->match_len = search->pattern.len;
+                search->match_outside_window = 0;
+                search->window_len = window_len;
+                search->resume_at = pos + 1;
+                return 1;
+            }
         }
-        return;
-    case 'i': case 'I':
-        clear_search_highlight();
-        ignore_interleave = !ignore_interleave;
-        build_status_message();
-        update_status(status_message);
-        needs_sector_load = 1;
-        redraw_info = 1;
-        redraw_data = 1;
-        break;
-    default:
-        break;
+
+        /* Carry the tail that could still begin a literal match spanning into the next sector */
+        long keep = window_len - start;
+        if (keep > keep_max) keep = keep_max;
+        StreamPosition tail_pos[SEARCH_MAX_CARRY];
+        for (long i = 0; i < keep; ++i) tail_pos[i] = pattern_search_position(search, window_len - keep + i);
+        memmove(search->window, search->window + window_len - keep, (size_t)keep);
+        memcpy(search->carry_pos, tail_pos, (size_t)keep * sizeof(StreamPosition));
+        search->carry = (int)keep;
     }
+    return -1;
+}
 
-    /* Apply navigation changes */
-    if (target_track_idx != current_track_index_in_image) {
-        current_track_index_in_image = target_track_idx;
-        load_track_for_display(current_track_index_in_image);
+/* Copies up to max bytes from the start of the last match, as the search saw them. Returns the count. */
+int pattern_search_match_context(const PatternSearch* search, uint8_t* out, int max) {
+    LogicalStream reader_copy;
+    LogicalStream* reader = &reader_copy;
+    StreamPosition pos = search->match_start_pos;
+    int n = 0;
+
+    if (!search->match_outside_window) {
+        long avail = search->window_len - search->match_at;
+        n = (int)(avail < max ? avail : max);
+        memcpy(out, search->window + search->match_at, (size_t)n);
+        return n;
+    }
+    /* Wildcard/regex match, or one starting in a sector no longer in the window: read it again */
+    if (!logical_stream_read_at(reader, &search->stream, &pos)) return 0;
+    do {
+        long take = reader->size - pos.offset;
+        if (n > 0 && reader->gap) break;
+        if (take > max - n) take = max - n;
+        memcpy(out + n, reader->data + pos.offset, (size_t)take);
+        n += (int)take;
+        pos.offset = 0;
+    } while (n < max && logical_stream_next(reader));
+    return n;
+}
 
-        if (target_logical_sector_idx == 0xFFFF && current_track_display.num_sectors > 0) {
-            current_sector_logical_idx = current_track_display.num_sectors - 1;
+/*
+ * Earliest start of a match the search may still report without reading a
+ * further start byte: a live wildcard/regex attempt, or carried literal bytes.
+ * Returns 0 if there is none.
+ */
+int pattern_search_pending_start(const PatternSearch* search, StreamPosition* pos) {
+    if (search->dfa) {
+        if (search->attempt_count > 0) *pos = search->attempts[0].start;
+        else if (search->best_valid) *pos = search->best_start;
+        else return 0;
+        return 1;
+    }
+    if (search->carry == 0) return 0;
+    *pos = search->carry_pos[0];
+    return 1;
+}
+
+/*
+ * Offset in the current sector a search starts at: the byte after the last
+ * match in this sector, or after the top of the view when repeating without one.
+ */
+long search_start_offset(int start_from_next_byte) {
+    long offset = 0;
+    if (!start_from_next_byte) return 0;
+    if (g_found_len > 0) {
+        if (g_found_on_track_idx == current_track_index_in_image &&
+            g_found_on_sector_log_idx == current_sector_logical_idx) {
+            offset = g_found_offset_in_sector + 1;
         }
-        else if (target_logical_sector_idx == 0xFFFF) {
-            current_sector_logical_idx = 0;
+    }
+    else {
+        offset = current_data_offset_in_sector + 1;
+        if (current_track_display.loaded && current_track_display.sector_size > 0 &&
+            offset >= (long)current_track_display.sector_size) {
+            offset = current_track_display.sector_size; /* Nothing left in this sector */
         }
-        else {
-            current_sector_logical_idx = target_logical_sector_idx;
+    }
+    return offset;
+}
+
+/* A match collected by find all, with the bytes that start there */
+typedef struct {
+    StreamPosition pos;
+    StreamPosition end;             /* Just past a wildcard/regex match; offset -1 for a literal */
+    int match_len;
+    uint8_t cyl;
+    uint8_t head;
+    uint8_t sector_id;
+    int context_len;
+    uint8_t context[FIND_ALL_CONTEXT];
+} FindAllResult;
+
+FindAllResult* g_find_all_results = NULL;
+size_t g_find_all_count = 0;
+size_t g_find_all_capacity = 0;
+int g_search_find_all = 0;
+
+int find_all_add_result(const StreamPosition* found, const StreamPosition* end, int match_len,
+    const uint8_t* context, int context_len);
+void display_find_all_panel(void);
+void show_search_match(const StreamPosition* found, const StreamPosition* end, int term_len);
+void show_search_not_found(void);
+
+/* --- Search Index Sidecar --- */
+
+/*
+ * Optional trigram index of the raw sector data, kept next to the image as
+ * <image>.imdx. Offsets are positions in the logical stream (all sectors with
+ * data, concatenated in the order LogicalStream visits them). Each trigram
+ * hashes to one of SEARCH_INDEX_BUCKETS posting lists of sorted offsets, so a
+ * lookup yields candidates that are verified against the image data.
+ * The file is tied to the image by a hash of its contents.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t bucket_count;
+    uint64_t image_hash;            /* FNV-1a of the whole image file */
+    uint64_t image_size;
+    uint64_t data_size;             /* Bytes in the logical stream */
+    uint64_t posting_count;
+    uint32_t sector_count;
+    uint32_t reserved;
+} SearchIndexHeader;
+
+/* One sector of the logical stream */
+typedef struct {
+    uint32_t track_idx;
+    uint16_t sector_log_idx;
+    uint8_t contiguous;             /* Follows the previous sector with no gap in between */
+    uint8_t reserved;
+    uint32_t offset;                /* Logical offset of its first byte */
+    uint32_t size;
+} SearchIndexSector;
+
+typedef struct {
+    void* map;                      /* Mapped sidecar (read-only) */
+    size_t map_size;
+    const SearchIndexHeader* header;
+    const SearchIndexSector* sectors;
+    const uint32_t* bucket_start;   /* bucket_count + 1 entries into postings */
+    const uint32_t* postings;
+    long cached_sector;             /* Sector held in cached_data for verification, -1 if none */
+    uint8_t cached_data[LIBIMD_MAX_SECTOR_SIZE];
+} SearchIndex;
+
+SearchIndex g_search_index = { NULL, 0, NULL, NULL, NULL, NULL, -1, { 0 } };
+char g_search_index_path[MAX_FILENAME + 8] = "";
+
+/* Hash and size of the image file as it is on disk. Returns 0 on success. */
+static int hash_image_file(const char* path, uint64_t* hash, uint64_t* size) {
+    uint8_t buf[65536];
+    size_t n;
+    FILE* f = fopen(path, "rb");
+    if (!f) return -1;
+    *hash = FNV1A64_OFFSET_BASIS;
+    *size = 0;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        *hash = fnv1a64_update(*hash, buf, n);
+        *size += n;
+    }
+    n = (size_t)ferror(f);
+    fclose(f);
+    return n ? -1 : 0;
+}
+
+static uint32_t trigram_bucket(const uint8_t* p) {
+    uint32_t v = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+    return (v * 2654435761u) >> (32 - SEARCH_INDEX_BUCKET_BITS);
+}
+
+void search_index_close(void) {
+    SearchIndex* index = &g_search_index;
+    if (!index->map) return;
+#ifdef _WIN32
+    free(index->map);
+#else
+    munmap(index->map, index->map_size);
+#endif
+    index->map = NULL;
+    index->map_size = 0;
+    index->header = NULL;
+    index->cached_sector = -1;
+}
+
+/*
+ * Checks that the mapped sidecar's tables agree with each other and with the
+ * open image, so a damaged or hand-made file cannot send lookups outside the
+ * map or the sector buffers. Returns 1 if the index can be used.
+ */
+static int search_index_valid(const SearchIndex* index) {
+    const SearchIndexHeader* hdr = index->header;
+    uint64_t offset = 0;
+
+    if (index->bucket_start[0] != 0 || index->bucket_start[SEARCH_INDEX_BUCKETS] != hdr->posting_count) return 0;
+    for (uint32_t b = 0; b < SEARCH_INDEX_BUCKETS; ++b) {
+        if (index->bucket_start[b] > index->bucket_start[b + 1]) return 0;
+    }
+    for (uint32_t i = 0; i < hdr->sector_count; ++i) {
+        const SearchIndexSector* sector = &index->sectors[i];
+        const ImdTrackInfo* track = sector->track_idx < total_tracks_in_image ?
+            imdf_get_track_info(g_imdf_handle, sector->track_idx) : NULL;
+        if (!track || !track->loaded || sector->sector_log_idx >= track->num_sectors ||
+            sector->size == 0 || sector->size > track->sector_size || sector->size > LIBIMD_MAX_SECTOR_SIZE ||
+            sector->offset != offset) {
+            return 0;
         }
-        if (current_track_display.num_sectors > 0 && current_sector_logical_idx >= current_track_display.num_sectors) {
-            current_sector_logical_idx = current_track_display.num_sectors - 1;
+        offset += sector->size;
+    }
+    if (offset != hdr->data_size) return 0;
+    for (uint64_t i = 0; i < hdr->posting_count; ++i) {
+        if (index->postings[i] >= hdr->data_size) return 0;
+    }
+    return 1;
+}
+
+/*
+ * Maps the sidecar if it exists and matches the image. A missing, stale or
+ * damaged sidecar is not an error: searches simply scan the image.
+ * Returns 1 if the index is in use.
+ */
+int search_index_open(void) {
+    SearchIndex* index = &g_search_index;
+    const SearchIndexHeader* hdr;
+    uint64_t image_hash, image_size;
+    size_t need;
+
+    search_index_close();
+#ifdef _WIN32
+    /* No mmap on Windows; read the sidecar in one go */
+    FILE* f = fopen(g_search_index_path, "rb");
+    if (!f) return 0;
+    if (fseek(f, 0, SEEK_END) == 0) {
+        long len = ftell(f);
+        if (len > 0 && fseek(f, 0, SEEK_SET) == 0) {
+            index->map = malloc((size_t)len);
+            if (index->map && fread(index->map, 1, (size_t)len, f) == (size_t)len) index->map_size = (size_t)len;
+            else { free(index->map); index->map = NULL; }
         }
-        else if (current_track_display.num_sectors == 0) {
-            current_sector_logical_idx = 0;
+    }
+    fclose(f);
+#else
+    struct stat st;
+    int fd = open(g_search_index_path, O_RDONLY);
+    if (fd < 0) return 0;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            index->map = map;
+            index->map_size = (size_t)st.st_size;
         }
+    }
+    close(fd);
+#endif
+    if (!index->map) return 0;
+
+    hdr = (const SearchIndexHeader*)index->map;
+    need = sizeof(*hdr);
+    if (index->map_size >= need && memcmp(hdr->magic, SEARCH_INDEX_MAGIC, sizeof(hdr->magic)) == 0 &&
+        hdr->version == SEARCH_INDEX_VERSION && hdr->bucket_count == SEARCH_INDEX_BUCKETS &&
+        hdr->data_size <= UINT32_MAX && hdr->posting_count <= hdr->data_size) {
+        need += (size_t)hdr->sector_count * sizeof(SearchIndexSector) +
+            (SEARCH_INDEX_BUCKETS + 1) * sizeof(uint32_t) + (size_t)hdr->posting_count * sizeof(uint32_t);
+    }
+    else {
+        need = 0;
+    }
+    if (need == 0 || index->map_size != need ||
+        hash_image_file(g_image_path, &image_hash, &image_size) != 0 ||
+        image_hash != hdr->image_hash || image_size != hdr->image_size) {
+        search_index_close();
+        return 0;
+    }
 
-        if (target_data_offset == 0xFFFFFFFF) {
-            if (current_track_display.sector_size > 0) {
-                int data_win_h_nav = getmaxy(win_data) > 0 ? getmaxy(win_data) : DATA_LINES;
-                current_data_offset_in_sector = (long)current_track_display.sector_size - (data_win_h_nav * BYTES_PER_LINE);
-                if (current_data_offset_in_sector < 0) current_data_offset_in_sector = 0;
-                current_data_offset_in_sector = (current_data_offset_in_sector / BYTES_PER_LINE) * BYTES_PER_LINE;
+    index->header = hdr;
+    index->sectors = (const SearchIndexSector*)((const uint8_t*)index->map + sizeof(*hdr));
+    index->bucket_start = (const uint32_t*)(index->sectors + hdr->sector_count);
+    index->postings = index->bucket_start + SEARCH_INDEX_BUCKETS + 1;
+    index->cached_sector = -1;
+    if (!search_index_valid(index)) {
+        search_index_close();
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Reads every sector in logical order, builds the trigram postings and writes
+ * the sidecar (to a temporary file, then renamed). Returns 0 on success.
+ */
+int search_index_build(void) {
+    SearchIndexHeader hdr;
+    SearchIndexSector* sectors = NULL;
+    uint8_t* data = NULL;
+    uint32_t* bucket_start = NULL;
+    uint32_t* postings = NULL;
+    size_t sector_count = 0, sector_capacity = 0;
+    uint64_t data_size = 0, data_capacity = 0, posting_count = 0;
+    char tmp_path[sizeof(g_search_index_path) + 4];
+    FILE* f = NULL;
+    int gap = 0;
+    int result = -1;
+
+    search_index_close();
+    memset(&hdr, 0, sizeof(hdr));
+    if (hash_image_file(g_image_path, &hdr.image_hash, &hdr.image_size) != 0) {
+        display_error("Search index: cannot read the image file.");
+        return -1;
+    }
+
+    /* Gather the logical stream, as the search walks it */
+    for (size_t t = 0; t < total_tracks_in_image; ++t) {
+        const ImdTrackInfo* track = imdf_get_track_info(g_imdf_handle, t);
+        if (!track || !track->loaded) { gap = 1; continue; }
+        for (uint32_t s = 0; s < track->num_sectors; ++s) {
+            if (data_size + LIBIMD_MAX_SECTOR_SIZE > data_capacity) {
+                uint64_t new_capacity = data_capacity ? data_capacity * 2 : 1024 * 1024;
+                uint8_t* grown = (uint8_t*)realloc(data, (size_t)new_capacity);
+                if (!grown) { display_error("Search index: out of memory."); goto cleanup; }
+                data = grown;
+                data_capacity = new_capacity;
             }
-            else { current_data_offset_in_sector = 0; }
+            int size = load_specific_sector_data(t, s, data + data_size, LIBIMD_MAX_SECTOR_SIZE, NULL);
+            if (size == 0) { gap = 1; continue; }
+            if (sector_count == sector_capacity) {
+                size_t new_capacity = sector_capacity ? sector_capacity * 2 : 1024;
+                SearchIndexSector* grown = (SearchIndexSector*)realloc(sectors, new_capacity * sizeof(SearchIndexSector));
+                if (!grown) { display_error("Search index: out of memory."); goto cleanup; }
+                sectors = grown;
+                sector_capacity = new_capacity;
+            }
+            sectors[sector_count].track_idx = (uint32_t)t;
+            sectors[sector_count].sector_log_idx = (uint16_t)s;
+            sectors[sector_count].contiguous = (uint8_t)(sector_count > 0 && !gap);
+            sectors[sector_count].reserved = 0;
+            sectors[sector_count].offset = (uint32_t)data_size;
+            sectors[sector_count].size = (uint32_t)size;
+            sector_count++;
+            data_size += (uint64_t)size;
+            gap = 0;
         }
-        else {
-            current_data_offset_in_sector = target_data_offset;
+    }
+    if (data_size > UINT32_MAX) {
+        display_error("Search index: image too large to index.");
+        goto cleanup;
+    }
+
+    /* Counting sort of trigram positions into buckets; trigrams never span a gap */
+    bucket_start = (uint32_t*)calloc(SEARCH_INDEX_BUCKETS + 1, sizeof(uint32_t));
+    if (!bucket_start) { display_error("Search index: out of memory."); goto cleanup; }
+    for (int pass = 0; pass < 2; ++pass) {
+        uint64_t run_start = 0;
+        for (size_t i = 0; i <= sector_count; ++i) {
+            if (i < sector_count && (i == 0 || sectors[i].contiguous)) continue;
+            /* [run_start, run_end) is contiguous */
+            uint64_t run_end = (i < sector_count) ? sectors[i].offset : data_size;
+            for (uint64_t p = run_start; p + 3 <= run_end; ++p) {
+                uint32_t b = trigram_bucket(data + p);
+                if (pass == 0) bucket_start[b + 1]++;
+                else postings[bucket_start[b]++] = (uint32_t)p;
+            }
+            run_start = run_end;
         }
-        if (current_data_offset_in_sector < 0) current_data_offset_in_sector = 0;
-        if (current_track_display.sector_size > 0 && current_data_offset_in_sector >= (long)current_track_display.sector_size) {
-            current_data_offset_in_sector = (((long)current_track_display.sector_size - 1) / BYTES_PER_LINE) * BYTES_PER_LINE;
-            if (current_data_offset_in_sector < 0) current_data_offset_in_sector = 0;
+        if (pass == 0) {
+            for (uint32_t b = 0; b < SEARCH_INDEX_BUCKETS; ++b) bucket_start[b + 1] += bucket_start[b];
+            posting_count = bucket_start[SEARCH_INDEX_BUCKETS];
+            postings = (uint32_t*)malloc((size_t)(posting_count ? posting_count : 1) * sizeof(uint32_t));
+            if (!postings) { display_error("Search index: out of memory."); goto cleanup; }
         }
-        else if (current_track_display.sector_size == 0) {
-            current_data_offset_in_sector = 0;
+    }
+    /* The fill pass advanced each start to the next bucket's start */
+    memmove(bucket_start + 1, bucket_start, SEARCH_INDEX_BUCKETS * sizeof(uint32_t));
+    bucket_start[0] = 0;
+
+    memcpy(hdr.magic, SEARCH_INDEX_MAGIC, sizeof(hdr.magic));
+    hdr.version = SEARCH_INDEX_VERSION;
+    hdr.bucket_count = SEARCH_INDEX_BUCKETS;
+    hdr.data_size = data_size;
+    hdr.posting_count = posting_count;
+    hdr.sector_count = (uint32_t)sector_count;
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", g_search_index_path);
+    f = fopen(tmp_path, "wb");
+    if (!f) {
+        display_error("Search index: cannot write the sidecar file.");
+        goto cleanup;
+    }
+    if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+        fwrite(sectors, sizeof(SearchIndexSector), sector_count, f) != sector_count ||
+        fwrite(bucket_start, sizeof(uint32_t), SEARCH_INDEX_BUCKETS + 1, f) != SEARCH_INDEX_BUCKETS + 1 ||
+        fwrite(postings, sizeof(uint32_t), (size_t)posting_count, f) != (size_t)posting_count) {
+        fclose(f);
+        remove(tmp_path);
+        display_error("Search index: failed writing the sidecar file.");
+        goto cleanup;
+    }
+    if (fclose(f) != 0) {
+        remove(tmp_path);
+        display_error("Search index: failed writing the sidecar file.");
+        goto cleanup;
+    }
+#ifdef _WIN32
+    remove(g_search_index_path); /* rename() does not replace an existing file on Windows */
+#endif
+    if (rename(tmp_path, g_search_index_path) != 0) {
+        remove(tmp_path);
+        display_error("Search index: cannot replace the sidecar file.");
+        goto cleanup;
+    }
+    result = search_index_open() ? 0 : -1;
+
+cleanup:
+    free(postings);
+    free(bucket_start);
+    free(data);
+    free(sectors);
+    return result;
+}
+
+static uint32_t trigram_postings(const uint8_t* p) {
+    uint32_t b = trigram_bucket(p);
+    return g_search_index.bucket_start[b + 1] - g_search_index.bucket_start[b];
+}
+
+/* Index of the sector holding a logical offset */
+static size_t search_index_sector_at(uint32_t offset) {
+    const SearchIndex* index = &g_search_index;
+    size_t lo = 0, hi = index->header->sector_count;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (index->sectors[mid].offset <= offset) lo = mid;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/*
+ * Copies up to len bytes of the raw logical stream starting at offset, stopping
+ * at a gap or the end of the data. Returns the number of bytes copied.
+ */
+static int search_index_read(uint32_t offset, uint8_t* out, int len) {
+    SearchIndex* index = &g_search_index;
+    size_t s = search_index_sector_at(offset);
+    int copied = 0;
+
+    while (copied < len && s < index->header->sector_count) {
+        const SearchIndexSector* sector = &index->sectors[s];
+        if (copied > 0 && !sector->contiguous) break;
+        if (index->cached_sector != (long)s) {
+            if (load_specific_sector_data(sector->track_idx, sector->sector_log_idx, index->cached_data,
+                LIBIMD_MAX_SECTOR_SIZE, NULL) != (int)sector->size) break;
+            index->cached_sector = (long)s;
+        }
+        uint32_t at = offset + (uint32_t)copied - sector->offset;
+        while (copied < len && at < sector->size) out[copied++] = index->cached_data[at++];
+        s++;
+    }
+    return copied;
+}
+
+/* 1 if the index can answer this search: it matches raw bytes, so EBCDIC text needs a scan */
+int search_index_usable(int is_text_search, int term_len) {
+    return g_search_index.header != NULL && term_len >= 3 && !(is_text_search && current_charset == CHARSET_EBCDIC);
+}
+
+/*
+ * Answers a search from the index: candidates come from the rarest trigram of
+ * the pattern, are filtered by the second rarest, then verified against the data.
+ * Finds the first match at or after the given position, or with find_all every match.
+ * Returns 1 if a match was found (*found filled in for the first), 0 if not.
+ */
+int search_index_find(const uint8_t* term, int term_len, size_t track_idx, uint32_t sector_log_idx,
+    long start_offset, int find_all, StreamPosition* found) {
+    SearchIndex* index = &g_search_index;
+    const uint32_t* starts = index->bucket_start;
+    uint8_t raw[MAX_SEARCH_TERM];
+    uint8_t check[MAX_SEARCH_TERM];
+    int rare = 0, second = -1;
+    uint32_t start = 0;
+    size_t lo, hi;
+    int matches = 0;
+
+    for (int i = 0; i < term_len; ++i) raw[i] = (uint8_t)(term[i] ^ xor_mask);
+    if (index->header->sector_count == 0) return 0;
+
+    /* Rarest two trigrams of the pattern */
+    for (int k = 1; k + 3 <= term_len; ++k) {
+        if (trigram_postings(raw + k) < trigram_postings(raw + rare)) rare = k;
+    }
+    for (int k = 0; k + 3 <= term_len; ++k) {
+        if (k != rare && (second < 0 || trigram_postings(raw + k) < trigram_postings(raw + second))) second = k;
+    }
+
+    /* Logical offset of the starting position */
+    lo = 0; hi = index->header->sector_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const SearchIndexSector* s = &index->sectors[mid];
+        if (s->track_idx < track_idx || (s->track_idx == track_idx && s->sector_log_idx < sector_log_idx)) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo >= index->header->sector_count) return 0;
+    start = index->sectors[lo].offset;
+    if (index->sectors[lo].track_idx == track_idx && index->sectors[lo].sector_log_idx == sector_log_idx && start_offset > 0) {
+        start += (uint32_t)(start_offset < (long)index->sectors[lo].size ? start_offset : (long)index->sectors[lo].size);
+    }
+
+    uint32_t rb = trigram_bucket(raw + rare);
+    const uint32_t* list = index->postings + starts[rb];
+    size_t count = starts[rb + 1] - starts[rb];
+
+    /* First posting that can start a match at or after 'start' */
+    lo = 0; hi = count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (list[mid] < start + (uint32_t)rare) lo = mid + 1;
+        else hi = mid;
+    }
+
+    for (size_t i = lo; i < count; ++i) {
+        uint32_t candidate = list[i] - (uint32_t)rare;
+        if (second >= 0) {
+            uint32_t sb = trigram_bucket(raw + second);
+            uint32_t want = candidate + (uint32_t)second;
+            size_t a = starts[sb], b = starts[sb + 1];
+            while (a < b) {
+                size_t mid = a + (b - a) / 2;
+                if (index->postings[mid] < want) a = mid + 1;
+                else b = mid;
+            }
+            if (a == starts[sb + 1] || index->postings[a] != want) continue;
         }
+        if (search_index_read(candidate, check, term_len) != term_len || memcmp(check, raw, (size_t)term_len) != 0) continue;
+
+        const SearchIndexSector* sector = &index->sectors[search_index_sector_at(candidate)];
+        StreamPosition pos;
+        pos.track_idx = sector->track_idx;
+        pos.sector_log_idx = sector->sector_log_idx;
+        pos.offset = (long)(candidate - sector->offset);
+        if (matches++ == 0) *found = pos;
+        if (!find_all) break;
+
+        uint8_t context[FIND_ALL_CONTEXT];
+        int context_len = search_index_read(candidate, context, FIND_ALL_CONTEXT);
+        for (int c = 0; c < context_len; ++c) context[c] ^= xor_mask;
+        if (!find_all_add_result(&pos, NULL, term_len, context, context_len)) break;
+    }
+    return matches > 0;
+}
+
+/* Builds (or rebuilds) the sidecar for the open image and reports the result */
+void rebuild_search_index(void) {
+    char msg[sizeof(status_message)];
+    if (g_search_index_path[0] == '\0') {
+        display_error("Search index: image path too long.");
+        return;
+    }
+    if (dirty_sector_count() > 0) {
+        /* The index is tied to the image file, which does not have the edits yet */
+        display_error("Save (S) or undo (U) the sector changes before building the search index.");
+        return;
+    }
+    update_status("Building search index..."); doupdate();
+    if (search_index_build() != 0) return; /* Error already shown */
+    snprintf(msg, sizeof(msg), "Search index built: %u sectors, %llu trigrams (%.60s)",
+        g_search_index.header->sector_count, (unsigned long long)g_search_index.header->posting_count,
+        get_basename(g_search_index_path));
+    update_status(msg); doupdate();
+}
+
+/*
+ * Background search: without the search index, find next runs on a worker
+ * thread and find all on several when the image is large enough, each with
+ * its own read-only handle and a copy of the unsaved edits taken when the
+ * search starts; the main loop only polls them, so the UI stays responsive,
+ * progress is shown and ESC cancels the search. Edits made while a search
+ * runs are not seen by it. Without threads, or if a worker cannot read the
+ * image, the main loop advances g_search on the UI thread a slice of
+ * SEARCH_SECTORS_PER_SLICE sectors at a time between keystrokes instead.
+ */
+PatternSearch g_search;
+
+#ifdef IMDV_HAVE_THREADS
+int find_all_start_workers(const uint8_t* term, int term_len, const CompiledPattern* cp, int is_text_search);
+int search_worker_start(const uint8_t* term, int term_len, const CompiledPattern* cp, int is_text_search,
+    size_t track_idx, uint32_t sector_log_idx, long start_offset);
+int search_worker_poll(int* matched, StreamPosition* found, StreamPosition* end, int* match_len);
+size_t search_worker_track(void);
+int search_worker_find_next(void);
+#endif
+
+/* Shows where the active search is */
+void show_search_progress(void) {
+    const ImdTrackInfo* track = imdf_get_track_info(g_imdf_handle, g_search.stream.track_idx);
+    char msg[sizeof(status_message)];
+#ifdef IMDV_HAVE_THREADS
+    if (search_worker_find_next()) {
+        track = imdf_get_track_info(g_imdf_handle, search_worker_track());
+    }
+    else if (search_workers_running()) {
+        int num_workers;
+        size_t done = find_all_workers_progress(&num_workers);
+        snprintf(msg, sizeof(msg), "Searching for %s... %zu of %zu tracks on %d threads (ESC to cancel)",
+            g_search_is_text ? "text" : "hex", done, total_tracks_in_image, num_workers);
+    }
+    else
+#endif
+    if (track) {
+        snprintf(msg, sizeof(msg), "Searching for %s... Cyl %u Head %u, %zu found (ESC to cancel)",
+            g_search_is_text ? "text" : "hex", track->cyl, track->head, g_find_all_count);
+    }
+    else {
+        snprintf(msg, sizeof(msg), "Searching for %s... (ESC to cancel)", g_search_is_text ? "text" : "hex");
+    }
+    update_status(msg);
+    doupdate();
+}
+
+/*
+ * Starts a background search for a literal term, or a compiled pattern (cp), at the given sector and offset.
+ * find_all: 1 to collect every match into the find-all results instead of stopping at the first.
+ */
+void start_search(const uint8_t* term, int term_len, const CompiledPattern* cp, int is_text_search,
+    size_t track_idx, uint32_t sector_log_idx, long start_offset, int find_all) {
+#ifdef IMDV_HAVE_THREADS
+    search_stop_workers();          /* A new search replaces a running one */
+#endif
+    pattern_search_begin(&g_search, term, term_len, cp, is_text_search, track_idx, sector_log_idx, start_offset);
+    g_search_is_text = is_text_search;
+    g_search_find_all = find_all;
+    if (find_all) g_find_all_count = 0;
+
+    if (!cp && search_index_usable(is_text_search, term_len)) {
+        /* Answered at once from the index */
+        StreamPosition found;
+        int search_result = search_index_find(term, term_len, track_idx, sector_log_idx, start_offset, find_all, &found);
+        g_search_active = 0;
+        if (find_all) display_find_all_panel();
+        else if (search_result) show_search_match(&found, NULL, term_len);
+        else show_search_not_found();
+        return;
+    }
+
+    g_search_active = 1;
+#ifdef IMDV_HAVE_THREADS
+    /* g_search stays ready in case a worker cannot read the image */
+    if (find_all) find_all_start_workers(term, term_len, cp, is_text_search);
+    else search_worker_start(term, term_len, cp, is_text_search, track_idx, sector_log_idx, start_offset);
+#endif
+    show_search_progress();
+}
+
+void cancel_search(void) {
+#ifdef IMDV_HAVE_THREADS
+    search_stop_workers();
+#endif
+    g_search_active = 0;
+    clear_search_highlight();
+    update_status("Search cancelled.");
+    doupdate();
+}
+
+/* Moves the UI thread's search onto g_imdf_handle after saving reopened the image */
+void search_handle_replaced(ImdImageFile* old_handle) {
+    if (g_search.stream.handle == old_handle) g_search.stream.handle = g_imdf_handle;
+}
+
+/* Moves the view to a match and highlights it. end: just past a wildcard/regex match, NULL for a literal. */
+void show_search_match(const StreamPosition* found, const StreamPosition* end, int term_len) {
+    current_track_index_in_image = found->track_idx;
+    current_sector_logical_idx = found->sector_log_idx;
+    /* current_data_offset_in_sector will be handled by adjust_view_for_match */
+
+    /* Set before loading: load_track_for_display keeps the sector only when it holds the match */
+    g_found_on_track_idx = found->track_idx;
+    g_found_on_sector_log_idx = found->sector_log_idx;
+    g_found_offset_in_sector = found->offset;
+    g_found_len = term_len;
+    g_found_end_offset = end ? end->offset : -1;
+    if (end) {
+        g_found_end_track_idx = end->track_idx;
+        g_found_end_sector_log_idx = end->sector_log_idx;
+    }
+
+    if (load_track_for_display(current_track_index_in_image) != 0) {
+        /* Error displayed by load_track_for_display */
+        clear_search_highlight(); /* Clean up search state */
+        return;
+    }
+    /* current_sector_logical_idx is already set, load_sector_for_display will use it */
+    if (load_sector_for_display() != 0) {
+        /* Error displayed by load_sector_for_display */
+        clear_search_highlight();
+        return;
+    }
+
+    adjust_view_for_match(found->offset, term_len);
+    snprintf(status_message, sizeof(status_message), "Found %sat Trk:%zu SecLogIdx:%u Offset:%ld",
+        g_search_is_text ? "" : "hex ", found->track_idx, found->sector_log_idx, found->offset);
+    update_status(status_message);
+    draw_info_window();
+    draw_data_window();
+    doupdate();
+}
 
-        load_sector_for_display();
-        redraw_info = 1; redraw_data = 1;
-    }
-    else if (target_logical_sector_idx != current_sector_logical_idx) {
-        if (target_logical_sector_idx == 0xFFFF && current_track_display.num_sectors > 0) {
-            current_sector_logical_idx = current_track_display.num_sectors - 1;
-        }
-        else if (target_logical_sector_idx == 0xFFFF) {
-            current_sector_logical_idx = 0;
-        }
-        else {
-            current_sector_logical_idx = target_logical_sector_idx;
-        }
-        if (current_track_display.num_sectors > 0 && current_sector_logical_idx >= current_track_display.num_sectors) {
-            current_sector_logical_idx = current_track_display.num_sectors - 1;
-        }
-        else if (current_track_display.num_sectors == 0) {
-            current_sector_logical_idx = 0;
-        }
+void show_search_not_found(void) {
+    update_status(g_search_is_text ? "Search: Text not found." : "Search: Hex pattern not found.");
+    doupdate();
+    beep();
+    clear_search_highlight(); /* Important to clear if not found */
+    /* Redraw to remove any old highlights */
+    draw_data_window();
+    doupdate();
+}
 
-        current_data_offset_in_sector = target_data_offset;
-        if (target_data_offset == 0xFFFFFFFF) {
-            if (current_track_display.sector_size > 0) {
-                int data_win_h_nav = getmaxy(win_data) > 0 ? getmaxy(win_data) : DATA_LINES;
-                current_data_offset_in_sector = (long)current_track_display.sector_size - (data_win_h_nav * BYTES_PER_LINE);
-                if (current_data_offset_in_sector < 0) current_data_offset_in_sector = 0;
-                current_data_offset_in_sector = (current_data_offset_in_sector / BYTES_PER_LINE) * BYTES_PER_LINE;
-            }
-            else { current_data_offset_in_sector = 0; }
-        }
-        if (current_data_offset_in_sector < 0) current_data_offset_in_sector = 0;
-        if (current_track_display.sector_size > 0 && current_data_offset_in_sector >= (long)current_track_display.sector_size) {
-            current_data_offset_in_sector = (((long)current_track_display.sector_size - 1) / BYTES_PER_LINE) * BYTES_PER_LINE;
-            if (current_data_offset_in_sector < 0) current_data_offset_in_sector = 0;
+/* Runs one slice of the active search; called from the main loop. */
+void search_poll(void) {
+    StreamPosition found;
+    int search_result;
+
+    if (!g_search_active) return;
+#ifdef IMDV_HAVE_THREADS
+    if (search_worker_find_next()) {
+        StreamPosition end;
+        int matched, match_len;
+        int poll_result = search_worker_poll(&matched, &found, &end, &match_len);
+        if (poll_result < 0) {
+            show_search_progress();
+            return;
         }
-        else if (current_track_display.sector_size == 0) {
-            current_data_offset_in_sector = 0;
+        if (poll_result == 0) {
+            g_search_active = 0;
+            if (matched) show_search_match(&found, end.offset >= 0 ? &end : NULL, match_len);
+            else show_search_not_found();
+            return;
         }
-
-        load_sector_for_display();
-        redraw_info = 1; redraw_data = 1;
+        /* The worker failed: scan on this thread with g_search */
     }
-    else if (target_data_offset != current_data_offset_in_sector) {
-        current_data_offset_in_sector = target_data_offset;
-        if (current_data_offset_in_sector < 0) current_data_offset_in_sector = 0;
-
-        if (current_track_display.sector_size > 0) {
-            if (current_data_offset_in_sector >= (long)current_track_display.sector_size) {
-                int data_win_h_nav = getmaxy(win_data) > 0 ? getmaxy(win_data) : DATA_LINES;
-                long last_line_start_offset = (((long)current_track_display.sector_size - 1) / BYTES_PER_LINE) * BYTES_PER_LINE;
-                current_data_offset_in_sector = last_line_start_offset;
-                /* Adjust so the view shows the last page containing data, not just the last line */
-                if ((long)current_track_display.sector_size > (long)(data_win_h_nav * BYTES_PER_LINE)) {
-                    long temp_offset = (long)current_track_display.sector_size - (data_win_h_nav * BYTES_PER_LINE);
-                    if (temp_offset < 0) temp_offset = 0;
-                    current_data_offset_in_sector = (temp_offset / BYTES_PER_LINE) * BYTES_PER_LINE;
-                    /* Ensure this adjustment does not hide the actual last line if sector ends mid-page */
-                    if (current_data_offset_in_sector > last_line_start_offset && last_line_start_offset >= 0) {
-                        current_data_offset_in_sector = last_line_start_offset;
-                    }
-                    else if (current_data_offset_in_sector < 0) {
-                        current_data_offset_in_sector = 0;
-                    }
-                }
-                if (current_data_offset_in_sector < 0) current_data_offset_in_sector = 0;
-            }
+    else if (search_workers_running()) {
+        int poll_result = find_all_workers_poll();
+        if (poll_result < 0) {
+            show_search_progress();
+            return;
         }
-        else {
-            current_data_offset_in_sector = 0;
+        if (poll_result == 0) {
+            g_search_active = 0;
+            display_find_all_panel();
+            return;
         }
-        redraw_data = 1;
+        /* A worker failed: scan from the start on this thread with g_search */
     }
-
-
-    if (needs_sector_load) {
-        if (current_track_display.num_sectors > 0 && current_sector_logical_idx >= current_track_display.num_sectors) {
-            current_sector_logical_idx = 0;
-            current_data_offset_in_sector = 0;
+#endif
+    if (g_search_find_all) {
+        while ((search_result = pattern_search_step(&g_search, SEARCH_SECTORS_PER_SLICE, &found)) == 1) {
+            /* Context as the search saw it (XOR mask and text charset applied) */
+            uint8_t context[FIND_ALL_CONTEXT];
+            int context_len = pattern_search_match_context(&g_search, context, FIND_ALL_CONTEXT);
+            if (!find_all_add_result(&found, g_search.dfa ? &g_search.match_end_pos : NULL, (int)g_search.match_len,
+                context, context_len)) break; /* Results full */
         }
-        else if (current_track_display.num_sectors == 0) {
-            current_sector_logical_idx = 0;
-            current_data_offset_in_sector = 0;
+        if (search_result < 0) {
+            show_search_progress();
+            return;
         }
-        load_sector_for_display();
-        redraw_info = 1; redraw_data = 1;
+        g_search_active = 0;
+        display_find_all_panel();
+        return;
     }
 
-    if (redraw_info) draw_info_window();
-    if (redraw_data) draw_data_window();
+    search_result = pattern_search_step(&g_search, SEARCH_SECTORS_PER_SLICE, &found);
+    if (search_result < 0) { /* Budget used up, more to scan */
+        show_search_progress();
+        return;
+    }
 
-    if (redraw_info || redraw_data || navigation_key_pressed || needs_sector_load || ch == ESC_KEY) {
-        doupdate();
+    g_search_active = 0;
+    if (search_result == 1) show_search_match(&found, g_search.dfa ? &g_search.match_end_pos : NULL, (int)g_search.match_len);
+    else show_search_not_found();
+}
+
+/* --- Find All --- */
+
+/* Appends a slot to a result list. Returns NULL once it holds MAX_FIND_ALL_RESULTS or memory runs out. */
+static FindAllResult* find_all_list_append(FindAllResult** list, size_t* count, size_t* capacity) {
+    if (*count >= MAX_FIND_ALL_RESULTS) return NULL;
+    if (*count == *capacity) {
+        size_t new_capacity = *capacity ? *capacity * 2 : 64;
+        FindAllResult* grown = (FindAllResult*)realloc(*list, new_capacity * sizeof(FindAllResult));
+        if (!grown) return NULL;
+        *list = grown;
+        *capacity = new_capacity;
     }
+    return &(*list)[(*count)++];
 }
 
-int ctoh(int c) {
-    if (c >= '0' && c <= '9') return c - '0';
-    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
-    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
-    return -1;
+/* Fills in a match found by a search reading 'handle', with the bytes that start there */
+static void find_all_result_init(FindAllResult* result, ImdImageFile* handle, SectorOrderCache* order,
+    const StreamPosition* found, const StreamPosition* end, int match_len, const uint8_t* context, int context_len) {
+    const ImdTrackInfo* track = imdf_get_track_info(handle, found->track_idx);
+
+    result->pos = *found;
+    if (end) result->end = *end;
+    else result->end.offset = -1;
+    result->match_len = match_len;
+    result->cyl = track ? track->cyl : 0;
+    result->head = track ? track->head : 0;
+    result->sector_id = (track && found->sector_log_idx < track->num_sectors) ?
+        track->smap[get_sector_order(order, found->track_idx, track, 0)[found->sector_log_idx]] : 0;
+
+    result->context_len = context_len < FIND_ALL_CONTEXT ? context_len : FIND_ALL_CONTEXT;
+    memcpy(result->context, context, (size_t)result->context_len);
 }
 
-int get_search_input(const char* prompt, char* buffer, int buffer_size, int is_hex) {
-    WINDOW* popup_win;
-    int screen_h, screen_w;
-    getmaxyx(stdscr, screen_h, screen_w);
+/*
+ * Records a match of the running find-all search with the bytes that start
+ * there. Returns 0 once MAX_FIND_ALL_RESULTS are stored.
+ */
+int find_all_add_result(const StreamPosition* found, const StreamPosition* end, int match_len,
+    const uint8_t* context, int context_len) {
+    FindAllResult* result = find_all_list_append(&g_find_all_results, &g_find_all_count, &g_find_all_capacity);
 
-    int win_h = 4;
-    int term_display_width = is_hex ? (MAX_SEARCH_TERM / 2 * 2) : MAX_SEARCH_TERM;
-    int win_w = (int)strlen(prompt) + term_display_width + 8;
-    if (win_w > screen_w - 4) win_w = screen_w - 4;
-    int input_field_width = win_w - (int)strlen(prompt) - 4;
-    if (input_field_width < 10) input_field_width = 10;
-    if (input_field_width >= buffer_size) input_field_width = buffer_size - 1;
+    if (!result) return 0;
+    find_all_result_init(result, g_imdf_handle, &g_search_order, found, end, match_len, context, context_len);
+    return g_find_all_count < MAX_FIND_ALL_RESULTS;
+}
 
+void draw_find_all_result(int y, int max_x, size_t idx, int selected) {
+    const FindAllResult* result = &g_find_all_results[idx];
+    char line[160];
+    int len = snprintf(line, sizeof(line), "%5zu  C/H/S %3u/%u/%-3u  +%04lX  ",
+        idx + 1, result->cyl, result->head, result->sector_id, (unsigned long)result->pos.offset);
 
-    int start_y = (screen_h - win_h) / 2;
-    int start_x = (screen_w - win_w) / 2;
+    for (int i = 0; i < FIND_ALL_CONTEXT && len < (int)sizeof(line) - 3; ++i) {
+        if (i < result->context_len) len += snprintf(line + len, sizeof(line) - len, "%02X ", result->context[i]);
+        else len += snprintf(line + len, sizeof(line) - len, "   ");
+    }
+    for (int i = 0; i < result->context_len && len < (int)sizeof(line) - 1; ++i) {
+        line[len++] = isprint(result->context[i]) ? (char)result->context[i] : '.';
+    }
+    line[len] = '\0';
 
-    popup_win = newwin(win_h, win_w, start_y, start_x);
-    wbkgd(popup_win, COLOR_PAIR(CP_SEARCH_BOX));
-    box(popup_win, 0, 0);
-    keypad(popup_win, TRUE);
+    if (selected) wattron(win_data, COLOR_PAIR(CP_INFO_HL));
+    mvwprintw(win_data, y, 0, "%-*.*s", max_x, max_x, line);
+    if (selected) wattroff(win_data, COLOR_PAIR(CP_INFO_HL));
+}
 
-    mvwprintw(popup_win, 1, 2, "%s", prompt);
+/*
+ * Scrollable list of the find-all results in the data window.
+ * Enter jumps to the selected match, ESC returns to where the view was.
+ */
+void display_find_all_panel(void) {
+    size_t selected = 0, top = 0;
+    int ch;
 
-    buffer[0] = '\0';
-    if (is_hex) {
-        if (last_search_type == SEARCH_TYPE_HEX && last_search_term_hex_len > 0) {
-            for (int i = 0; i < last_search_term_hex_len; ++i) {
-                if ((size_t)(i * 2 + 2) < (size_t)buffer_size) {
-                    snprintf(buffer + (i * 2), 3, "%02X", last_search_term_hex[i]);
-                }
-                else break;
-            }
-        }
+    if (g_find_all_count == 0) {
+        update_status(g_search_is_text ? "Find All: Text not found." : "Find All: Hex pattern not found.");
+        doupdate();
+        beep();
+        return;
     }
-    else {
-        if (last_search_type == SEARCH_TYPE_TEXT && strlen(last_search_term_text) > 0) {
-            strncpy(buffer, last_search_term_text, buffer_size - 1);
-            buffer[buffer_size - 1] = '\0';
+
+    while (1) {
+        int max_y, max_x;
+        char msg[sizeof(status_message)];
+        getmaxyx(win_data, max_y, max_x);
+        if (max_y < 1) max_y = 1;
+        if (selected < top) top = selected;
+        if (selected >= top + (size_t)max_y) top = selected - (size_t)max_y + 1;
+
+        werase(win_data);
+        for (int i = 0; i < max_y && top + (size_t)i < g_find_all_count; ++i) {
+            draw_find_all_result(i, max_x, top + (size_t)i, top + (size_t)i == selected);
+        }
+        wnoutrefresh(win_data);
+        snprintf(msg, sizeof(msg), "%zu match%s%s | Arrows/PgUp/PgDn=Select | Enter=Go to | ESC=Close",
+            g_find_all_count, g_find_all_count == 1 ? "" : "es",
+            g_find_all_count >= MAX_FIND_ALL_RESULTS ? " (limit reached)" : "");
+        update_status(msg);
+        doupdate();
+
+        ch = modal_getch(win_data);
+        if (ch == ESC_KEY || ch == 'q' || ch == 'Q' || ch == KEY_F(10) || ch == '\n' || ch == KEY_ENTER) {
+            g_data_view.valid = 0; /* The panel drew over the data window */
+        }
+        if (ch == ESC_KEY || ch == 'q' || ch == 'Q' || ch == KEY_F(10)) {
+            build_status_message();
+            update_status(status_message);
+            draw_info_window();
+            draw_data_window();
+            doupdate();
+            return;
+        }
+        if (ch == '\n' || ch == KEY_ENTER) {
+            const FindAllResult* result = &g_find_all_results[selected];
+            show_search_match(&result->pos, result->end.offset >= 0 ? &result->end : NULL, result->match_len);
+            return;
+        }
+        switch (ch) {
+        case KEY_UP:    if (selected > 0) selected--; break;
+        case KEY_DOWN:  if (selected + 1 < g_find_all_count) selected++; break;
+        case KEY_PPAGE: selected = (selected > (size_t)max_y) ? selected - (size_t)max_y : 0; break;
+        case KEY_NPAGE:
+            selected += (size_t)max_y;
+            if (selected >= g_find_all_count) selected = g_find_all_count - 1;
+            break;
+        case KEY_HOME:  selected = 0; break;
+        case KEY_END:   selected = g_find_all_count - 1; break;
+        default: break;
         }
     }
+}
 
-    int current_len = (int)strlen(buffer);
-    int cursor_pos = current_len;
-    int ch_input;
-    int MveX = 2;
+/* --- Searches on Worker Threads --- */
 
-    curs_set(1);
+#ifdef IMDV_HAVE_THREADS
 
-    while (1) {
-        wattron(popup_win, COLOR_PAIR(CP_SEARCH_BOX));
-        mvwprintw(popup_win, 2, MveX, "%-*.*s", input_field_width, input_field_width, buffer);
-        for (int k = current_len; k < input_field_width; ++k) {
-            mvwaddch(popup_win, 2, MveX + k, ' ');
-        }
-        wattroff(popup_win, COLOR_PAIR(CP_SEARCH_BOX));
+/*
+ * Find next without the search index runs as a job with one worker that scans
+ * from the start position to the end of the image and stops at the first
+ * match; the UI only polls it, so keys are never kept waiting on the scan.
+ * Without the search index, find all splits the image into track ranges and
+ * scans them on worker threads. A libimdf handle keeps per-handle state, so
+ * each worker opens the image file read-only with its own handle; the main
+ * handle, the sector cache and the edit cache stay on the UI thread. Workers
+ * see the unsaved edits through a snapshot taken when the search starts, and
+ * a copy of the compiled pattern, as the UI may start another search while
+ * they run. Each worker reports the matches starting in its range and scans
+ * on past the end while a match starting in the range is still pending, so
+ * matches that span two ranges are found. Ranges are in image order, so
+ * concatenating the per-worker results keeps them sorted. Wildcard/regex
+ * matches do not overlap: where a worker's match runs into the next range,
+ * the merge scans on from its end with a worker's search until it meets a
+ * match the next worker found, so the list is what one scan would give.
+ */
 
-        wmove(popup_win, 2, MveX + cursor_pos);
-        wrefresh(popup_win);
+typedef struct FindAllJob FindAllJob;
+
+typedef struct {
+    FindAllJob* job;
+    ImdImageFile* handle;           /* Worker's own read-only handle */
+    size_t first_track;
+    size_t end_track;               /* Matches starting on this track or later belong to the next worker */
+    size_t progress_track;          /* Track being scanned (under job->lock) */
+    int failed;                     /* Image could not be opened, or no longer matches the one shown */
+    SectorOrderCache order;
+    PatternSearch search;
+    FindAllResult* results;
+    size_t count;
+    size_t capacity;
+    pthread_t thread;
+} FindAllWorker;
+
+struct FindAllJob {
+    pthread_mutex_t lock;           /* Guards cancel, finished and progress_track */
+    int cancel;
+    int finished;
+    int started;
+    int num_workers;
+    int find_next;                  /* One worker, stopping at the first match */
+    int is_text_search;
+    int has_pattern;
+    CompiledPattern pattern;        /* Copy of the wildcard/regex being searched for */
+    DirtySector* edits;             /* Snapshot of the unsaved edits, shared read-only */
+    size_t edit_count;
+    FindAllWorker workers[FIND_ALL_MAX_WORKERS];
+};
 
-        ch_input = wgetch(popup_win);
+FindAllJob* g_find_all_job = NULL;
 
-        switch (ch_input) {
-        case KEY_BACKSPACE: case 127: case '\b':
-            if (cursor_pos > 0) {
-                memmove(&buffer[cursor_pos - 1], &buffer[cursor_pos], current_len - cursor_pos + 1);
-                cursor_pos--;
-                current_len--;
-            }
-            break;
-        case KEY_DC:
-            if (cursor_pos < current_len) {
-                memmove(&buffer[cursor_pos], &buffer[cursor_pos + 1], current_len - cursor_pos);
-                current_len--;
-            }
-            break;
-        case KEY_LEFT:
-            if (cursor_pos > 0) cursor_pos--;
-            break;
-        case KEY_RIGHT:
-            if (cursor_pos < current_len) cursor_pos++;
-            break;
-        case '\n': case KEY_ENTER:
-            goto process_input_label;
-        case ESC_KEY:
-            buffer[0] = '\0';
-            goto process_input_label;
-        default:
-            if (isprint(ch_input)) {
-                if (is_hex && !isxdigit(ch_input)) {
-                    beep();
-                }
-                else if (current_len < input_field_width && current_len < buffer_size - 1) {
-                    if (cursor_pos < current_len) {
-                        memmove(&buffer[cursor_pos + 1], &buffer[cursor_pos], current_len - cursor_pos);
-                    }
-                    buffer[cursor_pos] = (char)ch_input;
-                    cursor_pos++;
-                    current_len++;
-                    buffer[current_len] = '\0';
-                }
-                else {
-                    beep();
-                }
-            }
+static int stream_position_compare(const StreamPosition* a, const StreamPosition* b) {
+    if (a->track_idx != b->track_idx) return a->track_idx < b->track_idx ? -1 : 1;
+    if (a->sector_log_idx != b->sector_log_idx) return a->sector_log_idx < b->sector_log_idx ? -1 : 1;
+    if (a->offset != b->offset) return a->offset < b->offset ? -1 : 1;
+    return 0;
+}
+
+static int copy_byte_dfa(ByteDfa* dst, const ByteDfa* src) {
+    size_t cells = (size_t)src->num_states * (size_t)src->num_classes;
+    *dst = *src;
+    dst->next = (uint16_t*)malloc(cells * sizeof(uint16_t));
+    dst->accept = (uint8_t*)malloc((size_t)src->num_states);
+    if (!dst->next || !dst->accept) {
+        free_byte_dfa(dst);
+        return -1;
+    }
+    memcpy(dst->next, src->next, cells * sizeof(uint16_t));
+    memcpy(dst->accept, src->accept, (size_t)src->num_states);
+    return 0;
+}
+
+/* Records the worker's current match. Returns 0 once its list is full. */
+static int find_all_worker_add(FindAllWorker* w, const StreamPosition* found) {
+    PatternSearch* search = &w->search;
+    FindAllResult* result = find_all_list_append(&w->results, &w->count, &w->capacity);
+    uint8_t context[FIND_ALL_CONTEXT];
+    int context_len;
+
+    if (!result) return 0;
+    context_len = pattern_search_match_context(search, context, FIND_ALL_CONTEXT);
+    find_all_result_init(result, w->handle, &w->order, found, search->dfa ? &search->match_end_pos : NULL,
+        (int)search->match_len, context, context_len);
+    return w->count < MAX_FIND_ALL_RESULTS;
+}
+
+static void* find_all_worker(void* arg) {
+    FindAllWorker* w = (FindAllWorker*)arg;
+    FindAllJob* job = w->job;
+    PatternSearch* search = &w->search;
+    StreamPosition found;
+    size_t num_tracks = 0;
+    int cancel = 0;
+
+    if (imdf_open(g_image_path, 1, &w->handle) != IMDF_ERR_OK) {
+        w->handle = NULL;
+        w->failed = 1;
+    }
+    else if (imdf_get_num_tracks(w->handle, &num_tracks) != IMDF_ERR_OK || num_tracks != total_tracks_in_image) {
+        w->failed = 1;
+    }
+    search->stream.handle = w->handle;
+
+    while (!w->failed && !cancel) {
+        int result = pattern_search_step(search, 1, &found);
+        if (result == 1) {
+            if (found.track_idx >= w->end_track || !find_all_worker_add(w, &found) || job->find_next) break;
+        }
+        else if (result == 0) {
             break;
         }
+        else if (search->stream.track_idx >= w->end_track) {
+            StreamPosition pending;
+            /* No match starting in the range can still end here */
+            if (!pattern_search_pending_start(search, &pending) || pending.track_idx >= w->end_track) break;
+        }
+        pthread_mutex_lock(&job->lock);
+        cancel = job->cancel;
+        w->progress_track = search->stream.track_idx;
+        pthread_mutex_unlock(&job->lock);
     }
 
-process_input_label:
-    curs_set(0);
-    delwin(popup_win);
+    if (w->handle) imdf_close(w->handle);
+    w->handle = NULL;
+    pthread_mutex_lock(&job->lock);
+    job->finished++;
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+}
 
-    touchwin(stdscr); refresh();
+/* Cancels the search running on worker threads, if any, and frees it */
+void search_stop_workers(void) {
+    FindAllJob* job = g_find_all_job;
+
+    if (!job) return;
+    pthread_mutex_lock(&job->lock);
+    job->cancel = 1;
+    pthread_mutex_unlock(&job->lock);
+    for (int i = 0; i < job->started; ++i) pthread_join(job->workers[i].thread, NULL);
+    for (int i = 0; i < job->num_workers; ++i) free(job->workers[i].results);
+    dirty_sector_snapshot_free(job->edits, job->edit_count);
+    if (job->has_pattern) {
+        free_byte_dfa(&job->pattern.anchored);
+    }
+    pthread_mutex_destroy(&job->lock);
+    free(job);
+    g_find_all_job = NULL;
+}
 
+/*
+ * Sets up a search job with copies of the pattern and the unsaved edits, as
+ * g_find_all_job. Returns NULL if memory runs out.
+ */
+static FindAllJob* search_job_create(const CompiledPattern* cp, int is_text_search, int num_workers) {
+    FindAllJob* job = (FindAllJob*)calloc(1, sizeof(FindAllJob));
+
+    if (!job) return NULL;
+    pthread_mutex_init(&job->lock, NULL);
+    job->num_workers = num_workers;
+    job->is_text_search = is_text_search;
+    g_find_all_job = job;           /* search_stop_workers() cleans up from here on */
+
+    if (cp) {
+        if (copy_byte_dfa(&job->pattern.anchored, &cp->anchored) != 0) goto fail;
+        job->has_pattern = 1;
+    }
+    if (dirty_sector_snapshot(&job->edits, &job->edit_count) != 0) goto fail;
+    return job;
 
-    if (strlen(buffer) == 0) return 0;
+fail:
+    search_stop_workers();
+    return NULL;
+}
 
-    if (is_hex) {
-        if (strlen(buffer) % 2 != 0) {
-            display_error("Hex string must have an even number of digits.");
+/* Points worker i at [first_track, end_track), starting at the given sector and offset */
+static void search_job_init_worker(FindAllJob* job, int i, const uint8_t* term, int term_len, size_t first_track,
+    size_t end_track, uint32_t sector_log_idx, long start_offset) {
+    FindAllWorker* w = &job->workers[i];
+    w->job = job;
+    w->first_track = first_track;
+    w->end_track = end_track;
+    w->progress_track = first_track;
+    w->order.track_idx = (size_t)-1;
+    pattern_search_begin(&w->search, term, term_len, job->has_pattern ? &job->pattern : NULL, job->is_text_search,
+        first_track, sector_log_idx, start_offset);
+    w->search.stream.order = &w->order;
+    w->search.stream.edits = job->edits;
+    w->search.stream.edit_count = job->edit_count;
+}
+
+/* Starts the job's worker threads. Returns 1, or 0 (job freed) if they could not be started. */
+static int search_job_start(FindAllJob* job) {
+    for (; job->started < job->num_workers; job->started++) {
+        if (pthread_create(&job->workers[job->started].thread, NULL, find_all_worker, &job->workers[job->started]) != 0) {
+            search_stop_workers();
             return 0;
         }
     }
@@ -1604,201 +5432,241 @@ process_input_label:
 }
 
 /*
- * Common internal search function to find a pattern (text or hex) in the disk image.
- * Iterates through tracks and sectors, handling intra-sector and inter-sector (span) matches.
- *
- * Parameters:
- * raw_term: Pointer to the search term (bytes for hex, char* for text).
- * raw_term_len: Length of the search term.
- * is_text_search: 1 if text search (implies EBCDIC conversion of disk data if enabled), 0 for hex.
- * start_from_next_byte: 1 to start searching from the byte after the last find/current relevant position, 0 to start from current.
- * out_found_track_idx: Pointer to store the track index of the found match.
- * out_found_sector_log_idx: Pointer to store the logical sector index of the found match.
- * out_found_offset_in_sector: Pointer to store the byte offset within the sector of the found match.
- * out_found_actual_len: Pointer to store the length of the found match (should be raw_term_len).
- *
- * Returns:
- * 1 if the pattern is found.
- * 0 if the pattern is not found.
- * -1 if a memory allocation error occurred.
- * If found (returns 1), the out_* parameters are populated with the location details.
+ * Starts find all on worker threads. Returns 0, leaving the search to the UI
+ * thread, if the image is too small to be worth splitting or threads could
+ * not be started.
  */
-static int find_pattern_in_image(
-    const uint8_t* raw_term,
-    int raw_term_len,
-    int is_text_search,
-    int start_from_next_byte,
-    size_t* out_found_track_idx,
-    uint32_t* out_found_sector_log_idx,
-    long* out_found_offset_in_sector,
-    int* out_found_actual_len
-) {
-    uint8_t* primary_sector_data = NULL;
-    uint8_t* processed_primary_sector_data = NULL;
-    uint8_t* next_sector_data = NULL;
-    uint8_t* processed_next_sector_data = NULL;
-    int search_status = 0; /* 0 = not found, 1 = found, -1 = error */
-
-    size_t search_start_track = current_track_index_in_image;
-    uint32_t search_start_sector_log = current_sector_logical_idx;
-    long initial_offset_for_first_sector = 0;
-
-    if (start_from_next_byte) {
-        if (g_found_len > 0 &&
-            g_found_on_track_idx == search_start_track &&
-            g_found_on_sector_log_idx == search_start_sector_log) {
-            initial_offset_for_first_sector = g_found_offset_in_sector + 1;
-        }
-        else if (g_found_len <= 0) { /* If start_from_next_byte is true, but no prior global find */
-            /* This case is less common; implies advancing from current view pos */
-            initial_offset_for_first_sector = current_data_offset_in_sector + 1; /* Or another relevant start point */
-            /* Ensure it's within bounds of where current_data_offset_in_sector might be */
-            if (current_track_display.loaded && current_track_display.sector_size > 0 &&
-                initial_offset_for_first_sector >= (long)current_track_display.sector_size) {
-                initial_offset_for_first_sector = current_track_display.sector_size; /* Will search 0 bytes in this specific case */
-            }
-        }
-        /* if g_found_len > 0 but on different track/sector, start_from_next_byte on a new track/sector implies start from 0 */
-    }
-
-    primary_sector_data = (uint8_t*)malloc(LIBIMD_MAX_SECTOR_SIZE);
-    processed_primary_sector_data = (uint8_t*)malloc(LIBIMD_MAX_SECTOR_SIZE);
-    next_sector_data = (uint8_t*)malloc(LIBIMD_MAX_SECTOR_SIZE);
-    processed_next_sector_data = (uint8_t*)malloc(LIBIMD_MAX_SECTOR_SIZE);
-
-    if (!primary_sector_data || !processed_primary_sector_data || !next_sector_data || !processed_next_sector_data) {
-        display_error("Memory allocation failed for search buffers.");
-        search_status = -1;
-        goto cleanup_find_pattern;
-    }
-
-    for (size_t tk_idx = search_start_track; tk_idx < total_tracks_in_image; ++tk_idx) {
-        const ImdTrackInfo* search_track_info_ptr = imdf_get_track_info(g_imdf_handle, tk_idx);
-        if (!search_track_info_ptr || !search_track_info_ptr->loaded) continue;
-
-        uint32_t sec_idx_start_loop = (tk_idx == search_start_track) ? search_start_sector_log : 0;
-
-        for (uint32_t sec_log_idx = sec_idx_start_loop; sec_log_idx < search_track_info_ptr->num_sectors; ++sec_log_idx) {
-            int primary_sector_actual_size = load_specific_sector_data(tk_idx, sec_log_idx, primary_sector_data, LIBIMD_MAX_SECTOR_SIZE, NULL);
-
-            if (primary_sector_actual_size == 0) {
-                if (tk_idx == search_start_track && sec_log_idx == search_start_sector_log) {
-                    initial_offset_for_first_sector = 0; /* Reset for next viable sector */
-                }
-                continue;
-            }
-
-            for (int k = 0; k < primary_sector_actual_size; ++k) {
-                uint8_t val = primary_sector_data[k] ^ xor_mask;
-                if (is_text_search && current_charset == CHARSET_EBCDIC) {
-                    processed_primary_sector_data[k] = ebcdic_to_ascii[val];
-                }
-                else {
-                    processed_primary_sector_data[k] = val;
-                }
-            }
-
-            long offset_in_sector_to_search_from = 0;
-            if (tk_idx == search_start_track && sec_log_idx == search_start_sector_log) {
-                offset_in_sector_to_search_from = initial_offset_for_first_sector;
-            }
-            /* Ensure the offset is not negative or excessively large */
-            if (offset_in_sector_to_search_from < 0) offset_in_sector_to_search_from = 0;
-            if (offset_in_sector_to_search_from >= primary_sector_actual_size) {
-                /* Effectively, no search in this sector if starting point is already at or past the end */
-                offset_in_sector_to_search_from = primary_sector_actual_size;
-            }
+int find_all_start_workers(const uint8_t* term, int term_len, const CompiledPattern* cp, int is_text_search) {
+    int num_workers = (int)(total_tracks_in_image / FIND_ALL_MIN_TRACKS);
+    FindAllJob* job;
+
+    if (num_workers > FIND_ALL_MAX_WORKERS) num_workers = FIND_ALL_MAX_WORKERS;
+    if (num_workers < 2 || !g_image_path) return 0;
+    job = search_job_create(cp, is_text_search, num_workers);
+    if (!job) return 0;
+    for (int i = 0; i < num_workers; ++i) {
+        search_job_init_worker(job, i, term, term_len, total_tracks_in_image * (size_t)i / (size_t)num_workers,
+            total_tracks_in_image * (size_t)(i + 1) / (size_t)num_workers, 0, 0);
+    }
+    return search_job_start(job);
+}
 
+/*
+ * Starts find next on a worker thread, from the given sector and offset to
+ * the end of the image. Returns 0, leaving the search to the UI thread, if
+ * the worker could not be started.
+ */
+int search_worker_start(const uint8_t* term, int term_len, const CompiledPattern* cp, int is_text_search,
+    size_t track_idx, uint32_t sector_log_idx, long start_offset) {
+    FindAllJob* job;
+
+    if (!g_image_path || track_idx >= total_tracks_in_image) return 0;
+    job = search_job_create(cp, is_text_search, 1);
+    if (!job) return 0;
+    job->find_next = 1;
+    search_job_init_worker(job, 0, term, term_len, track_idx, total_tracks_in_image, sector_log_idx, start_offset);
+    return search_job_start(job);
+}
 
-            /* Pass 1: Search within the primary sector */
-            if (raw_term_len <= primary_sector_actual_size) { /* Optimization */
-                for (long i = offset_in_sector_to_search_from; (i + (long)raw_term_len) <= primary_sector_actual_size; ++i) {
-                    if (memcmp(processed_primary_sector_data + i, raw_term, raw_term_len) == 0) {
-                        *out_found_track_idx = tk_idx;
-                        *out_found_sector_log_idx = sec_log_idx;
-                        *out_found_offset_in_sector = i;
-                        *out_found_actual_len = raw_term_len;
-                        search_status = 1;
-                        goto cleanup_find_pattern;
-                    }
-                }
-            }
+/*
+ * Checks on find next running on a worker. Returns -1 while it runs, 0 once
+ * it is done (*matched says whether it found one, and where), or 1 if the
+ * worker could not read the image (the caller scans on the UI thread instead).
+ */
+int search_worker_poll(int* matched, StreamPosition* found, StreamPosition* end, int* match_len) {
+    FindAllJob* job = g_find_all_job;
+    const FindAllWorker* w = &job->workers[0];
+    int finished, failed;
+
+    pthread_mutex_lock(&job->lock);
+    finished = job->finished;
+    pthread_mutex_unlock(&job->lock);
+    if (finished < job->started) return -1;
+
+    failed = w->failed;
+    *matched = !failed && w->count > 0;
+    if (*matched) {
+        *found = w->results[0].pos;
+        *end = w->results[0].end;
+        *match_len = w->results[0].match_len;
+    }
+    search_stop_workers();
+    return failed;
+}
 
-            /* Pass 2: Search for spans into the next sector (if raw_term_len > 1) */
-            if (raw_term_len > 1) {
-                for (int len_in_primary = 1; len_in_primary < raw_term_len; ++len_in_primary) {
-                    if (primary_sector_actual_size < len_in_primary) continue;
+/* Track the find-next worker is scanning */
+size_t search_worker_track(void) {
+    FindAllJob* job = g_find_all_job;
+    size_t track;
 
-                    long primary_match_start_offset = primary_sector_actual_size - len_in_primary;
+    pthread_mutex_lock(&job->lock);
+    track = job->workers[0].progress_track;
+    pthread_mutex_unlock(&job->lock);
+    return track;
+}
 
-                    if (primary_match_start_offset < offset_in_sector_to_search_from &&
-                        (tk_idx == search_start_track && sec_log_idx == search_start_sector_log)) {
-                        continue;
-                    }
-                    if (primary_match_start_offset < 0) continue; /* Should not happen if primary_sector_actual_size >= len_in_primary */
+/* A find all or find next runs on worker threads */
+int search_workers_running(void) {
+    return g_find_all_job != NULL;
+}
 
+/* The search on worker threads is find next */
+int search_worker_find_next(void) {
+    return g_find_all_job != NULL && g_find_all_job->find_next;
+}
 
-                    if (memcmp(processed_primary_sector_data + primary_match_start_offset, raw_term, len_in_primary) == 0) {
-                        int remaining_len = raw_term_len - len_in_primary;
-                        size_t next_s_trk_idx = tk_idx;
-                        uint32_t next_s_sec_log_idx = sec_log_idx + 1;
-                        const ImdTrackInfo* next_lookup_track_info = imdf_get_track_info(g_imdf_handle, next_s_trk_idx);
+/* Tracks the workers have scanned so far */
+size_t find_all_workers_progress(int* num_workers) {
+    FindAllJob* job = g_find_all_job;
+    size_t done = 0;
+
+    *num_workers = job->num_workers;
+    pthread_mutex_lock(&job->lock);
+    for (int i = 0; i < job->num_workers; ++i) {
+        const FindAllWorker* w = &job->workers[i];
+        size_t at = w->progress_track < w->end_track ? w->progress_track : w->end_track;
+        done += at - w->first_track;
+    }
+    pthread_mutex_unlock(&job->lock);
+    return done;
+}
 
-                        if (!next_lookup_track_info || !next_lookup_track_info->loaded) continue;
+/* Sequential re-scan used by the merge, reading like the workers did */
+typedef struct {
+    ImdImageFile* handle;
+    SectorOrderCache order;
+    PatternSearch search;
+} FindAllRescan;
+
+/* Finds the first wildcard/regex match at or after from, as one scan would. Returns 1 if found. */
+static int find_all_rescan_next(FindAllJob* job, FindAllRescan* rescan, const StreamPosition* from, StreamPosition* found) {
+    PatternSearch* search = &rescan->search;
+    pattern_search_begin(search, NULL, 0, &job->pattern, job->is_text_search, from->track_idx, from->sector_log_idx, from->offset);
+    search->stream.handle = rescan->handle;
+    search->stream.order = &rescan->order;
+    search->stream.edits = job->edits;
+    search->stream.edit_count = job->edit_count;
+    return pattern_search_step(search, 0, found) == 1;
+}
 
-                        if (next_s_sec_log_idx >= next_lookup_track_info->num_sectors) {
-                            next_s_trk_idx++;
-                            next_s_sec_log_idx = 0;
-                            if (next_s_trk_idx >= total_tracks_in_image) continue;
-                        }
+/*
+ * Decides a worker's wildcard/regex result against the merged list, which
+ * ends at prev_end. The worker found 'next' as the first match of a scan it
+ * began at 'fresh'; if that is after prev_end, matches it skipped are added
+ * from a re-scan first. Returns 1 to append 'next' (NULL: the range is
+ * done), 0 if one scan would not report it, -1 if the image could not be read.
+ */
+static int find_all_merge_check(FindAllJob* job, FindAllRescan* rescan, const StreamPosition* fresh,
+    const FindAllResult* next, size_t end_track, StreamPosition* prev_end) {
+    for (;;) {
+        StreamPosition found;
+        FindAllResult* result;
+        uint8_t context[FIND_ALL_CONTEXT];
+        int context_len;
+
+        if (next && stream_position_compare(&next->pos, prev_end) < 0) return 0;
+        if (stream_position_compare(fresh, prev_end) <= 0) return 1;
+        if (!rescan->handle) {
+            if (imdf_open(g_image_path, 1, &rescan->handle) != IMDF_ERR_OK) {
+                rescan->handle = NULL;
+                return -1;
+            }
+            rescan->order.track_idx = (size_t)-1;
+        }
+        if (!find_all_rescan_next(job, rescan, prev_end, &found)) return next ? 0 : 1;
+        if (next && stream_position_compare(&found, &next->pos) == 0 &&
+            stream_position_compare(&rescan->search.match_end_pos, &next->end) == 0) {
+            return 1;               /* Back in step with the worker */
+        }
+        if (!next && found.track_idx >= end_track) return 1; /* The next range's worker has it */
+        result = find_all_list_append(&g_find_all_results, &g_find_all_count, &g_find_all_capacity);
+        if (!result) return 1;
+        context_len = pattern_search_match_context(&rescan->search, context, FIND_ALL_CONTEXT);
+        find_all_result_init(result, rescan->handle, &rescan->order, &found, &rescan->search.match_end_pos,
+            (int)rescan->search.match_len, context, context_len);
+        *prev_end = rescan->search.match_end_pos;
+    }
+}
 
-                        int next_sector_actual_s = load_specific_sector_data(next_s_trk_idx, next_s_sec_log_idx, next_sector_data, LIBIMD_MAX_SECTOR_SIZE, NULL);
-
-                        if (next_sector_actual_s >= remaining_len) {
-                            for (int k = 0; k < remaining_len; ++k) {
-                                uint8_t val = next_sector_data[k] ^ xor_mask;
-                                if (is_text_search && current_charset == CHARSET_EBCDIC) {
-                                    processed_next_sector_data[k] = ebcdic_to_ascii[val];
-                                }
-                                else {
-                                    processed_next_sector_data[k] = val;
-                                }
-                            }
-                            if (memcmp(processed_next_sector_data, raw_term + len_in_primary, remaining_len) == 0) {
-                                *out_found_track_idx = tk_idx;
-                                *out_found_sector_log_idx = sec_log_idx;
-                                *out_found_offset_in_sector = primary_match_start_offset;
-                                *out_found_actual_len = raw_term_len;
-                                search_status = 1;
-                                goto cleanup_find_pattern;
-                            }
-                        }
-                    }
+/*
+ * Checks on the threaded find all. Returns -1 while workers run, 0 once their
+ * results are in the find-all list, or 1 if a worker could not read the image
+ * (the caller runs the search on the UI thread instead).
+ */
+int find_all_workers_poll(void) {
+    FindAllJob* job = g_find_all_job;
+    static FindAllRescan rescan;    /* Large search window */
+    StreamPosition prev_end;
+    int have_prev_end = 0;
+    int finished, failed = 0;
+
+    pthread_mutex_lock(&job->lock);
+    finished = job->finished;
+    pthread_mutex_unlock(&job->lock);
+    if (finished < job->started) return -1;
+
+    for (int i = 0; i < job->num_workers; ++i) failed |= job->workers[i].failed;
+    g_find_all_count = 0;
+    rescan.handle = NULL;
+    for (int i = 0; i < job->num_workers && !failed; ++i) {
+        const FindAllWorker* w = &job->workers[i];
+        StreamPosition fresh;       /* Where the worker's scan for its next result began */
+        fresh.track_idx = w->first_track;
+        fresh.sector_log_idx = 0;
+        fresh.offset = 0;
+        /* The previous worker reported every match starting before this range */
+        if (have_prev_end && stream_position_compare(&prev_end, &fresh) < 0) prev_end = fresh;
+        for (size_t r = 0; r <= w->count; ++r) {
+            const FindAllResult* next = r < w->count ? &w->results[r] : NULL;
+            FindAllResult* result;
+            if (job->has_pattern && have_prev_end) {
+                int check = find_all_merge_check(job, &rescan, &fresh, next, w->end_track, &prev_end);
+                if (check < 0) { failed = 1; break; }
+                if (check == 0) {
+                    fresh = next->end;
+                    continue;
                 }
             }
-
-            if (tk_idx == search_start_track && sec_log_idx == search_start_sector_log) {
-                initial_offset_for_first_sector = 0; /* Processed the first specific sector, subsequent ones start at 0 */
+            if (!next) break;
+            result = find_all_list_append(&g_find_all_results, &g_find_all_count, &g_find_all_capacity);
+            if (!result) break;
+            *result = *next;
+            if (job->has_pattern) {
+                prev_end = next->end;
+                fresh = next->end;
+                have_prev_end = 1;
             }
         }
-        search_start_sector_log = 0; /* For next track, start search from its sector 0 */
     }
+    if (rescan.handle) imdf_close(rescan.handle);
+    search_stop_workers();
+    return failed;
+}
+
+#endif /* IMDV_HAVE_THREADS */
 
-cleanup_find_pattern:
-    if (primary_sector_data) free(primary_sector_data);
-    if (processed_primary_sector_data) free(processed_primary_sector_data);
-    if (next_sector_data) free(next_sector_data);
-    if (processed_next_sector_data) free(processed_next_sector_data);
-    return search_status;
+/* Finds every occurrence of the last search term in the whole image */
+void find_all_last_search(void) {
+    clear_search_highlight();
+    if (last_search_type == SEARCH_TYPE_TEXT) {
+        start_search((const uint8_t*)last_search_term_text, (int)strlen(last_search_term_text), NULL, 1, 0, 0, 0, 1);
+    }
+    else if (last_search_type == SEARCH_TYPE_HEX) {
+        start_search(last_search_term_hex, last_search_term_hex_len, NULL, 0, 0, 0, 0, 1);
+    }
+    else if (last_search_type == SEARCH_TYPE_HEX_PATTERN || last_search_type == SEARCH_TYPE_REGEX) {
+        int is_hex_pattern = (last_search_type == SEARCH_TYPE_HEX_PATTERN);
+        const char* error = compile_search_pattern(&g_search_pattern, last_search_pattern, is_hex_pattern);
+        if (error) { display_error(error); return; }
+        start_search(NULL, 0, &g_search_pattern, !is_hex_pattern, 0, 0, 0, 1);
+    }
+    else {
+        update_status("No search term for Find All (use F3, F4 or F8 first)."); doupdate(); beep();
+    }
 }
 
 void search_text_from_current(const char* term, int start_from_next_byte) {
     size_t term_len;
-    int search_result;
-    size_t found_tk_idx;
-    uint32_t found_sec_log_idx;
-    long found_offset;
-    int found_term_len;
 
     if (term == NULL || (term_len = strlen(term)) == 0) {
         update_status("Search: No text term provided."); doupdate();
@@ -1811,69 +5679,11 @@ void search_text_from_current(const char* term, int start_from_next_byte) {
         return;
     }
 
-    update_status("Searching for text..."); doupdate();
-
-    search_result = find_pattern_in_image(
-        (const uint8_t*)term, (int)term_len,
-        1, /* is_text_search = true */
-        start_from_next_byte,
-        &found_tk_idx, &found_sec_log_idx, &found_offset, &found_term_len
-    );
-
-    if (search_result == 1) { /* Found */
-        current_track_index_in_image = found_tk_idx;
-        current_sector_logical_idx = found_sec_log_idx;
-        /* current_data_offset_in_sector will be handled by adjust_view_for_match */
-
-        if (load_track_for_display(current_track_index_in_image) != 0) {
-            /* Error displayed by load_track_for_display */
-            clear_search_highlight(); /* Clean up search state */
-            return;
-        }
-        /* current_sector_logical_idx is already set, load_sector_for_display will use it */
-        if (load_sector_for_display() != 0) {
-            /* Error displayed by load_sector_for_display */
-            clear_search_highlight();
-            return;
-        }
-
-        g_found_on_track_idx = found_tk_idx;
-        g_found_on_sector_log_idx = found_sec_log_idx;
-        g_found_offset_in_sector = found_offset;
-        g_found_len = found_term_len;
-
-        adjust_view_for_match(found_offset, found_term_len);
-        snprintf(status_message, sizeof(status_message), "Found at Trk:%zu SecLogIdx:%u Offset:%ld", found_tk_idx, found_sec_log_idx, found_offset);
-        update_status(status_message);
-        draw_info_window();
-        draw_data_window();
-        doupdate();
-    }
-    else if (search_result == 0) { /* Not found */
-        update_status("Search: Text not found."); doupdate();
-        beep();
-        clear_search_highlight(); /* Important to clear if not found */
-        /* Redraw to remove any old highlights if necessary, though clear_search_highlight should trigger it */
-        draw_data_window();
-        doupdate();
-    }
-    else { /* search_result == -1, Error (e.g., memory allocation) */
-        /* display_error was called by find_pattern_in_image */
-        clear_search_highlight();
-        /* Redraw to ensure UI is consistent after error popup */
-        draw_info_window();
-        draw_data_window();
-        doupdate();
-    }
+    start_search((const uint8_t*)term, (int)term_len, NULL, 1,
+        current_track_index_in_image, current_sector_logical_idx, search_start_offset(start_from_next_byte), 0);
 }
 
 void search_hex_from_current(const uint8_t* hex_term, int term_len, int start_from_next_byte) {
-    int search_result;
-    size_t found_tk_idx;
-    uint32_t found_sec_log_idx;
-    long found_offset;
-    int found_term_len_actual;
-
     if (hex_term == NULL || term_len == 0) {
         update_status("Search: No hex term provided."); doupdate();
         clear_search_highlight();
@@ -1886,53 +5696,38 @@ void search_hex_from_current(const uint8_t* hex_term, int term_len, int start_fr
         return;
     }
 
-    update_status("Searching for hex..."); doupdate();
-
-    search_result = find_pattern_in_image(
-        hex_term, term_len,
-        0, /* is_text_search = false */
-        start_from_next_byte,
-        &found_tk_idx, &found_sec_log_idx, &found_offset, &found_term_len_actual
-    );
-
-    if (search_result == 1) { /* Found */
-        current_track_index_in_image = found_tk_idx;
-        current_sector_logical_idx = found_sec_log_idx;
-
-        if (load_track_for_display(current_track_index_in_image) != 0) {
-            clear_search_highlight();
-            return;
-        }
-        if (load_sector_for_display() != 0) {
-            clear_search_highlight();
-            return;
-        }
+    start_search(hex_term, term_len, NULL, 0,
+        current_track_index_in_image, current_sector_logical_idx, search_start_offset(start_from_next_byte), 0);
+}
 
-        g_found_on_track_idx = found_tk_idx;
-        g_found_on_sector_log_idx = found_sec_log_idx;
-        g_found_offset_in_sector = found_offset;
-        g_found_len = found_term_len_actual;
+/*
+ * Searches for a wildcard hex pattern (binary data, XOR mask applied) or a
+ * regular expression (text, charset translated) from the current position.
+ */
+void search_pattern_from_current(const char* pattern, int is_hex_pattern, int start_from_next_byte) {
+    const char* error;
 
-        adjust_view_for_match(found_offset, found_term_len_actual);
-        snprintf(status_message, sizeof(status_message), "Found hex at Trk:%zu SecLogIdx:%u Offset:%ld", found_tk_idx, found_sec_log_idx, found_offset);
-        update_status(status_message);
-        draw_info_window();
-        draw_data_window();
-        doupdate();
-    }
-    else if (search_result == 0) { /* Not found */
-        update_status("Search: Hex pattern not found."); doupdate();
-        beep();
+    if (pattern == NULL || pattern[0] == '\0') {
+        update_status("Search: No pattern provided."); doupdate();
         clear_search_highlight();
-        draw_data_window();
-        doupdate();
+        return;
     }
-    else { /* search_result == -1, Error */
+    error = compile_search_pattern(&g_search_pattern, pattern, is_hex_pattern);
+    if (error) {
+        display_error(error);
         clear_search_highlight();
-        draw_info_window();
-        draw_data_window();
-        doupdate();
+        return;
+    }
+
+    if (start_from_next_byte && g_found_len > 0 && g_found_end_offset >= 0 &&
+        g_found_on_track_idx == current_track_index_in_image && g_found_on_sector_log_idx == current_sector_logical_idx) {
+        /* Matches do not overlap: continue just past the highlighted one */
+        start_search(NULL, 0, &g_search_pattern, !is_hex_pattern,
+            g_found_end_track_idx, g_found_end_sector_log_idx, g_found_end_offset, 0);
+        return;
     }
+    start_search(NULL, 0, &g_search_pattern, !is_hex_pattern,
+        current_track_index_in_image, current_sector_logical_idx, search_start_offset(start_from_next_byte), 0);
 }
 
 void repeat_last_search(void) {
@@ -1947,6 +5742,9 @@ void repeat_last_search(void) {
     else if (last_search_type == SEARCH_TYPE_HEX) {
         search_hex_from_current(last_search_term_hex, last_search_term_hex_len, 1);
     }
+    else if (last_search_type == SEARCH_TYPE_HEX_PATTERN || last_search_type == SEARCH_TYPE_REGEX) {
+        search_pattern_from_current(last_search_pattern, last_search_type == SEARCH_TYPE_HEX_PATTERN, 1);
+    }
 }
 
 
@@ -2020,26 +5818,17 @@ void edit_sector(void) {
         }
 
 
-        if (redraw_needed) {
-            if (current_track_display.sector_size > 0) {
-                memcpy(current_sector_buffer, edit_buffer, current_track_display.sector_size);
-                draw_data_window();
-            }
-            else {
-                draw_data_window();
-            }
-            redraw_needed = 0;
+        /* Only the lines that changed (an edited byte, the last cursor cell) are repainted */
+        if (current_track_display.sector_size > 0) {
+            memcpy(current_sector_buffer, edit_buffer, current_track_display.sector_size);
         }
+        draw_data_window();
+        redraw_needed = 0;
 
         int cursor_line_in_window = (int)((edit_cursor_offset_in_sector - current_data_offset_in_sector) / BYTES_PER_LINE);
         int cursor_col_offset_in_byte_line = (int)((edit_cursor_offset_in_sector - current_data_offset_in_sector) % BYTES_PER_LINE);
         int screen_col_for_byte;
 
-        if (memcmp(current_sector_buffer, edit_buffer, current_track_display.sector_size) != 0) {
-            memcpy(current_sector_buffer, edit_buffer, current_track_display.sector_size);
-            draw_data_window();
-        }
-
         if (current_track_display.sector_size > 0 && cursor_line_in_window >= 0 && cursor_line_in_window < data_win_h) {
             if (current_edit_mode == EDIT_MODE_HEX) {
                 screen_col_for_byte = 6 + (cursor_col_offset_in_byte_line * 3) + (cursor_col_offset_in_byte_line / 8) + 1;
@@ -2058,6 +5847,7 @@ void edit_sector(void) {
                 wattron(win_data, COLOR_PAIR(CP_EDIT_HEX) | A_REVERSE);
                 mvwprintw(win_data, cursor_line_in_window, screen_col_for_byte, "%02X", display_byte_val);
                 wattroff(win_data, COLOR_PAIR(CP_EDIT_HEX) | A_REVERSE);
+                data_window_damage_line(cursor_line_in_window);
                 wmove(win_data, cursor_line_in_window, screen_col_for_byte + (cursor_on_first_nibble_char_pos ? 0 : 1));
             }
             else { /* EDIT_MODE_ASCII */
@@ -2070,6 +5860,7 @@ void edit_sector(void) {
                 wattron(win_data, COLOR_PAIR(CP_EDIT_ASC) | A_REVERSE);
                 mvwaddch(win_data, cursor_line_in_window, screen_col_for_byte, char_to_display_ascii);
                 wattroff(win_data, COLOR_PAIR(CP_EDIT_ASC) | A_REVERSE);
+                data_window_damage_line(cursor_line_in_window);
                 wmove(win_data, cursor_line_in_window, screen_col_for_byte);
             }
         }
@@ -2081,6 +5872,16 @@ void edit_sector(void) {
 
         int ch = wgetch(win_data);
 
+        if (ch == ERR && exit_signal_pending()) {
+            /* Keep the sector being edited, so it reaches the recovery file */
+            if (data_modified_this_edit_session) {
+                edit_journal_record(current_track_display.cyl, current_track_display.head,
+                    (uint8_t)current_sector_logical_id, original_sector_data_at_edit_start, edit_buffer,
+                    current_track_display.sector_size);
+            }
+            exit_on_signal(exit_signal_pending());
+        }
+
         if (pending_nibble_value != -1) {
             int is_nav_key_or_mode_switch = (ch == KEY_UP || ch == KEY_DOWN || ch == KEY_LEFT || ch == KEY_RIGHT ||
                 ch == KEY_PPAGE || ch == KEY_NPAGE || ch == KEY_HOME || ch == KEY_END ||
@@ -2139,60 +5940,38 @@ void edit_sector(void) {
             curs_set(0);
 
             if (data_modified_this_edit_session && ch != ESC_KEY && ch != KEY_F(10)) {
-                update_status("Save sector changes to disk? (Y/N)"); doupdate();
-                timeout(-1); int confirm_ch; do { confirm_ch = tolower(wgetch(win_data)); } while (confirm_ch != 'y' && confirm_ch != 'n' && confirm_ch != ESC_KEY); timeout(100);
+                update_status("Keep sector changes? (Y/N)"); doupdate();
+                timeout(-1); int confirm_ch; do { confirm_ch = tolower(modal_getch(win_data)); } while (confirm_ch != 'y' && confirm_ch != 'n' && confirm_ch != ESC_KEY); timeout(100);
 
                 if (confirm_ch == 'y') {
-                    update_status("Writing sector..."); doupdate();
-                    int write_res = imdf_write_sector(g_imdf_handle, current_track_display.cyl, current_track_display.head,
-                        current_sector_logical_id, edit_buffer, current_track_display.sector_size);
+                    /* Buffered in the write-back cache; S or quitting writes it to the image */
+                    int keep_res = edit_journal_record(current_track_display.cyl, current_track_display.head,
+                        (uint8_t)current_sector_logical_id, original_sector_data_at_edit_start, edit_buffer,
+                        current_track_display.sector_size);
 
-                    if (write_res == IMDF_ERR_OK) {
+                    if (keep_res >= 0) {
+                        char kept_msg[sizeof(status_message)];
                         memcpy(current_sector_buffer, edit_buffer, current_track_display.sector_size);
-                        const ImdTrackInfo* updated_imdf_track = imdf_get_track_info(g_imdf_handle, current_track_index_in_image);
-                        if (updated_imdf_track) {
-                            uint32_t preserved_logical_idx = current_sector_logical_idx;
-                            long preserved_data_offset = current_data_offset_in_sector;
-
-                            copy_track_metadata_for_display(updated_imdf_track);
-                            if (current_track_display.num_sectors == 0) {
-                                current_sector_logical_idx = 0; current_data_offset_in_sector = 0;
-                            }
-                            else {
-                                if (preserved_logical_idx >= current_track_display.num_sectors) {
-                                    current_sector_logical_idx = current_track_display.num_sectors - 1; preserved_data_offset = 0;
-                                }
-                                else { current_sector_logical_idx = preserved_logical_idx; }
-
-                                if (preserved_data_offset >= (long)current_track_display.sector_size) {
-                                    current_data_offset_in_sector = 0;
-                                }
-                                else { current_data_offset_in_sector = preserved_data_offset; }
-                            }
-                            load_sector_for_display();
-                        }
-                        else {
-                            display_error("ERR: Post-write track info fetch failed!");
-                        }
+                        snprintf(kept_msg, sizeof(kept_msg), "Sector changes kept: %zu sector(s) unsaved (S=Save, U=Undo).",
+                            dirty_sector_count());
                         draw_info_window();
                         draw_data_window();
-                        update_status("Sector written successfully.");
+                        update_status(kept_msg);
                         doupdate();
 
-                        timeout(1000);
-                        wgetch(win_data);
-                        timeout(100);
+                        wtimeout(win_data, 1000);
+                        modal_getch(win_data);
+                        wtimeout(win_data, -1);
                     }
                     else {
-                        char err_buf[100]; snprintf(err_buf, sizeof(err_buf), "Error writing sector: %d", write_res);
                         memcpy(current_sector_buffer, original_sector_data_at_edit_start, current_track_display.sector_size);
-                        display_error(err_buf);
+                        display_error("Memory allocation failed for edit journal.");
                     }
                 }
                 else {
                     memcpy(current_sector_buffer, original_sector_data_at_edit_start, current_track_display.sector_size);
                     update_status("Changes discarded."); doupdate();
-                    timeout(1000); wgetch(win_data); timeout(100);
+                    timeout(1000); modal_getch(win_data); timeout(100);
                 }
             }
             else if (ch == ESC_KEY || ch == KEY_F(10)) {
@@ -2204,7 +5983,7 @@ void edit_sector(void) {
                     update_status("Edit cancelled (ESC/F10).");
                 }
                 doupdate();
-                timeout(1000); wgetch(win_data); timeout(100);
+                timeout(1000); modal_getch(win_data); timeout(100);
             }
             goto exit_edit_loop;
 
@@ -2311,23 +6090,458 @@ exit_edit_loop:
 }
 
 
+/* --- Headless Script Mode (--script) --- */
+
+/*
+ * imdv --script <file> <image.imd>...
+ *
+ * Runs the same edit script against each image without curses. Edits go
+ * through the write-back cache, so an image is written once, by 'save'.
+ * Commands, one per line ('#' starts a comment; numbers are decimal or 0x hex;
+ * BYTES is hex digits and/or "quoted text"):
+ *
+ *   goto C H S            Sector ID S on cylinder C, head H, offset 0
+ *   seek OFFSET           Offset in the current sector
+ *   write BYTES           Write at the current position and move past them
+ *   fill COUNT BYTE       Write COUNT copies of BYTE
+ *   search BYTES          Move to the next occurrence at or after the position
+ *   replace BYTES = BYTES Replace every occurrence in the image (same length)
+ *   save                  Write all changed sectors to the image
+ *
+ * Writes and matches continue into the following sectors (ID order, then
+ * tracks in image order); sectors without data are skipped by both. Changes not saved by the end of the script are
+ * discarded. An error stops the script for that image without saving.
+ */
+
+#define SCRIPT_MAX_LINE 1024
+#define SCRIPT_MAX_BYTES 4096
+
+typedef struct {
+    size_t track_idx;
+    uint32_t sector_log_idx;        /* Sector ID order */
+    long offset;
+    int positioned;                 /* 0 until the first goto */
+} ScriptPosition;
+
+/* Sector at a logical position: its address and size. Returns 0 if it has no data. */
+static int script_sector(size_t track_idx, uint32_t sector_log_idx, uint8_t* cyl, uint8_t* head, uint8_t* sector_id, uint32_t* size) {
+    const ImdTrackInfo* track = imdf_get_track_info(g_imdf_handle, track_idx);
+    if (!track || !track->loaded || sector_log_idx >= track->num_sectors || track->sector_size == 0) return 0;
+    uint32_t physical_idx = get_sector_order(&g_search_order, track_idx, track, 0)[sector_log_idx];
+    if (!IMD_SDR_HAS_DATA(track->sflag[physical_idx])) return 0;
+    *cyl = track->cyl;
+    *head = track->head;
+    *sector_id = track->smap[physical_idx];
+    *size = track->sector_size;
+    return 1;
+}
+
+/* Moves to the start of the next sector with data. Returns 0 at the end of the image. */
+static int script_next_sector(ScriptPosition* pos) {
+    uint8_t cyl, head, sector_id;
+    uint32_t size;
+    pos->offset = 0;
+    pos->sector_log_idx++;
+    while (pos->track_idx < total_tracks_in_image) {
+        const ImdTrackInfo* track = imdf_get_track_info(g_imdf_handle, pos->track_idx);
+        if (!track || pos->sector_log_idx >= track->num_sectors) {
+            pos->track_idx++;
+            pos->sector_log_idx = 0;
+            continue;
+        }
+        if (script_sector(pos->track_idx, pos->sector_log_idx, &cyl, &head, &sector_id, &size)) return 1;
+        pos->sector_log_idx++;
+    }
+    return 0;
+}
+
+/* Writes bytes at the position, continuing into following sectors. Returns an error message or NULL. */
+static const char* script_put_bytes(ScriptPosition* pos, const uint8_t* bytes, size_t len) {
+    static uint8_t before[LIBIMD_MAX_SECTOR_SIZE], after[LIBIMD_MAX_SECTOR_SIZE];
+    uint8_t cyl, head, sector_id;
+    uint32_t size;
+
+    if (!pos->positioned) return "No sector selected (use goto first)";
+    while (len > 0) {
+        if (!script_sector(pos->track_idx, pos->sector_log_idx, &cyl, &head, &sector_id, &size)) {
+            return "Sector has no data";
+        }
+        if (pos->offset >= (long)size) {
+            if (!script_next_sector(pos)) return "Write runs past the end of the image";
+            continue;
+        }
+        int res = imdf_read_sector(g_imdf_handle, cyl, head, sector_id, before, size);
+        if (res != IMDF_ERR_OK) return "Sector read failed";
+        dirty_sector_overlay(cyl, head, sector_id, before, size);
+        memcpy(after, before, size);
+
+        size_t chunk = size - (uint32_t)pos->offset;
+        if (chunk > len) chunk = len;
+        memcpy(after + pos->offset, bytes, chunk);
+        if (edit_journal_record(cyl, head, sector_id, before, after, size) < 0) return "Out of memory";
+        bytes += chunk;
+        len -= chunk;
+        pos->offset += (long)chunk;
+    }
+    return NULL;
+}
+
+/* Parses hex digits and "quoted text" into bytes. Returns an error message or NULL. */
+static const char* script_parse_bytes(const char** cursor, uint8_t* out, size_t max, size_t* out_len) {
+    const char* p = *cursor;
+    int high = -1;
+    *out_len = 0;
+    for (;;) {
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p == '\0' || *p == '#' || *p == '=') break;
+        if (*p == '"') {
+            if (high >= 0) return "Odd number of hex digits";
+            for (p++; *p && *p != '"'; p++) {
+                if (*p == '\\' && (p[1] == '"' || p[1] == '\\')) p++;
+                if (*out_len == max) return "Too many bytes";
+                out[(*out_len)++] = (uint8_t)*p;
+            }
+            if (*p != '"') return "Unterminated string";
+            p++;
+            continue;
+        }
+        int nibble = ctoh((unsigned char)*p);
+        if (nibble < 0) return "Invalid hex digit";
+        if (high < 0) {
+            high = nibble;
+        }
+        else {
+            if (*out_len == max) return "Too many bytes";
+            out[(*out_len)++] = (uint8_t)((high << 4) | nibble);
+            high = -1;
+        }
+        p++;
+    }
+    if (high >= 0) return "Odd number of hex digits";
+    *cursor = p;
+    return NULL;
+}
+
+static int script_parse_number(const char** cursor, unsigned long* value) {
+    char* end;
+    while (**cursor == ' ' || **cursor == '\t') (*cursor)++;
+    if (!isdigit((unsigned char)**cursor)) return 0;
+    *value = strtoul(*cursor, &end, 0);
+    *cursor = end;
+    return 1;
+}
+
+static int script_at_end(const char* p) {
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+    return *p == '\0' || *p == '#';
+}
+
+/* Finds the pattern at or after the position. Returns 1 and moves there if found. */
+static int script_search(ScriptPosition* pos, const uint8_t* term, int term_len) {
+    static PatternSearch search;    /* Large window */
+    StreamPosition found;
+    pattern_search_begin(&search, term, term_len, NULL, 0, pos->track_idx, pos->sector_log_idx, pos->offset);
+    search.stream.data_only = 1;    /* The same sectors, in the same order, as writes walk */
+    if (pattern_search_step(&search, 0, &found) != 1) return 0;
+    pos->track_idx = found.track_idx;
+    pos->sector_log_idx = found.sector_log_idx;
+    pos->offset = found.offset;
+    return 1;
+}
+
+/* Runs one script command. Returns an error message or NULL; *saved counts sectors written. */
+static const char* script_command(const char* line, ScriptPosition* pos, int* saved) {
+    static uint8_t bytes[SCRIPT_MAX_BYTES], replacement[MAX_SEARCH_TERM];
+    char verb[16];
+    size_t verb_len = 0, len, replacement_len;
+    unsigned long a, b, c;
+    const char* p = line;
+    const char* error;
+
+    while (*p == ' ' || *p == '\t') p++;
+    while (isalpha((unsigned char)*p) && verb_len < sizeof(verb) - 1) verb[verb_len++] = (char)tolower((unsigned char)*p++);
+    verb[verb_len] = '\0';
+    if (verb_len == 0) return script_at_end(p) ? NULL : "Expected a command";
+
+    if (strcmp(verb, "goto") == 0) {
+        uint8_t cyl, head, sector_id;
+        uint32_t size;
+        if (!script_parse_number(&p, &a) || !script_parse_number(&p, &b) || !script_parse_number(&p, &c) || !script_at_end(p)) {
+            return "Usage: goto C H S";
+        }
+        for (size_t t = 0; t < total_tracks_in_image; ++t) {
+            const ImdTrackInfo* track = imdf_get_track_info(g_imdf_handle, t);
+            if (!track || track->cyl != a || track->head != b) continue;
+            for (uint32_t s = 0; s < track->num_sectors; ++s) {
+                if (!script_sector(t, s, &cyl, &head, &sector_id, &size) || sector_id != c) continue;
+                pos->track_idx = t;
+                pos->sector_log_idx = s;
+                pos->offset = 0;
+                pos->positioned = 1;
+                return NULL;
+            }
+        }
+        return "No such sector (or it has no data)";
+    }
+    if (strcmp(verb, "seek") == 0) {
+        uint8_t cyl, head, sector_id;
+        uint32_t size;
+        if (!script_parse_number(&p, &a) || !script_at_end(p)) return "Usage: seek OFFSET";
+        if (!pos->positioned) return "No sector selected (use goto first)";
+        if (!script_sector(pos->track_idx, pos->sector_log_idx, &cyl, &head, &sector_id, &size) || a >= size) {
+            return "Offset is beyond the end of the sector";
+        }
+        pos->offset = (long)a;
+        return NULL;
+    }
+    if (strcmp(verb, "write") == 0) {
+        if ((error = script_parse_bytes(&p, bytes, sizeof(bytes), &len)) != NULL) return error;
+        if (len == 0 || !script_at_end(p)) return "Usage: write BYTES";
+        return script_put_bytes(pos, bytes, len);
+    }
+    if (strcmp(verb, "fill") == 0) {
+        if (!script_parse_number(&p, &a) || !script_parse_number(&p, &b) || !script_at_end(p) || b > 0xFF) {
+            return "Usage: fill COUNT BYTE";
+        }
+        if (a > sizeof(bytes)) return "Fill count too large";
+        memset(bytes, (int)b, (size_t)a);
+        return script_put_bytes(pos, bytes, (size_t)a);
+    }
+    if (strcmp(verb, "search") == 0) {
+        if ((error = script_parse_bytes(&p, bytes, MAX_SEARCH_TERM, &len)) != NULL) return error;
+        if (len == 0 || !script_at_end(p)) return "Usage: search BYTES";
+        if (!pos->positioned) {
+            pos->track_idx = 0; pos->sector_log_idx = 0; pos->offset = 0; pos->positioned = 1;
+        }
+        return script_search(pos, bytes, (int)len) ? NULL : "Not found";
+    }
+    if (strcmp(verb, "replace") == 0) {
+        ScriptPosition at = { 0, 0, 0, 1 };
+        int count = 0;
+        if ((error = script_parse_bytes(&p, bytes, MAX_SEARCH_TERM, &len)) != NULL) return error;
+        if (len == 0 || *p++ != '=') return "Usage: replace BYTES = BYTES";
+        if ((error = script_parse_bytes(&p, replacement, sizeof(replacement), &replacement_len)) != NULL) return error;
+        if (!script_at_end(p)) return "Usage: replace BYTES = BYTES";
+        if (replacement_len != len) return "Replacement must be the same length as the search bytes";
+        /* Resume after each replacement, so replaced bytes are never matched again */
+        while (script_search(&at, bytes, (int)len)) {
+            if ((error = script_put_bytes(&at, replacement, replacement_len)) != NULL) return error;
+            count++;
+        }
+        printf("  replace: %d occurrence%s\n", count, count == 1 ? "" : "s");
+        return NULL;
+    }
+    if (strcmp(verb, "save") == 0) {
+        static char err[100];
+        int written;
+        if (!script_at_end(p)) return "Usage: save";
+        written = write_dirty_sectors(err, sizeof(err));
+        if (written < 0) return err;
+        *saved += written;
+        return NULL;
+    }
+    return "Unknown command";
+}
+
+/* Runs the script against each image. Returns the process exit status. */
+int run_script(const char* script_path, char** images, int num_images) {
+    static char line[SCRIPT_MAX_LINE];
+    int failed = 0;
+    FILE* script = fopen(script_path, "r");
+
+    if (!script) {
+        fprintf(stderr, "Error: Cannot open script '%s'.\n", script_path);
+        return 1;
+    }
+    for (int i = 0; i < num_images; ++i) {
+        ScriptPosition pos = { 0, 0, 0, 0 };
+        const char* error = NULL;
+        int line_no = 0, saved = 0, wp_stat = 0;
+        int res = imdf_open(images[i], 0, &g_imdf_handle);
+
+        g_image_path = images[i];   /* Saving writes a copy next to it */
+        if (res != IMDF_ERR_OK) {
+            fprintf(stderr, "Error: Cannot open IMD file '%s' using libimdf (Error %d).\n", images[i], res);
+            failed = 1;
+            continue;
+        }
+        imdf_get_write_protect(g_imdf_handle, &wp_stat);
+        total_tracks_in_image = 0;
+        imdf_get_num_tracks(g_imdf_handle, &total_tracks_in_image);
+        g_search_order.track_idx = (size_t)-1;
+        printf("%s:\n", images[i]);
+
+        rewind(script);
+        while (!wp_stat && fgets(line, sizeof(line), script)) {
+            line_no++;
+            if (strchr(line, '\n') == NULL && !feof(script)) {
+                error = "Line too long";
+                break;
+            }
+            line[strcspn(line, "\r\n")] = '\0';
+            if ((error = script_command(line, &pos, &saved)) != NULL) break;
+        }
+        fflush(stdout);
+        if (wp_stat) {
+            fprintf(stderr, "%s: Image is write-protected, skipped.\n", images[i]);
+            failed = 1;
+        }
+        else if (error) {
+            fprintf(stderr, "%s:%d: %s (%s)\n", script_path, line_no, error, images[i]);
+            failed = 1;
+        }
+        if (!error && dirty_sector_count() > 0) {
+            fprintf(stderr, "%s: Warning: %zu changed sector(s) not saved (no 'save' at the end of the script).\n",
+                images[i], dirty_sector_count());
+        }
+        if (wp_stat || error) {
+            if (saved > 0) printf("  %d sector(s) written before the error, later changes discarded\n", saved);
+        }
+        else {
+            printf("  %d sector(s) written\n", saved);
+        }
+
+        edit_cache_free();
+        sector_cache_clear();
+        imdf_close(g_imdf_handle);
+        g_imdf_handle = NULL;
+    }
+    fclose(script);
+    return failed ? 1 : 0;
+}
+
+
+/* --- Recovery File on SIGHUP/SIGTERM --- */
+
+/*
+ * Kept edits live only in memory until S or quit. If the terminal goes away
+ * (SIGHUP) or imdv is asked to stop (SIGTERM), the unsaved edits are written
+ * to <image>.recover as a --script file instead of being lost; the image
+ * itself is left untouched. Replay with: imdv --script <image>.recover <image>
+ */
+
+#define RECOVERY_CHUNK_BYTES 256    /* Keeps each 'write' line under SCRIPT_MAX_LINE */
+
+#ifndef _WIN32
+static volatile sig_atomic_t g_exit_signal = 0;
+
+static void exit_signal_handler(int sig) {
+    g_exit_signal = sig;            /* Acted on by the main loop and modal_getch(), outside the handler */
+}
+
+/* Installs the handler without SA_RESTART, so a blocking wgetch() returns and the signal is seen */
+void install_exit_signal_handlers(void) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = exit_signal_handler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGHUP, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+}
+#endif
+
+/* Signal that should end imdv, or 0 */
+int exit_signal_pending(void) {
+#ifndef _WIN32
+    return g_exit_signal;
+#else
+    return 0;
+#endif
+}
+
+/*
+ * wgetch() for prompts and panels that wait on their own key loop. Once
+ * SIGHUP/SIGTERM interrupts the wait it leaves through exit_on_signal()
+ * rather than returning ERR: after a hangup wgetch() fails at once for
+ * ever, and the loop would spin without reaching the main loop.
+ */
+int modal_getch(WINDOW* win) {
+    int ch = wgetch(win);
+    if (ch == ERR && exit_signal_pending()) exit_on_signal(exit_signal_pending());
+    return ch;
+}
+
+/* Writes every unsaved edit as script commands. Returns the number of sectors written, or -1. */
+int write_recovery_file(const char* path) {
+    FILE* f = fopen(path, "w");
+    int sectors = 0;
+
+    if (!f) return -1;
+    fprintf(f, "# imdv recovery file: unsaved edits to %s\n", g_image_path ? g_image_path : current_filename_base);
+    fprintf(f, "# Replay with: imdv --script %s <image.imd>\n", path);
+    for (size_t i = 0; i < g_dirty_count; ++i) {
+        const DirtySector* d = &g_dirty_sectors[i];
+        uint32_t pos = 0;
+        if (memcmp(d->data, d->saved, d->size) == 0) continue;
+        fprintf(f, "goto %u %u %u\n", d->cyl, d->head, d->sector_id);
+        while (pos < d->size) {
+            uint32_t end;
+            if (d->data[pos] == d->saved[pos]) { pos++; continue; }
+            /* One changed run, split into lines the script reader accepts */
+            for (end = pos; end < d->size && end - pos < RECOVERY_CHUNK_BYTES && d->data[end] != d->saved[end]; ++end);
+            fprintf(f, "seek %u\nwrite ", pos);
+            for (; pos < end; ++pos) fprintf(f, "%02X", d->data[pos]);
+            fputc('\n', f);
+        }
+        sectors++;
+    }
+    fprintf(f, "save\n");
+    if (fclose(f) != 0) return -1;
+    return sectors;
+}
+
+/* Leaves after SIGHUP/SIGTERM, first saving unsaved edits to the recovery file */
+void exit_on_signal(int sig) {
+    char path[MAX_FILENAME + 16];
+    size_t unsaved = dirty_sector_count();
+    int written = -1;
+
+#ifdef IMDV_HAVE_THREADS
+    search_stop_workers();          /* Join them before their handles and snapshot go away */
+    prefetch_stop();
+    diff_stop_worker();
+#endif
+    cleanup_ui();
+    if (unsaved > 0 && g_image_path && strlen(g_image_path) + 9 < sizeof(path)) {
+        snprintf(path, sizeof(path), "%s.recover", g_image_path);
+        written = write_recovery_file(path);
+        if (written >= 0) fprintf(stderr, "imdv: signal %d, %d unsaved sector(s) written to %s\n", sig, written, path);
+    }
+    if (unsaved > 0 && written < 0) fprintf(stderr, "imdv: signal %d, %zu unsaved sector(s) lost\n", sig, unsaved);
+    if (g_imdf_handle) imdf_close(g_imdf_handle);
+    exit(EXIT_FAILURE);
+}
+
 int main(int argc, char* argv[]) {
     char* input_filename = NULL;
+    char* compare_filename = NULL;
     const char* base_filename_ptr = NULL;
     int imdf_res;
+    int build_index = 0;
 
     if (argc < 2 || strcmp(argv[1], "--help") == 0 || strcmp(argv[1], "/?") == 0) {
         fprintf(stderr, "ImageDisk Viewer (IMDF) %s [%s]\n", CMAKE_VERSION_STR, GIT_VERSION_STR);
         fprintf(stderr, "Copyright (C) 2025 - Howard M. Harte - https://github.com/hharte/imd-utils\n\n");
-        fprintf(stderr, "Usage: %s <image.imd> [options]\n", get_basename(argv[0]));
+        fprintf(stderr, "Usage: %s <image.imd> [<other.imd>] [options]\n", get_basename(argv[0]));
+        fprintf(stderr, "       %s --script <file> <image.imd>...  (edit without the viewer)\n", get_basename(argv[0]));
         fprintf(stderr, "Options:\n");
         fprintf(stderr, "  -I      : Ignore interleave (show physical sector order in nav)\n");
         fprintf(stderr, "  -W      : Enable writing (editing) - if image not RO\n");
         fprintf(stderr, "  -E      : Use EBCDIC display\n");
         fprintf(stderr, "  -X=xx   : Apply hex XOR mask xx to data view\n");
+        fprintf(stderr, "  -N      : Build the search index (<image>.imdx) if missing or out of date\n");
+        fprintf(stderr, "  -C=kb   : Sector cache size in KB (default %d, 0 = off)\n", SECTOR_CACHE_DEFAULT_KB);
         fprintf(stderr, "  --help  : Show this help message\n");
+        fprintf(stderr, "With <other.imd>, its matching sectors are shown below and differences highlighted.\n");
         return 1;
     }
+    if (strcmp(argv[1], "--script") == 0) {
+        if (argc < 4) {
+            fprintf(stderr, "Usage: %s --script <file> <image.imd>...\n", get_basename(argv[0]));
+            return 1;
+        }
+        return run_script(argv[2], argv + 3, argc - 3);
+    }
     input_filename = argv[1];
     base_filename_ptr = get_basename(input_filename);
     if (base_filename_ptr) {
@@ -2339,10 +6553,23 @@ int main(int argc, char* argv[]) {
     }
 
 
-    for (int i = 2; i < argc; ++i) {
+    int first_option = 2;
+    if (argc > 2 && argv[2][0] != '-') compare_filename = argv[first_option++];
+    for (int i = first_option; i < argc; ++i) {
         if (strcmp(argv[i], "-I") == 0) ignore_interleave = 1;
         else if (strcmp(argv[i], "-W") == 0) write_enabled = 1;
         else if (strcmp(argv[i], "-E") == 0) current_charset = CHARSET_EBCDIC;
+        else if (strcmp(argv[i], "-N") == 0) build_index = 1;
+        else if (strncmp(argv[i], "-C=", 3) == 0) {
+            char* endptr;
+            unsigned long kb = strtoul(argv[i] + 3, &endptr, 10);
+            if (*endptr == '\0' && argv[i][3] != '\0') {
+                g_sector_cache.budget = (size_t)kb * 1024;
+            }
+            else {
+                fprintf(stderr, "Warning: Invalid value for -C= option: %s\n", argv[i]);
+            }
+        }
         else if (strncmp(argv[i], "-X=", 3) == 0) {
             char* endptr;
             unsigned long val = strtoul(argv[i] + 3, &endptr, 16);
@@ -2380,11 +6607,39 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
+    /* Use the search index sidecar if there is one for this exact image */
+    g_image_path = input_filename;
+    if (strlen(input_filename) + 5 < sizeof(g_search_index_path)) {
+        snprintf(g_search_index_path, sizeof(g_search_index_path), "%s.imdx", input_filename);
+        search_index_open();
+    }
+
+    if (compare_filename) {
+        const char* diff_error = diff_open(compare_filename);
+        if (diff_error) {
+            fprintf(stderr, "Error: %s\n", diff_error);
+            diff_close();
+            imdf_close(g_imdf_handle);
+            return 1;
+        }
+    }
+
+    if (flag_index_build() != 0) {
+        fprintf(stderr, "Error: Out of memory building the sector flag index.\n");
+        diff_close();
+        imdf_close(g_imdf_handle);
+        return 1;
+    }
+
     init_ui();
+#ifndef _WIN32
+    install_exit_signal_handlers();
+#endif
     clear_search_highlight();
 
     build_status_message();
     update_status(status_message);
+    if (build_index && !g_search_index.header) rebuild_search_index();
 
     current_track_index_in_image = 0;
     current_sector_logical_idx = 0;
@@ -2401,7 +6656,11 @@ int main(int argc, char* argv[]) {
     doupdate();
 
     while (1) {
+        if (exit_signal_pending()) exit_on_signal(exit_signal_pending());
         handle_input();
+        search_poll();
+        prefetch_poll();
+        diff_poll();
     }
 
     return 0;